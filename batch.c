@@ -0,0 +1,411 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h> // major(), minor()
+#include "nerorip.h"
+
+/**
+ * A disk some of the images are on and how many tracks are being read from it
+ */
+typedef struct {
+  dev_t dev;
+  unsigned int active;
+  unsigned int limit;
+} batch_device;
+
+/**
+ * Shared state for the worker threads started by batch_rip()
+ */
+typedef struct {
+  nerorip_context ctx;
+  batch_image *images;
+  unsigned int number_images;
+
+  // The first image that isn't done and the next one to be opened
+  unsigned int first_image;
+  unsigned int next_image;
+  // How many images are open or being opened and how many may be at once
+  unsigned int open_images;
+  unsigned int max_open;
+  // How many images are being opened or have tracks being ripped right now
+  unsigned int busy;
+
+  batch_device *devices;
+  unsigned int number_devices;
+
+  // Protects everything above except ctx. Broadcast whenever a job or an image finishes
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} batch_pool;
+
+
+// Gets the time now in seconds
+static double batch_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Returns 1 if the block device is a spinning disk. Partitions get it from the disk they are on
+static int batch_rotational(dev_t dev) {
+  char path[128];
+  int r = 0;
+  snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(dev), minor(dev));
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(dev), minor(dev));
+    f = fopen(path, "r");
+  }
+  if (f) {
+    if (fscanf(f, "%d", &r) != 1)
+      r = 0;
+    fclose(f);
+  }
+  return r;
+}
+
+// Finds the device an image is on, adding it to the list if it's new. Returns its index or -1
+static int batch_find_device(batch_pool *pool, dev_t dev) {
+  unsigned int i;
+  for (i = 0; i < pool->number_devices; i++)
+    if (pool->devices[i].dev == dev)
+      return i;
+
+  batch_device *d = realloc(pool->devices, sizeof(batch_device) * (pool->number_devices + 1));
+  if (!d)
+    return -1;
+  pool->devices = d;
+  d = &pool->devices[pool->number_devices];
+  d->dev = dev;
+  d->active = 0;
+  d->limit = pool->ctx.device_jobs;
+  if (!d->limit)
+    d->limit = batch_rotational(dev) ? 1 : pool->ctx.jobs;
+  ver_printf(&pool->ctx, 2, "Reading at most %u track(s) at once from device %u:%u\n", d->limit, major(dev), minor(dev));
+  return pool->number_devices++;
+}
+
+
+// Compares two output directories, ignoring trailing slashes
+static int batch_compare_dirs(const char *a, const char *b) {
+  size_t a_length = strlen(a), b_length = strlen(b);
+  while (a_length > 1 && a[a_length - 1] == '/')
+    a_length--;
+  while (b_length > 1 && b[b_length - 1] == '/')
+    b_length--;
+  int r = memcmp(a, b, (a_length < b_length) ? a_length : b_length);
+  if (r == 0 && a_length != b_length)
+    r = (a_length < b_length) ? -1 : 1;
+  return r;
+}
+
+// Sorts images by output directory and then by where they are in the list
+static int compare_batch_images(const void *a, const void *b) {
+  const batch_image *x = *(batch_image * const *) a, *y = *(batch_image * const *) b;
+  int r = batch_compare_dirs(x->output_dir, y->output_dir);
+  if (r == 0)
+    r = (x < y) ? -1 : (x > y);
+  return r;
+}
+
+// Fails an image that goes in the same output directory as one before it
+static void batch_fail_dir(batch_image *img, const batch_image *first) {
+  fprintf(stderr, "Error: %s would be ripped into %s along with %s\n", img->input, img->output_dir, first->input);
+  img->result = BATCH_DIR_ERR;
+}
+
+// Fails every image that goes in the same output directory as one before it in the list
+static void batch_check_dirs(batch_image *images, unsigned int number_images) {
+  unsigned int i, j, first = 0;
+  batch_image **sorted = malloc(sizeof(batch_image *) * number_images);
+
+  // Without the memory to sort them, compare every pair instead. Slow for big batches, but skipping the
+  // check would let images overwrite each other
+  if (!sorted) {
+    for (i = 1; i < number_images; i++) {
+      for (j = 0; j < i && batch_compare_dirs(images[j].output_dir, images[i].output_dir) != 0; j++);
+      if (j < i)
+        batch_fail_dir(&images[i], &images[j]);
+    }
+    return;
+  }
+
+  for (i = 0; i < number_images; i++)
+    sorted[i] = &images[i];
+  qsort(sorted, number_images, sizeof(batch_image *), compare_batch_images);
+
+  // The first one in the list keeps the directory
+  for (i = 1; i < number_images; i++) {
+    if (batch_compare_dirs(sorted[first]->output_dir, sorted[i]->output_dir) != 0) {
+      first = i;
+      continue;
+    }
+    batch_fail_dir(sorted[i], sorted[first]);
+  }
+  free(sorted);
+}
+
+// Opens and parses an image and makes its jobs. Called without the lock. Returns 0 or the error
+static int batch_open(batch_pool *pool, batch_image *img) {
+  nerorip_context *ctx = &pool->ctx;
+
+  // Already failed by batch_check_dirs()
+  if (img->result != 0)
+    return img->result;
+
+  img->source = src_open(ctx, img->input);
+  if (!img->source) {
+    fprintf(stderr, "Error opening %s: %s\n", img->input, strerror(errno));
+    return BATCH_OPEN_ERR;
+  }
+
+  img->image = alloc_nrg_image();
+  if (!img->image)
+    return RIP_ALLOC_ERR;
+  int r = nrg_parse(ctx, img->source, img->image);
+  if (r != 0 && r != NRG_WARN) {
+    fprintf(stderr, "Error: %s is not a usable nero image\n", img->input);
+    return BATCH_PARSE_ERR;
+  }
+  nrg_print(ctx, 2, img->image);
+
+  if (mkdir(img->output_dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error making %s: %s\n", img->output_dir, strerror(errno));
+    return BATCH_DIR_ERR;
+  }
+
+  img->jobs = nerorip_image_jobs(ctx, img->image, img->output_dir);
+  if (!img->jobs)
+    return RIP_ALLOC_ERR;
+  img->number_tracks = img->image->number_tracks;
+  unsigned int i;
+  for (i = 0; i < img->number_tracks; i++)
+    img->bytes += img->image->tracks[i].length;
+  return 0;
+}
+
+// Closes an image once all its tracks are done and reports how it went. Called without the lock
+static void batch_close(batch_pool *pool, batch_image *img) {
+  unsigned int i;
+  for (i = 0; i < img->number_tracks && img->jobs && img->result == 0; i++)
+    img->result = img->jobs[i].result;
+
+  // Save the hashes with the tracks
+  if (img->jobs && pool->ctx.hash) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%s", img->output_dir, NERORIP_HASH_FILE);
+    int r = nerorip_write_hashes(&pool->ctx, filename, img->jobs, img->number_tracks);
+    if (img->result == 0)
+      img->result = r;
+  }
+
+  if (img->source)
+    src_close(img->source);
+  free_nrg_image(img->image);
+  free(img->jobs);
+  img->source = NULL;
+  img->image = NULL;
+  img->jobs = NULL;
+
+  img->seconds = batch_now() - img->start;
+  progress_image_done(&pool->ctx, img->input, img->result, batch_result_string(img->result), img->number_tracks, img->bytes, img->seconds);
+}
+
+
+// Worker thread, rips tracks from the open images and opens more as they are needed
+static void *batch_worker(void *arg) {
+  batch_pool *pool = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    // Skip past the images that are done
+    while (pool->first_image < pool->next_image && pool->images[pool->first_image].state == BATCH_DONE)
+      pool->first_image++;
+
+    // Take the next track of the oldest image whose disk isn't already busy enough
+    batch_image *img = NULL;
+    unsigned int i;
+    for (i = pool->first_image; i < pool->next_image && !img; i++) {
+      batch_image *candidate = &pool->images[i];
+      if (candidate->state != BATCH_RIPPING || candidate->next_job >= candidate->number_tracks)
+        continue;
+      if (candidate->device >= 0 && pool->devices[candidate->device].active >= pool->devices[candidate->device].limit)
+        continue;
+      img = candidate;
+    }
+    if (img) {
+      rip_job *job = &img->jobs[img->next_job++];
+      if (img->device >= 0)
+        pool->devices[img->device].active++;
+      pool->busy++;
+      pthread_mutex_unlock(&pool->lock);
+
+      rip_job_run(&pool->ctx, img->source, job);
+
+      pthread_mutex_lock(&pool->lock);
+      if (img->device >= 0)
+        pool->devices[img->device].active--;
+      pool->busy--;
+
+      // The last one out closes the image
+      if (--img->jobs_left == 0) {
+        pool->busy++;
+        pthread_mutex_unlock(&pool->lock);
+        batch_close(pool, img);
+        pthread_mutex_lock(&pool->lock);
+        img->state = BATCH_DONE;
+        pool->open_images--;
+        pool->busy--;
+      }
+      pthread_cond_broadcast(&pool->changed);
+      continue;
+    }
+
+    // Open the next image if there's room for it
+    if (pool->next_image < pool->number_images && pool->open_images < pool->max_open) {
+      img = &pool->images[pool->next_image++];
+      img->state = BATCH_OPENING;
+      pool->open_images++;
+      pool->busy++;
+      pthread_mutex_unlock(&pool->lock);
+
+      img->start = batch_now();
+      img->result = batch_open(pool, img);
+      progress_add_total(&pool->ctx, (int64_t) img->bytes - (int64_t) img->file_size);
+      if (img->result != 0 || img->number_tracks == 0)
+        batch_close(pool, img);
+
+      pthread_mutex_lock(&pool->lock);
+      if (img->result != 0 || img->number_tracks == 0) {
+        img->state = BATCH_DONE;
+        pool->open_images--;
+      }
+      else {
+        img->jobs_left = img->number_tracks;
+        img->state = BATCH_RIPPING;
+      }
+      pool->busy--;
+      pthread_cond_broadcast(&pool->changed);
+      continue;
+    }
+
+    // Nothing left to do once nobody is busy and every image has been opened
+    if (pool->busy == 0 && pool->next_image == pool->number_images)
+      break;
+    pthread_cond_wait(&pool->changed, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+// Rips a list of images with one pool of workers
+int batch_rip(nerorip_context *ctx, batch_image *images, unsigned int number_images) {
+  unsigned int threads = (ctx->jobs > 0) ? ctx->jobs : 1;
+
+  batch_pool pool;
+  memset(&pool, 0, sizeof(batch_pool));
+  pool.ctx = *ctx;
+  pool.ctx.stats = NULL;
+  pool.ctx.jobs = threads;
+  pool.images = images;
+  pool.number_images = number_images;
+  pool.max_open = threads * BATCH_OPEN_PER_WORKER;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.changed, NULL);
+
+  // The buffer budget is split between all the workers, no matter which image they are working on
+  pool.ctx.options.batch_sectors = rip_worker_batch_sectors(ctx, threads);
+
+  // Until each image is parsed, guess that all of it is track data
+  uint64_t total = 0;
+  unsigned int i;
+  for (i = 0; i < number_images; i++) {
+    batch_image *img = &images[i];
+    img->result = 0;
+    img->number_tracks = 0;
+    img->bytes = 0;
+    img->seconds = 0;
+    img->state = BATCH_WAITING;
+    img->device = -1;
+    img->file_size = 0;
+    img->source = NULL;
+    img->image = NULL;
+    img->jobs = NULL;
+    img->next_job = 0;
+    img->jobs_left = 0;
+
+    struct stat s;
+    if (stat(img->input, &s) == 0) {
+      img->file_size = s.st_size;
+      img->device = batch_find_device(&pool, s.st_dev);
+    }
+    total += img->file_size;
+  }
+  batch_check_dirs(images, number_images);
+
+  nerorip_progress progress;
+  progress_start(&progress, &pool.ctx, total);
+  pool.ctx.progress = &progress;
+
+  // Start up the workers. If some can't be started, the ones that did will do all the work.
+  pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+  unsigned int started = 0;
+  if (workers) {
+    for (started = 0; started < threads - 1; started++)
+      if (pthread_create(&workers[started], NULL, batch_worker, &pool) != 0)
+        break;
+  }
+  batch_worker(&pool);
+
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  pthread_cond_destroy(&pool.changed);
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.devices);
+
+  // Count up the failures
+  int failed = 0, first_error = 0;
+  for (i = 0; i < number_images; i++) {
+    if (images[i].result != 0 && !failed++)
+      first_error = images[i].result;
+  }
+  progress_finish(&progress, first_error);
+  return failed;
+}
+
+
+// Describes a batch_image result
+const char *batch_result_string(int result) {
+  switch (result) {
+    case 0:               return "ok";
+    case RIP_READ_ERR:    return "error reading a track";
+    case RIP_WRITE_ERR:   return "error writing a track";
+    case RIP_ALLOC_ERR:   return "out of memory";
+    case RIP_EXEC_ERR:    return "the command for a track failed";
+    case BATCH_OPEN_ERR:  return "could not open the image";
+    case BATCH_PARSE_ERR: return "not a usable nero image";
+    case BATCH_DIR_ERR:   return "could not make or share the output directory";
+  }
+  return "unknown error";
+}
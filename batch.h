@@ -0,0 +1,117 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include "util.h"
+#include "nrg.h"
+#include "source.h"
+#include "rip.h"
+
+// How many images each worker may have open at once. Opening the next image early lets its chunk data be
+// parsed while the tracks of the last one are still being ripped without keeping thousands of them open
+#define BATCH_OPEN_PER_WORKER 2
+
+// Indicates that the image could not be opened. Follows on from the RIP_*_ERR codes
+#define BATCH_OPEN_ERR  -5
+// Indicates that the image is not a usable nero image
+#define BATCH_PARSE_ERR -6
+// Indicates that the output directory could not be made or that an image before it goes in the same one
+#define BATCH_DIR_ERR   -7
+
+// What batch_rip() is doing with an image
+#define BATCH_WAITING  0
+#define BATCH_OPENING  1
+#define BATCH_RIPPING  2
+#define BATCH_DONE     3
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Batch image struct
+ *
+ * One image to be ripped by batch_rip() and, once it has been, how that went.
+ */
+typedef struct {
+  // The image file and the directory its tracks go in, which is made if it doesn't exist yet
+  const char *input;
+  const char *output_dir;
+
+  // 0 if every track was ripped, otherwise the first error: BATCH_OPEN_ERR, BATCH_PARSE_ERR, BATCH_DIR_ERR
+  // or one from rip_track()
+  int result;
+  // How many tracks and bytes of track data were in the image and how long it took from opening it to closing it
+  unsigned int number_tracks;
+  uint64_t bytes;
+  double seconds;
+
+  // Only used by batch_rip() while it runs
+  int state;
+  int device;
+  uint64_t file_size;
+  double start;
+  image_source *source;
+  nrg_image *image;
+  rip_job *jobs;
+  unsigned int next_job, jobs_left;
+} batch_image;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Rip a list of images with one pool of ctx->jobs worker threads.
+ *
+ * The tracks of all the images go through the same queue, so workers move straight on to the next image
+ * instead of waiting for the last track of the one before to finish. Images are opened and parsed in order,
+ * a few ahead of the tracks being ripped. The buffer budget is shared by all the workers no matter how many
+ * images are open. No more than ctx->device_jobs tracks are read from the same disk at once.
+ * As each image finishes, a summary line is printed at verbosity 1 and sent to ctx->progress_fd as a JSON line.
+ * Every image needs an output directory of its own: one that goes in the same directory as an image before it
+ * fails with BATCH_DIR_ERR without being ripped, since their tracks would overwrite each other.
+ * ctx->stats is not used.
+ *
+ * @param nerorip_context *ctx
+ *   How the tracks should be ripped and how many at once
+ * @param batch_image *images
+ *   The images, with input and output_dir filled in. Everything else is filled in by batch_rip()
+ * @param unsigned int number_images
+ *   Number of images in the array
+ * @return int
+ *   The number of images that could not be ripped completely
+ */
+int batch_rip(nerorip_context *ctx, batch_image *images, unsigned int number_images);
+
+/**
+ * Get a short description of a batch_image result
+ */
+const char *batch_result_string(int result);
+
+#endif
@@ -0,0 +1,582 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "edc.h"
+#include "subchannel.h"
+#ifdef HAVE_X86_EDC
+#include <immintrin.h> // PCLMULQDQ and SSE4.1 intrinsics
+#endif
+
+// Block states
+#define EDC_BLOCK_FREE     0
+#define EDC_BLOCK_FILLING  1
+#define EDC_BLOCK_FULL     2
+#define EDC_BLOCK_CHECKING 3
+
+// The sync pattern at the start of every 2352 byte data sector
+static const uint8_t edc_sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+
+/*
+ * Tables
+ */
+
+// Slicing-by-8 tables for the EDC: edc_table[k][n] is the EDC of byte n followed by k zero bytes
+static uint32_t edc_table[8][256];
+// Multiplying by alpha in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1,
+// and dividing by 1 + alpha, which turns the two ECC sums into the parity bytes
+static uint8_t ecc_f_table[256];
+static uint8_t ecc_b_table[256];
+// Where byte k of each Q codeword pair is in the sector, padded out to 28 pairs so they fill whole 64 bit words
+static uint16_t ecc_q_offset[43][28];
+static pthread_once_t edc_tables_once = PTHREAD_ONCE_INIT;
+
+// Fills in the tables
+static void edc_tables_init() {
+  unsigned int n, k;
+  for (n = 0; n < 256; n++) {
+    uint32_t edc = n;
+    for (k = 0; k < 8; k++)
+      edc = (edc >> 1) ^ ((edc & 1) ? 0xd8018001 : 0);
+    edc_table[0][n] = edc;
+
+    const uint8_t f = (n << 1) ^ ((n & 0x80) ? 0x1d : 0);
+    ecc_f_table[n] = f;
+    ecc_b_table[n ^ f] = n;
+  }
+  for (n = 0; n < 256; n++)
+    for (k = 1; k < 8; k++)
+      edc_table[k][n] = (edc_table[k - 1][n] >> 8) ^ edc_table[0][edc_table[k - 1][n] & 0xff];
+
+  // Taken as 16 bit words, byte k of Q codeword pair n is word 43 * ((n + k) % 26) + k
+  for (k = 0; k < 43; k++)
+    for (n = 0; n < 28; n++)
+      ecc_q_offset[k][n] = (n < 26) ? (43 * ((n + k) % 26) + k) * 2 : 0;
+}
+
+
+/*
+ * EDC
+ */
+
+// Reads a little endian 32 bit number
+static inline uint32_t load_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// EDC 8 bytes at a time with the slicing-by-8 tables
+uint32_t edc_compute_scalar(uint32_t edc, const uint8_t *data, size_t length) {
+  pthread_once(&edc_tables_once, edc_tables_init);
+
+  while (length >= 8) {
+    uint32_t one = load_le32(data) ^ edc;
+    uint32_t two = load_le32(data + 4);
+    edc = edc_table[7][one & 0xff] ^ edc_table[6][(one >> 8) & 0xff] ^
+          edc_table[5][(one >> 16) & 0xff] ^ edc_table[4][one >> 24] ^
+          edc_table[3][two & 0xff] ^ edc_table[2][(two >> 8) & 0xff] ^
+          edc_table[1][(two >> 16) & 0xff] ^ edc_table[0][two >> 24];
+    data += 8;
+    length -= 8;
+  }
+  while (length--)
+    edc = edc_table[0][(edc ^ *data++) & 0xff] ^ (edc >> 8);
+
+  return edc;
+}
+
+#ifdef HAVE_X86_EDC
+/**
+ * EDC by folding 64 bytes at a time with carry-less multiplies, like crc32_pclmul() but with the
+ * constants worked out for the EDC polynomial (x^n mod P for n = 544, 480, 160 and 96, bit reflected).
+ * Instead of a Barrett reduction the last 16 bytes the data was folded down to go through the tables,
+ * which is fast enough for the few times it is done per sector.
+ */
+__attribute__((target("pclmul,sse4.1")))
+uint32_t edc_compute_pclmul(uint32_t edc, const uint8_t *data, size_t length) {
+  if (length < 64)
+    return edc_compute_scalar(edc, data, length);
+
+  const __m128i k1k2 = _mm_set_epi64x(0x012e7928a2, 0x01f8931102);
+  const __m128i k3k4 = _mm_set_epi64x(0x01d5934102, 0x006c90c100);
+
+  __m128i x1 = _mm_loadu_si128((__m128i *) (data + 0x00));
+  __m128i x2 = _mm_loadu_si128((__m128i *) (data + 0x10));
+  __m128i x3 = _mm_loadu_si128((__m128i *) (data + 0x20));
+  __m128i x4 = _mm_loadu_si128((__m128i *) (data + 0x30));
+  __m128i x5, x6, x7, x8;
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(edc));
+  data += 64;
+  length -= 64;
+
+  // Fold four 128 bit lanes forward over each 64 bytes
+  while (length >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i *) (data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i *) (data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i *) (data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i *) (data + 0x30)));
+    data += 64;
+    length -= 64;
+  }
+
+  // Fold the four lanes into one, then fold in whatever 16 byte blocks are left
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+  while (length >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i *) data)), x5);
+    data += 16;
+    length -= 16;
+  }
+
+  // What's left has the same EDC as the whole thing so far
+  uint8_t folded[16];
+  _mm_storeu_si128((__m128i *) folded, x1);
+  edc = edc_compute_scalar(0, folded, 16);
+  return edc_compute_scalar(edc, data, length);
+}
+#endif
+
+
+/**
+ * The edc_compute implementation in use and its name.
+ * Starts out pointing at edc_select(), which replaces it with the best one the CPU can run.
+ */
+static uint32_t edc_select(uint32_t edc, const uint8_t *data, size_t length);
+static uint32_t (*edc_impl)(uint32_t, const uint8_t *, size_t) = edc_select;
+static const char *edc_impl_name = "scalar";
+
+// Picks the best implementation the CPU supports using cpuid
+static uint32_t edc_select(uint32_t edc, const uint8_t *data, size_t length) {
+  uint32_t (*impl)(uint32_t, const uint8_t *, size_t) = edc_compute_scalar;
+  const char *name = "scalar";
+
+#ifdef HAVE_X86_EDC
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    impl = edc_compute_pclmul;
+    name = "pclmul";
+  }
+#endif
+
+  // Same as swap_buffer_select(), the name goes first so it always matches the implementation
+  __atomic_store_n(&edc_impl_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&edc_impl, impl, __ATOMIC_RELEASE);
+
+  return impl(edc, data, length);
+}
+
+// Computes the EDC of the data
+uint32_t edc_compute(uint32_t edc, const uint8_t *data, size_t length) {
+  return __atomic_load_n(&edc_impl, __ATOMIC_ACQUIRE)(edc, data, length);
+}
+
+// Returns the name of the edc_compute implementation
+const char *edc_name() {
+  if (__atomic_load_n(&edc_impl, __ATOMIC_ACQUIRE) == edc_select)
+    edc_select(0, NULL, 0);
+  return __atomic_load_n(&edc_impl_name, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * ECC
+ *
+ * P is 86 codewords of 24 bytes, the columns of the first 2064 bytes laid out as 24 rows of 86.
+ * Q is 52 codewords of 43 bytes, diagonals through the first 2236 bytes (P included).
+ * Each codeword is worked through one byte at a time, but all the codewords are done side by side
+ * 8 to a 64 bit word, so a row of bytes from each codeword is handled with a few word operations.
+ */
+
+// Multiplies each of the 8 bytes in v by alpha
+static inline uint64_t ecc_mul2(uint64_t v) {
+  const uint64_t high = v & 0x8080808080808080ULL;
+  return ((v & 0x7f7f7f7f7f7f7f7fULL) << 1) ^ ((high >> 7) * 0x1d);
+}
+
+// Reads a little endian 64 bit number, so byte i always lands in bits 8i to 8i+7
+static inline uint64_t load_le64(const uint8_t *p) {
+  return (uint64_t) load_le32(p) | ((uint64_t) load_le32(p + 4) << 32);
+}
+
+// Reads a little endian 16 bit number
+static inline uint64_t load_le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+// Turns the sums of the codewords into their two parity bytes each
+static void ecc_finish(const uint64_t *a, const uint64_t *s, unsigned int codewords, uint8_t *parity) {
+  unsigned int i;
+  for (i = 0; i < codewords; i++) {
+    const uint8_t a_byte = a[i / 8] >> (i % 8 * 8);
+    const uint8_t s_byte = s[i / 8] >> (i % 8 * 8);
+    const uint8_t x = ecc_b_table[ecc_f_table[a_byte] ^ s_byte];
+    parity[i] = x;
+    parity[i + codewords] = x ^ s_byte;
+  }
+}
+
+// Computes the P parity. The rows are read 88 bytes at a time, the last 2 bytes go in codewords that are thrown away
+void ecc_compute_p(const uint8_t *data, uint8_t *p) {
+  pthread_once(&edc_tables_once, edc_tables_init);
+  uint64_t a[11] = {0}, s[11] = {0};
+
+  unsigned int row, i;
+  for (row = 0; row < 24; row++) {
+    const uint8_t *bytes = data + row * 86;
+    for (i = 0; i < 11; i++) {
+      const uint64_t t = load_le64(bytes + i * 8);
+      a[i] = ecc_mul2(a[i] ^ t);
+      s[i] ^= t;
+    }
+  }
+  ecc_finish(a, s, 86, p);
+}
+
+// Computes the Q parity. Each row of 52 bytes is gathered from a column of the 16 bit words with ecc_q_offset,
+// 4 words straight into each 64 bit word. The last 4 bytes go in codewords that are thrown away
+void ecc_compute_q(const uint8_t *data, uint8_t *q) {
+  pthread_once(&edc_tables_once, edc_tables_init);
+  uint64_t a[7] = {0}, s[7] = {0};
+
+  unsigned int k, i;
+  for (k = 0; k < 43; k++) {
+    const uint16_t *offset = ecc_q_offset[k];
+    for (i = 0; i < 7; i++, offset += 4) {
+      const uint64_t t = load_le16(data + offset[0]) | (load_le16(data + offset[1]) << 16) |
+                         (load_le16(data + offset[2]) << 32) | (load_le16(data + offset[3]) << 48);
+      a[i] = ecc_mul2(a[i] ^ t);
+      s[i] ^= t;
+    }
+  }
+  ecc_finish(a, s, 52, q);
+}
+
+
+/*
+ * Sectors
+ */
+
+// Where the EDC of a sector starts and ends, and whether it has ECC, based on its mode and form.
+// Offsets are into a 2352 byte sector. Returns 0 if there is nothing to check
+static int edc_sector_layout(const uint8_t *sector, unsigned int sector_size, unsigned int *start, unsigned int *end, int *ecc, int *zero_address) {
+  // 2336 byte sectors are a 2352 byte Mode2 sector without the first 16 bytes
+  const uint8_t mode = (sector_size == 2352) ? sector[15] : 2;
+  const uint8_t *subheader = (sector_size == 2352) ? sector + 16 : sector;
+
+  if (mode == 1) {
+    *start = 0;
+    *end = 2064;
+    *ecc = 1;
+    *zero_address = 0;
+    return 1;
+  }
+  if (mode == 2) {
+    *start = 16;
+    *zero_address = 1;
+    // Form 2 has no ECC and its EDC is optional
+    if (subheader[2] & 0x20) {
+      *end = 2348;
+      *ecc = 0;
+    }
+    else {
+      *end = 2072;
+      *ecc = 1;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+// Checks a sector
+int edc_check_sector(const uint8_t *sector, unsigned int sector_size) {
+  unsigned int start, end;
+  int ecc, zero_address;
+  if (sector_size == 2352 && memcmp(sector, edc_sync, sizeof(edc_sync)) != 0)
+    return EDC_BAD_SYNC;
+  if ((sector_size != 2352 && sector_size != 2336) || !edc_sector_layout(sector, sector_size, &start, &end, &ecc, &zero_address))
+    return EDC_UNCHECKED;
+
+  // The offsets are for a 2352 byte sector, 2336 byte ones start 16 bytes in
+  const unsigned int skip = 2352 - sector_size;
+  const uint32_t stored = load_le32(sector + end - skip);
+  if (!ecc && stored == 0)
+    return EDC_UNCHECKED;
+  if (edc_compute(0, sector + start - skip, end - start) != stored)
+    return EDC_BAD_EDC;
+  if (!ecc)
+    return EDC_OK;
+
+  // The ECC covers everything after the sync pattern, with the address taken as zeros in Mode2
+  const uint8_t *data = sector + 12;
+  uint8_t copy[2340];
+  if (zero_address) {
+    memset(copy, 0, 4);
+    memcpy(copy + 4, sector + 16 - skip, 2336);
+    data = copy;
+  }
+  uint8_t parity[172];
+  ecc_compute_p(data, parity);
+  if (memcmp(parity, data + 2064, 172) != 0)
+    return EDC_BAD_ECC;
+  ecc_compute_q(data, parity);
+  if (memcmp(parity, data + 2236, 104) != 0)
+    return EDC_BAD_ECC;
+  return EDC_OK;
+}
+
+// Fills in the EDC and ECC of a sector
+void edc_generate_sector(uint8_t *sector, unsigned int sector_size) {
+  unsigned int start, end;
+  int ecc, zero_address;
+  if ((sector_size != 2352 && sector_size != 2336) || !edc_sector_layout(sector, sector_size, &start, &end, &ecc, &zero_address))
+    return;
+
+  const unsigned int skip = 2352 - sector_size;
+  const uint32_t edc = edc_compute(0, sector + start - skip, end - start);
+  uint8_t *stored = sector + end - skip;
+  stored[0] = edc;
+  stored[1] = edc >> 8;
+  stored[2] = edc >> 16;
+  stored[3] = edc >> 24;
+  if (!ecc)
+    return;
+
+  // Mode1 has 8 zero bytes between the EDC and P
+  if (!zero_address)
+    memset(sector + 2068, 0, 8);
+  uint8_t copy[2340];
+  if (zero_address)
+    memset(copy, 0, 4);
+  else
+    memcpy(copy, sector + 12, 4);
+  memcpy(copy + 4, sector + 16 - skip, 2336);
+  ecc_compute_p(copy, copy + 2064);
+  ecc_compute_q(copy, copy + 2236);
+  memcpy(sector + 2076 - skip, copy + 2064, 276);
+}
+
+
+/*
+ * Verifier
+ */
+
+// Adds one report to another, keeping the lowest EDC_MAX_BAD_LBAS bad LBAs of the two
+static void edc_report_add(edc_report *report, const edc_report *add) {
+  report->sectors += add->sectors;
+  report->bad_sync += add->bad_sync;
+  report->bad_edc += add->bad_edc;
+  report->bad_ecc += add->bad_ecc;
+
+  uint32_t merged[EDC_MAX_BAD_LBAS];
+  unsigned int i = 0, j = 0, n = 0;
+  while (n < EDC_MAX_BAD_LBAS && (i < report->number_bad_lbas || j < add->number_bad_lbas)) {
+    if (j >= add->number_bad_lbas || (i < report->number_bad_lbas && report->bad_lbas[i] < add->bad_lbas[j]))
+      merged[n++] = report->bad_lbas[i++];
+    else
+      merged[n++] = add->bad_lbas[j++];
+  }
+  memcpy(report->bad_lbas, merged, sizeof(uint32_t) * n);
+  report->number_bad_lbas = n;
+}
+
+// Checks some sectors in order, counting the bad ones in report
+static void edc_check_sectors(edc_report *report, const uint8_t *sectors, unsigned int count, unsigned int sector_size, uint32_t lba) {
+  // Subchannel data after a sector isn't covered by its EDC or ECC
+  const unsigned int main_size = sector_size - sub_length(sector_size);
+  unsigned int i;
+  for (i = 0; i < count; i++, sectors += sector_size) {
+    int r = edc_check_sector(sectors, main_size);
+    if (r == EDC_UNCHECKED)
+      continue;
+    report->sectors++;
+    if (r == EDC_OK)
+      continue;
+
+    if (r == EDC_BAD_SYNC)
+      report->bad_sync++;
+    else if (r == EDC_BAD_EDC)
+      report->bad_edc++;
+    else
+      report->bad_ecc++;
+    if (report->number_bad_lbas < EDC_MAX_BAD_LBAS)
+      report->bad_lbas[report->number_bad_lbas++] = lba + i;
+  }
+}
+
+// Thread that checks whichever block is full
+static void *edc_verifier_thread(void *arg) {
+  edc_verifier *v = (edc_verifier *) arg;
+
+  pthread_mutex_lock(&v->lock);
+  while (1) {
+    unsigned int block;
+    for (block = 0; block < v->number_blocks; block++)
+      if (v->block_state[block] == EDC_BLOCK_FULL)
+        break;
+    if (block == v->number_blocks) {
+      if (v->finished)
+        break;
+      pthread_cond_wait(&v->changed, &v->lock);
+      continue;
+    }
+    v->block_state[block] = EDC_BLOCK_CHECKING;
+    pthread_mutex_unlock(&v->lock);
+
+    edc_report report;
+    memset(&report, 0, sizeof(edc_report));
+    edc_check_sectors(&report, v->blocks[block], v->block_sectors[block], v->sector_size, v->block_lba[block]);
+
+    pthread_mutex_lock(&v->lock);
+    edc_report_add(&v->report, &report);
+    v->block_state[block] = EDC_BLOCK_FREE;
+    pthread_cond_broadcast(&v->changed);
+  }
+  pthread_mutex_unlock(&v->lock);
+  return NULL;
+}
+
+// Starts checking a track
+edc_verifier *edc_verifier_start(unsigned int sector_size, uint32_t lba, unsigned int threads) {
+  edc_verifier *v = malloc(sizeof(edc_verifier));
+  if (!v) {
+    fprintf(stderr, "Failed to allocate EDC verifier: %s\n", strerror(errno));
+    return NULL;
+  }
+  memset(v, 0, sizeof(edc_verifier));
+  v->sector_size = sector_size;
+  v->next_lba = lba;
+  v->filling = -1;
+  pthread_mutex_init(&v->lock, NULL);
+  pthread_cond_init(&v->changed, NULL);
+
+  if (threads > EDC_MAX_THREADS)
+    threads = EDC_MAX_THREADS;
+  v->number_blocks = threads * EDC_BLOCKS_PER_THREAD;
+  unsigned int i;
+  for (i = 0; i < v->number_blocks; i++) {
+    v->blocks[i] = malloc((size_t) EDC_BLOCK_SECTORS * sector_size);
+    if (!v->blocks[i]) {
+      fprintf(stderr, "Failed to allocate EDC verifier: %s\n", strerror(errno));
+      v->number_blocks = i;
+      edc_verifier_finish(v, NULL);
+      return NULL;
+    }
+  }
+
+  // Whatever threads can't be started, the others make up for. With none, the sectors are checked as they come in
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&v->threads[i], NULL, edc_verifier_thread, v) != 0)
+      break;
+  }
+  v->number_threads = i;
+  return v;
+}
+
+// Copies sectors into the blocks, handing each one to the threads as it fills up
+void edc_verifier_add(edc_verifier *v, const uint8_t *sectors, unsigned int count) {
+  if (!v)
+    return;
+  if (!v->number_threads) {
+    edc_report report;
+    memset(&report, 0, sizeof(edc_report));
+    edc_check_sectors(&report, sectors, count, v->sector_size, v->next_lba);
+    edc_report_add(&v->report, &report);
+    v->next_lba += count;
+    return;
+  }
+
+  while (count) {
+    // Wait for a free block before starting to fill one
+    if (v->filling < 0) {
+      pthread_mutex_lock(&v->lock);
+      while (v->filling < 0) {
+        unsigned int block;
+        for (block = 0; block < v->number_blocks; block++)
+          if (v->block_state[block] == EDC_BLOCK_FREE)
+            break;
+        if (block < v->number_blocks) {
+          v->block_state[block] = EDC_BLOCK_FILLING;
+          v->block_sectors[block] = 0;
+          v->block_lba[block] = v->next_lba;
+          v->filling = block;
+        }
+        else
+          pthread_cond_wait(&v->changed, &v->lock);
+      }
+      pthread_mutex_unlock(&v->lock);
+    }
+
+    const int block = v->filling;
+    unsigned int n = EDC_BLOCK_SECTORS - v->block_sectors[block];
+    if (n > count)
+      n = count;
+    memcpy(v->blocks[block] + (size_t) v->block_sectors[block] * v->sector_size, sectors, (size_t) n * v->sector_size);
+    v->block_sectors[block] += n;
+    v->next_lba += n;
+    sectors += (size_t) n * v->sector_size;
+    count -= n;
+
+    if (v->block_sectors[block] == EDC_BLOCK_SECTORS) {
+      pthread_mutex_lock(&v->lock);
+      v->block_state[block] = EDC_BLOCK_FULL;
+      v->filling = -1;
+      pthread_cond_signal(&v->changed);
+      pthread_mutex_unlock(&v->lock);
+    }
+  }
+}
+
+// Hands the last block to the threads, waits for them and frees the verifier
+void edc_verifier_finish(edc_verifier *v, edc_report *report) {
+  if (!v) {
+    if (report)
+      memset(report, 0, sizeof(edc_report));
+    return;
+  }
+
+  pthread_mutex_lock(&v->lock);
+  if (v->filling >= 0)
+    v->block_state[v->filling] = EDC_BLOCK_FULL;
+  v->finished = 1;
+  pthread_cond_broadcast(&v->changed);
+  pthread_mutex_unlock(&v->lock);
+
+  unsigned int i;
+  for (i = 0; i < v->number_threads; i++)
+    pthread_join(v->threads[i], NULL);
+  if (report)
+    *report = v->report;
+
+  for (i = 0; i < v->number_blocks; i++)
+    free(v->blocks[i]);
+  pthread_mutex_destroy(&v->lock);
+  pthread_cond_destroy(&v->changed);
+  free(v);
+}
@@ -0,0 +1,193 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef EDC_H
+#define EDC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <pthread.h>
+
+// What edc_check_sector() found
+#define EDC_OK        0
+#define EDC_BAD_SYNC  1
+#define EDC_BAD_EDC   2
+#define EDC_BAD_ECC   3
+#define EDC_UNCHECKED 4
+
+// Number of sectors handed to a checking thread at once, how many threads a verifier can have
+// and how many blocks each thread gets so the next one can be filled while it checks one
+#define EDC_BLOCK_SECTORS 256
+#define EDC_MAX_THREADS   8
+#define EDC_BLOCKS_PER_THREAD 2
+// How many of the bad sectors of a track have their LBA kept
+#define EDC_MAX_BAD_LBAS 64
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * EDC report struct
+ *
+ * What was found checking the sectors of a track.
+ */
+typedef struct {
+  // Sectors that had an EDC or ECC to check
+  uint64_t sectors;
+  // Sectors with a broken sync pattern, a wrong EDC or a wrong ECC
+  uint64_t bad_sync, bad_edc, bad_ecc;
+  // The LBAs of the first EDC_MAX_BAD_LBAS bad sectors, in order
+  unsigned int number_bad_lbas;
+  uint32_t bad_lbas[EDC_MAX_BAD_LBAS];
+} edc_report;
+
+
+/**
+ * EDC verifier struct
+ *
+ * Checks the sectors of a track on a few threads while the track is ripped. Sectors are copied into
+ * blocks of EDC_BLOCK_SECTORS and each full block is checked by whichever thread gets to it first.
+ */
+typedef struct {
+  unsigned int sector_size;
+  // LBA of the next sector to be passed in
+  uint32_t next_lba;
+
+  // The blocks, how many sectors are in each one, the LBA of the first one and what is being done with it
+  unsigned int number_blocks;
+  uint8_t *blocks[EDC_MAX_THREADS * EDC_BLOCKS_PER_THREAD];
+  unsigned int block_sectors[EDC_MAX_THREADS * EDC_BLOCKS_PER_THREAD];
+  uint32_t block_lba[EDC_MAX_THREADS * EDC_BLOCKS_PER_THREAD];
+  int block_state[EDC_MAX_THREADS * EDC_BLOCKS_PER_THREAD];
+  // The block being filled in by the ripping thread, -1 for none
+  int filling;
+
+  // Threads doing the checking, 0 if the sectors are checked as they are passed in instead
+  unsigned int number_threads;
+  pthread_t threads[EDC_MAX_THREADS];
+  // Protects the block states, finished and the report
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int finished;
+
+  edc_report report;
+} edc_verifier;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Compute the EDC (CRC-32 with polynomial 0x8001801B, nothing inverted) of some data.
+ *
+ * @param uint32_t edc
+ *   The EDC of the data before this, 0 to start
+ * @param const uint8_t *data
+ *   The data
+ * @param size_t length
+ *   How many bytes of data there are
+ * @return uint32_t
+ *   The EDC of everything so far
+ */
+uint32_t edc_compute(uint32_t edc, const uint8_t *data, size_t length);
+
+/**
+ * The individual edc_compute() implementations, slicing-by-8 and folding with carry-less multiplies.
+ * Only call edc_compute_pclmul() if the CPU supports PCLMULQDQ and SSE4.1.
+ */
+uint32_t edc_compute_scalar(uint32_t edc, const uint8_t *data, size_t length);
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_EDC
+uint32_t edc_compute_pclmul(uint32_t edc, const uint8_t *data, size_t length);
+#endif
+
+/**
+ * Returns the name of the edc_compute() implementation being used ("scalar" or "pclmul")
+ */
+const char *edc_name();
+
+/**
+ * Compute the P and Q parity (ECMA-130 RSPC) of a sector.
+ *
+ * @param const uint8_t *data
+ *   The 2340 bytes of the sector after the sync pattern: header, data, EDC and P parity.
+ *   For Mode2 Form1 sectors the 4 header bytes must be zeros
+ * @param uint8_t *p
+ *   Where the 172 bytes of P parity go
+ * @param uint8_t *q
+ *   Where the 104 bytes of Q parity go. Q covers the P parity, so this must be done after P is in data
+ */
+void ecc_compute_p(const uint8_t *data, uint8_t *p);
+void ecc_compute_q(const uint8_t *data, uint8_t *q);
+
+
+/**
+ * Check the sync pattern, EDC and ECC of a sector.
+ * 2352 byte sectors are checked according to the mode in their header, Mode 0 sectors aren't checked.
+ * 2336 byte sectors are taken to be Mode2 without the sync pattern and header.
+ * Mode2 Form2 sectors only have an EDC, and only if it isn't 0.
+ *
+ * @param const uint8_t *sector
+ *   The raw sector
+ * @param unsigned int sector_size
+ *   2352 or 2336
+ * @return int
+ *   EDC_OK, EDC_BAD_SYNC, EDC_BAD_EDC, EDC_BAD_ECC or EDC_UNCHECKED if there was nothing to check
+ */
+int edc_check_sector(const uint8_t *sector, unsigned int sector_size);
+
+/**
+ * Fill in the EDC and ECC of a sector, according to its mode and form like edc_check_sector().
+ */
+void edc_generate_sector(uint8_t *sector, unsigned int sector_size);
+
+
+/**
+ * Start checking a track.
+ *
+ * @param unsigned int sector_size
+ *   Size of the sectors of the track, 2352 or 2336, or 2448 or 2368 for 2352 byte sectors with subchannel data after them
+ * @param uint32_t lba
+ *   The LBA of the first sector that will be passed in
+ * @param unsigned int threads
+ *   How many threads check the sectors, at most EDC_MAX_THREADS.
+ *   If they can't be started the sectors are checked as they are passed in instead
+ * @return *edc_verifier
+ *   A pointer to the new verifier or NULL if it could not be allocated
+ */
+edc_verifier *edc_verifier_start(unsigned int sector_size, uint32_t lba, unsigned int threads);
+
+/**
+ * Pass the next count sectors of the track to a verifier. They are copied, so they can be reused as soon as this returns.
+ * Only waits if all the blocks are full. If verifier is NULL, nothing is done.
+ */
+void edc_verifier_add(edc_verifier *verifier, const uint8_t *sectors, unsigned int count);
+
+/**
+ * Wait for everything to be checked, get the report and free the verifier.
+ */
+void edc_verifier_finish(edc_verifier *verifier, edc_report *report);
+
+#endif
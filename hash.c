@@ -0,0 +1,731 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "hash.h"
+#ifdef HAVE_X86_HASH
+#include <immintrin.h> // PCLMULQDQ, SHA and SSE4.1 intrinsics
+#endif
+
+
+/*
+ * CRC32
+ */
+
+// Slicing-by-8 tables: crc32_table[k][n] is the CRC of byte n followed by k zero bytes
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+// Fills in crc32_table
+static void crc32_table_init() {
+  unsigned int n, k;
+  for (n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crc32_table[0][n] = c;
+  }
+  for (n = 0; n < 256; n++)
+    for (k = 1; k < 8; k++)
+      crc32_table[k][n] = (crc32_table[k - 1][n] >> 8) ^ crc32_table[0][crc32_table[k - 1][n] & 0xff];
+}
+
+// Reads a little endian 32 bit number
+static inline uint32_t load_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// CRC32 8 bytes at a time with the slicing-by-8 tables
+uint32_t crc32_scalar(uint32_t crc, const uint8_t *data, size_t length) {
+  pthread_once(&crc32_table_once, crc32_table_init);
+  crc = ~crc;
+
+  while (length >= 8) {
+    uint32_t one = load_le32(data) ^ crc;
+    uint32_t two = load_le32(data + 4);
+    crc = crc32_table[7][one & 0xff] ^ crc32_table[6][(one >> 8) & 0xff] ^
+          crc32_table[5][(one >> 16) & 0xff] ^ crc32_table[4][one >> 24] ^
+          crc32_table[3][two & 0xff] ^ crc32_table[2][(two >> 8) & 0xff] ^
+          crc32_table[1][(two >> 16) & 0xff] ^ crc32_table[0][two >> 24];
+    data += 8;
+    length -= 8;
+  }
+  while (length--)
+    crc = crc32_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+#ifdef HAVE_X86_HASH
+/**
+ * CRC32 by folding 64 bytes at a time with carry-less multiplies, then a Barrett reduction.
+ * This is the method from Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" with the constants for the zlib polynomial. length must be at least 64 and a
+ * multiple of 16, and crc is the inverted CRC like inside crc32_scalar().
+ * The crc32 instruction in SSE4.2 can't be used because it only does CRC32C, a different polynomial.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold(const uint8_t *data, size_t length, uint32_t crc) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1 = _mm_loadu_si128((__m128i *) (data + 0x00));
+  __m128i x2 = _mm_loadu_si128((__m128i *) (data + 0x10));
+  __m128i x3 = _mm_loadu_si128((__m128i *) (data + 0x20));
+  __m128i x4 = _mm_loadu_si128((__m128i *) (data + 0x30));
+  __m128i x5, x6, x7, x8;
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  data += 64;
+  length -= 64;
+
+  // Fold four 128 bit lanes forward over each 64 bytes
+  while (length >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i *) (data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i *) (data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i *) (data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i *) (data + 0x30)));
+    data += 64;
+    length -= 64;
+  }
+
+  // Fold the four lanes into one, then fold in whatever 16 byte blocks are left
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+  while (length >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i *) data)), x5);
+    data += 16;
+    length -= 16;
+  }
+
+  // 128 bits down to 64
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, low32);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+  // Barrett reduction down to 32
+  x2 = _mm_and_si128(x1, low32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, low32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+
+// CRC32 with crc32_fold() for everything but the last few bytes
+uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t length) {
+  if (length >= 64) {
+    size_t chunk = length & ~(size_t) 15;
+    crc = ~crc32_fold(data, chunk, ~crc);
+    data += chunk;
+    length -= chunk;
+  }
+  return crc32_scalar(crc, data, length);
+}
+#endif
+
+
+/**
+ * The crc32_update implementation in use and its name.
+ * Starts out pointing at crc32_select(), which replaces it with the best one the CPU can run.
+ */
+static uint32_t crc32_select(uint32_t crc, const uint8_t *data, size_t length);
+static uint32_t (*crc32_impl)(uint32_t, const uint8_t *, size_t) = crc32_select;
+static const char *crc32_impl_name = "scalar";
+
+// Picks the best implementation the CPU supports using cpuid
+static uint32_t crc32_select(uint32_t crc, const uint8_t *data, size_t length) {
+  uint32_t (*impl)(uint32_t, const uint8_t *, size_t) = crc32_scalar;
+  const char *name = "scalar";
+
+#ifdef HAVE_X86_HASH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    impl = crc32_pclmul;
+    name = "pclmul";
+  }
+#endif
+
+  // Same as swap_buffer_select(), the name goes first so it always matches the implementation
+  __atomic_store_n(&crc32_impl_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&crc32_impl, impl, __ATOMIC_RELEASE);
+
+  return impl(crc, data, length);
+}
+
+// Computes the CRC32 of the data
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+  return __atomic_load_n(&crc32_impl, __ATOMIC_ACQUIRE)(crc, data, length);
+}
+
+// Returns the name of the crc32_update implementation
+const char *crc32_name() {
+  if (__atomic_load_n(&crc32_impl, __ATOMIC_ACQUIRE) == crc32_select)
+    crc32_select(0, NULL, 0);
+  return __atomic_load_n(&crc32_impl_name, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * MD5 (RFC 1321)
+ */
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_STEP(f, a, b, c, d, w, k, s) \
+  a += f(b, c, d) + w + k;              \
+  a = ROTL(a, s) + b;
+
+// Hashes 64 byte blocks of data
+static void md5_blocks(uint32_t *state, const uint8_t *data, size_t blocks) {
+  for (; blocks; blocks--, data += 64) {
+    uint32_t w[16];
+    unsigned int i;
+    for (i = 0; i < 16; i++)
+      w[i] = load_le32(data + i * 4);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, w[0], 0xd76aa478, 7)
+    MD5_STEP(MD5_F, d, a, b, c, w[1], 0xe8c7b756, 12)
+    MD5_STEP(MD5_F, c, d, a, b, w[2], 0x242070db, 17)
+    MD5_STEP(MD5_F, b, c, d, a, w[3], 0xc1bdceee, 22)
+    MD5_STEP(MD5_F, a, b, c, d, w[4], 0xf57c0faf, 7)
+    MD5_STEP(MD5_F, d, a, b, c, w[5], 0x4787c62a, 12)
+    MD5_STEP(MD5_F, c, d, a, b, w[6], 0xa8304613, 17)
+    MD5_STEP(MD5_F, b, c, d, a, w[7], 0xfd469501, 22)
+    MD5_STEP(MD5_F, a, b, c, d, w[8], 0x698098d8, 7)
+    MD5_STEP(MD5_F, d, a, b, c, w[9], 0x8b44f7af, 12)
+    MD5_STEP(MD5_F, c, d, a, b, w[10], 0xffff5bb1, 17)
+    MD5_STEP(MD5_F, b, c, d, a, w[11], 0x895cd7be, 22)
+    MD5_STEP(MD5_F, a, b, c, d, w[12], 0x6b901122, 7)
+    MD5_STEP(MD5_F, d, a, b, c, w[13], 0xfd987193, 12)
+    MD5_STEP(MD5_F, c, d, a, b, w[14], 0xa679438e, 17)
+    MD5_STEP(MD5_F, b, c, d, a, w[15], 0x49b40821, 22)
+
+    MD5_STEP(MD5_G, a, b, c, d, w[1], 0xf61e2562, 5)
+    MD5_STEP(MD5_G, d, a, b, c, w[6], 0xc040b340, 9)
+    MD5_STEP(MD5_G, c, d, a, b, w[11], 0x265e5a51, 14)
+    MD5_STEP(MD5_G, b, c, d, a, w[0], 0xe9b6c7aa, 20)
+    MD5_STEP(MD5_G, a, b, c, d, w[5], 0xd62f105d, 5)
+    MD5_STEP(MD5_G, d, a, b, c, w[10], 0x02441453, 9)
+    MD5_STEP(MD5_G, c, d, a, b, w[15], 0xd8a1e681, 14)
+    MD5_STEP(MD5_G, b, c, d, a, w[4], 0xe7d3fbc8, 20)
+    MD5_STEP(MD5_G, a, b, c, d, w[9], 0x21e1cde6, 5)
+    MD5_STEP(MD5_G, d, a, b, c, w[14], 0xc33707d6, 9)
+    MD5_STEP(MD5_G, c, d, a, b, w[3], 0xf4d50d87, 14)
+    MD5_STEP(MD5_G, b, c, d, a, w[8], 0x455a14ed, 20)
+    MD5_STEP(MD5_G, a, b, c, d, w[13], 0xa9e3e905, 5)
+    MD5_STEP(MD5_G, d, a, b, c, w[2], 0xfcefa3f8, 9)
+    MD5_STEP(MD5_G, c, d, a, b, w[7], 0x676f02d9, 14)
+    MD5_STEP(MD5_G, b, c, d, a, w[12], 0x8d2a4c8a, 20)
+
+    MD5_STEP(MD5_H, a, b, c, d, w[5], 0xfffa3942, 4)
+    MD5_STEP(MD5_H, d, a, b, c, w[8], 0x8771f681, 11)
+    MD5_STEP(MD5_H, c, d, a, b, w[11], 0x6d9d6122, 16)
+    MD5_STEP(MD5_H, b, c, d, a, w[14], 0xfde5380c, 23)
+    MD5_STEP(MD5_H, a, b, c, d, w[1], 0xa4beea44, 4)
+    MD5_STEP(MD5_H, d, a, b, c, w[4], 0x4bdecfa9, 11)
+    MD5_STEP(MD5_H, c, d, a, b, w[7], 0xf6bb4b60, 16)
+    MD5_STEP(MD5_H, b, c, d, a, w[10], 0xbebfbc70, 23)
+    MD5_STEP(MD5_H, a, b, c, d, w[13], 0x289b7ec6, 4)
+    MD5_STEP(MD5_H, d, a, b, c, w[0], 0xeaa127fa, 11)
+    MD5_STEP(MD5_H, c, d, a, b, w[3], 0xd4ef3085, 16)
+    MD5_STEP(MD5_H, b, c, d, a, w[6], 0x04881d05, 23)
+    MD5_STEP(MD5_H, a, b, c, d, w[9], 0xd9d4d039, 4)
+    MD5_STEP(MD5_H, d, a, b, c, w[12], 0xe6db99e5, 11)
+    MD5_STEP(MD5_H, c, d, a, b, w[15], 0x1fa27cf8, 16)
+    MD5_STEP(MD5_H, b, c, d, a, w[2], 0xc4ac5665, 23)
+
+    MD5_STEP(MD5_I, a, b, c, d, w[0], 0xf4292244, 6)
+    MD5_STEP(MD5_I, d, a, b, c, w[7], 0x432aff97, 10)
+    MD5_STEP(MD5_I, c, d, a, b, w[14], 0xab9423a7, 15)
+    MD5_STEP(MD5_I, b, c, d, a, w[5], 0xfc93a039, 21)
+    MD5_STEP(MD5_I, a, b, c, d, w[12], 0x655b59c3, 6)
+    MD5_STEP(MD5_I, d, a, b, c, w[3], 0x8f0ccc92, 10)
+    MD5_STEP(MD5_I, c, d, a, b, w[10], 0xffeff47d, 15)
+    MD5_STEP(MD5_I, b, c, d, a, w[1], 0x85845dd1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, w[8], 0x6fa87e4f, 6)
+    MD5_STEP(MD5_I, d, a, b, c, w[15], 0xfe2ce6e0, 10)
+    MD5_STEP(MD5_I, c, d, a, b, w[6], 0xa3014314, 15)
+    MD5_STEP(MD5_I, b, c, d, a, w[13], 0x4e0811a1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, w[4], 0xf7537e82, 6)
+    MD5_STEP(MD5_I, d, a, b, c, w[11], 0xbd3af235, 10)
+    MD5_STEP(MD5_I, c, d, a, b, w[2], 0x2ad7d2bb, 15)
+    MD5_STEP(MD5_I, b, c, d, a, w[9], 0xeb86d391, 21)
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+}
+
+// Starts a new MD5
+void md5_init(md5_context *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->length = 0;
+}
+
+// Adds data to an MD5. Whole blocks are hashed straight from data, the rest waits in ctx->buffer
+void md5_update(md5_context *ctx, const uint8_t *data, size_t length) {
+  size_t used = ctx->length % 64;
+  ctx->length += length;
+
+  if (used) {
+    size_t n = (length < 64 - used) ? length : 64 - used;
+    memcpy(ctx->buffer + used, data, n);
+    data += n;
+    length -= n;
+    if (used + n < 64)
+      return;
+    md5_blocks(ctx->state, ctx->buffer, 1);
+  }
+  md5_blocks(ctx->state, data, length / 64);
+  memcpy(ctx->buffer, data + length / 64 * 64, length % 64);
+}
+
+// Pads the data out to a whole block with its length at the end and writes out the MD5
+void md5_final(md5_context *ctx, uint8_t digest[16]) {
+  uint64_t bits = ctx->length * 8;
+  uint8_t pad[72] = {0x80};
+  size_t used = ctx->length % 64;
+  md5_update(ctx, pad, (used < 56) ? 56 - used : 120 - used);
+
+  unsigned int i;
+  for (i = 0; i < 8; i++)
+    pad[i] = bits >> (i * 8);
+  md5_update(ctx, pad, 8);
+
+  for (i = 0; i < 16; i++)
+    digest[i] = ctx->state[i / 4] >> ((i % 4) * 8);
+}
+
+
+/*
+ * SHA-1 (FIPS 180-4)
+ */
+
+// Reads a big endian 32 bit number
+static inline uint32_t load_be32(const uint8_t *p) {
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Message schedule, kept as a ring of 16 words
+#define SHA1_W(i) ((i) < 16 ? w[i] : (w[(i) & 15] = ROTL(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1)))
+#define SHA1_F0(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1_F1(b, c, d) ((b) ^ (c) ^ (d))
+#define SHA1_F2(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define SHA1_STEP(f, k, a, b, c, d, e, x) \
+  e += ROTL(a, 5) + f(b, c, d) + k + (x);  \
+  b = ROTL(b, 30);
+#define SHA1_STEP5(f, k, i)                           \
+  SHA1_STEP(f, k, a, b, c, d, e, SHA1_W(i))           \
+  SHA1_STEP(f, k, e, a, b, c, d, SHA1_W((i) + 1))     \
+  SHA1_STEP(f, k, d, e, a, b, c, SHA1_W((i) + 2))     \
+  SHA1_STEP(f, k, c, d, e, a, b, SHA1_W((i) + 3))     \
+  SHA1_STEP(f, k, b, c, d, e, a, SHA1_W((i) + 4))
+
+// Hashes 64 byte blocks of data
+void sha1_blocks_scalar(uint32_t *state, const uint8_t *data, size_t blocks) {
+  for (; blocks; blocks--, data += 64) {
+    uint32_t w[16];
+    unsigned int i;
+    for (i = 0; i < 16; i++)
+      w[i] = load_be32(data + i * 4);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    SHA1_STEP5(SHA1_F0, 0x5a827999, 0)
+    SHA1_STEP5(SHA1_F0, 0x5a827999, 5)
+    SHA1_STEP5(SHA1_F0, 0x5a827999, 10)
+    SHA1_STEP5(SHA1_F0, 0x5a827999, 15)
+    SHA1_STEP5(SHA1_F1, 0x6ed9eba1, 20)
+    SHA1_STEP5(SHA1_F1, 0x6ed9eba1, 25)
+    SHA1_STEP5(SHA1_F1, 0x6ed9eba1, 30)
+    SHA1_STEP5(SHA1_F1, 0x6ed9eba1, 35)
+    SHA1_STEP5(SHA1_F2, 0x8f1bbcdc, 40)
+    SHA1_STEP5(SHA1_F2, 0x8f1bbcdc, 45)
+    SHA1_STEP5(SHA1_F2, 0x8f1bbcdc, 50)
+    SHA1_STEP5(SHA1_F2, 0x8f1bbcdc, 55)
+    SHA1_STEP5(SHA1_F1, 0xca62c1d6, 60)
+    SHA1_STEP5(SHA1_F1, 0xca62c1d6, 65)
+    SHA1_STEP5(SHA1_F1, 0xca62c1d6, 70)
+    SHA1_STEP5(SHA1_F1, 0xca62c1d6, 75)
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#ifdef HAVE_X86_HASH
+/**
+ * Four rounds of SHA-1 with the SHA extensions, h being which four (0 to 19).
+ * e is the E for these rounds, worked out from the A saved in it by the last four rounds,
+ * and save gets this A for the next ones. The message schedule is worked out a few rounds ahead
+ * in m, four words to a register, so m[h % 4] always has the words for these rounds.
+ */
+#define SHA1_SHANI_ROUNDS(h, e, save)                                            \
+  e = _mm_sha1nexte_epu32(e, m[(h) % 4]);                                       \
+  save = abcd;                                                                  \
+  abcd = _mm_sha1rnds4_epu32(abcd, e, (h) / 5);                                 \
+  if ((h) >= 3 && (h) <= 18)                                                    \
+    m[((h) + 1) % 4] = _mm_sha1msg2_epu32(m[((h) + 1) % 4], m[(h) % 4]);        \
+  if ((h) >= 2 && (h) <= 17)                                                    \
+    m[((h) + 2) % 4] = _mm_xor_si128(m[((h) + 2) % 4], m[(h) % 4]);             \
+  if ((h) >= 1 && (h) <= 16)                                                    \
+    m[((h) + 3) % 4] = _mm_sha1msg1_epu32(m[((h) + 3) % 4], m[(h) % 4]);
+
+// Hashes 64 byte blocks of data with the SHA instructions
+__attribute__((target("sha,sse4.1")))
+void sha1_blocks_shani(uint32_t *state, const uint8_t *data, size_t blocks) {
+  const __m128i big_endian = _mm_set_epi64x(0x0001020304050607, 0x08090a0b0c0d0e0f);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) state), 0x1b);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  __m128i e1;
+
+  for (; blocks; blocks--, data += 64) {
+    const __m128i abcd_save = abcd, e0_save = e0;
+    __m128i m[4];
+    unsigned int i;
+    for (i = 0; i < 4; i++)
+      m[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (data + i * 16)), big_endian);
+
+    // The first E comes straight from the state
+    e0 = _mm_add_epi32(e0, m[0]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    SHA1_SHANI_ROUNDS(1, e1, e0)
+    SHA1_SHANI_ROUNDS(2, e0, e1)
+    SHA1_SHANI_ROUNDS(3, e1, e0)
+    SHA1_SHANI_ROUNDS(4, e0, e1)
+    SHA1_SHANI_ROUNDS(5, e1, e0)
+    SHA1_SHANI_ROUNDS(6, e0, e1)
+    SHA1_SHANI_ROUNDS(7, e1, e0)
+    SHA1_SHANI_ROUNDS(8, e0, e1)
+    SHA1_SHANI_ROUNDS(9, e1, e0)
+    SHA1_SHANI_ROUNDS(10, e0, e1)
+    SHA1_SHANI_ROUNDS(11, e1, e0)
+    SHA1_SHANI_ROUNDS(12, e0, e1)
+    SHA1_SHANI_ROUNDS(13, e1, e0)
+    SHA1_SHANI_ROUNDS(14, e0, e1)
+    SHA1_SHANI_ROUNDS(15, e1, e0)
+    SHA1_SHANI_ROUNDS(16, e0, e1)
+    SHA1_SHANI_ROUNDS(17, e1, e0)
+    SHA1_SHANI_ROUNDS(18, e0, e1)
+    SHA1_SHANI_ROUNDS(19, e1, e0)
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+
+/**
+ * The SHA-1 block function in use and its name.
+ * Starts out pointing at sha1_blocks_select(), which replaces it with the best one the CPU can run.
+ */
+static void sha1_blocks_select(uint32_t *state, const uint8_t *data, size_t blocks);
+static void (*sha1_blocks_impl)(uint32_t *, const uint8_t *, size_t) = sha1_blocks_select;
+static const char *sha1_blocks_impl_name = "scalar";
+
+// Picks the best implementation the CPU supports using cpuid
+static void sha1_blocks_select(uint32_t *state, const uint8_t *data, size_t blocks) {
+  void (*impl)(uint32_t *, const uint8_t *, size_t) = sha1_blocks_scalar;
+  const char *name = "scalar";
+
+#ifdef HAVE_X86_HASH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+    impl = sha1_blocks_shani;
+    name = "sha";
+  }
+#endif
+
+  __atomic_store_n(&sha1_blocks_impl_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&sha1_blocks_impl, impl, __ATOMIC_RELEASE);
+
+  if (blocks)
+    impl(state, data, blocks);
+}
+
+// Hashes 64 byte blocks of data with the best implementation
+static void sha1_blocks(uint32_t *state, const uint8_t *data, size_t blocks) {
+  __atomic_load_n(&sha1_blocks_impl, __ATOMIC_ACQUIRE)(state, data, blocks);
+}
+
+// Returns the name of the SHA-1 implementation
+const char *sha1_name() {
+  if (__atomic_load_n(&sha1_blocks_impl, __ATOMIC_ACQUIRE) == sha1_blocks_select)
+    sha1_blocks_select(NULL, NULL, 0);
+  return __atomic_load_n(&sha1_blocks_impl_name, __ATOMIC_RELAXED);
+}
+
+// Starts a new SHA-1
+void sha1_init(sha1_context *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->length = 0;
+}
+
+// Adds data to a SHA-1, the same way as md5_update()
+void sha1_update(sha1_context *ctx, const uint8_t *data, size_t length) {
+  size_t used = ctx->length % 64;
+  ctx->length += length;
+
+  if (used) {
+    size_t n = (length < 64 - used) ? length : 64 - used;
+    memcpy(ctx->buffer + used, data, n);
+    data += n;
+    length -= n;
+    if (used + n < 64)
+      return;
+    sha1_blocks(ctx->state, ctx->buffer, 1);
+  }
+  sha1_blocks(ctx->state, data, length / 64);
+  memcpy(ctx->buffer, data + length / 64 * 64, length % 64);
+}
+
+// Pads the data out like md5_final() but with the length big endian and writes out the SHA-1
+void sha1_final(sha1_context *ctx, uint8_t digest[20]) {
+  uint64_t bits = ctx->length * 8;
+  uint8_t pad[72] = {0x80};
+  size_t used = ctx->length % 64;
+  sha1_update(ctx, pad, (used < 56) ? 56 - used : 120 - used);
+
+  unsigned int i;
+  for (i = 0; i < 8; i++)
+    pad[i] = bits >> ((7 - i) * 8);
+  sha1_update(ctx, pad, 8);
+
+  for (i = 0; i < 20; i++)
+    digest[i] = ctx->state[i / 4] >> ((3 - i % 4) * 8);
+}
+
+
+/*
+ * Track hasher
+ */
+
+// Hashes some data of a stream
+static void hash_stream_update(hash_stream *s, const uint8_t *data, size_t length) {
+  s->size += length;
+  s->crc32 = crc32_update(s->crc32, data, length);
+  md5_update(&s->md5, data, length);
+  sha1_update(&s->sha1, data, length);
+}
+
+// Thread that hashes each block of a stream as it is filled
+static void *hash_stream_thread(void *arg) {
+  hash_stream *s = (hash_stream *) arg;
+
+  pthread_mutex_lock(&s->lock);
+  while (1) {
+    while (s->hashed == s->filled && !s->finished)
+      pthread_cond_wait(&s->changed, &s->lock);
+    if (s->hashed == s->filled)
+      break;
+    unsigned int block = s->hashed % HASH_BLOCKS;
+    pthread_mutex_unlock(&s->lock);
+
+    hash_stream_update(s, s->blocks[block], s->lengths[block]);
+
+    pthread_mutex_lock(&s->lock);
+    s->hashed++;
+    pthread_cond_signal(&s->changed);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+// Sets up a stream and starts its thread. Returns 0 on success.
+// If it fails, hash_stream_free() still has to be called
+static int hash_stream_start(hash_stream *s) {
+  memset(s, 0, sizeof(hash_stream));
+  md5_init(&s->md5);
+  sha1_init(&s->sha1);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->changed, NULL);
+
+  unsigned int i;
+  for (i = 0; i < HASH_BLOCKS; i++) {
+    s->blocks[i] = malloc(HASH_BLOCK_SIZE);
+    if (!s->blocks[i])
+      return -1;
+  }
+
+  s->threaded = (pthread_create(&s->thread, NULL, hash_stream_thread, s) == 0);
+  return 0;
+}
+
+// Copies data into a stream's blocks, handing each one to the thread as it fills up
+static void hash_stream_feed(hash_stream *s, const uint8_t *data, size_t length) {
+  if (!s->threaded) {
+    hash_stream_update(s, data, length);
+    return;
+  }
+
+  while (length) {
+    // Wait for the thread to be done with a block before starting to fill it
+    if (s->fill == 0) {
+      pthread_mutex_lock(&s->lock);
+      while (s->filled - s->hashed >= HASH_BLOCKS)
+        pthread_cond_wait(&s->changed, &s->lock);
+      pthread_mutex_unlock(&s->lock);
+    }
+
+    unsigned int block = s->filled % HASH_BLOCKS;
+    size_t n = (length < HASH_BLOCK_SIZE - s->fill) ? length : HASH_BLOCK_SIZE - s->fill;
+    memcpy(s->blocks[block] + s->fill, data, n);
+    s->fill += n;
+    data += n;
+    length -= n;
+
+    if (s->fill == HASH_BLOCK_SIZE) {
+      s->lengths[block] = s->fill;
+      s->fill = 0;
+      pthread_mutex_lock(&s->lock);
+      s->filled++;
+      pthread_cond_signal(&s->changed);
+      pthread_mutex_unlock(&s->lock);
+    }
+  }
+}
+
+// Hands the last block to the thread, waits for it to finish and writes out the digest
+static void hash_stream_finish(hash_stream *s, hash_digest *digest) {
+  if (s->threaded) {
+    pthread_mutex_lock(&s->lock);
+    if (s->fill) {
+      s->lengths[s->filled % HASH_BLOCKS] = s->fill;
+      s->filled++;
+    }
+    s->finished = 1;
+    pthread_cond_signal(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+  }
+
+  if (digest) {
+    digest->size = s->size;
+    digest->crc32 = s->crc32;
+    md5_final(&s->md5, digest->md5);
+    sha1_final(&s->sha1, digest->sha1);
+  }
+}
+
+// Frees a stream's blocks
+static void hash_stream_free(hash_stream *s) {
+  unsigned int i;
+  for (i = 0; i < HASH_BLOCKS; i++)
+    free(s->blocks[i]);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->changed);
+}
+
+
+// Starts hashing a track
+track_hasher *hasher_start() {
+  track_hasher *hasher = malloc(sizeof(track_hasher));
+  if (!hasher) {
+    fprintf(stderr, "Failed to allocate track hasher: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  if (hash_stream_start(&hasher->raw) != 0) {
+    fprintf(stderr, "Failed to allocate track hasher: %s\n", strerror(errno));
+    hash_stream_free(&hasher->raw);
+    free(hasher);
+    return NULL;
+  }
+  if (hash_stream_start(&hasher->output) != 0) {
+    fprintf(stderr, "Failed to allocate track hasher: %s\n", strerror(errno));
+    hash_stream_finish(&hasher->raw, NULL);
+    hash_stream_free(&hasher->raw);
+    hash_stream_free(&hasher->output);
+    free(hasher);
+    return NULL;
+  }
+  return hasher;
+}
+
+// Adds raw track data to the hasher
+void hasher_raw(track_hasher *hasher, const uint8_t *data, size_t length) {
+  if (hasher)
+    hash_stream_feed(&hasher->raw, data, length);
+}
+
+// Adds output data to the hasher
+void hasher_output(track_hasher *hasher, const uint8_t *data, size_t length) {
+  if (hasher)
+    hash_stream_feed(&hasher->output, data, length);
+}
+
+// Finishes both streams and frees the hasher
+void hasher_finish(track_hasher *hasher, hash_digest *raw, hash_digest *output) {
+  if (!hasher)
+    return;
+  hash_stream_finish(&hasher->raw, raw);
+  hash_stream_finish(&hasher->output, output);
+  hash_stream_free(&hasher->raw);
+  hash_stream_free(&hasher->output);
+  free(hasher);
+}
+
+
+// Writes a digest as hex
+void hash_hex(const hash_digest *digest, char *crc32, char *md5, char *sha1) {
+  unsigned int i;
+  sprintf(crc32, "%08x", digest->crc32);
+  for (i = 0; i < 16; i++)
+    sprintf(md5 + i * 2, "%02x", digest->md5[i]);
+  for (i = 0; i < 20; i++)
+    sprintf(sha1 + i * 2, "%02x", digest->sha1[i]);
+}
@@ -0,0 +1,202 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <pthread.h>
+
+// Size of each block of data handed to a hashing thread and how many of them each stream can have queued up
+#define HASH_BLOCK_SIZE (1024 * 1024)
+#define HASH_BLOCKS     4
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Hash digest struct
+ *
+ * The size and CRC32, MD5 and SHA-1 of some data, which is everything a DAT file has for a track.
+ */
+typedef struct {
+  uint64_t size;
+  uint32_t crc32;
+  uint8_t md5[16];
+  uint8_t sha1[20];
+} hash_digest;
+
+
+/**
+ * MD5 and SHA-1 contexts
+ *
+ * The state of a hash part way through some data
+ */
+typedef struct {
+  uint32_t state[4];
+  uint64_t length;
+  uint8_t buffer[64];
+} md5_context;
+
+typedef struct {
+  uint32_t state[5];
+  uint64_t length;
+  uint8_t buffer[64];
+} sha1_context;
+
+
+/**
+ * Hash stream struct
+ *
+ * One stream of data being hashed on its own thread. Data is copied into a block, and full blocks
+ * are hashed by the thread while the next one is filled in.
+ */
+typedef struct {
+  // The hashes so far
+  uint64_t size;
+  uint32_t crc32;
+  md5_context md5;
+  sha1_context sha1;
+
+  // The blocks and how much is in each. Block filled % HASH_BLOCKS is being filled in by the ripping thread
+  uint8_t *blocks[HASH_BLOCKS];
+  size_t lengths[HASH_BLOCKS];
+  size_t fill;
+  // How many blocks have been handed to the thread and how many it has hashed, protected by lock
+  unsigned int filled;
+  unsigned int hashed;
+  // Set once there is nothing more to hash, protected by lock
+  int finished;
+
+  // 1 if the thread is running, 0 if the data is hashed as it comes in instead
+  int threaded;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} hash_stream;
+
+
+/**
+ * Track hasher struct
+ *
+ * Hashes a track two ways at the same time: the raw track data exactly as it is in the image,
+ * and the converted data written to the output, headers and all.
+ */
+typedef struct {
+  hash_stream raw;
+  hash_stream output;
+} track_hasher;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Compute the CRC32 (the zlib/PKZIP one) of some data.
+ *
+ * @param uint32_t crc
+ *   The CRC32 of the data before this, 0 to start
+ * @param const uint8_t *data
+ *   The data
+ * @param size_t length
+ *   How many bytes of data there are
+ * @return uint32_t
+ *   The CRC32 of everything so far
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+
+/**
+ * The individual crc32_update() implementations.
+ * Only call crc32_pclmul() if the CPU supports PCLMULQDQ and SSE4.1.
+ */
+uint32_t crc32_scalar(uint32_t crc, const uint8_t *data, size_t length);
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_HASH
+uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t length);
+#endif
+
+/**
+ * Returns the name of the crc32_update() implementation being used ("scalar" or "pclmul")
+ */
+const char *crc32_name();
+
+
+/**
+ * MD5 and SHA-1 of some data. Call init, then update as many times as needed, then final to get the hash.
+ * SHA-1 uses the SHA instructions if the CPU has them.
+ */
+void md5_init(md5_context *ctx);
+void md5_update(md5_context *ctx, const uint8_t *data, size_t length);
+void md5_final(md5_context *ctx, uint8_t digest[16]);
+void sha1_init(sha1_context *ctx);
+void sha1_update(sha1_context *ctx, const uint8_t *data, size_t length);
+void sha1_final(sha1_context *ctx, uint8_t digest[20]);
+
+/**
+ * The individual SHA-1 block functions, which hash whole 64 byte blocks into the 5 word state.
+ * Only call sha1_blocks_shani() if the CPU supports the SHA extensions and SSE4.1.
+ */
+void sha1_blocks_scalar(uint32_t *state, const uint8_t *data, size_t blocks);
+#ifdef HAVE_X86_HASH
+void sha1_blocks_shani(uint32_t *state, const uint8_t *data, size_t blocks);
+#endif
+
+/**
+ * Returns the name of the SHA-1 implementation being used ("scalar" or "sha")
+ */
+const char *sha1_name();
+
+
+/**
+ * Start hashing a track, with a thread for each of the two streams.
+ * If the threads can't be started the data is hashed as it is passed in instead.
+ *
+ * @return *track_hasher
+ *   A pointer to the new hasher or NULL if it could not be allocated
+ */
+track_hasher *hasher_start();
+
+/**
+ * Add some data to the raw or output stream of a hasher.
+ * The data is copied, so the buffer can be reused as soon as this returns.
+ * Only waits if the thread has fallen HASH_BLOCKS blocks behind.
+ * If hasher is NULL, nothing is done.
+ */
+void hasher_raw(track_hasher *hasher, const uint8_t *data, size_t length);
+void hasher_output(track_hasher *hasher, const uint8_t *data, size_t length);
+
+/**
+ * Wait for the threads to hash everything, get the hashes of both streams and free the hasher.
+ */
+void hasher_finish(track_hasher *hasher, hash_digest *raw, hash_digest *output);
+
+
+/**
+ * Write a digest as hex: the CRC32 into crc32 (9 bytes), the MD5 into md5 (33 bytes) and the SHA-1 into sha1 (41 bytes).
+ */
+void hash_hex(const hash_digest *digest, char *crc32, char *md5, char *sha1);
+
+#endif
@@ -0,0 +1,459 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <strings.h> // strcasecmp()
+#include "nerorip.h"
+#include "iso.h"
+
+// How many sectors are read at once when reading directories and files
+#define ISO_READ_SECTORS 32
+
+// Allocates memory for an iso_fs
+iso_fs *alloc_iso_fs() {
+  iso_fs *r = malloc(sizeof(iso_fs));
+  if (!r) {
+    fprintf(stderr, "Failed to allocate memory for iso_fs structure: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  r->cache = NULL;
+  r->track = NULL;
+  r->base_lba = 0;
+  r->joliet = 0;
+  r->volume_id[0] = '\0';
+  r->files = NULL;
+  r->number_files = 0;
+  r->files_allocated = 0;
+
+  return r;
+}
+
+// Frees an iso_fs and the paths of all its files
+static void iso_clear_files(iso_fs *fs) {
+  unsigned int i;
+  for (i = 0; i < fs->number_files; i++)
+    free(fs->files[i].path);
+  free(fs->files);
+  fs->files = NULL;
+  fs->number_files = 0;
+  fs->files_allocated = 0;
+}
+
+void free_iso_fs(iso_fs *fs) {
+  if (!fs)
+    return;
+  iso_clear_files(fs);
+  free(fs);
+}
+
+
+// The ISO9660 both-endian fields are read from their little endian half
+static uint32_t iso_read32(const uint8_t *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+static uint16_t iso_read16(const uint8_t *p) {
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+// Reads count 2048 byte sectors of the filesystem. Returns 0 on success
+static int iso_read_sectors(iso_fs *fs, uint32_t lba, unsigned int count, uint8_t *buffer) {
+  if (count == 0)
+    return 0;
+
+  // sector_read() wants room for whole raw sectors
+  const unsigned int chunk = (count > ISO_READ_SECTORS) ? ISO_READ_SECTORS : count;
+  uint8_t *sectors = malloc((size_t) chunk * NRG_MAX_SECTOR_SIZE);
+  if (!sectors)
+    return ISO_NON_ALLOC;
+
+  while (count > 0) {
+    unsigned int length;
+    int r = sector_read(fs->cache, fs->base_lba + lba, (count > chunk) ? chunk : count, 1, sectors, &length);
+    if (r <= 0 || length != 2048) {
+      free(sectors);
+      return ISO_READ_ERR;
+    }
+    memcpy(buffer, sectors, (size_t) r * 2048);
+    buffer += (size_t) r * 2048;
+    lba += r;
+    count -= r;
+  }
+
+  free(sectors);
+  return 0;
+}
+
+
+// Checks whether the sector at lba starts with the "." record of the directory at lba
+static int iso_is_directory(iso_fs *fs, uint32_t lba) {
+  uint8_t sector[2048];
+  if (iso_read_sectors(fs, lba, 1, sector) != 0)
+    return 0;
+  return sector[0] >= 34 && sector[32] == 1 && sector[33] == 0 && iso_read32(sector + 2) == lba && (sector[25] & 0x02);
+}
+
+
+// Builds the path of a file from its parent's path and its name in the directory record.
+// Joliet names are UCS-2 big endian and get converted to UTF-8. Version numbers like ";1" are removed.
+static char *iso_make_path(const char *parent, const uint8_t *name, unsigned int length, int joliet) {
+  size_t parent_length = strlen(parent);
+  // A UCS-2 character (2 bytes) takes at most 3 bytes of UTF-8, a Latin-1 one (1 byte) at most 2
+  char *r = malloc(parent_length + 2 + (size_t) length * ((joliet) ? 3 : 4) / 2 + 1);
+  if (!r)
+    return NULL;
+
+  memcpy(r, parent, parent_length);
+  char *out = r + parent_length;
+  if (parent_length == 0 || parent[parent_length - 1] != '/')
+    *out++ = '/';
+  char *start = out;
+
+  unsigned int i;
+  for (i = 0; i + (joliet ? 1 : 0) < length; i += (joliet ? 2 : 1)) {
+    unsigned int c = (joliet) ? (unsigned int) (name[i] << 8 | name[i + 1]) : name[i];
+    if (c == ';')
+      break;
+    // These would mess up the path
+    if (c == '/' || c == '\0')
+      c = '_';
+
+    if (c < 0x80)
+      *out++ = c;
+    else if (c < 0x800) {
+      *out++ = 0xC0 | (c >> 6);
+      *out++ = 0x80 | (c & 0x3F);
+    }
+    else {
+      *out++ = 0xE0 | (c >> 12);
+      *out++ = 0x80 | ((c >> 6) & 0x3F);
+      *out++ = 0x80 | (c & 0x3F);
+    }
+  }
+
+  // Files with no extension are stored as "NAME."
+  if (out > start + 1 && out[-1] == '.')
+    out--;
+  *out = '\0';
+  return r;
+}
+
+
+// Adds a file to an iso_fs. Takes ownership of path
+static int iso_add_file(iso_fs *fs, char *path, uint32_t lba, uint32_t length, int directory) {
+  if (!path)
+    return ISO_NON_ALLOC;
+
+  if (fs->number_files == fs->files_allocated) {
+    unsigned int new_allocated = (fs->files_allocated) ? fs->files_allocated * 2 : 16;
+    iso_file *r = realloc(fs->files, new_allocated * sizeof(iso_file));
+    if (!r) {
+      free(path);
+      return ISO_NON_ALLOC;
+    }
+    fs->files = r;
+    fs->files_allocated = new_allocated;
+  }
+
+  iso_file *f = &fs->files[fs->number_files++];
+  f->path = path;
+  f->lba = lba;
+  f->length = length;
+  f->directory = directory;
+  return 0;
+}
+
+
+// Reads the files out of one directory. Subdirectories come from the path table so they're skipped here
+static int iso_parse_directory(nerorip_context *ctx, iso_fs *fs, const char *path, uint32_t lba, uint32_t *directory_length) {
+  uint8_t first[2048];
+  int r = iso_read_sectors(fs, lba, 1, first);
+  if (r != 0)
+    return r;
+
+  // The "." record says how big the directory is
+  if (first[0] < 34 || first[32] != 1 || first[33] != 0) {
+    fprintf(stderr, "Directory %s at LBA %u does not start with a \".\" entry\n", path, lba);
+    return ISO_CORRUPT;
+  }
+  uint32_t length = iso_read32(first + 10);
+  if (length > ISO_MAX_DIRECTORY) {
+    fprintf(stderr, "Directory %s is %u bytes long which is too big\n", path, length);
+    return ISO_CORRUPT;
+  }
+  *directory_length = length;
+  ver_printf(ctx, 3, "  Reading directory %s at LBA %u, %u bytes\n", path, lba, length);
+
+  unsigned int sectors = (length + 2047) / 2048;
+  uint8_t *data = malloc((size_t) sectors * 2048);
+  if (!data)
+    return ISO_NON_ALLOC;
+  if ((r = iso_read_sectors(fs, lba, sectors, data)) != 0) {
+    free(data);
+    return r;
+  }
+
+  uint64_t position = 0;
+  while (position < length) {
+    const uint8_t *record = data + position;
+    unsigned int record_length = record[0];
+    uint64_t sector_left = 2048 - position % 2048;
+
+    // Records don't cross sectors. A zero length means the rest of this sector is padding
+    if (record_length == 0) {
+      position += sector_left;
+      continue;
+    }
+    if (record_length < 34 || record_length > sector_left || (unsigned int) 33 + record[32] > record_length) {
+      fprintf(stderr, "Bad directory record in %s at byte %llu\n", path, (unsigned long long) position);
+      free(data);
+      return ISO_CORRUPT;
+    }
+    position += record_length;
+
+    // Skip "." and ".." and the subdirectories
+    unsigned int name_length = record[32];
+    if ((name_length == 1 && record[33] <= 1) || (record[25] & 0x02))
+      continue;
+
+    r = iso_add_file(fs, iso_make_path(path, record + 33, name_length, fs->joliet), iso_read32(record + 2), iso_read32(record + 10), 0);
+    if (r != 0) {
+      free(data);
+      return r;
+    }
+  }
+
+  free(data);
+  return 0;
+}
+
+
+// Sorts files by path
+static int compare_iso_files(const void *a, const void *b) {
+  const iso_file *x = a, *y = b;
+  return strcmp(x->path, y->path);
+}
+
+
+// Parses the filesystem on a data track
+int iso_parse(nerorip_context *ctx, sector_cache *cache, nrg_track *track, iso_fs *fs) {
+  if (!fs || !cache || !track)
+    return ISO_NON_ALLOC;
+  if (track->track_mode == AUDIO)
+    return ISO_NOT_ISO;
+
+  iso_clear_files(fs);
+  fs->cache = cache;
+  fs->track = track;
+  fs->base_lba = track->track_lba;
+  fs->joliet = 0;
+  fs->volume_id[0] = '\0';
+
+  // Look through the volume descriptors for the primary and a Joliet supplementary descriptor
+  uint8_t primary[2048], joliet[2048], sector[2048];
+  int found_primary = 0;
+  unsigned int i;
+  for (i = 0; i < ISO_MAX_DESCRIPTORS; i++) {
+    if (iso_read_sectors(fs, ISO_FIRST_DESCRIPTOR + i, 1, sector) != 0 || memcmp(sector + 1, "CD001", 5) != 0)
+      break;
+
+    if (sector[0] == 1 && !found_primary) {
+      memcpy(primary, sector, 2048);
+      found_primary = 1;
+    }
+    // Joliet is marked by one of three escape sequences for the UCS-2 levels
+    else if (sector[0] == 2 && !fs->joliet && sector[88] == '%' && sector[89] == '/' &&
+             (sector[90] == '@' || sector[90] == 'C' || sector[90] == 'E')) {
+      memcpy(joliet, sector, 2048);
+      fs->joliet = 1;
+    }
+    else if (sector[0] == 255)
+      break;
+  }
+  if (!found_primary) {
+    ver_printf(ctx, 3, "Track %u has no ISO9660 primary volume descriptor\n", track->number);
+    return ISO_NOT_ISO;
+  }
+
+  // The volume id is always taken from the primary descriptor
+  memcpy(fs->volume_id, primary + 40, 32);
+  fs->volume_id[32] = '\0';
+  for (i = 32; i > 0 && fs->volume_id[i - 1] == ' '; i--)
+    fs->volume_id[i - 1] = '\0';
+
+  const uint8_t *descriptor = (fs->joliet) ? joliet : primary;
+  uint32_t root_lba = iso_read32(descriptor + 156 + 2);
+  uint32_t path_table_length = iso_read32(descriptor + 132);
+  uint32_t path_table_lba = iso_read32(descriptor + 140);
+  ver_printf(ctx, 2, "Track %u has %s filesystem \"%s\"\n", track->number, (fs->joliet ? "a Joliet" : "an ISO9660"), fs->volume_id);
+
+  // Filesystems in later sessions usually give LBAs from the start of the disc, others from the start of the track.
+  // Whichever one has the root directory where it should be is the one used.
+  fs->base_lba = 0;
+  if (!iso_is_directory(fs, root_lba)) {
+    fs->base_lba = track->track_lba;
+    if (!iso_is_directory(fs, root_lba)) {
+      fprintf(stderr, "Could not find the root directory of the filesystem on track %u\n", track->number);
+      return ISO_CORRUPT;
+    }
+  }
+  ver_printf(ctx, 3, "  Filesystem LBAs start at %u\n", fs->base_lba);
+
+  // Read the whole path table
+  if (path_table_length == 0 || path_table_length > ISO_MAX_PATH_TABLE) {
+    fprintf(stderr, "Path table on track %u is %u bytes long which does not make sense\n", track->number, path_table_length);
+    return ISO_CORRUPT;
+  }
+  uint8_t *table = malloc((size_t) (path_table_length + 2047) / 2048 * 2048);
+  if (!table)
+    return ISO_NON_ALLOC;
+  int r = iso_read_sectors(fs, path_table_lba, (path_table_length + 2047) / 2048, table);
+  if (r != 0) {
+    free(table);
+    return r;
+  }
+
+  // Each path table entry gives a directory and the number of its parent. The parent always comes first
+  // so the list of directory paths can be built as it's read. Directory numbers start at 1.
+  char **paths = NULL;
+  unsigned int number_paths = 0, paths_allocated = 0;
+  uint32_t position = 0;
+  while (r == 0 && position + 8 <= path_table_length) {
+    const uint8_t *entry = table + position;
+    unsigned int name_length = entry[0];
+    uint32_t lba = iso_read32(entry + 2);
+    unsigned int parent = iso_read16(entry + 6);
+    if (name_length == 0 || position + 8 + name_length > path_table_length || parent < 1 || parent > number_paths + (number_paths == 0)) {
+      fprintf(stderr, "Bad path table entry on track %u at byte %u\n", track->number, position);
+      r = ISO_CORRUPT;
+      break;
+    }
+    if (number_paths > 0 && strlen(paths[parent - 1]) > ISO_MAX_PATH) {
+      fprintf(stderr, "Directories on track %u are nested too deep\n", track->number);
+      r = ISO_CORRUPT;
+      break;
+    }
+    position += 8 + name_length + (name_length & 1);
+
+    if (number_paths == paths_allocated) {
+      unsigned int new_allocated = (paths_allocated) ? paths_allocated * 2 : 16;
+      char **new_paths = realloc(paths, new_allocated * sizeof(char *));
+      if (!new_paths) {
+        r = ISO_NON_ALLOC;
+        break;
+      }
+      paths = new_paths;
+      paths_allocated = new_allocated;
+    }
+
+    // The first entry is the root
+    char *path = (number_paths == 0) ? strdup("/") : iso_make_path(paths[parent - 1], entry + 8, name_length, fs->joliet);
+    if (!path) {
+      r = ISO_NON_ALLOC;
+      break;
+    }
+    paths[number_paths++] = path;
+
+    uint32_t length;
+    if ((r = iso_parse_directory(ctx, fs, path, lba, &length)) != 0)
+      break;
+    if (number_paths > 1) {
+      char *copy = strdup(path);
+      r = (copy) ? iso_add_file(fs, copy, lba, length, 1) : ISO_NON_ALLOC;
+    }
+  }
+
+  for (i = 0; i < number_paths; i++)
+    free(paths[i]);
+  free(paths);
+  free(table);
+  if (r != 0)
+    return r;
+
+  qsort(fs->files, fs->number_files, sizeof(iso_file), compare_iso_files);
+  return 0;
+}
+
+
+// Prints every file in a filesystem
+void iso_print(nerorip_context *ctx, int verbosity, iso_fs *fs) {
+  ver_printf(ctx, verbosity, "Track %u: %s filesystem \"%s\"\n", fs->track->number, (fs->joliet ? "Joliet" : "ISO9660"), fs->volume_id);
+
+  unsigned int i;
+  for (i = 0; i < fs->number_files; i++) {
+    iso_file *f = &fs->files[i];
+    if (f->directory)
+      ver_printf(ctx, verbosity, "  %10s  %s/\n", "<dir>", f->path);
+    else
+      ver_printf(ctx, verbosity, "  %10u  %s\n", f->length, f->path);
+  }
+}
+
+
+// Finds a file by path
+iso_file *iso_find(iso_fs *fs, const char *path) {
+  // The stored paths all start with '/'
+  while (*path == '/')
+    path++;
+
+  iso_file *nocase = NULL;
+  unsigned int i;
+  for (i = 0; i < fs->number_files; i++) {
+    const char *p = fs->files[i].path + 1;
+    if (strcmp(p, path) == 0)
+      return &fs->files[i];
+    if (!nocase && strcasecmp(p, path) == 0)
+      nocase = &fs->files[i];
+  }
+  return nocase;
+}
+
+
+// Copies a file out of the filesystem
+int iso_extract(nerorip_context *ctx, iso_fs *fs, iso_file *file, FILE *output) {
+  uint8_t *buffer = malloc(ISO_READ_SECTORS * 2048);
+  if (!buffer) {
+    fprintf(stderr, "Failed to allocate memory for file buffer: %s\n", strerror(errno));
+    return ISO_NON_ALLOC;
+  }
+
+  uint32_t lba = file->lba;
+  uint32_t left = file->length;
+  while (left > 0) {
+    unsigned int count = (left > ISO_READ_SECTORS * 2048) ? ISO_READ_SECTORS : (left + 2047) / 2048;
+    size_t length = (left > count * 2048) ? count * 2048 : left;
+
+    if (iso_read_sectors(fs, lba, count, buffer) != 0) {
+      fprintf(stderr, "Failed to read %s at LBA %u\n", file->path, fs->base_lba + lba);
+      free(buffer);
+      return ISO_READ_ERR;
+    }
+    if (fwrite(buffer, 1, length, output) != length) {
+      fprintf(stderr, "Failed to write %s: %s\n", file->path, strerror(errno));
+      free(buffer);
+      return ISO_WRITE_ERR;
+    }
+
+    lba += count;
+    left -= length;
+  }
+
+  ver_printf(ctx, 2, "Extracted %s, %u bytes\n", file->path, file->length);
+  free(buffer);
+  return 0;
+}
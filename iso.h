@@ -0,0 +1,194 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ISO_H
+#define ISO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include "util.h"
+#include "nrg.h"
+#include "sector.h"
+
+// Indicates that the track has no ISO9660 filesystem on it
+#define ISO_NOT_ISO   -1
+// Indicates that the iso_fs was not allocated
+#define ISO_NON_ALLOC -2
+// Indicates that the filesystem structures don't make sense
+#define ISO_CORRUPT   -3
+// Indicates that sectors could not be read from the image
+#define ISO_READ_ERR  -4
+// Indicates that the output could not be written
+#define ISO_WRITE_ERR -5
+
+// Sector the first volume descriptor is in
+#define ISO_FIRST_DESCRIPTOR 16
+// Stop looking for volume descriptors after this many
+#define ISO_MAX_DESCRIPTORS 32
+// Largest path table that will be read
+#define ISO_MAX_PATH_TABLE (16 * 1024 * 1024)
+// Largest directory that will be read
+#define ISO_MAX_DIRECTORY (16 * 1024 * 1024)
+// Longest directory path that is accepted
+#define ISO_MAX_PATH 4096
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * ISO9660 file struct
+ *
+ * One file or directory found in the filesystem.
+ */
+typedef struct {
+  // The full path of the file from the root, like "/DIR/FILE.TXT". Joliet names are converted to UTF-8
+  char *path;
+  // The LBA the file data starts at
+  uint32_t lba;
+  // How long the file is in bytes
+  uint32_t length;
+  // 1 if this is a directory, 0 if it's a file
+  int directory;
+} iso_file;
+
+
+/**
+ * ISO9660 filesystem struct
+ *
+ * Describes the filesystem on one data track.
+ * It is filled in by iso_parse() and keeps the sector_cache it was parsed with to read files later.
+ */
+typedef struct {
+  // Where sectors are read from
+  sector_cache *cache;
+  // The track the filesystem is on
+  nrg_track *track;
+  // Added to every LBA in the filesystem. 0 if the filesystem uses LBAs from the start of the disc,
+  // otherwise the LBA of the track
+  uint32_t base_lba;
+
+  // 1 if the names came from a Joliet supplementary volume descriptor
+  int joliet;
+  // The volume identifier, trailing spaces removed
+  char volume_id[33];
+
+  // Every file and directory in the filesystem, sorted by path
+  iso_file *files;
+  unsigned int number_files, files_allocated;
+} iso_fs;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Allocate an empty iso_fs struct
+ *
+ * @return *iso_fs
+ *   A pointer to the new struct or NULL if it could not be allocated
+ */
+iso_fs *alloc_iso_fs();
+
+/**
+ * Free an iso_fs struct and all of its files.
+ * If fs is NULL, it will simply return without doing anything.
+ */
+void free_iso_fs(iso_fs *fs);
+
+
+/**
+ * Read the ISO9660 filesystem on a data track without ripping it.
+ *
+ * The volume descriptors are read from sector 16 of the track. If there is a Joliet supplementary
+ * descriptor its names are used, otherwise the primary descriptor's are. The directories are found
+ * through the path table and then only those directories are read to find the files in them.
+ *
+ * @param nerorip_context *ctx
+ *   The context to report progress to
+ * @param sector_cache *cache
+ *   A sector cache for the image the track is in
+ * @param nrg_track *track
+ *   The data track to look at
+ * @param iso_fs *fs
+ *   The already allocated iso_fs to fill
+ * @return int
+ *   0 on success
+ *   ISO_NOT_ISO if the track is audio or has no ISO9660 volume descriptors
+ *   ISO_NON_ALLOC if fs was not allocated or memory ran out
+ *   ISO_CORRUPT if the path table or a directory doesn't make sense
+ *   ISO_READ_ERR if a sector could not be read
+ */
+int iso_parse(nerorip_context *ctx, sector_cache *cache, nrg_track *track, iso_fs *fs);
+
+
+/**
+ * Print every file and directory in a filesystem.
+ *
+ * @param nerorip_context *ctx
+ *   The context to print with
+ * @param int verbosity
+ *   The verbosity level to print at
+ * @param iso_fs *fs
+ *   The filesystem, already filled in by iso_parse()
+ */
+void iso_print(nerorip_context *ctx, int verbosity, iso_fs *fs);
+
+
+/**
+ * Find a file or directory by its path.
+ * The leading '/' is optional. If no name matches exactly, a name differing only in case is accepted
+ * since plain ISO9660 names are all upper case.
+ *
+ * @param iso_fs *fs
+ *   The filesystem to look in
+ * @param const char *path
+ *   The path to look for
+ * @return *iso_file
+ *   The file or NULL if there is nothing at that path
+ */
+iso_file *iso_find(iso_fs *fs, const char *path);
+
+
+/**
+ * Copy a file out of the filesystem.
+ * Only the sectors of the file are read and each one has its header stripped as it is copied.
+ *
+ * @param nerorip_context *ctx
+ *   The context to report errors to
+ * @param iso_fs *fs
+ *   The filesystem the file is in
+ * @param iso_file *file
+ *   The file to copy. It can't be a directory
+ * @param FILE *output
+ *   Where the file data is written
+ * @return int
+ *   0 on success
+ *   ISO_READ_ERR if a sector of the file could not be read
+ *   ISO_WRITE_ERR if the output could not be written
+ *   ISO_NON_ALLOC if the copy buffer could not be allocated
+ */
+int iso_extract(nerorip_context *ctx, iso_fs *fs, iso_file *file, FILE *output);
+
+#endif
@@ -0,0 +1,565 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * kernbench
+ *
+ * Times the hot kernels of libnerorip on their own, over a buffer that fits in the L1/L2 cache and one
+ * that has to come from DRAM, and reports cycles/byte and GB/s for each implementation.
+ * Where the library only has one implementation of a kernel, a plain reference version is timed next
+ * to it so there's something to compare against. Used by make microbench.
+ *
+ * Cycles are counted with the time stamp counter, which ticks at a fixed rate that isn't necessarily
+ * the rate the core runs at when it turbos. On machines without one only GB/s is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <unistd.h>
+#include <time.h>
+#include "nerorip.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc()
+#define HAVE_TSC
+#endif
+
+// Size of the buffer that stays in the cache and of the one that doesn't
+#define BENCH_CACHE_SIZE (32 * 1024)
+#define BENCH_DRAM_SIZE (64 * 1024 * 1024)
+// Each timing pass takes at least this many seconds and the fastest of BENCH_PASSES passes is reported
+#define BENCH_PASS_TIME 0.05
+#define BENCH_PASSES 5
+
+
+/**
+ * Kernel benchmark struct
+ *
+ * One implementation of a kernel and what it needs to run.
+ */
+typedef struct bench_kernel {
+  // Name of the kernel and of this implementation of it
+  const char *kernel;
+  const char *variant;
+  // Runs the kernel over length bytes of in, writing to out if it writes anything
+  void (*run)(struct bench_kernel *k, uint8_t *in, uint8_t *out, size_t length);
+  // Skipped if this returns 0, for implementations the CPU can't run
+  int (*supported)();
+  // Layout for the conversion kernels and implementation for the swap kernels
+  rip_layout layout;
+  void (*swap)(uint8_t *, unsigned int);
+} bench_kernel;
+
+// Keeps the compiler from throwing away results that are never used
+static volatile uint64_t bench_sink;
+
+
+static uint64_t bench_cycles() {
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static double bench_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/*
+ * swap_buffer
+ */
+static void run_swap(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) out;
+  k->swap(in, length & ~(size_t) 1);
+}
+#ifdef HAVE_X86_SWAP
+static int has_sse2()  { __builtin_cpu_init(); return __builtin_cpu_supports("sse2"); }
+static int has_ssse3() { __builtin_cpu_init(); return __builtin_cpu_supports("ssse3"); }
+static int has_avx2()  { __builtin_cpu_init(); return __builtin_cpu_supports("avx2"); }
+#endif
+
+
+/*
+ * Header stripping, done RIP_BATCH_SECTORS at a time like rip_track() does
+ */
+static void run_convert(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  const unsigned int sector_size = k->layout.sector_size;
+  if (!k->layout.gather)
+    rip_select_kernels(&k->layout);
+  size_t sectors = length / sector_size;
+  while (sectors > 0) {
+    unsigned int count = (sectors > RIP_BATCH_SECTORS) ? RIP_BATCH_SECTORS : sectors;
+    out += rip_convert_batch(&k->layout, in, count, count, out);
+    in += (size_t) count * sector_size;
+    sectors -= count;
+  }
+}
+
+// The reference copies every sector with sizes only known at run time, checking the form of each one for xa layouts
+static void run_convert_generic(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  static const uint8_t mac_header[8] = {0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00};
+  rip_layout *l = &k->layout;
+  size_t i, sectors = length / l->sector_size;
+  for (i = 0; i < sectors; i++) {
+    const uint8_t *sector = in + i * l->sector_size;
+    unsigned int write_length = l->write_length;
+    if (l->xa && (sector[l->header_length - 6] & 0x20))
+      write_length = RIP_FORM2_LENGTH;
+    if (l->mac) {
+      memcpy(out, mac_header, sizeof(mac_header));
+      out += sizeof(mac_header);
+    }
+    memcpy(out, sector + l->header_length, write_length);
+    if (l->swap)
+      swap_buffer_scalar(out, write_length);
+    out += write_length;
+  }
+}
+
+
+/*
+ * P-W subchannel deinterleaving, done on the 96 bytes after each 2448 byte sector like rip_track() does
+ */
+static void run_sub_scalar(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  sub_deinterleave_scalar(out, in + 2352, length / 2448, 2448);
+}
+#ifdef HAVE_X86_SUB
+static void run_sub_sse2(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  sub_deinterleave_sse2(out, in + 2352, length / 2448, 2448);
+}
+
+static void run_sub_avx2(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  sub_deinterleave_avx2(out, in + 2352, length / 2448, 2448);
+}
+#endif
+
+// The reference moves one bit at a time
+static void run_sub_generic(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  size_t i, sectors = length / 2448;
+  unsigned int b, c;
+  for (i = 0; i < sectors; i++, out += SUB_LENGTH) {
+    const uint8_t *sub = in + i * 2448 + 2352;
+    memset(out, 0, SUB_LENGTH);
+    for (b = 0; b < SUB_LENGTH; b++)
+      for (c = 0; c < 8; c++)
+        out[c * SUB_CHANNEL_LENGTH + b / 8] |= ((sub[b] >> (7 - c)) & 1) << (7 - b % 8);
+  }
+}
+
+
+/*
+ * Trailing sector zero scan. The buffer is all zeros so every byte has to be looked at
+ */
+static void run_zero_scan(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) out;
+  const unsigned int sector_size = k->layout.sector_size;
+  size_t sectors = length / sector_size;
+  uint64_t found = 0;
+  while (sectors > 0) {
+    unsigned int count = (sectors > RIP_BATCH_SECTORS) ? RIP_BATCH_SECTORS : sectors;
+    found += rip_trimmed_has_data(&k->layout, in, 0, count);
+    in += (size_t) count * sector_size;
+    sectors -= count;
+  }
+  bench_sink += found;
+}
+
+// The reference ORs the payload together 8 bytes at a time
+static void run_zero_scan_word(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) out;
+  rip_layout *l = &k->layout;
+  size_t i, sectors = length / l->sector_size;
+  uint64_t found = 0;
+  for (i = 0; i < sectors; i++) {
+    const uint8_t *payload = in + i * l->sector_size + l->header_length;
+    uint64_t any = 0, word;
+    unsigned int d;
+    for (d = 0; d + 8 <= l->write_length; d += 8) {
+      memcpy(&word, payload + d, 8);
+      any |= word;
+    }
+    found += (any != 0);
+  }
+  bench_sink += found;
+}
+
+
+/*
+ * Big endian decoding like the chunk parser does
+ */
+static void run_fread32u(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  FILE *f = fmemopen(in, length, "rb");
+  if (!f)
+    return;
+  size_t i;
+  uint32_t sum = 0;
+  for (i = 0; i + 4 <= length; i += 4)
+    sum += fread32u(f);
+  fclose(f);
+  bench_sink += sum;
+}
+
+// The reference decodes straight out of memory
+static void run_decode_memory(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  size_t i;
+  uint32_t sum = 0, value;
+  for (i = 0; i + 4 <= length; i += 4) {
+    memcpy(&value, in + i, 4);
+    sum += bswap_32(value);
+  }
+  bench_sink += sum;
+}
+
+
+/*
+ * Audio header writers. These are timed per header written, the "bytes" are the header bytes
+ */
+static void run_wav_header(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) in;
+  FILE *f = fmemopen(out, 64, "wb");
+  size_t i;
+  for (i = 0; i + 44 <= length; i += 44) {
+    rewind(f);
+    fwrite_wav_header(f, i);
+  }
+  fclose(f);
+}
+
+static void run_aiff_header(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) in;
+  FILE *f = fmemopen(out, 64, "wb");
+  size_t i;
+  for (i = 0; i + 54 <= length; i += 54) {
+    rewind(f);
+    fwrite_aiff_header(f, i);
+  }
+  fclose(f);
+}
+
+
+/*
+ * Hashes
+ */
+static void run_crc32_scalar(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  bench_sink += crc32_scalar(0, in, length);
+}
+
+static void run_md5(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  md5_context ctx;
+  md5_init(&ctx);
+  md5_update(&ctx, in, length);
+  bench_sink += ctx.state[0];
+}
+
+static void run_sha1_scalar(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+  sha1_blocks_scalar(state, in, length / 64);
+  bench_sink += state[0];
+}
+#ifdef HAVE_X86_HASH
+static void run_crc32_pclmul(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  bench_sink += crc32_pclmul(0, in, length);
+}
+
+static void run_sha1_shani(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+  sha1_blocks_shani(state, in, length / 64);
+  bench_sink += state[0];
+}
+
+static int has_pclmul() { __builtin_cpu_init(); return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"); }
+static int has_sha()    { __builtin_cpu_init(); return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"); }
+#endif
+
+
+/*
+ * EDC and ECC, done on each 2352 byte sector like --verify does
+ */
+static void run_edc_scalar(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  bench_sink += edc_compute_scalar(0, in, length);
+}
+#ifdef HAVE_X86_EDC
+static void run_edc_pclmul(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) out;
+  bench_sink += edc_compute_pclmul(0, in, length);
+}
+#endif
+
+static void run_ecc(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  size_t i;
+  for (i = 0; i + 2352 <= length; i += 2352) {
+    ecc_compute_p(in + i + 12, out + i);
+    ecc_compute_q(in + i + 12, out + i + 172);
+  }
+}
+
+// The usual byte at a time ECC: one codeword at a time, looking each byte up in the sector
+static uint8_t ecc_f_lut[256], ecc_b_lut[256];
+static void ecc_generic_block(const uint8_t *src, unsigned int major_count, unsigned int minor_count,
+                              unsigned int major_mult, unsigned int minor_inc, uint8_t *dest) {
+  const unsigned int size = major_count * minor_count;
+  unsigned int major, minor;
+  for (major = 0; major < major_count; major++) {
+    unsigned int index = (major >> 1) * major_mult + (major & 1);
+    uint8_t a = 0, b = 0;
+    for (minor = 0; minor < minor_count; minor++) {
+      const uint8_t t = src[index];
+      index += minor_inc;
+      if (index >= size)
+        index -= size;
+      a = ecc_f_lut[a ^ t];
+      b ^= t;
+    }
+    a = ecc_b_lut[ecc_f_lut[a] ^ b];
+    dest[major] = a;
+    dest[major + major_count] = a ^ b;
+  }
+}
+
+static void run_ecc_generic(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k;
+  unsigned int n;
+  for (n = 0; n < 256; n++) {
+    ecc_f_lut[n] = (n << 1) ^ ((n & 0x80) ? 0x1d : 0);
+    ecc_b_lut[n ^ ecc_f_lut[n]] = n;
+  }
+  size_t i;
+  for (i = 0; i + 2352 <= length; i += 2352) {
+    ecc_generic_block(in + i + 12, 86, 24, 2, 86, out + i);
+    ecc_generic_block(in + i + 12, 52, 43, 86, 88, out + i + 172);
+  }
+}
+
+// Zeros would fail on the sync pattern straight away, so good Mode1 sectors are made in out first
+static void run_edc_check(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length) {
+  (void) k; (void) in;
+  static size_t prepared = 0;
+  static const uint8_t sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+  size_t i;
+  if (prepared != length) {
+    for (i = 0; i + 2352 <= length; i += 2352) {
+      memset(out + i, (uint8_t) (i / 2352), 2352);
+      memcpy(out + i, sync, 12);
+      out[i + 15] = 1;
+      edc_generate_sector(out + i, 2352);
+    }
+    prepared = length;
+  }
+  for (i = 0; i + 2352 <= length; i += 2352)
+    bench_sink += edc_check_sector(out + i, 2352);
+}
+
+// Shorthand for the layouts,
+// {sector_size, header_length, write_length, subchannel_length, mac, swap, xa, passthrough, trimmed_track_length,
+//  gather, gather_form2, kernel}, with the kernels picked by run_convert()
+#define LAYOUT(size, header, write, mac, swap) {size, header, write, 0, mac, swap, 0, 0, 0, NULL, NULL, NULL}
+#define LAYOUT_XA(size, header) {size, header, 2048, 0, 0, 0, 1, 0, 0, NULL, NULL, NULL}
+#define LAYOUT_SUB(size, header, write) {size, header, write, size - 2352, 0, 0, 0, 0, 0, NULL, NULL, NULL}
+
+static bench_kernel kernels[] = {
+  {"swap_buffer", "scalar", run_swap, NULL, LAYOUT(0, 0, 0, 0, 0), swap_buffer_scalar},
+#ifdef HAVE_X86_SWAP
+  {"swap_buffer", "sse2",   run_swap, has_sse2,  LAYOUT(0, 0, 0, 0, 0), swap_buffer_sse2},
+  {"swap_buffer", "ssse3",  run_swap, has_ssse3, LAYOUT(0, 0, 0, 0, 0), swap_buffer_ssse3},
+  {"swap_buffer", "avx2",   run_swap, has_avx2,  LAYOUT(0, 0, 0, 0, 0), swap_buffer_avx2},
+#endif
+
+  {"strip mode2/2352",     "library", run_convert,         NULL, LAYOUT(2352, 24, 2048, 0, 0), NULL},
+  {"strip mode2/2352",     "generic", run_convert_generic, NULL, LAYOUT(2352, 24, 2048, 0, 0), NULL},
+  {"strip mode1/2352",     "library", run_convert,         NULL, LAYOUT(2352, 16, 2048, 0, 0), NULL},
+  {"strip mode1/2352",     "generic", run_convert_generic, NULL, LAYOUT(2352, 16, 2048, 0, 0), NULL},
+  {"strip mode2/2336",     "library", run_convert,         NULL, LAYOUT(2336, 8, 2048, 0, 0), NULL},
+  {"strip mode2/2336",     "generic", run_convert_generic, NULL, LAYOUT(2336, 8, 2048, 0, 0), NULL},
+  {"strip mode2/2352 xa",  "library", run_convert,         NULL, LAYOUT_XA(2352, 24),          NULL},
+  {"strip mode2/2352 xa",  "generic", run_convert_generic, NULL, LAYOUT_XA(2352, 24),          NULL},
+  {"strip mode2/2352 mac", "library", run_convert,         NULL, LAYOUT(2352, 24, 2048, 1, 0), NULL},
+  {"strip mode2/2352 mac", "generic", run_convert_generic, NULL, LAYOUT(2352, 24, 2048, 1, 0), NULL},
+  {"strip mode1/2048 mac", "library", run_convert,         NULL, LAYOUT(2048, 0, 2048, 1, 0), NULL},
+  {"strip mode1/2048 mac", "generic", run_convert_generic, NULL, LAYOUT(2048, 0, 2048, 1, 0), NULL},
+  {"audio/2352 swap",      "library", run_convert,         NULL, LAYOUT(2352, 0, 2352, 0, 1), NULL},
+  {"audio/2352 swap",      "generic", run_convert_generic, NULL, LAYOUT(2352, 0, 2352, 0, 1), NULL},
+  {"strip mode2/2448",     "library", run_convert,         NULL, LAYOUT_SUB(2448, 24, 2048),   NULL},
+  {"strip mode2/2448",     "generic", run_convert_generic, NULL, LAYOUT_SUB(2448, 24, 2048),   NULL},
+  {"strip mode1/2448",     "library", run_convert,         NULL, LAYOUT_SUB(2448, 16, 2048),   NULL},
+  {"strip mode1/2448",     "generic", run_convert_generic, NULL, LAYOUT_SUB(2448, 16, 2048),   NULL},
+  {"strip audio/2448",     "library", run_convert,         NULL, LAYOUT_SUB(2448, 0, 2352),    NULL},
+  {"strip audio/2448",     "generic", run_convert_generic, NULL, LAYOUT_SUB(2448, 0, 2352),    NULL},
+
+  {"subchannel 2448", "scalar",  run_sub_scalar, NULL,     LAYOUT(0, 0, 0, 0, 0), NULL},
+#ifdef HAVE_X86_SUB
+  {"subchannel 2448", "sse2",    run_sub_sse2,   has_sse2, LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"subchannel 2448", "avx2",    run_sub_avx2,   has_avx2, LAYOUT(0, 0, 0, 0, 0), NULL},
+#endif
+  {"subchannel 2448", "generic", run_sub_generic, NULL,    LAYOUT(0, 0, 0, 0, 0), NULL},
+
+  {"zero scan mode2/2352", "library", run_zero_scan,      NULL, LAYOUT(2352, 24, 2048, 0, 0), NULL},
+  {"zero scan mode2/2352", "word",    run_zero_scan_word, NULL, LAYOUT(2352, 24, 2048, 0, 0), NULL},
+  {"zero scan audio/2352", "library", run_zero_scan,      NULL, LAYOUT(2352, 0, 2352, 0, 0), NULL},
+  {"zero scan audio/2352", "word",    run_zero_scan_word, NULL, LAYOUT(2352, 0, 2352, 0, 0), NULL},
+
+  {"decode 32 bit BE", "fread32u", run_fread32u,      NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"decode 32 bit BE", "memory",   run_decode_memory, NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+
+  {"wav header",  "library", run_wav_header,  NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"aiff header", "library", run_aiff_header, NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+
+  {"crc32", "scalar",  run_crc32_scalar, NULL,       LAYOUT(0, 0, 0, 0, 0), NULL},
+#ifdef HAVE_X86_HASH
+  {"crc32", "pclmul",  run_crc32_pclmul, has_pclmul, LAYOUT(0, 0, 0, 0, 0), NULL},
+#endif
+  {"md5",   "library", run_md5,          NULL,       LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"sha1",  "scalar",  run_sha1_scalar,  NULL,       LAYOUT(0, 0, 0, 0, 0), NULL},
+#ifdef HAVE_X86_HASH
+  {"sha1",  "sha",     run_sha1_shani,   has_sha,    LAYOUT(0, 0, 0, 0, 0), NULL},
+#endif
+
+  {"edc", "scalar",  run_edc_scalar, NULL,       LAYOUT(0, 0, 0, 0, 0), NULL},
+#ifdef HAVE_X86_EDC
+  {"edc", "pclmul",  run_edc_pclmul, has_pclmul, LAYOUT(0, 0, 0, 0, 0), NULL},
+#endif
+  {"ecc", "library", run_ecc,         NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"ecc", "generic", run_ecc_generic, NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+  {"verify mode1/2352", "library", run_edc_check, NULL, LAYOUT(0, 0, 0, 0, 0), NULL},
+};
+
+
+// Times one kernel over a buffer of length bytes and prints the result
+static void bench(bench_kernel *k, uint8_t *in, uint8_t *out, size_t length, const char *size_name) {
+  double best_time = 0;
+  uint64_t best_cycles = 0;
+
+  // Once to warm up and see how many runs a pass needs, then the passes
+  double start = bench_now();
+  k->run(k, in, out, length);
+  double once = bench_now() - start;
+  size_t runs = (once < BENCH_PASS_TIME) ? BENCH_PASS_TIME / (once + 1e-9) + 1 : 1;
+  int p;
+  for (p = 0; p < BENCH_PASSES; p++) {
+    double start = bench_now();
+    uint64_t start_cycles = bench_cycles();
+    size_t r;
+    for (r = 0; r < runs; r++)
+      k->run(k, in, out, length);
+    uint64_t cycles = bench_cycles() - start_cycles;
+    double time = bench_now() - start;
+
+    if (p == 0 || time < best_time) {
+      best_time = time;
+      best_cycles = cycles;
+    }
+  }
+
+  double bytes = (double) runs * length;
+  printf("%-22s %-9s %6s", k->kernel, k->variant, size_name);
+#ifdef HAVE_TSC
+  printf(" %10.3f", best_cycles / bytes);
+#else
+  (void) best_cycles;
+  printf(" %10s", "n/a");
+#endif
+  printf(" %9.2f\n", bytes / best_time / 1e9);
+  fflush(stdout);
+}
+
+
+void usage(char *argv0) {
+  printf("Usage: %s [OPTIONS]... [KERNEL]...\n", argv0);
+  printf("Times the kernels whose names contain any of the KERNEL strings, or all of them.\n\n");
+  printf("  -c SIZE\tSize in KB of the buffer that fits in the cache (default %d)\n", BENCH_CACHE_SIZE / 1024);
+  printf("  -d SIZE\tSize in MB of the buffer that doesn't (default %d)\n", BENCH_DRAM_SIZE / (1024 * 1024));
+  printf("  -l\t\tList the kernels and exit\n");
+  printf("  -h\t\tDisplay this help message and exit\n");
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+  size_t cache_size = BENCH_CACHE_SIZE;
+  size_t dram_size = BENCH_DRAM_SIZE;
+  const unsigned int number_kernels = sizeof(kernels) / sizeof(kernels[0]);
+  unsigned int i;
+
+  int c;
+  while ((c = getopt(argc, argv, "c:d:lh")) != -1) {
+    switch (c) {
+      case 'c': cache_size = (size_t) atoi(optarg) * 1024; break;
+      case 'd': dram_size = (size_t) atoi(optarg) * 1024 * 1024; break;
+      case 'l':
+        for (i = 0; i < number_kernels; i++)
+          printf("%s (%s)\n", kernels[i].kernel, kernels[i].variant);
+        exit(EXIT_SUCCESS);
+      case 'h': usage(argv[0]); break;
+      default: exit(EXIT_FAILURE);
+    }
+  }
+  if (cache_size < 4096 || dram_size < cache_size)
+    usage(argv[0]);
+
+  // The output buffer needs room for the Mac headers on top of everything that's read
+  uint8_t *in = malloc(dram_size);
+  uint8_t *out = malloc(dram_size + dram_size / 2048 * 8 + 4096);
+  if (!in || !out) {
+    fprintf(stderr, "Failed to allocate memory for the buffers: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  // Zeros are the worst case for the zero scan and don't matter to anything else
+  memset(in, 0, dram_size);
+  memset(out, 0, dram_size + dram_size / 2048 * 8 + 4096);
+
+  char cache_name[32], dram_name[32];
+  snprintf(cache_name, sizeof(cache_name), "%zuK", cache_size / 1024);
+  snprintf(dram_name, sizeof(dram_name), "%zuM", dram_size / (1024 * 1024));
+
+  printf("%-22s %-9s %6s %10s %9s\n", "kernel", "variant", "buffer", "cycles/B", "GB/s");
+  for (i = 0; i < number_kernels; i++) {
+    bench_kernel *k = &kernels[i];
+
+    // Only the kernels asked for
+    int wanted = (optind == argc);
+    int a;
+    for (a = optind; a < argc && !wanted; a++)
+      wanted = (strstr(k->kernel, argv[a]) != NULL || strstr(k->variant, argv[a]) != NULL);
+    if (!wanted || (k->supported && !k->supported()))
+      continue;
+
+    bench(k, in, out, cache_size, cache_name);
+    bench(k, in, out, dram_size, dram_name);
+  }
+
+  free(in);
+  free(out);
+  return EXIT_SUCCESS;
+}
@@ -16,6 +16,7 @@
  *
  */
 
+#define _GNU_SOURCE // F_SETPIPE_SZ
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -23,70 +24,24 @@
 #include <stdint.h> // uintXX_t types
 #include <getopt.h> // getopt_long
 #include <ctype.h> // getopt_long
-#include "util.h"
-#include "nrg.h"
+#include <fcntl.h> // fcntl() for --progress-fd and --stdout
+#include <unistd.h> // isatty()
+#include <signal.h> // signal() for --exec
+#include "nerorip.h"
 
-#define AUD_WAV  0
-#define AUD_RAW  1
-#define AUD_CDA  2
-#define AUD_AIFF 3
-
-#define DAT_ISO 0
-#define DAT_BIN 1
-#define DAT_MAC 2
-
-#define TRIM_NONE  0
-#define TRIM_FIRST 1
-#define TRIM_ALL   2
-
-/**
- * Whether only information about the file should be printed
- * Should be 0 or 1 for false or true respectively
- */
-static int info_only = 0;
-
-/**
- * What format the data tracks should be saved as
- * Should be DAT_ISO, DAT_BIN, or DAT_MAC
- */
-static int data_output = DAT_ISO;
 
 // An array of strings describing the data output options
-static char data_output_str[3][26] = {"converted ISO/2048", "raw bin", "converted \"Mac\" ISO/2048"};
-// An array of strings with the extension for each of those output types
-static char data_output_ext[3][4] = {"iso", "bin", "iso"};
-
-/**
- * What format the audio tracks should be output as
- * Should be AUD_WAV, AUD_RAW, AUD_CDA, or AUD_AIFF
- */
-static int audio_output = AUD_WAV;
-
-/**
- * Whether or not audio tracks should be swapped
- * Should be 0 or 1 for false or true respectively
- */
-static int swap_audio_output = 0;
+static const char data_output_str[DAT_COUNT][29] = {"converted ISO/2048", "raw bin", "converted \"Mac\" ISO/2048",
+                                                    "MPEG (Form1/Form2 user data)"};
 
 // An array of strings to represent the audio output types
-static char audio_output_str[4][5] = {"wav", "raw", "cda", "aiff"};
-
-/**
- * Whether or not tracks should be trimmed
- * Should be TRIM_NONE or TRIM_FIRST or TRIM_ALL or TRIM_FIRST & TRIM_ALL
- */
-static int trim_tracks = TRIM_FIRST;
-
-/**
- * Whether or not pretrack data should be moved to the end of the previous track
- * Should be 0 or 1 for false or true respectively
- */
-static int move_pretrack = 0;
+static const char audio_output_str[AUD_COUNT][5] = {"wav", "raw", "cda", "aiff"};
 
 
 void usage(char *argv0) {
-  // Used letters: a b c h i f m p q r s t T v
+  // Used letters: a b c h i f j l m p q r s t T v x
   printf("Usage: %s [OPTIONS]... [INPUT FILE] [OUTPUT DIRECTORY]\n", argv0);
+  printf("  or:  %s --batch [OPTIONS]... [INPUT FILE]...\n", argv0);
   printf("Nerorip takes a nero image file (.nrt extension) as input\n");
   printf("and attempts to extract the track data as either ISO or audio data.\n\n");
   printf("  Audio track saving options:\n");
@@ -99,6 +54,8 @@ void usage(char *argv0) {
   printf("  Data track saving options:\n");
   printf("    -b, --bin\t\tExport data directly out of image file\n");
   printf("    -m, --mac\t\tConvert data to \"Mac\" ISO/2056 format\n");
+  printf("    -g, --mpg\t\tKeep all the user data of each Mode2 sector according to its form: 2048 bytes of Form1\n");
+  printf("             \t\tand 2324 bytes of Form2, which writes the MPEG tracks of VCDs and SVCDs out as .mpg files\n");
   printf("  If omitted, Data tracks will be converted to ISO/2048 format\n\n");
 
   printf("  Data track trimming options:\n");
@@ -109,11 +66,36 @@ void usage(char *argv0) {
   printf("  --trim and --trimall can be combined, resulting in 4 sectors being trimmed from the first track\n");
   printf("  If omitted, only the first track will have 2 sectors trimmed. See readme for more information\n\n");
 
+  printf("  Filesystem options:\n");
+  printf("    -l, --list\t\tList the files in the ISO9660/Joliet filesystem of each data track, do not rip\n");
+  printf("    -x, --extract=PATH\tOnly extract the file at PATH from the filesystem into the output directory\n");
+  printf("  --extract can be given more than once. Files are taken from the last session that has them\n\n");
+
   printf("  General options:\n");
   printf("  -i, --info\t\tOnly disply information about the image file, do not rip\n");
   printf("  -v, --verbose\t\tIncrement program verbosity by one tick\n");
   printf("  -q, --quiet\t\tDecrement program verbosity by one tick\n");
   printf("             \t\tVerbosity starts at 1, a verbosity of 0 will print nothing.\n");
+  printf("  -j, --jobs=N\t\tRip up to N tracks at the same time\n");
+  printf("      --stdio\t\tRead the image file through stdio instead of memory mapping it\n");
+  printf("      --async\t\tOverlap reading, converting and writing each track (uses io_uring if available)\n");
+  printf("      --progress-fd=FD\tAlso write the progress to file descriptor FD as JSON lines\n");
+  printf("      --progress-rate=N\tUpdate the progress at most N times a second (default %d, 0 only when tracks finish)\n", PROGRESS_RATE);
+  printf("      --track=N\t\tOnly rip track N\n");
+  printf("      --stdout\t\tWrite the track picked with --track to stdout instead of a file, messages go to stderr\n");
+  printf("      --exec=COMMAND\tPipe each audio track into its own COMMAND instead of a file, up to --jobs at once.\n");
+  printf("             \t\t{track}, {fmt}, {file} and {name} are replaced by the track number, extension, file name\n");
+  printf("             \t\tand file name without directory or extension, e.g. --exec='flac -o {name}.flac -'\n");
+  printf("      --hash\t\tHash each track (CRC32, MD5 and SHA-1) as it is ripped, both as it is in the image and as\n");
+  printf("             \t\tit was written, into %s in the output directory\n", NERORIP_HASH_FILE);
+  printf("      --verify\t\tCheck the EDC and ECC of every sector of the data tracks as they are ripped and warn about bad ones\n");
+  printf("      --stats[=json]\tPrint the time, CPU time, I/O and memory used by parsing and by each track at the end\n");
+  printf("      --memory=MB\tUse at most MB megabytes for track buffers, shared by all jobs (default %d)\n", RIP_BUFFER_BUDGET / (1024 * 1024));
+  printf("\n  Batch options:\n");
+  printf("      --batch\t\tRip every input file, each into a directory named after it in the current directory\n");
+  printf("      --manifest=FILE\tAlso rip the images listed in FILE (- for stdin), one per line as IMAGE[<tab>OUTPUT DIRECTORY]\n");
+  printf("      --device-jobs=N\tRead at most N tracks from the same disk at once (default 1 for spinning disks, otherwise --jobs)\n");
+  printf("  All the images share the --jobs workers. A summary line is printed as each image finishes\n\n");
   printf("  -h, --help\t\tDisplay this help message and exit\n");
   printf("      --version\t\tOutput version information and exit.\n\n");
   printf("If output directory is omitted, image data is put in the same directory as the input file.\n\n");
@@ -142,7 +124,218 @@ void version(char *argv0) {
   exit(EXIT_SUCCESS);
 }
 
+// Lists the files in the filesystems on the data tracks and extracts the ones asked for.
+// Returns 0 if every file asked for was extracted
+static int browse_filesystems(nerorip_context *ctx, image_source *source, nrg_image *image, char *output_dir, int list_files, char **extract_paths, int number_extract) {
+  sector_cache *cache = alloc_sector_cache(source, image, 0);
+  iso_fs **filesystems = calloc(image->number_tracks + 1, sizeof(iso_fs *));
+  if (!cache || !filesystems) {
+    free_sector_cache(cache);
+    free(filesystems);
+    return -1;
+  }
+
+  // Read the filesystem on every data track that has one
+  int r = 0;
+  unsigned int i;
+  int found = 0;
+  for (i = 0; i < image->number_tracks; i++) {
+    iso_fs *fs = alloc_iso_fs();
+    if (!fs) {
+      r = -1;
+      break;
+    }
+    if (iso_parse(ctx, cache, &image->tracks[i], fs) != 0) {
+      free_iso_fs(fs);
+      continue;
+    }
+    filesystems[i] = fs;
+    found = 1;
+    if (list_files)
+      iso_print(ctx, 1, fs);
+  }
+  if (!found) {
+    fprintf(stderr, "Error: No ISO9660 filesystem found on any data track\n");
+    r = -1;
+  }
+
+  // Files are taken from the last session that has them since that's what a drive would show
+  int e;
+  for (e = 0; found && e < number_extract; e++) {
+    iso_file *file = NULL;
+    iso_fs *fs = NULL;
+    for (i = image->number_tracks; i > 0 && !file; i--)
+      if ((fs = filesystems[i - 1]))
+        file = iso_find(fs, extract_paths[e]);
+
+    if (!file) {
+      fprintf(stderr, "Error: %s was not found in the image\n", extract_paths[e]);
+      r = -1;
+      continue;
+    }
+    if (file->directory) {
+      fprintf(stderr, "Error: %s is a directory\n", extract_paths[e]);
+      r = -1;
+      continue;
+    }
+
+    // The file goes straight into the output directory
+    char filename[FILENAME_MAX];
+    const char *name = strrchr(file->path, '/') + 1;
+    snprintf(filename, sizeof(filename), "%s/%s", output_dir, name);
+    ver_printf(ctx, 1, "Extracting %s from track %u to %s\n", file->path, fs->track->number, filename);
+
+    FILE *output = fopen(filename, "wb");
+    if (!output) {
+      fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+      r = -1;
+      continue;
+    }
+    if (iso_extract(ctx, fs, file, output) != 0)
+      r = -1;
+    if (fclose(output) != 0) {
+      fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+      r = -1;
+    }
+  }
+
+  for (i = 0; i < image->number_tracks; i++)
+    free_iso_fs(filesystems[i]);
+  free(filesystems);
+  free_sector_cache(cache);
+  return r;
+}
+
+// Adds an image to the batch list, growing it as needed. Without an output directory, it goes in
+// one named after the image file, without its extension, in the current directory. If an image before it
+// already has that name, like a/disc.nrg and b/disc.nrg, the CRC32 of its whole path is added to the name.
+// Returns 0 on success
+static int add_batch_image(batch_image **images, unsigned int *number_images, char ***strings, const char *input, const char *output_dir) {
+  batch_image *i = realloc(*images, sizeof(batch_image) * (*number_images + 1));
+  char **s = realloc(*strings, sizeof(char *) * (2 * *number_images + 2));
+  if (i)
+    *images = i;
+  if (s)
+    *strings = s;
+  if (!i || !s)
+    return -1;
+
+  // Keep copies of the names, the manifest lines they came from get reused
+  char *in = strdup(input);
+  char *out = NULL;
+  if (in && output_dir)
+    out = strdup(output_dir);
+  else if (in) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    const char *cwd = getenv("PWD") ? getenv("PWD") : ".";
+    const char *dot = strrchr(name, '.');
+    int length = (dot && dot != name) ? dot - name : (int) strlen(name);
+    out = malloc(strlen(cwd) + length + 11);
+    if (out) {
+      sprintf(out, "%s/%.*s", cwd, length, name);
+      unsigned int j;
+      for (j = 0; j < *number_images && strcmp((*images)[j].output_dir, out) != 0; j++);
+      if (j < *number_images)
+        sprintf(out + strlen(out), "-%08x", crc32_update(0, (const uint8_t *) input, strlen(input)));
+    }
+  }
+  if (!in || !out) {
+    free(in);
+    free(out);
+    return -1;
+  }
+
+  (*strings)[2 * *number_images] = in;
+  (*strings)[2 * *number_images + 1] = out;
+  (*images)[*number_images].input = in;
+  (*images)[*number_images].output_dir = out;
+  (*number_images)++;
+  return 0;
+}
+
+// Rips all the images given on the command line and in the manifest. Returns the number that failed
+static int rip_batch(nerorip_context *ctx, char **inputs, int number_inputs, const char *manifest) {
+  batch_image *images = NULL;
+  unsigned int number_images = 0;
+  char **strings = NULL;
+  int r = -1, i;
+
+  for (i = 0; i < number_inputs; i++)
+    if (add_batch_image(&images, &number_images, &strings, inputs[i], NULL) != 0)
+      goto out;
+
+  // Each line of the manifest is an image, optionally followed by a tab and where it goes
+  if (manifest) {
+    FILE *f = (strcmp(manifest, "-") == 0) ? stdin : fopen(manifest, "r");
+    if (!f) {
+      fprintf(stderr, "Error opening %s: %s\n", manifest, strerror(errno));
+      goto out;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &size, f)) >= 0) {
+      while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        line[--length] = '\0';
+      if (length == 0 || line[0] == '#')
+        continue;
+      char *output_dir = strchr(line, '\t');
+      if (output_dir)
+        *output_dir++ = '\0';
+      if (add_batch_image(&images, &number_images, &strings, line, (output_dir && *output_dir) ? output_dir : NULL) != 0)
+        break;
+    }
+    free(line);
+    if (f != stdin)
+      fclose(f);
+  }
+
+  if (number_images == 0) {
+    fprintf(stderr, "Error: No input files provided\n");
+    goto out;
+  }
+
+  ver_printf(ctx, 1, "Ripping %u images:\n", number_images);
+  r = batch_rip(ctx, images, number_images);
+  if (r)
+    ver_printf(ctx, 1, "%d of %u images could not be ripped\n", r, number_images);
+
+out:
+  for (i = 0; i < (int) (2 * number_images); i++)
+    free(strings[i]);
+  free(strings);
+  free(images);
+  return r;
+}
+
 int main(int argc, char **argv) {
+  // Everything about how the image is ripped lives in here
+  nerorip_context *ctx = nerorip_new();
+  if (!ctx)
+    exit(EXIT_FAILURE);
+  rip_options *options = &ctx->options;
+
+  // Whether only information about the file should be printed
+  int info_only = 0;
+  // Whether or not pretrack data should be moved to the end of the previous track
+  int move_pretrack = 0;
+  // Whether the files in the data tracks should be listed and which files should be extracted
+  int list_files = 0;
+  char **extract_paths = calloc(argc, sizeof(char *));
+  int number_extract = 0;
+  if (!extract_paths)
+    exit(EXIT_FAILURE);
+  // Whether timings and I/O counts should be printed at the end and whether as JSON
+  int show_stats = 0;
+  int stats_json = 0;
+  // The only track to rip (0 for all of them) and whether it goes to stdout
+  unsigned int only_track = 0;
+  int to_stdout = 0;
+  // Whether every input file is an image to be ripped and where to read more of them from
+  int batch = 0;
+  char *manifest = NULL;
+
   // Configure the long getopt options
   static struct option long_options[] = {
     // Audio
@@ -153,15 +346,35 @@ int main(int argc, char **argv) {
     // Data
     {"bin",      no_argument, 0, 'b'},
     {"mac",      no_argument, 0, 'm'},
+    {"mpg",      no_argument, 0, 'g'},
     // Trim
     {"trim",      no_argument, 0, 't'},
     {"trimall",   no_argument, 0, 'T'},
     {"full",      no_argument, 0, 'f'},
     {"pregap",    no_argument, 0, 'p'},
+    // Filesystem
+    {"list",     no_argument, 0, 'l'},
+    {"extract",  required_argument, 0, 'x'},
     // General
     {"info",     no_argument, 0, 'i'},
     {"verbose",  no_argument, 0, 'v'},
     {"quiet",    no_argument, 0, 'q'},
+    {"jobs",     required_argument, 0, 'j'},
+    {"stdio",    no_argument, 0, 'S'},
+    {"async",    no_argument, 0, 'A'},
+    {"stats",    optional_argument, 0, 'Z'},
+    {"track",    required_argument, 0, 'N'},
+    {"stdout",   no_argument, 0, 'O'},
+    {"exec",     required_argument, 0, 'E'},
+    {"hash",     no_argument, 0, 'H'},
+    {"verify",   no_argument, 0, 'Y'},
+    {"memory",   required_argument, 0, 'G'},
+    // Batch
+    {"batch",       no_argument, 0, 'B'},
+    {"manifest",    required_argument, 0, 'M'},
+    {"device-jobs", required_argument, 0, 'D'},
+    {"progress-fd",   required_argument, 0, 'P'},
+    {"progress-rate", required_argument, 0, 'R'},
     {"help",     no_argument, 0, 'h'},
     {"version",  no_argument, 0, 'V'},
     {0, 0, 0, 0}
@@ -173,27 +386,27 @@ int main(int argc, char **argv) {
 
   // Loop through all the passed options
   int c;
-  while ((c = getopt_long (argc, argv, "rcasbmtTfpivqhV", long_options, NULL)) != -1) {
+  while ((c = getopt_long (argc, argv, "rcasbmgtTfplx:ij:vqhV", long_options, NULL)) != -1) {
     switch (c) {
       /*
        * Audio track options
        */
 
       // Raw
-      case 'r': audio_output = AUD_RAW; break;
+      case 'r': options->audio_output = AUD_RAW; break;
       // Cda
       case 'c':
-        audio_output = AUD_CDA;
-        swap_audio_output = !swap_audio_output;
+        options->audio_output = AUD_CDA;
+        options->swap_audio_output = !options->swap_audio_output;
         break;
       // Aiff
       case 'a':
-        audio_output = AUD_AIFF;
-        swap_audio_output = !swap_audio_output;
+        options->audio_output = AUD_AIFF;
+        options->swap_audio_output = !options->swap_audio_output;
         break;
       // Swap
       case 's':
-        swap_audio_output = !swap_audio_output;
+        options->swap_audio_output = !options->swap_audio_output;
         break;
 
       /*
@@ -201,9 +414,11 @@ int main(int argc, char **argv) {
        */
 
       // Bin
-      case 'b': data_output = DAT_BIN; break;
+      case 'b': options->data_output = DAT_BIN; break;
       // Mac
-      case 'm': data_output = DAT_MAC; break;
+      case 'm': options->data_output = DAT_MAC; break;
+      // MPEG
+      case 'g': options->data_output = DAT_MPG; break;
 
       /*
        * Track trimming options
@@ -229,16 +444,102 @@ int main(int argc, char **argv) {
       case 'p': move_pretrack = 1; break;
 
 
+      /*
+       * Filesystem options
+       */
+
+      // List
+      case 'l': list_files = 1; break;
+      // Extract
+      case 'x': extract_paths[number_extract++] = optarg; break;
+
       /*
        * General options
        */
 
       // Verbose
-      case 'v': inc_verbosity(); break;
+      case 'v': ctx->verbosity++; break;
       // Quiet
-      case 'q': dec_verbosity(); break;
+      case 'q': ctx->verbosity--; break;
       // Info
       case 'i': info_only = 1; break;
+      // Jobs
+      case 'j':
+        if (atoi(optarg) < 1) {
+          fprintf(stderr, "Error: --jobs needs a number of tracks greater than 0\n\n");
+          usage(argv[0]);
+        }
+        ctx->jobs = atoi(optarg);
+        break;
+      // Stdio
+      case 'S': ctx->use_mmap = 0; break;
+      case 'A': options->async = 1; break;
+      // Progress
+      case 'P':
+        if (atoi(optarg) < 0 || fcntl(atoi(optarg), F_GETFD) == -1) {
+          fprintf(stderr, "Error: --progress-fd needs an open file descriptor\n\n");
+          usage(argv[0]);
+        }
+        ctx->progress_fd = atoi(optarg);
+        break;
+      case 'R':
+        if (atoi(optarg) < 0) {
+          fprintf(stderr, "Error: --progress-rate needs a number of updates per second\n\n");
+          usage(argv[0]);
+        }
+        ctx->progress_rate = atoi(optarg);
+        break;
+      // Track
+      case 'N':
+        if (atoi(optarg) < 1) {
+          fprintf(stderr, "Error: --track needs a track number greater than 0\n\n");
+          usage(argv[0]);
+        }
+        only_track = atoi(optarg);
+        break;
+      // Stdout
+      case 'O': to_stdout = 1; break;
+      // Exec
+      case 'E': ctx->exec = optarg; break;
+      // Hash
+      case 'H': ctx->hash = 1; break;
+      // Verify
+      case 'Y': ctx->verify = 1; break;
+      // Memory
+      case 'G':
+        if (atoi(optarg) < 1) {
+          fprintf(stderr, "Error: --memory needs a number of megabytes greater than 0\n\n");
+          usage(argv[0]);
+        }
+        ctx->buffer_budget = (size_t) atoi(optarg) * 1024 * 1024;
+        break;
+
+      /*
+       * Batch options
+       */
+
+      case 'B': batch = 1; break;
+      case 'M':
+        batch = 1;
+        manifest = optarg;
+        break;
+      case 'D':
+        if (atoi(optarg) < 1) {
+          fprintf(stderr, "Error: --device-jobs needs a number of tracks greater than 0\n\n");
+          usage(argv[0]);
+        }
+        ctx->device_jobs = atoi(optarg);
+        break;
+
+      // Stats
+      case 'Z':
+        if (optarg && strcmp(optarg, "json") != 0) {
+          fprintf(stderr, "Error: --stats only knows the json format\n\n");
+          usage(argv[0]);
+        }
+        show_stats = 1;
+        stats_json = (optarg != NULL);
+        break;
       // Help
       case 'h': usage(argv[0]); break;
       // Version
@@ -249,35 +550,71 @@ int main(int argc, char **argv) {
 
   // Reset the trim_tracks option now that all the options have been parsed
   if (use_new_trim_tracks)
-    trim_tracks = new_trim_tracks;
+    options->trim_tracks = new_trim_tracks;
+
+  // With the track data on stdout, everything else has to go to stderr
+  if (to_stdout) {
+    if (!only_track || batch || info_only || list_files || number_extract) {
+      fprintf(stderr, "Error: --stdout needs --track and can't be used with --batch, --info, --list or --extract\n\n");
+      usage(argv[0]);
+    }
+    if (isatty(STDOUT_FILENO)) {
+      fprintf(stderr, "Error: Not writing track data to a terminal, redirect stdout to a file or a pipe\n");
+      exit(EXIT_FAILURE);
+    }
+    ctx->log = stderr;
+#ifdef F_SETPIPE_SZ
+    // Fewer trips through the pipe for whatever is reading it. Not being allowed to is fine too
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, 1024 * 1024);
+#endif
+  }
 
   // Print simple welcome message
-  ver_printf(1, "neorip v%s\n", VERSION);
+  ver_printf(ctx, 1, "neorip v%s\n", VERSION);
 
   // Note any enabled options
 
   // Note if info_only is on. If it is, that's the only option to tell the user about.
   if (info_only)
-    ver_printf(1, "Will only print disc image information.\n");
+    ver_printf(ctx, 1, "Will only print disc image information.\n");
+  else if (list_files || number_extract)
+    ver_printf(ctx, 1, "Will only %s files in the data tracks.\n", (number_extract ? "extract" : "list"));
 
   else {
     // Audio track information
-    ver_printf(1, "Saving audio tracks as %s %s files\n", (swap_audio_output ? "swapped" : "non-swapped"), audio_output_str[audio_output]);
+    ver_printf(ctx, 1, "Saving audio tracks as %s %s files\n", (options->swap_audio_output ? "swapped" : "non-swapped"), audio_output_str[options->audio_output]);
 
     // Data track information
-    ver_printf(1, "Saving data tracks as %s files.\n", data_output_str[data_output]);
+    ver_printf(ctx, 1, "Saving data tracks as %s files.\n", data_output_str[options->data_output]);
 
     // Data trimming information
-    if (trim_tracks == TRIM_NONE)
-      ver_printf(1, "Not trimming any track data.\n");
+    if (options->trim_tracks == TRIM_NONE)
+      ver_printf(ctx, 1, "Not trimming any track data.\n");
     else {
-      int trim_first = (trim_tracks & TRIM_FIRST) ? 2 : 0;
-      int trim_all = (trim_tracks & TRIM_ALL) ? 2 : 0;
-      ver_printf(1, "Trimming %d sectors from first track and %d sectors from all other tracks\n", trim_first + trim_all, trim_all);
+      int trim_first = (options->trim_tracks & TRIM_FIRST) ? 2 : 0;
+      int trim_all = (options->trim_tracks & TRIM_ALL) ? 2 : 0;
+      ver_printf(ctx, 1, "Trimming %d sectors from first track and %d sectors from all other tracks\n", trim_first + trim_all, trim_all);
     }
 
-    // Moving pretrack
-//    if (move_pretrack) ver_printf(1, "Appending all tracks' pregap data to the end of the previous track\n");
+    // Moving pretrack (not implemented yet)
+    (void) move_pretrack;
+//    if (move_pretrack) ver_printf(ctx, 1, "Appending all tracks' pregap data to the end of the previous track\n");
+  }
+
+  // A command that gives up early shouldn't take the whole program down with it, its track just fails
+  if (ctx->exec)
+    signal(SIGPIPE, SIG_IGN);
+
+  // In batch mode, every input file is an image of its own
+  if (batch) {
+    if (info_only || list_files || number_extract || show_stats || only_track) {
+      fprintf(stderr, "Error: --batch only rips, it can't be used with --info, --list, --extract, --stats or --track\n\n");
+      usage(argv[0]);
+    }
+    int failed = rip_batch(ctx, argv + optind, argc - optind, manifest);
+    nerorip_free(ctx);
+    free(extract_paths);
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   // Now that all the getopt options have been parsed, that only leaves the input file and output directory.
@@ -288,10 +625,14 @@ int main(int argc, char **argv) {
     usage(argv[0]);
   }
 
+  // Start counting before the image is even opened
+  if (show_stats && !(ctx->stats = alloc_nerorip_stats()))
+    exit(EXIT_FAILURE);
+
   char *input_str = argv[optind];
-  ver_printf(2, "Opening file %s\n", input_str);
-  FILE *image_file = fopen(input_str, "rb");
-  if (image_file == NULL) {
+  ver_printf(ctx, 2, "Opening file %s\n", input_str);
+  image_source *source = src_open(ctx, input_str);
+  if (source == NULL) {
     fprintf(stderr, "Error opening %s: %s\n", input_str, strerror(errno));
     exit(EXIT_FAILURE);
   }
@@ -300,154 +641,75 @@ int main(int argc, char **argv) {
   char *output_dir = getenv("PWD");
   if (optind + 2 == argc)
     output_dir = argv[optind + 1];
-  if (!info_only)
-    ver_printf(2, "Outputing data to %s\n", output_dir);
-
-  ver_printf(3, "Allocating memory\n");
+  if (!info_only && !list_files)
+    ver_printf(ctx, 2, "Outputing data to %s\n", output_dir);
+
+  ver_printf(ctx, 3, "Using %s swap_buffer\n", swap_buffer_name());
+  if (ctx->hash)
+    ver_printf(ctx, 3, "Using %s CRC32\n", crc32_name());
+  if (ctx->verify)
+    ver_printf(ctx, 3, "Using %s EDC\n", edc_name());
+  ver_printf(ctx, 3, "Using %s subchannel deinterleaving\n", sub_deinterleave_name());
+  ver_printf(ctx, 3, "Allocating memory\n");
   nrg_image *image = alloc_nrg_image();
 
-  // Parse the image file
-  nrg_parse(image_file, image);
-  ver_printf(3, "\n");
+  // Parse the image file. Warnings are fine but anything worse means there is nothing sensible to rip.
+  int parse_result = nrg_parse(ctx, source, image);
+  ver_printf(ctx, 3, "\n");
+  if (parse_result != 0 && parse_result != NRG_WARN) {
+    fprintf(stderr, "Error: %s is not a usable nero image\n", input_str);
+    src_close(source);
+    free_nrg_image(image);
+    nerorip_free(ctx);
+    exit(EXIT_FAILURE);
+  }
 
   // Print the collected information
-  nrg_print(1, image);
+  nrg_print(ctx, 1, image);
+  int exit_status = EXIT_SUCCESS;
 
-  if (info_only)
+  if (only_track > image->number_tracks) {
+    fprintf(stderr, "Error: There is no track %u, the image has %u\n", only_track, image->number_tracks);
+    exit_status = EXIT_FAILURE;
     goto quit;
+  }
 
-  ver_printf(1, "Saving track data:\n");
-  // Try to extract that data
-  unsigned int track = 1;
-  nrg_session *s;
-  for(s = image->first_session; s != NULL; s=s->next) {
-    nrg_track *t;
-    for (t = s->first_track; t!=NULL; t=t->next) {
-
-      // Seek to the track lba
-      fseek(image_file, t->track_offset, SEEK_SET);
-
-      char filename[256];
-      sprintf(filename, "%s/%s%02d.%s", output_dir, (t->track_mode == AUDIO ? "taudio" : "tdata"), track, (t->track_mode == AUDIO ? audio_output_str[audio_output] : data_output_ext[data_output]));
-      ver_printf(1, "  %s: 00%%", filename);
-
-      // Open up a file to dump stuff into
-      FILE *tf = fopen(filename, "wb");
-
-      // Determine the number of sectors to write depending on the trimming options
-      unsigned trimmed_track_length = t->length;
-      // First track trimming
-      if (track == 1 && (trim_tracks & TRIM_FIRST))
-        trimmed_track_length -= 2 * t->sector_size;
-      if (trim_tracks & TRIM_ALL)
-        trimmed_track_length -= 2 * t->sector_size;
-
-
-      // Add the proper header if the track is AUDIO
-      if (t->track_mode == AUDIO) {
-        switch (audio_output) {
-          case AUD_WAV:
-            fwrite_wav_header(tf, trimmed_track_length);
-            break;
-          case AUD_AIFF:
-            fwrite_aiff_header(tf, trimmed_track_length / t->sector_size);
-            break;
-        }
-      }
-
-
-      // Write length bytes
-      unsigned int b;
-      for (b = 0; b < t->length; b += t->sector_size)
-      {
-        // Update status
-        ver_printf(1, "\b\b\b%02d%%", (int)( ((float) b / (float) t->length) * 100.0));
-
-        // Read one sector of data
-        uint8_t *buffer = malloc(sizeof(uint8_t) * t->sector_size);
-        if (fread(buffer, sizeof(uint8_t), t->sector_size, image_file) != t->sector_size) {
-          fprintf(stderr, "Error reading track: %s\n", strerror(errno));
-        }
-
-        // Swap buffer if necessary
-        if (swap_audio_output && t->track_mode == AUDIO)
-          swap_buffer(buffer, t->sector_size);
-
-        // If the track isn't audio and a conversion is to be done, figure out how long the header is
-        unsigned int header_length = 0;
-        unsigned int write_length = t->sector_size;
-        if (t->track_mode != AUDIO && data_output != DAT_BIN) {
-
-          // The header length depends on the track mode
-          if (t->track_mode == MODE2) {
-            switch (t->sector_size) {
-              case 2352: header_length = 24; break;
-              case 2336: header_length = 8;  break;
-              default:   header_length = 0;  break;
-            }
-          }
-          else {
-            switch (t->sector_size) {
-              case 2352: header_length = 16; break;
-              default:   header_length = 0;  break;
-            }
-          }
-
-          // Since we're converting to ISO/2048, the sector length is now 2048
-          write_length = 2048;
-        }
-        // If converting to the "Mac" iso type, Write that header
-        if (data_output == DAT_MAC) {
-          if (fwrite("\0\0\x08\0\0\0\x08\0", sizeof(uint8_t), 8, tf) != 8) {
-            fprintf(stderr, "Error writing Mac header to track: %s\n Skipping this track.\n", strerror(errno));
-            fclose(tf);
-            free(buffer);
-            continue;
-          }
-        }
-
-
-        // Only write the sector if it isn't to be trimmed
-        if (b < trimmed_track_length) {
-
-          // Write one sector of data skipping the header (if converting)
-          if (fwrite(buffer + header_length, sizeof(uint8_t), write_length, tf) != write_length) {
-            fprintf(stderr, "Error writing track: %s\n  Skipping this track.\n", strerror(errno));
-            fclose(tf);
-            free(buffer);
-            continue;
-          }
-
-        }
-        // If the sector is to be trimmed, have a look and see if it might contain some useful data
-        else {
-          unsigned int d;
-          for (d = header_length; d < write_length; d++)
-            if (buffer[d]) {
-              ver_printf(1, "\n  WARNING: Might be trimming relevant data from the end of this track. Consider using the --full option.\n");
-              break;
-            }
-        }
-
-        // Clean up buffer
-        free(buffer);
-      }
+  if (info_only)
+    goto quit;
 
-      ver_printf(1, "\b\b\b100%%\n");
+  if (list_files || number_extract) {
+    if (browse_filesystems(ctx, source, image, output_dir, list_files, extract_paths, number_extract) != 0)
+      exit_status = EXIT_FAILURE;
+    goto quit;
+  }
 
-      // Close that file
-      fclose(tf);
+  ver_printf(ctx, 1, "Saving track data:\n");
 
-      track++;
-    }
+  // Try to extract that data, either just the one track or all of them
+  int rip_result;
+  if (only_track) {
+    rip_job *jobs = nerorip_image_jobs(ctx, image, output_dir);
+    rip_result = (jobs) ? nerorip_rip_track(ctx, source, image, only_track, to_stdout ? "-" : jobs[only_track - 1].filename) : RIP_ALLOC_ERR;
+    free(jobs);
   }
+  else
+    rip_result = nerorip_rip_image(ctx, source, image, output_dir);
+  if (rip_result != 0)
+    exit_status = EXIT_FAILURE;
 
 quit:
+  if (ctx->stats) {
+    stats_finish(ctx->stats);
+    stats_print(ctx->stats, ctx->log ? ctx->log : stdout, stats_json);
+  }
+
   // Close file and free ram
-  ver_printf(3, "Cleaning up\n");
-  fclose(image_file);
+  ver_printf(ctx, 3, "Cleaning up\n");
+  src_close(source);
   free_nrg_image(image);
+  nerorip_free(ctx);
+  free(extract_paths);
 
-  return EXIT_SUCCESS;
+  return exit_status;
 }
 
@@ -0,0 +1,200 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "nerorip.h"
+
+// The extension for each of the data output types
+static const char data_output_ext[4][4] = {"iso", "bin", "iso", "mpg"};
+// The extension for each of the audio output types
+static const char audio_output_ext[4][5] = {"wav", "raw", "cda", "aiff"};
+
+
+// Allocates a context with the default settings
+nerorip_context *nerorip_new() {
+  // Do the malloc
+  nerorip_context *r = malloc(sizeof(nerorip_context));
+
+  // Make sure it didn't fail
+  if (!r) {
+    fprintf(stderr, "Failed to allocate memory for nerorip_context structure: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  // Audio tracks default to non-swapped WAV, data tracks to ISO/2048 and only the first track is trimmed
+  rip_options defaults = {AUD_WAV, 0, DAT_ISO, TRIM_FIRST, RIP_BATCH_SECTORS, 1, 0};
+
+  r->verbosity = 1;
+  r->log = NULL;
+  r->options = defaults;
+  r->use_mmap = 1;
+  r->jobs = 1;
+  r->buffer_budget = 0;
+  r->device_jobs = 0;
+  r->exec = NULL;
+  r->hash = 0;
+  r->verify = 0;
+  r->stats = NULL;
+  r->progress_fd = -1;
+  r->progress_rate = PROGRESS_RATE;
+  r->progress = NULL;
+
+  return r;
+}
+
+// Frees a context
+void nerorip_free(nerorip_context *ctx) {
+  if (!ctx)
+    return;
+  free_nerorip_stats(ctx->stats);
+  free(ctx);
+}
+
+
+// Returns the extension a track is saved with
+const char *nerorip_track_extension(nerorip_context *ctx, nrg_track *track) {
+  if (track->track_mode == AUDIO)
+    return audio_output_ext[ctx->options.audio_output];
+  // Only raw Mode2 tracks can have Form2 sectors, the others are still plain ISOs
+  if (ctx->options.data_output == DAT_MPG && (track->sector_mode != SECTOR_MODE2 || track->sector_size == 2048))
+    return data_output_ext[DAT_ISO];
+  return data_output_ext[ctx->options.data_output];
+}
+
+
+// Makes a job for each track in an image
+rip_job *nerorip_image_jobs(nerorip_context *ctx, nrg_image *image, const char *output_dir) {
+  const unsigned int number_jobs = image->number_tracks;
+  rip_job *jobs = malloc(sizeof(rip_job) * (number_jobs + 1));
+  if (!jobs) {
+    fprintf(stderr, "Failed to allocate memory for track list: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  // Figure out where each track goes
+  unsigned int i;
+  for (i = 0; i < number_jobs; i++) {
+    nrg_track *t = &image->tracks[i];
+    rip_job *job = &jobs[i];
+    job->track = t;
+    job->track_number = t->number;
+    job->result = 0;
+    job->hashed = 0;
+    job->verified = 0;
+    snprintf(job->filename, sizeof(job->filename), "%s/%s%02d.%s", output_dir, (t->track_mode == AUDIO ? "taudio" : "tdata"), t->number, nerorip_track_extension(ctx, t));
+  }
+  return jobs;
+}
+
+// Rips some of the jobs for an image, counting them in the stats if there are any
+static int nerorip_run_jobs(nerorip_context *ctx, image_source *source, nrg_image *image, rip_job *jobs, unsigned int number_jobs) {
+  // Make room to count each track
+  if (ctx->stats && stats_prepare(ctx->stats, image) != 0)
+    return RIP_ALLOC_ERR;
+
+  int r = rip_jobs(ctx, source, jobs, number_jobs);
+  if (ctx->stats)
+    stats_finish(ctx->stats);
+  return r;
+}
+
+// Rips every track in an image
+int nerorip_rip_image(nerorip_context *ctx, image_source *source, nrg_image *image, const char *output_dir) {
+  // There is one job for each track
+  rip_job *jobs = nerorip_image_jobs(ctx, image, output_dir);
+  if (!jobs)
+    return RIP_ALLOC_ERR;
+
+  // Try to extract that data
+  int r = nerorip_run_jobs(ctx, source, image, jobs, image->number_tracks);
+
+  // Save the hashes with the tracks
+  if (ctx->hash) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%s", output_dir, NERORIP_HASH_FILE);
+    int w = nerorip_write_hashes(ctx, filename, jobs, image->number_tracks);
+    if (r == 0)
+      r = w;
+  }
+  free(jobs);
+  return r;
+}
+
+// Rips one track of an image
+int nerorip_rip_track(nerorip_context *ctx, image_source *source, nrg_image *image, unsigned int track_number, const char *filename) {
+  nrg_track *t = get_nrg_track(image, track_number);
+  if (!t) {
+    fprintf(stderr, "Error: There is no track %u, the image has %u\n", track_number, image->number_tracks);
+    return RIP_READ_ERR;
+  }
+
+  rip_job job;
+  job.track = t;
+  job.track_number = t->number;
+  job.result = 0;
+  job.hashed = 0;
+  job.verified = 0;
+  snprintf(job.filename, sizeof(job.filename), "%s", filename);
+  int r = nerorip_run_jobs(ctx, source, image, &job, 1);
+
+  // Save the hashes next to the track, there's nowhere to put them but the log if it went to stdout
+  if (ctx->hash) {
+    char hash_filename[256 + 8];
+    if (strcmp(filename, "-") == 0)
+      strcpy(hash_filename, "-");
+    else
+      snprintf(hash_filename, sizeof(hash_filename), "%s.hashes", filename);
+    int w = nerorip_write_hashes(ctx, hash_filename, &job, 1);
+    if (r == 0)
+      r = w;
+  }
+  return r;
+}
+
+// Writes the hashes of the jobs to a file
+int nerorip_write_hashes(nerorip_context *ctx, const char *filename, rip_job *jobs, unsigned int number_jobs) {
+  const int to_log = (strcmp(filename, "-") == 0);
+  FILE *f = (to_log) ? (ctx->log ? ctx->log : stdout) : fopen(filename, "we");
+  if (!f) {
+    fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+    return RIP_WRITE_ERR;
+  }
+
+  fprintf(f, "# Track, raw image data or output, size, CRC32, MD5, SHA-1, file\n");
+  unsigned int i;
+  for (i = 0; i < number_jobs; i++) {
+    rip_job *job = &jobs[i];
+    const char *name = strrchr(job->filename, '/');
+    name = (name) ? name + 1 : job->filename;
+    if (!job->hashed) {
+      fprintf(f, "# %02u not hashed, it was not ripped\n", job->track_number);
+      continue;
+    }
+
+    char crc32[9], md5[33], sha1[41];
+    hash_hex(&job->raw_hash, crc32, md5, sha1);
+    fprintf(f, "%02u raw %llu %s %s %s %s\n", job->track_number, (unsigned long long) job->raw_hash.size, crc32, md5, sha1, name);
+    hash_hex(&job->output_hash, crc32, md5, sha1);
+    fprintf(f, "%02u output %llu %s %s %s %s\n", job->track_number, (unsigned long long) job->output_hash.size, crc32, md5, sha1, name);
+  }
+
+  if ((to_log ? fflush(f) : fclose(f)) != 0) {
+    fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+    return RIP_WRITE_ERR;
+  }
+  return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef NERORIP_H
+#define NERORIP_H
+
+/*
+ * libnerorip
+ *
+ * This is the header programs using libnerorip.a should include. A typical use looks like:
+ *
+ *   nerorip_context *ctx = nerorip_new();
+ *   ctx->verbosity = 0;
+ *   image_source *source = src_open(ctx, "image.nrg");
+ *   nrg_image *image = alloc_nrg_image();
+ *   nrg_parse(ctx, source, image);
+ *   nerorip_rip_image(ctx, source, image, "/some/dir");
+ *   free_nrg_image(image);
+ *   src_close(source);
+ *   nerorip_free(ctx);
+ *
+ * The library keeps no state of its own outside of the context, the image_source and the nrg_image,
+ * so any number of images can be handled at once from different threads as long as each one has its own
+ * image_source and nrg_image. A context can be shared by several threads as long as nobody changes it.
+ *
+ * Single sectors can be read by LBA without ripping anything with a sector_cache:
+ *
+ *   sector_cache *cache = alloc_sector_cache(source, image, 0);
+ *   sector_read(cache, 16, 1, 1, buffer, NULL);
+ *   free_sector_cache(cache);
+ *
+ * Setting ctx->stats = alloc_nerorip_stats() before parsing has the time and I/O of every phase counted,
+ * which stats_finish() and stats_print() then report.
+ *
+ * Setting ctx->hash has every track hashed (CRC32, MD5 and SHA-1) while it is ripped, both as it is in
+ * the image and as it was written out. nerorip_rip_image() and batch_rip() write the hashes to
+ * NERORIP_HASH_FILE in the output directory, and they can be found in each rip_job and in ctx->stats.
+ * Setting ctx->verify has the EDC and ECC of every raw data sector checked the same way, see rip_job_run().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include "util.h"
+#include "nrg.h"
+#include "source.h"
+#include "rip.h"
+#include "sector.h"
+#include "iso.h"
+#include "stats.h"
+#include "progress.h"
+#include "batch.h"
+#include "hash.h"
+#include "edc.h"
+#include "subchannel.h"
+
+// The file the hashes of each track are written to in the output directory when ctx->hash is set
+#define NERORIP_HASH_FILE "hashes.txt"
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Nerorip context struct
+ *
+ * Holds everything that says how images are read, ripped and reported on.
+ * Every library function that prints anything or needs an option takes one of these.
+ */
+struct nerorip_context {
+  // What level of messages should be printed. 0 prints nothing, 1 is the normal amount and each tick above that prints more
+  int verbosity;
+  // Where messages printed with ver_printf() go. NULL sends them to stdout
+  FILE *log;
+
+  // How the tracks should be converted when ripped
+  rip_options options;
+
+  // Whether or not image files should be memory mapped. 0 or 1 for false or true respectively
+  int use_mmap;
+  // How many tracks should be ripped at the same time
+  unsigned int jobs;
+  // How many bytes all the batch buffers may use together, 0 for RIP_BUFFER_BUDGET
+  size_t buffer_budget;
+  // Command audio tracks are piped into instead of being written to files, NULL for none. See rip_job_run()
+  const char *exec;
+  // How many tracks batch_rip() reads from the same disk at once. 0 picks 1 for spinning disks and no limit otherwise
+  unsigned int device_jobs;
+  // Whether or not each track should be hashed while it is ripped. 0 or 1 for false or true respectively
+  int hash;
+  // Whether or not the EDC and ECC of the sectors of each data track should be checked while it is ripped
+  int verify;
+
+  // Where timings and I/O counts are collected, NULL to not collect stats. Freed by nerorip_free()
+  nerorip_stats *stats;
+
+  // File descriptor progress is written to as JSON lines, -1 for none
+  int progress_fd;
+  // Most progress reports made per second, 0 to only report when each track is done
+  unsigned int progress_rate;
+  // The progress of the image being ripped. Set by rip_jobs() in its own copy of the context, otherwise NULL
+  nerorip_progress *progress;
+};
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Allocate a new context with the default settings:
+ * verbosity 1 to stdout, non-swapped WAV audio, ISO/2048 data, only the first track trimmed,
+ * memory mapped images, one track at a time, no hashes, no verifying, no stats and progress PROGRESS_RATE times a second on the terminal only.
+ *
+ * @return *nerorip_context
+ *   A pointer to the new context or NULL if it could not be allocated
+ */
+nerorip_context *nerorip_new();
+
+/**
+ * Free a context allocated with nerorip_new().
+ * If ctx is NULL, it will simply return without doing anything.
+ */
+void nerorip_free(nerorip_context *ctx);
+
+
+/**
+ * Get the file extension a track is saved with, like "wav" or "iso".
+ *
+ * @param nerorip_context *ctx
+ *   The context whose options say how the track is converted
+ * @param nrg_track *track
+ *   The track to be ripped
+ * @return const char*
+ *   The extension, without the dot
+ */
+const char *nerorip_track_extension(nerorip_context *ctx, nrg_track *track);
+
+
+/**
+ * Make a rip job for each track in a parsed image, in track order.
+ * The tracks are named taudioXX or tdataXX with the extension from nerorip_track_extension().
+ *
+ * @param nerorip_context *ctx
+ *   How the tracks will be ripped
+ * @param nrg_image *image
+ *   The image, already filled in by nrg_parse()
+ * @param const char *output_dir
+ *   The directory the tracks go in
+ * @return *rip_job
+ *   An array of image->number_tracks jobs to be freed with free(), or NULL if it could not be allocated
+ */
+rip_job *nerorip_image_jobs(nerorip_context *ctx, nrg_image *image, const char *output_dir);
+
+/**
+ * Rip every track in a parsed image into output_dir.
+ * The tracks are named taudioXX or tdataXX with the extension from nerorip_track_extension().
+ * If ctx->hash is set, their hashes are written to NERORIP_HASH_FILE in output_dir.
+ *
+ * @param nerorip_context *ctx
+ *   How the tracks should be ripped
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param nrg_image *image
+ *   The image, already filled in by nrg_parse()
+ * @param const char *output_dir
+ *   The directory to put the tracks in
+ * @return int
+ *   0 if every track was ripped, otherwise the first error returned by rip_track()
+ */
+int nerorip_rip_image(nerorip_context *ctx, image_source *source, nrg_image *image, const char *output_dir);
+
+/**
+ * Rip only one track of a parsed image.
+ * If ctx->hash is set, its hashes are written next to it in filename.hashes, or to the log if it goes to stdout.
+ *
+ * @param nerorip_context *ctx
+ *   How the track should be ripped
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param nrg_image *image
+ *   The image, already filled in by nrg_parse()
+ * @param unsigned int track_number
+ *   The number of the track in the whole image (starting at 1)
+ * @param const char *filename
+ *   The file to rip it to, or "-" to stream it to stdout
+ * @return int
+ *   0 if the track was ripped, RIP_READ_ERR if there is no such track, otherwise the error returned by rip_track()
+ */
+int nerorip_rip_track(nerorip_context *ctx, image_source *source, nrg_image *image, unsigned int track_number, const char *filename);
+
+/**
+ * Write the hashes of some ripped jobs to a file, one line for the raw data and one for the output of each track:
+ *   TRACK raw|output SIZE CRC32 MD5 SHA-1 FILE
+ * where FILE is the name of the output file without its directory. Tracks that weren't hashed get a comment instead.
+ *
+ * @param nerorip_context *ctx
+ *   Where the hashes go if filename is "-"
+ * @param const char *filename
+ *   The file to write, or "-" for ctx->log (stdout if that is NULL)
+ * @param rip_job *jobs
+ *   The jobs, after rip_job_run() hashed them
+ * @param unsigned int number_jobs
+ *   Number of jobs in the array
+ * @return int
+ *   0 on success or RIP_WRITE_ERR if the file could not be written
+ */
+int nerorip_write_hashes(nerorip_context *ctx, const char *filename, rip_job *jobs, unsigned int number_jobs);
+
+#endif
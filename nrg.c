@@ -16,7 +16,7 @@
  *
  */
 
-#include "nrg.h"
+#include "nerorip.h"
 
 // Allocates memory for an nrg_image
 nrg_image *alloc_nrg_image() {
@@ -32,10 +32,14 @@ nrg_image *alloc_nrg_image() {
   //Initialize some variables in there and return the pointer
   r->nrg_version = UNPROCESSED;
   r->first_chunk_offset = 0x00;
-  r->first_session = NULL;
-  r->last_session = NULL;
+  r->media_type = 0x00;
+  r->sessions = NULL;
   r->number_sessions = 0;
+  r->sessions_allocated = 0;
+  r->tracks = NULL;
   r->number_tracks = 0;
+  r->tracks_allocated = 0;
+  r->lba_index = NULL;
 
   return r;
 }
@@ -47,29 +51,10 @@ void free_nrg_image(nrg_image *image) {
   if (!image)
     return;
 
-  // Loop through all the sessions
-  nrg_session *s;
-  for (s = image->first_session; s != NULL; ) {
-
-    // Loop through all the tracks in this session
-    nrg_track *t;
-    for (t = s->first_track; t != NULL; ) {
-
-      // Get the next track before freeing this one
-      nrg_track *next_track = t->next;
-
-      // Free this track
-      free(t);
-
-      // reset t
-      t = next_track;
-    }
-
-    // Now that all the tracks have been freed, free this session
-    nrg_session *next_session = s->next;
-    free(s);
-    s = next_session;
-  }
+  // All the sessions and tracks are in their own arrays
+  free(image->sessions);
+  free(image->tracks);
+  free(image->lba_index);
 
   // It's now safe to free the image
   free(image);
@@ -77,118 +62,306 @@ void free_nrg_image(nrg_image *image) {
 }
 
 
-// Allocates memory for an nrg_session
-nrg_session *alloc_nrg_session() {
-  // Do the malloc
-  nrg_session *r = malloc(sizeof(nrg_session));
+// Makes room for one more element in an array, doubling it when it's full. Returns 0 on success
+static int grow_array(void **array, unsigned int *allocated, unsigned int used, size_t element_size) {
+  if (used < *allocated)
+    return 0;
 
-  // Make sure it didn't fail
-  if (!r) {
+  unsigned int new_allocated = (*allocated) ? *allocated * 2 : 4;
+  void *r = realloc(*array, new_allocated * element_size);
+  if (!r)
+    return -1;
+
+  *array = r;
+  *allocated = new_allocated;
+  return 0;
+}
+
+// Adds a new session to an nrg_image
+nrg_session *add_nrg_session(nrg_image *image) {
+  if (!image) {
+    fprintf(stderr, "add_nrg_session got an unallocated nrg_image.\n");
+    return NULL;
+  }
+
+  if (grow_array((void **) &image->sessions, &image->sessions_allocated, image->number_sessions, sizeof(nrg_session)) != 0) {
     fprintf(stderr, "Failed to allocate memory for nrg_session structure: %s\n", strerror(errno));
     return NULL;
   }
 
-  //Initialize some variables in there and return the pointer
-  r->next = NULL;
-  r->first_track = NULL;
-  r->last_track = NULL;
-  r->number_tracks = 0;
+  // The new session starts out with no tracks, right after the tracks of the sessions before it
+  nrg_session *r = &image->sessions[image->number_sessions++];
+  memset(r, 0, sizeof(nrg_session));
+  r->first_track_index = image->number_tracks;
 
   return r;
 }
 
 
-// Allocates memory for an nrg_track
-nrg_track *alloc_nrg_track() {
-  // Do the malloc
-  nrg_track *r = malloc(sizeof(nrg_track));
+// Adds a new track to the last session in an nrg_image
+nrg_track *add_nrg_track(nrg_image *image, nrg_session *session) {
+  if (!image || !session) {
+    fprintf(stderr, "add_nrg_track got an unallocated nrg_image or nrg_session.\n");
+    return NULL;
+  }
+  if (session != &image->sessions[image->number_sessions - 1]) {
+    fprintf(stderr, "add_nrg_track can only add tracks to the last session.\n");
+    return NULL;
+  }
 
-  // Make sure it didn't fail
-  if (!r) {
+  if (grow_array((void **) &image->tracks, &image->tracks_allocated, image->number_tracks, sizeof(nrg_track)) != 0) {
     fprintf(stderr, "Failed to allocate memory for nrg_track structure: %s\n", strerror(errno));
     return NULL;
   }
 
-  //Initialize some variables in there and return the pointer
-  r->next = NULL;
+  nrg_track *r = &image->tracks[image->number_tracks++];
+  memset(r, 0, sizeof(nrg_track));
+  r->number = image->number_tracks;
+  session->number_tracks++;
 
   return r;
 }
 
 
-// Adds an nrg_session to an nrg_image
-void add_nrg_session(nrg_image *image, nrg_session *session) {
-  if (!image || !session) {
-    fprintf(stderr, "add_nrg_session got an unallocated nrg_image or nrg_session.\n");
-    return;
-  }
+// Gets a track by its number
+nrg_track *get_nrg_track(nrg_image *image, unsigned int number) {
+  if (!image || number < 1 || number > image->number_tracks)
+    return NULL;
+  return &image->tracks[number - 1];
+}
+
+
+// Sorts LBA index entries by LBA
+static int compare_lba_entries(const void *a, const void *b) {
+  const nrg_lba_entry *x = a, *y = b;
+  return (x->lba > y->lba) - (x->lba < y->lba);
+}
 
-  // If this is the first session going on the image, this session is both the first and last
-  if (image->first_session == NULL) {
-    image->first_session = session;
-    image->last_session = session;
+// Builds the LBA index for a parsed image. Returns 0 on success
+static int nrg_index_lbas(nrg_image *image) {
+  free(image->lba_index);
+  image->lba_index = malloc(sizeof(nrg_lba_entry) * (image->number_tracks + 1));
+  if (!image->lba_index) {
+    fprintf(stderr, "Failed to allocate memory for LBA index: %s\n", strerror(errno));
+    return -1;
   }
-  // Otherwise, it goes on the end and is the new last_session
-  else {
-    image->last_session->next = session;
-    image->last_session = session;
+
+  unsigned int i;
+  for (i = 0; i < image->number_tracks; i++) {
+    nrg_track *t = &image->tracks[i];
+    nrg_lba_entry *e = &image->lba_index[i];
+    e->lba = t->track_lba;
+    e->sectors = (t->sector_size) ? t->length / t->sector_size : 0;
+    e->offset = t->track_offset;
+    e->sector_size = t->sector_size;
+    e->track = t->number;
   }
+
+  qsort(image->lba_index, image->number_tracks, sizeof(nrg_lba_entry), compare_lba_entries);
+  return 0;
 }
 
+// Finds the track holding a sector
+nrg_track *nrg_find_lba(nrg_image *image, uint32_t lba, uint64_t *offset) {
+  if (!image || !image->lba_index || image->number_tracks == 0)
+    return NULL;
 
-// Adds an nrg_track to an nrg_session
-void add_nrg_track(nrg_session *session, nrg_track *track) {
-  if (!track || !session) {
-    fprintf(stderr, "add_nrg_track got an unallocated nrg_session or nrg_track.\n");
-    return;
+  // Find the last track starting at or before lba
+  unsigned int low = 0, high = image->number_tracks;
+  while (high - low > 1) {
+    unsigned int middle = low + (high - low) / 2;
+    if (image->lba_index[middle].lba <= lba)
+      low = middle;
+    else
+      high = middle;
   }
 
-  // If this is the first track going on the session, this track is both the first and last
-  if (session->first_track == NULL) {
-    session->first_track = track;
-    session->last_track = track;
-  }
-  // Otherwise, it goes on the end and is the new last_track
-  else {
-    session->last_track->next = track;
-    session->last_track = track;
+  // Make sure the sector is actually in that track
+  nrg_lba_entry *e = &image->lba_index[low];
+  if (lba < e->lba || lba - e->lba >= e->sectors)
+    return NULL;
+
+  if (offset)
+    *offset = e->offset + (uint64_t) (lba - e->lba) * e->sector_size;
+  return &image->tracks[e->track - 1];
+}
+
+
+/**
+ * Chunk data reader
+ *
+ * Walks over chunk data that has already been read into memory.
+ * Every read is checked against the end of the data. Reading past it returns 0 and sets overrun.
+ */
+typedef struct {
+  const uint8_t *data;
+  uint64_t length;
+  uint64_t position;
+  int overrun;
+} chunk_reader;
+
+// Checks that length more bytes can be read, setting overrun if they can't
+static int chunk_has(chunk_reader *c, uint64_t length) {
+  if (c->overrun || length > c->length - c->position) {
+    c->overrun = 1;
+    return 0;
   }
+  return 1;
 }
 
+// Skips over length bytes
+static void chunk_skip(chunk_reader *c, uint64_t length) {
+  if (chunk_has(c, length))
+    c->position += length;
+}
 
-// Parses the chunk data in the image file to fill in nrg_image data structure
-int nrg_parse(FILE *image_file, nrg_image *image) {
-  // Make sure properly allocated
-  if (!image_file || !image)
-    return NON_ALLOC;
+// Chunk data reading convenience functions. The values are converted from big endian.
+static uint8_t chunk_read8u(chunk_reader *c) {
+  if (!chunk_has(c, sizeof(uint8_t)))
+    return 0;
+  return c->data[c->position++];
+}
 
-  ver_printf(3, "Detecting NRG file version:\n");
+static uint32_t chunk_read32u(chunk_reader *c) {
+  uint32_t r = 0;
+  if (!chunk_has(c, sizeof(uint32_t)))
+    return 0;
+  memcpy(&r, c->data + c->position, sizeof(uint32_t));
+  c->position += sizeof(uint32_t);
+  return bswap_32(r);
+}
 
-  // Seek to 12 bytes from the end and try to read the footer.
-  fseek(image_file, -12, SEEK_END);
+static uint64_t chunk_read64u(chunk_reader *c) {
+  uint64_t r = 0;
+  if (!chunk_has(c, sizeof(uint64_t)))
+    return 0;
+  memcpy(&r, c->data + c->position, sizeof(uint64_t));
+  c->position += sizeof(uint64_t);
+  return bswap_64(r);
+}
+
+// Reads a cue sheet address. Nero 5.5 stores an LBA, Nero 5.0 00 MM SS FF counted from the start of the
+// disc including the 2 second (150 sector) lead in, so 00:00:00 is LBA -150. Images over 255 minutes
+// (about 2.5 GB) carry the minutes on into the top byte
+static uint32_t chunk_read_address(chunk_reader *c, int nrg_version) {
+  uint32_t address = chunk_read32u(c);
+  if (nrg_version == NRG_VER_55)
+    return address;
+  return (address >> 16) * 4500 + ((address >> 8) & 0xFF) * 75 + (address & 0xFF) - 150;
+}
+
+// Checks that a value read from the chunk data is what it should be. If not, warns and sets *r to NRG_WARN
+static void nrg_expect(nerorip_context *ctx, int *r, uint64_t value, uint64_t expected, const char *what) {
+  if (value == expected)
+    return;
+
+  ver_printf(ctx, 2, "    Warning: %s is 0x%llX, expected 0x%llX\n", what, (unsigned long long) value, (unsigned long long) expected);
+  if (*r == 0)
+    *r = NRG_WARN;
+}
+
+
+// Every Nero track mode nerorip knows about: what its sectors hold and how big they are
+static const struct {
+  uint8_t code;
+  uint8_t sector_mode;
+  uint32_t sector_size;
+} nrg_modes[] = {
+  { ENT_MODE1_2048, SECTOR_MODE1, 2048 },
+  { ENT_MODE2_2048, SECTOR_MODE2, 2048 },
+  { ENT_MODE2_2336, SECTOR_MODE2, 2336 },
+  { ENT_MODE1_2352, SECTOR_MODE1, 2352 },
+  { ENT_MODE2_2352, SECTOR_MODE2, 2352 },
+  { ENT_AUDIO,      SECTOR_AUDIO, 2352 },
+  { ENT_MODE1_SUB,  SECTOR_MODE1, 2352 + SUB_LENGTH },
+  { ENT_AUDIO_SUB,  SECTOR_AUDIO, 2352 + SUB_LENGTH },
+  { ENT_MODE2_SUB,  SECTOR_MODE2, 2352 + SUB_LENGTH },
+};
+
+// Looks up a Nero track mode, returns its index in nrg_modes or -1 if it isn't one
+static int nrg_find_mode(uint32_t code) {
+  unsigned int i;
+  for (i = 0; i < sizeof(nrg_modes) / sizeof(nrg_modes[0]); i++)
+    if (nrg_modes[i].code == code)
+      return i;
+  return -1;
+}
+
+// Names what the sectors of a track hold
+static const char *nrg_sector_mode_name(uint8_t sector_mode) {
+  switch (sector_mode) {
+    case SECTOR_AUDIO: return "Audio";
+    case SECTOR_MODE1: return "Mode1";
+    case SECTOR_MODE2: return "Mode2";
+    default:           return "Unknown";
+  }
+}
+
+// Does the work for nrg_parse(), adding what was read from the image to *bytes_read and *read_calls
+static int nrg_parse_chunks(nerorip_context *ctx, image_source *source, nrg_image *image, uint64_t *bytes_read, uint64_t *read_calls) {
+  ver_printf(ctx, 3, "Detecting NRG file version:\n");
+
+  // Read the footer from the last 12 bytes of the file
+  uint8_t footer_data[12];
+  src_seek(source, 0, SEEK_END);
+  const uint64_t file_size = src_tell(source);
+  (*read_calls)++;
+  *bytes_read += sizeof(footer_data);
+  if (file_size < sizeof(footer_data) || src_pread(source, footer_data, sizeof(footer_data), file_size - sizeof(footer_data)) != sizeof(footer_data)) {
+    image->nrg_version = NOT_NRG;
+    ver_printf(ctx, 3, "  File does not appear to be a Nero image\n");
+    return NOT_NRG;
+  }
+  chunk_reader footer = {footer_data, sizeof(footer_data), 0, 0};
 
   // If the value there is NER5, it's version 5.5
-  if (fread32u(image_file) == NER5) {
-    image->first_chunk_offset = fread64u(image_file);
+  if (chunk_read32u(&footer) == NER5) {
+    image->first_chunk_offset = chunk_read64u(&footer);
     image->nrg_version = NRG_VER_55;
-    ver_printf(3, "  File appears to be a Nero 5.5 image\n");
+    ver_printf(ctx, 3, "  File appears to be a Nero 5.5 image\n");
   }
   // Otherwise, try to read the next chunk, if it's NERO, then its version 5
-  else if (fread32u(image_file) == NERO) {
-    image->first_chunk_offset = (uint64_t) fread32u(image_file);
+  else if (chunk_read32u(&footer) == NERO) {
+    image->first_chunk_offset = (uint64_t) chunk_read32u(&footer);
     image->nrg_version = NRG_VER_5;
-    ver_printf(3, "  File appears to be a Nero 5 image\n");
+    ver_printf(ctx, 3, "  File appears to be a Nero 5 image\n");
   }
   // If it wasn't either of the above, it must not be a nero image.
   else {
     image->nrg_version = NOT_NRG;
-    ver_printf(3, "  File does not appear to be a Nero image\n");
+    ver_printf(ctx, 3, "  File does not appear to be a Nero image\n");
+    return NOT_NRG;
   }
 
-  ver_printf(3, "Seeking to first chunk offset\n");
-  fseek(image_file, image->first_chunk_offset, SEEK_SET);
+  // All the chunk data lies between the first chunk offset and the footer
+  if (image->first_chunk_offset >= file_size || file_size - image->first_chunk_offset > NRG_MAX_CHUNK_DATA) {
+    fprintf(stderr, "First chunk offset 0x%llX does not make sense for a %llu byte file\n", (unsigned long long) image->first_chunk_offset, (unsigned long long) file_size);
+    return NRG_CORRUPT;
+  }
 
-  ver_printf(3, "Processing Chunk data:\n");
+  // Grab all the chunk data at once, straight out of the mapping if possible
+  const uint64_t chunk_data_length = file_size - image->first_chunk_offset;
+  ver_printf(ctx, 3, "Reading %llu bytes of chunk data\n", (unsigned long long) chunk_data_length);
+  uint8_t *buffer = NULL;
+  const uint8_t *chunk_data = src_map(source, image->first_chunk_offset, chunk_data_length);
+  *bytes_read += chunk_data_length;
+  if (!chunk_data) {
+    (*read_calls)++;
+    buffer = malloc(chunk_data_length);
+    if (!buffer) {
+      fprintf(stderr, "Failed to allocate memory for chunk data: %s\n", strerror(errno));
+      return NRG_READ_ERR;
+    }
+    if (src_pread(source, buffer, chunk_data_length, image->first_chunk_offset) != chunk_data_length) {
+      fprintf(stderr, "Error reading chunk data: %s\n", (errno ? strerror(errno) : "Unexpected end of file"));
+      free(buffer);
+      return NRG_READ_ERR;
+    }
+    chunk_data = buffer;
+  }
+  chunk_reader chunks = {chunk_data, chunk_data_length, 0, 0};
+
+  ver_printf(ctx, 3, "Processing Chunk data:\n");
 
   // Keep track of what should be returned
   int r = 0;
@@ -196,15 +369,33 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
   // Keep count of sessions and tracks
   unsigned int session_number = 1;
   unsigned int track_number = 1;
+  // Count of SINF chunks seen so far, each one describes the next session
+  unsigned int sinf_number = 0;
 
-  // Don't let this loop forever: break if we reach the end of the file
-  while (!feof(image_file)) {
+  // Don't let this loop forever: break if we reach the end of the chunk data
+  int found_end = 0;
+  while (chunk_has(&chunks, 8)) {
 
     // Chunk data came from the source for libdiscmage available at http://sourceforge.net/projects/discmage/
     // The chunk ID and chunk size are always 32 bit integers
-    const long int chunk_offset = ftell(image_file);
-    const uint32_t chunk_id = fread32u(image_file);
-    const uint32_t chunk_size = fread32u(image_file);
+    const uint64_t chunk_offset = image->first_chunk_offset + chunks.position;
+    const uint32_t chunk_id = chunk_read32u(&chunks);
+    const uint32_t chunk_size = chunk_read32u(&chunks);
+
+    if (chunk_id == END) {
+      ver_printf(ctx, 3, "  END! at 0x%llX\n", (unsigned long long) chunk_offset);
+      found_end = 1;
+      break;
+    }
+
+    // Everything in this chunk is read through its own reader so it can't run into the next one
+    if (!chunk_has(&chunks, chunk_size)) {
+      fprintf(stderr, "  Chunk at 0x%llX runs past the end of the file.\n", (unsigned long long) chunk_offset);
+      r = NRG_TRUNCATED;
+      break;
+    }
+    chunk_reader c = {chunks.data + chunks.position, chunk_size, 0, 0};
+    chunk_skip(&chunks, chunk_size);
 
     if (chunk_id == CUES || chunk_id == CUEX) {
       /**
@@ -240,63 +431,79 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       *                second is indicates where the track actually begins.
       *                Unless the track is audio with an intro bit (where the player starts at a negative time), the second LBA
       *                in each loop is 0x00000000
+      * About MM:SS:FF: Nero 5.0 stores each address as 00 MM SS FF, in binary, counting from the start of the lead in.
+      *                 They're turned into LBAs (M * 4500 + S * 75 + F - 150) as they are read so the rest of nerorip only
+      *                 ever sees LBAs.
       */
+      if (chunk_size < 16) {
+        fprintf(stderr, "  %s chunk at 0x%llX is too small to describe a session.\n", (chunk_id == CUES ? "CUES" : "CUEX"), (unsigned long long) chunk_offset);
+        r = NRG_CORRUPT;
+        break;
+      }
 
       // CUES / CUEX indicates the start of a new DAO session so create a new session and add it to the image
-      nrg_session *session = alloc_nrg_session();
-      add_nrg_session(image, session);
+      nrg_session *session = add_nrg_session(image);
+      if (!session) {
+        r = NON_ALLOC;
+        break;
+      }
       session->burn_mode = DAO;
 
       // Set burn mode and session mode and number of tracks
-      session->number_tracks = chunk_size / 16 - 1;
-      session->session_mode = fread8u(image_file);
+      const unsigned int number_tracks = chunk_size / 16 - 1;
+      session->session_mode = chunk_read8u(&c);
 
       // Skip junk
-      assert(fread8u(image_file) == 0x00); // Track
-      assert(fread8u(image_file) == 0x00); // 0x00
-      assert(fread8u(image_file) == 0x00); // Index
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Session track number");
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Session index");
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Session padding");
 
-      session->start_lba = fread32u(image_file);
-      ver_printf(3, "  %s at 0x%X: Size - %d B\n", (chunk_id == CUES ? "CUES" : "CUEX"), chunk_offset, chunk_size);
-      ver_printf(3, "    Session %d has %d track(s) using mode %s and starting at 0x%X.\n", session_number, session->number_tracks, (session->session_mode == 0x41 ? "Mode2" : (session->session_mode == 0x01 ? "Audio" : "Unknown")), session->start_lba);
+      session->start_lba = chunk_read_address(&c, image->nrg_version);
+      ver_printf(ctx, 3, "  %s at 0x%llX: Size - %d B\n", (chunk_id == CUES ? "CUES" : "CUEX"), (unsigned long long) chunk_offset, chunk_size);
+      ver_printf(ctx, 3, "    Session %d has %d track(s) using mode %s and starting at 0x%X.\n", session_number, number_tracks, (session->session_mode == 0x41 ? "Mode2" : (session->session_mode == 0x01 ? "Audio" : "Unknown")), session->start_lba);
 
       unsigned int i = 1;
-      for (i = 1; i <= session->number_tracks; i++, track_number++) {
+      for (i = 1; i <= number_tracks && !c.overrun; i++, track_number++) {
         // Each of these middle chunks holds a bit of data about one track for the session.
-        // Allocate and add the new track
-        nrg_track *track = alloc_nrg_track();
-        add_nrg_track(session, track);
-
-        track->pretrack_mode  = fread8u(image_file);
-        assert(fread8u(image_file) == track_number);    // Track number
-        assert(fread8u(image_file) == 0x00); // Track index
-        assert(fread8u(image_file) == 0x00); // 0x00
-        track->pretrack_lba = fread32u(image_file);
-
-        track->track_mode = fread8u(image_file);
-        assert(fread8u(image_file) == track_number);    // Track number
-        assert(fread8u(image_file) == 0x01); // Track index
-        assert(fread8u(image_file) == 0x00); // 0x00
-        track->track_lba = fread32u(image_file);
-
-        assert(track->pretrack_mode == track->track_mode);
-
-        ver_printf(3, "      Track %d: Index 0 uses mode %s and starts at LBA 0x%X, ", i, (track->pretrack_mode == 0x41 ? "Mode2" : (track->pretrack_mode == 0x01 ? "Audio" : "Unknown")), track->pretrack_lba);
-        ver_printf(3, "Index 1 uses mode %s and starts at LBA 0x%X.\n", (track->track_mode == 0x41 ? "Mode2" : (track->track_mode == 0x01 ? "Audio" : "Unknown")), track->track_lba);
+        // Add the new track
+        nrg_track *track = add_nrg_track(image, session);
+        if (!track) {
+          r = NON_ALLOC;
+          break;
+        }
+
+        track->pretrack_mode  = chunk_read8u(&c);
+        nrg_expect(ctx, &r, chunk_read8u(&c), track_number, "Index 0 track number");
+        nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Index 0 index");
+        nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Index 0 padding");
+        track->pretrack_lba = chunk_read_address(&c, image->nrg_version);
+
+        track->track_mode = chunk_read8u(&c);
+        nrg_expect(ctx, &r, chunk_read8u(&c), track_number, "Index 1 track number");
+        nrg_expect(ctx, &r, chunk_read8u(&c), 0x01, "Index 1 index");
+        nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Index 1 padding");
+        track->track_lba = chunk_read_address(&c, image->nrg_version);
+
+        nrg_expect(ctx, &r, track->pretrack_mode, track->track_mode, "Index 0 mode");
+
+        ver_printf(ctx, 3, "      Track %d: Index 0 uses mode %s and starts at LBA 0x%X, ", i, (track->pretrack_mode == 0x41 ? "Mode2" : (track->pretrack_mode == 0x01 ? "Audio" : "Unknown")), track->pretrack_lba);
+        ver_printf(ctx, 3, "Index 1 uses mode %s and starts at LBA 0x%X.\n", (track->track_mode == 0x41 ? "Mode2" : (track->track_mode == 0x01 ? "Audio" : "Unknown")), track->track_lba);
       }
+      if (r == NON_ALLOC)
+        break;
 
       // Skip junk
       // Nero 5.5 images always have the session mode here but 5.0 images generated by cdi2nero have a 0x00 here.
       if (image->nrg_version == NRG_VER_55)
-        assert(fread8u(image_file) == session->session_mode);
+        nrg_expect(ctx, &r, chunk_read8u(&c), session->session_mode, "Lead out mode");
       else
-        fread8u(image_file);
-      assert(fread8u(image_file) == 0xaa);         // 0xAA
-      assert(fread8u(image_file) == 0x01);         // 0x01
-      assert(fread8u(image_file) == 0x00);         // 0x00
+        chunk_read8u(&c);
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0xaa, "Lead out track number");
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0x01, "Lead out index");
+      nrg_expect(ctx, &r, chunk_read8u(&c), 0x00, "Lead out padding");
 
-      session->end_lba = fread32u(image_file);
-      ver_printf(3, "    Session ends at LBA 0x%X\n", session->end_lba);
+      session->end_lba = chunk_read_address(&c, image->nrg_version);
+      ver_printf(ctx, 3, "    Session ends at LBA 0x%X\n", session->end_lba);
 
       session_number++;
     }
@@ -313,57 +520,88 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       *   1  B | 1  B | Last track                   | Usually = # tracks
       * --------------------------------------------------------------------------------------------------------------------
       *   10 B | 10 B | ISRC Code?
-      *   4  B | 4  B | Sector size
-      *   4  B | 4  B | Mode                         | mode2 = 0x03000001, audio = 0x07000001
+      *   4  B | 4  B | Sector size                  | 2448 = 2352 + P-W subchannel, 2368 = 2352 + Q subchannel
+      *   4  B | 4  B | Mode                         | Nero track mode (as in ETNF) << 24 | 0x000001, e.g.
+      *        |      |                              | mode2 = 0x03000001, audio = 0x07000001, mode1 = 0x00000001
       *   4  B | 8  B | Index0 start offset
       *   4  B | 8  B | Index1 start offset          | = index0 + pregap length
       *   4  B | 8  B | Next offset                  | = index1 + track length
       * ... Repeat for each track in this session
       */
       // When a DAOI / DAOX tag is encountered, it's talking about the last session described by a CUES / CUEX chunk
-      nrg_session *session = image->last_session;
+      nrg_session *session = (image->number_sessions) ? &image->sessions[image->number_sessions - 1] : NULL;
+      if (!session || session->burn_mode != DAO) {
+        fprintf(stderr, "  %s chunk at 0x%llX does not follow a cue sheet.\n", (chunk_id == DAOI ? "DAOI" : "DAOX"), (unsigned long long) chunk_offset);
+        r = NRG_CORRUPT;
+        break;
+      }
 
       // # tracks
-      assert(session->number_tracks == (chunk_id == DAOI) ? (fread32u(image_file) - 22) / 30) : (fread32u(image_file) - 22) / 42);
+      const uint32_t dao_size = chunk_read32u(&c);
+      nrg_expect(ctx, &r, (dao_size - 22) / ((chunk_id == DAOI) ? 30 : 42), session->number_tracks, "DAO track count");
 
       // Skip UPC
-      fseek(image_file, 14, SEEK_CUR);
+      chunk_skip(&c, 14);
 
-      session->toc_type    = fread8u(image_file);
-      fread8u(image_file); // close cd
-      session->first_track_number = fread8u(image_file);
-      session->last_track_number  = fread8u(image_file);
+      session->toc_type    = chunk_read8u(&c);
+      chunk_read8u(&c); // close cd
+      session->first_track_number = chunk_read8u(&c);
+      session->last_track_number  = chunk_read8u(&c);
 
-      ver_printf(3, "  %s at 0x%X:  Size - %dB\n", (chunk_id == DAOI ? "DAOI" : "DAOX"), chunk_offset, chunk_size);
-      ver_printf(3, "    Toc Type - %s, First Track - %d, Last Track - %d, has %d track(s)\n", (session->toc_type == TOC_MODE2 ? "Mode2" : (session->toc_type == TOC_AUDIO ? "Audio" : "Unknown")), session->first_track_number, session->last_track_number, session->number_tracks);
+      ver_printf(ctx, 3, "  %s at 0x%llX:  Size - %dB\n", (chunk_id == DAOI ? "DAOI" : "DAOX"), (unsigned long long) chunk_offset, chunk_size);
+      ver_printf(ctx, 3, "    Toc Type - %s, First Track - %d, Last Track - %d, has %d track(s)\n", (session->toc_type == TOC_MODE2 ? "Mode2" : (session->toc_type == TOC_AUDIO ? "Audio" : "Unknown")), session->first_track_number, session->last_track_number, session->number_tracks);
 
       // Each track in the session should be described now
-      int i = 0;
-      nrg_track *track;
-      for (track = session->first_track; track != NULL; track = track->next, i++)
+      unsigned int i;
+      for (i = 0; i < session->number_tracks && !c.overrun; i++)
       {
+        nrg_track *track = &image->tracks[session->first_track_index + i];
+
         // Skip ISRC Code
-        fseek(image_file, 10, SEEK_CUR);
+        chunk_skip(&c, 10);
 
         // Read track data
-        track->sector_size = fread32u(image_file);
-        uint32_t mode       = fread32u(image_file);
-        track->pretrack_offset      = (chunk_id == DAOI) ? (uint64_t) fread32u(image_file) : fread64u(image_file);
-        track->track_offset      = (chunk_id == DAOI) ? (uint64_t) fread32u(image_file) : fread64u(image_file);
-        track->next_offset = (chunk_id == DAOI) ? (uint64_t) fread32u(image_file) : fread64u(image_file);
+        track->sector_size = chunk_read32u(&c);
+        uint32_t mode       = chunk_read32u(&c);
+        track->pretrack_offset      = (chunk_id == DAOI) ? (uint64_t) chunk_read32u(&c) : chunk_read64u(&c);
+        track->track_offset      = (chunk_id == DAOI) ? (uint64_t) chunk_read32u(&c) : chunk_read64u(&c);
+        track->next_offset = (chunk_id == DAOI) ? (uint64_t) chunk_read32u(&c) : chunk_read64u(&c);
         track->length = track->next_offset - track->track_offset;
 
-        // Assert that the mode read here is the same as that read in CUES / CUEX
-        if (mode == DAO_MODE2)
-          assert(track->track_mode == MODE2);
-        else if (mode == DAO_AUDIO)
-          assert(track->track_mode == AUDIO);
+        // The top byte of the mode is the Nero track mode. The sector size always comes from the chunk, so all
+        // that is taken from the mode is what the sectors hold. Anything unknown goes by the cue sheet.
+        const int m = nrg_find_mode(mode >> 24);
+        if (m < 0 || (mode & 0x00FFFFFF) != 0x000001) {
+          nrg_expect(ctx, &r, mode, (track->track_mode == AUDIO) ? DAO_AUDIO : DAO_MODE2, "DAO track mode");
+          track->sector_mode = (track->track_mode == AUDIO) ? SECTOR_AUDIO : SECTOR_MODE2;
+        }
+        else {
+          track->sector_mode = nrg_modes[m].sector_mode;
+          // Check that the mode read here is the same as that read in CUES / CUEX
+          nrg_expect(ctx, &r, track->track_mode, (track->sector_mode == SECTOR_AUDIO) ? AUDIO : MODE2, "Cue sheet mode");
+          // Modes with subchannel data have all 96 bytes of it after each raw sector
+          if (nrg_modes[m].sector_size > 2352)
+            nrg_expect(ctx, &r, track->sector_size, nrg_modes[m].sector_size, "Subchannel sector size");
+        }
 
-        ver_printf(3, "      Track %d: Type - %s/%d, pretrack_offset start - 0x%X, track_offset start - 0x%X, Next offset - 0x%X\n", i, (mode == 0x03000001 ? "Mode2" : (mode == 0x07000001 ? "Audio" : "Other")), track->sector_size, track->pretrack_offset, track->track_offset, track->next_offset);
-      }
+        // The sector size has to be something that could be on a disc
+        if (track->sector_size == 0 || track->sector_size > NRG_MAX_SECTOR_SIZE) {
+          fprintf(stderr, "  Track %d in %s chunk at 0x%llX has a bad sector size: %u.\n", i, (chunk_id == DAOI ? "DAOI" : "DAOX"), (unsigned long long) chunk_offset, track->sector_size);
+          r = NRG_CORRUPT;
+          break;
+        }
+
+        // The track has to actually be in the file
+        if (track->next_offset < track->track_offset || track->track_offset < track->pretrack_offset || track->next_offset > file_size) {
+          fprintf(stderr, "  Track %d in %s chunk at 0x%llX lies outside of the file.\n", i, (chunk_id == DAOI ? "DAOI" : "DAOX"), (unsigned long long) chunk_offset);
+          r = NRG_CORRUPT;
+          break;
+        }
 
-      // Update number of tracks in the image
-      image->number_tracks += session->number_tracks;
+        ver_printf(ctx, 3, "      Track %d: Type - %s/%d, pretrack_offset start - 0x%llX, track_offset start - 0x%llX, Next offset - 0x%llX\n", i, nrg_sector_mode_name(track->sector_mode), track->sector_size, (unsigned long long) track->pretrack_offset, (unsigned long long) track->track_offset, (unsigned long long) track->next_offset);
+      }
+      if (r == NRG_CORRUPT)
+        break;
     }
     else if (chunk_id == ETNF || chunk_id == ETN2) {
       /**
@@ -373,59 +611,70 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       * --------------------------------------------------------------------------------------------------------------------
       *   4 B  | 8 B  | Start offset
       *   4 B  | 8 B  | Length (bytes)
-      *   4 B  | 4 B  | Mode                         | 0x03 = mode2/2336, 0x06 = mode2/2352, 0x07 = audio/2352
+      *   4 B  | 4 B  | Mode                         | 0x00 = mode1/2048, 0x02 = mode2/2048, 0x03 = mode2/2336,
+      *        |      |                              | 0x05 = mode1/2352, 0x06 = mode2/2352, 0x07 = audio/2352,
+      *        |      |                              | 0x0F = mode1/2448, 0x10 = audio/2448, 0x11 = mode2/2448
       *   4 B  | 4 B  | Start lba
       *   4 B  | 8 B  | 00
       * ... Repeat for each track (in session)
       */
-      ver_printf(3, "  %s at 0x%X: Size - %d B\n", (chunk_id == ETNF ? "ETNF" : "ETN2"), chunk_offset, chunk_size);
+      ver_printf(ctx, 3, "  %s at 0x%llX: Size - %d B\n", (chunk_id == ETNF ? "ETNF" : "ETN2"), (unsigned long long) chunk_offset, chunk_size);
 
        // ENTF / ENT2 chunks indicate the start of a new TAO session so create a new session and add it to the image
-      nrg_session *session = alloc_nrg_session();
-      add_nrg_session(image, session);
+      nrg_session *session = add_nrg_session(image);
+      if (!session) {
+        r = NON_ALLOC;
+        break;
+      }
       session->burn_mode = TAO;
 
       // Calculate number of tracks from the chunk size
-      session->number_tracks = chunk_size / ((chunk_id == ETNF) ? 20 : 32);
+      const unsigned int number_tracks = chunk_size / ((chunk_id == ETNF) ? 20 : 32);
 
       unsigned int i;
-      for (i = 0; i < session->number_tracks; i++) {
+      for (i = 0; i < number_tracks; i++) {
         // Make a new track and add it to the session
-        nrg_track *track = alloc_nrg_track();
-        add_nrg_track(session, track);
+        nrg_track *track = add_nrg_track(image, session);
+        if (!track) {
+          r = NON_ALLOC;
+          break;
+        }
 
         // Read track data
-        track->track_offset     = (chunk_id == ETNF) ? (uint64_t) fread32u(image_file) : fread64u(image_file);
-        track->length     = (chunk_id == ETNF) ? (uint64_t) fread32u(image_file) : fread64u(image_file);
-        track->track_mode = fread32u(image_file);
-        track->track_lba  = fread32u(image_file);
+        track->track_offset     = (chunk_id == ETNF) ? (uint64_t) chunk_read32u(&c) : chunk_read64u(&c);
+        track->length     = (chunk_id == ETNF) ? (uint64_t) chunk_read32u(&c) : chunk_read64u(&c);
+        track->track_mode = chunk_read32u(&c);
+        track->track_lba  = chunk_read32u(&c);
 
         track->pretrack_mode = track->track_mode;
         track->pretrack_lba  = track->track_lba;
 
         // Convert the track mode
-        if (track->track_mode == ENT_MODE2_2336) {
-          track->track_mode = MODE2;
-          track->sector_size = 2336;
-        }
-        else if (track->track_mode == ENT_MODE2_2352) {
-          track->track_mode = MODE2;
-          track->sector_size = 2352;
-        }
-        else if (track->track_mode == ENT_AUDIO) {
-          track->track_mode = AUDIO;
-          track->sector_size = 2352;
+        const int m = nrg_find_mode(track->track_mode);
+        if (m < 0) {
+          fprintf(stderr, "  Track %d in %s chunk at 0x%llX has an unsupported mode: 0x%X.\n", i, (chunk_id == ETNF ? "ETNF" : "ETN2"), (unsigned long long) chunk_offset, track->track_mode);
+          r = NRG_CORRUPT;
+          break;
         }
+        track->sector_mode = nrg_modes[m].sector_mode;
+        track->sector_size = nrg_modes[m].sector_size;
+        track->track_mode = (track->sector_mode == SECTOR_AUDIO) ? AUDIO : MODE2;
 
         // Fill in the rest of the track data
         track->pretrack_mode = track->track_mode;
-        assert( ((chunk_id == ETNF) ? fread32u(image_file) : fread64u(image_file)) == 0x00);
+        nrg_expect(ctx, &r, (chunk_id == ETNF) ? chunk_read32u(&c) : chunk_read64u(&c), 0x00, "Track padding");
 
-        ver_printf(3, "    Track Offset - 0x%X, Track Length - %d B, Type - %s/%d, Start LBA - 0x%X\n",  track->track_offset, track->length, (track->track_mode == MODE2 ? "Mode2" : (track->track_mode == AUDIO ? "Audio" : "Unknown")), track->sector_size, track->track_lba);
-      }
+        // The track has to actually be in the file
+        if (track->track_offset > file_size || track->length > file_size - track->track_offset) {
+          fprintf(stderr, "  Track %d in %s chunk at 0x%llX lies outside of the file.\n", i, (chunk_id == ETNF ? "ETNF" : "ETN2"), (unsigned long long) chunk_offset);
+          r = NRG_CORRUPT;
+          break;
+        }
 
-      // Update number of tracks in the image
-      image->number_tracks += session->number_tracks;
+        ver_printf(ctx, 3, "    Track Offset - 0x%llX, Track Length - %llu B, Type - %s/%d, Start LBA - 0x%X\n",  (unsigned long long) track->track_offset, (unsigned long long) track->length, nrg_sector_mode_name(track->sector_mode), track->sector_size, track->track_lba);
+      }
+      if (r == NON_ALLOC || r == NRG_CORRUPT)
+        break;
     }
     else if (chunk_id == CDTX) {
       /**
@@ -434,9 +683,8 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       * --------------------------------------------------------------------------------------------------------------------
       *  18 B  | 18 B | CD-text pack
       */
-      ver_printf(3, "  CDTX at 0x%X: Size - %dB\n", chunk_offset, chunk_size);
-      ver_printf(2, "    Ignoring CDTX chunk (unsupported)\n");
-      fseek(image_file, chunk_size, SEEK_CUR);
+      ver_printf(ctx, 3, "  CDTX at 0x%llX: Size - %dB\n", (unsigned long long) chunk_offset, chunk_size);
+      ver_printf(ctx, 2, "    Ignoring CDTX chunk (unsupported)\n");
     }
     else if (chunk_id == SINF) {
       /**
@@ -445,30 +693,24 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       * --------------------------------------------------------------------------------------------------------------------
       *   4 B  | 4 B  | Number tracks in session
       */
-      static unsigned int sinf_number = 0;
-      uint32_t number_tracks = fread32u(image_file);
-      ver_printf(3, "  SINF at 0x%X: Size - %dB, Number of Tracks: %d\n", chunk_offset, chunk_size, number_tracks);
+      uint32_t number_tracks = chunk_read32u(&c);
+      ver_printf(ctx, 3, "  SINF at 0x%llX: Size - %dB, Number of Tracks: %d\n", (unsigned long long) chunk_offset, chunk_size, number_tracks);
 
       // Get the session this SINF tag should be referring to
-      unsigned int i;
-      nrg_session *relevant_session = image->first_session;
-      for (i = 0; i < sinf_number; i ++) {
-        if (relevant_session->next)
-          relevant_session = relevant_session->next;
-        else {
-          ver_printf(3, "    Warning: there are more SINF chunks than there are sessions\n");
-          r = NRG_WARN;
-          relevant_session = NULL;
-          break;
-        }
+      nrg_session *relevant_session = NULL;
+      if (sinf_number < image->number_sessions)
+        relevant_session = &image->sessions[sinf_number];
+      else if (image->number_sessions > 0) {
+        ver_printf(ctx, 3, "    Warning: there are more SINF chunks than there are sessions\n");
+        r = NRG_WARN;
       }
 
       // See if the number of sessions reported by this SINF matches the number of sessions found
       if (relevant_session) {
         if (relevant_session->number_tracks == number_tracks)
-          ver_printf(3, "    Matches number of tracks found for session %d\n", sinf_number + 1);
+          ver_printf(ctx, 3, "    Matches number of tracks found for session %d\n", sinf_number + 1);
         else {
-          ver_printf(3, "    Warning: Doesn't match number of tracks found for session %d\n", sinf_number);
+          ver_printf(ctx, 3, "    Warning: Doesn't match number of tracks found for session %d\n", sinf_number);
           r = NRG_WARN;
         }
       }
@@ -482,58 +724,98 @@ int nrg_parse(FILE *image_file, nrg_image *image) {
       * --------------------------------------------------------------------------------------------------------------------
       *   4 B  | 4 B  | unknown
       */
-      image->media_type = fread32u(image_file);
+      image->media_type = chunk_read32u(&c);
 
-      ver_printf(3, "  MTYP at 0x%X:  Size - %dB, Media Type - 0x%X\n", chunk_offset, chunk_size, image->media_type);
-      ver_printf(2, "    Ignoring MTYP Chunk (unsupported)\n");
-    }
-    else if (chunk_id == END) {
-      ver_printf(3, "  END! at 0x%X\n", chunk_offset);
-      break;
+      ver_printf(ctx, 3, "  MTYP at 0x%llX:  Size - %dB, Media Type - 0x%X\n", (unsigned long long) chunk_offset, chunk_size, image->media_type);
+      ver_printf(ctx, 2, "    Ignoring MTYP Chunk (unsupported)\n");
     }
     else {
-      fprintf(stderr, "  Unrecognized Chunk ID at 0x%X: 0x%X.\n", chunk_offset, chunk_id);
+      fprintf(stderr, "  Unrecognized Chunk ID at 0x%llX: 0x%X.\n", (unsigned long long) chunk_offset, chunk_id);
       r = NRG_WARN;
     }
+
+    // If the chunk ran out before everything it describes was read, nothing after this can be trusted
+    if (c.overrun) {
+      fprintf(stderr, "  Chunk at 0x%llX is too short for the data it describes.\n", (unsigned long long) chunk_offset);
+      r = NRG_CORRUPT;
+      break;
+    }
   }
 
-  // If the eof was reached, there was a problem so tell the user.
-  if (feof(image_file)) {
-    ver_printf(1,   "WARNING: End of file reached. This should not have happened.\n");
-    if (get_verbosity() < 3)
-      ver_printf(1, "         Try running again with -vv to see chunk processing output to see what went wrong\n");
+  free(buffer);
+
+  // Every track needs to have been described by a DAOI / DAOX or ETNF / ETN2 chunk to be ripped
+  if (r == 0 || r == NRG_WARN) {
+    unsigned int i;
+    for (i = 0; i < image->number_tracks; i++)
+      if (image->tracks[i].sector_size == 0) {
+        fprintf(stderr, "  Track %d has no sector size or offset information.\n", image->tracks[i].number);
+        r = NRG_CORRUPT;
+        break;
+      }
+  }
+
+  // Index the tracks by LBA so sectors can be found quickly
+  if ((r == 0 || r == NRG_WARN) && nrg_index_lbas(image) != 0)
+    r = NON_ALLOC;
+
+  // If the end of the chunk data was reached without an END! chunk, there was a problem so tell the user.
+  if (!found_end) {
+    ver_printf(ctx, 1,   "WARNING: End of file reached. This should not have happened.\n");
+    if (!ctx || ctx->verbosity < 3)
+      ver_printf(ctx, 1, "         Try running again with -vv to see chunk processing output to see what went wrong\n");
     else
-      ver_printf(3, "         See output above to see what went wrong\n");
-    ver_printf(1,   "         This was likely a bug in nerorip so please report to %s\n", WEBSITE);
+      ver_printf(ctx, 3, "         See output above to see what went wrong\n");
+    ver_printf(ctx, 1,   "         This was likely a bug in nerorip so please report to %s\n", WEBSITE);
 
-    r = NRG_WARN;
+    if (r == 0)
+      r = NRG_WARN;
   }
 
-  ver_printf(3, "Done processing chunk data.\n");
+  ver_printf(ctx, 3, "Done processing chunk data.\n");
+  return r;
+}
+
+// Parses the chunk data in the image file to fill in nrg_image data structure
+int nrg_parse(nerorip_context *ctx, image_source *source, nrg_image *image) {
+  // Make sure properly allocated
+  if (!source || !image)
+    return NON_ALLOC;
+
+  uint64_t bytes_read = 0, read_calls = 0;
+  stats_clock clock = stats_now();
+  int r = nrg_parse_chunks(ctx, source, image, &bytes_read, &read_calls);
+
+  // Count it if the context wants stats
+  if (ctx && ctx->stats) {
+    stats_add(&ctx->stats->parse, &clock);
+    ctx->stats->parse_bytes_read += bytes_read;
+    ctx->stats->parse_read_calls += read_calls;
+  }
   return r;
 }
 
 
 // Prints out all gathered information about the nrg image
-void nrg_print(int ver, nrg_image *image) {
-  ver_printf(ver, "Loaded a Nero %s image containing the following data:\n", (image->nrg_version == NRG_VER_55 ? "5.5" : "5.0"));
+void nrg_print(nerorip_context *ctx, int ver, nrg_image *image) {
+  ver_printf(ctx, ver, "Loaded a Nero %s image containing the following data:\n", (image->nrg_version == NRG_VER_55 ? "5.5" : "5.0"));
 
   // All session data
-  nrg_session *session;
-  unsigned int s = 1, t = 1;
-  for (session = image->first_session; session != NULL; session = session->next, s++) {
-    ver_printf(ver, "  Session %d has %d track(s):\n", s, session->number_tracks);
+  unsigned int s, t;
+  for (s = 0; s < image->number_sessions; s++) {
+    nrg_session *session = &image->sessions[s];
+    ver_printf(ctx, ver, "  Session %d has %d track(s):\n", s + 1, session->number_tracks);
 
     // All tracks in this session
-    nrg_track *track;
-    for (track = session->first_track; track != NULL; track = track->next, t++) {
-      ver_printf(ver, "    Track: %d\tType: %s/%d\tSize: %6d\t", t, (track->track_mode == MODE2 ? "Mode2" : (track->track_mode == AUDIO ? "Audio" : "Unknown")), track->sector_size, track->length / track->sector_size);
+    for (t = 0; t < session->number_tracks; t++) {
+      nrg_track *track = &image->tracks[session->first_track_index + t];
+      ver_printf(ctx, ver, "    Track: %d\tType: %s/%d\tSize: %6llu\t", track->number, nrg_sector_mode_name(track->sector_mode), track->sector_size, (unsigned long long) (track->length / track->sector_size));
       if (session->burn_mode == TAO)
-        ver_printf(ver, "Offset: 0x%06X\tLBA:%6d\n", track->track_offset, track->track_lba);
+        ver_printf(ctx, ver, "Offset: 0x%06llX\tLBA:%6d\n", (unsigned long long) track->track_offset, track->track_lba);
       else
-        ver_printf(ver, "Pretrack offset: 0x%06X\tPretrack LBA: %6d\tTrack Offset: 0x%06X\tTrack LBA: %6d\n", track->pretrack_offset, track->pretrack_lba, track->track_offset, track->track_lba);
+        ver_printf(ctx, ver, "Pretrack offset: 0x%06llX\tPretrack LBA: %6d\tTrack Offset: 0x%06llX\tTrack LBA: %6d\n", (unsigned long long) track->pretrack_offset, track->pretrack_lba, (unsigned long long) track->track_offset, track->track_lba);
     }
 
-    ver_printf(ver, "\n");
+    ver_printf(ctx, ver, "\n");
   }
 }
@@ -24,8 +24,8 @@
 #include <string.h> // strerror()
 #include <stdint.h> // uintXX_t types
 #include <byteswap.h> // for bswap_XX functions
-#include <assert.h>
 #include "util.h"
+#include "source.h"
 
 // Nero Image defines
 #define NER5 0x4e455235
@@ -46,9 +46,25 @@
 #define TOC_AUDIO 0x00
 #define DAO_MODE2 0x03000001
 #define DAO_AUDIO 0x07000001
+#define DAO_AUDIO_SUB 0x10000001
+#define DAO_MODE2_SUB 0x11000001
+// Nero track modes, as found in ETNF / ETN2 chunks and in the top byte of the mode in DAOI / DAOX chunks
+#define ENT_MODE1_2048 0x00
+#define ENT_MODE2_2048 0x02
 #define ENT_MODE2_2336 0x03
+#define ENT_MODE1_2352 0x05
 #define ENT_MODE2_2352 0x06
 #define ENT_AUDIO      0x07
+#define ENT_MODE1_SUB  0x0F
+#define ENT_AUDIO_SUB  0x10
+#define ENT_MODE2_SUB  0x11
+// Turns a Nero track mode into the mode of a DAOI / DAOX chunk
+#define DAO_MODE(mode) (((uint32_t) (mode) << 24) | 0x000001)
+
+// What the sectors of a track hold, going by its Nero track mode
+#define SECTOR_AUDIO 1
+#define SECTOR_MODE1 2
+#define SECTOR_MODE2 3
 
 // Defines nero image versions
 #define NRG_VER_55 2
@@ -64,6 +80,17 @@
 #define NON_ALLOC -2
 // Indicates that something unexpected happened while parsing the file.
 #define NRG_WARN -3
+// Indicates that a chunk runs past the end of the file
+#define NRG_TRUNCATED -4
+// Indicates that the chunk data doesn't make sense, so the image can't be ripped
+#define NRG_CORRUPT -5
+// Indicates that the chunk data could not be read from the file
+#define NRG_READ_ERR -6
+
+// Largest sector size a track can have: a raw 2352 byte sector plus 96 bytes of subchannel data
+#define NRG_MAX_SECTOR_SIZE 2448
+// Largest amount of chunk data an image can have. Even 99 tracks only need a few KB
+#define NRG_MAX_CHUNK_DATA (16 * 1024 * 1024)
 
 /*
  * DATA STRUCTURES
@@ -73,13 +100,13 @@
  * Nero image track struct
  *
  * Manages all data relevant to a track in the nero image.
- * Keeps a pointer to the next track making this a linked list.
+ * All the tracks in an image are kept in one array in the nrg_image, in order.
  *
  * @author Joe Balough
  */
 typedef struct {
-  // Pointer to the next track
-  struct nrg_track *next;
+  // Number of this track in the whole image (starting at 1). Track n is image->tracks[n - 1]
+  unsigned int number;
 
   /*
    * Track data
@@ -96,8 +123,9 @@ typedef struct {
   uint64_t pretrack_offset;
   uint64_t track_offset;
 
-  // Sector size used by this track
+  // Sector size used by this track and what its sectors hold: SECTOR_AUDIO, SECTOR_MODE1 or SECTOR_MODE2
   uint32_t sector_size;
+  uint8_t sector_mode;
   // Where index 1 track data ends
   uint64_t next_offset;
 
@@ -111,16 +139,14 @@ typedef struct {
  * Nero image session struct
  *
  * Manages all data relevant to a session in the nero image.
- * Keeps a pointer to the next session making this a linked list.
+ * All the sessions in an image are kept in one array in the nrg_image, in order.
  *
  * @author Joe Balough
  */
 typedef struct {
-  // Pointer to the next session
-  struct nrg_session *next;
-
-  // Pointer to the front of the list of tracks in this session and the number of them
-  nrg_track *first_track, *last_track;
+  // Index in image->tracks of the first track in this session and the number of them.
+  // The tracks of a session are always next to each other in the array.
+  unsigned int first_track_index;
   unsigned int number_tracks;
 
   /*
@@ -141,6 +167,24 @@ typedef struct {
 } nrg_session;
 
 
+/**
+ * LBA index entry
+ *
+ * Says where the index 1 data of one track is, both on the disc and in the image file.
+ * nrg_image keeps one of these per track sorted by LBA so a sector can be found with a binary search.
+ */
+typedef struct {
+  // First LBA of the track and how many sectors it has
+  uint32_t lba;
+  uint32_t sectors;
+  // Where the track starts in the image file and the size of its sectors
+  uint64_t offset;
+  uint32_t sector_size;
+  // Number of the track in the whole image (starting at 1)
+  unsigned int track;
+} nrg_lba_entry;
+
+
 /**
  * Nero image struct
  *
@@ -149,9 +193,16 @@ typedef struct {
  * @author Joe Balough
  */
 typedef struct {
-  // Pointer to the list of sessions and number of sessions
-  nrg_session *first_session, *last_session;
-  unsigned int number_sessions;
+  // Array of all the sessions, how many there are and how many there is room for
+  nrg_session *sessions;
+  unsigned int number_sessions, sessions_allocated;
+
+  // Array of all the tracks in every session, how many there are and how many there is room for
+  nrg_track *tracks;
+  unsigned int number_tracks, tracks_allocated;
+
+  // Every track sorted by its index 1 LBA, built once the image has been parsed
+  nrg_lba_entry *lba_index;
 
   /*
    * Image data
@@ -163,8 +214,6 @@ typedef struct {
   int nrg_version;
   // Value from the MTYP chunk (0x0 if not set)
   uint32_t media_type;
-  // Total number of tracks in this image
-  unsigned int number_tracks;
 
 } nrg_image;
 
@@ -197,48 +246,61 @@ void free_nrg_image(nrg_image *image);
 
 
 /**
- * Allocate memory for an nrg_session struct and return a pointer to it.
+ * Add a new session to the end of the passed nrg_image.
+ * The session is zeroed out and has no tracks.
+ *
+ * @param nrg_image *image
+ *   The nrg_image to which the session should be added
  * @return *nrg_session
- *   A pointer to the properly allocated nrg_session struct
- * @author Joe Balough
+ *   A pointer to the new session or NULL if there wasn't memory for it.
+ *   The pointer is only good until the next session is added.
  */
-nrg_session *alloc_nrg_session();
+nrg_session *add_nrg_session(nrg_image *image);
 
 
 /**
- * Allocate memory for an nrg_track struct and return a pointer to it.
+ * Add a new track to the end of the passed session.
+ * Only the last session of an image can have tracks added to it, so that the tracks of every session
+ * stay next to each other in image->tracks.
+ *
+ * @param nrg_image *image
+ *   The nrg_image the session belongs to
+ * @param nrg_session *session
+ *   The session to which the track should be added. Must be the last session in image
  * @return *nrg_track
- *   A pointer to the properly allocated nrg_track struct
- * @author Joe Balough
+ *   A pointer to the new, zeroed out track or NULL if there wasn't memory for it.
+ *   The pointer is only good until the next track is added.
  */
-nrg_track *alloc_nrg_track();
+nrg_track *add_nrg_track(nrg_image *image, nrg_session *session);
+
 
 /**
- * Adds an nrg_track to the list in the passed nrg_session.
- * The track should be allocated before calling.
- * If session or track is NULL, the function will simply return having done nothing.
+ * Get a track by its number in the whole image, in constant time.
  *
- * @param nrg_session *session
- *   The nrg_session to which the track should be added
- * @param nrg_track *track
- *   The nrg_track to add
- * @author Joe Balough
+ * @param nrg_image *image
+ *   The parsed image
+ * @param unsigned int number
+ *   The track number (starting at 1)
+ * @return *nrg_track
+ *   The track or NULL if there is no track with that number
  */
-void add_nrg_track(nrg_session *session, nrg_track *track);
+nrg_track *get_nrg_track(nrg_image *image, unsigned int number);
 
 
 /**
- * Adds an nrg_session to the list in the passed nrg_image.
- * The session should be allocated before calling.
- * If image or session is NULL, the function will simply return having done nothing.
+ * Find the track holding a sector, using a binary search of the LBA index.
+ * nrg_parse() builds the index once it has parsed the image.
  *
  * @param nrg_image *image
- *   The nrg_image to which the session should be added
- * @param nrg_session *session
- *   The nrg_session to add
- * @author Joe Balough
+ *   The parsed image
+ * @param uint32_t lba
+ *   The LBA of the wanted sector
+ * @param uint64_t *offset
+ *   If not NULL, set to where the sector starts in the image file
+ * @return *nrg_track
+ *   The track holding the sector or NULL if no track has it
  */
-void add_nrg_session(nrg_image *image, nrg_session *session);
+nrg_track *nrg_find_lba(nrg_image *image, uint32_t lba, uint64_t *offset);
 
 
 /**
@@ -246,29 +308,44 @@ void add_nrg_session(nrg_image *image, nrg_session *session);
  * and fill in the image data structure.
  * When this function returns, image will completely describe the image file.
  *
- * @param FILE* image_file
- *   File pointer to already opened nero image file
+ * All of the chunk data, from first_chunk_offset to the end of the file, is read with one read
+ * (or used straight out of the mapping) and decoded from memory. Every chunk is checked against its
+ * own size and the end of the file, so a damaged image gets an error code instead of a crash.
+ * Unexpected values in fields that should be fixed are reported at verbosity 2 and parsing carries on.
+ *
+ * Everything the parser keeps track of lives on the stack or in image, so several images can be parsed at once.
+ *
+ * @param nerorip_context *ctx
+ *   The context to report progress to
+ * @param image_source* source
+ *   Already opened nero image file
  * @param nrg_image* image
  *   The already allocated nrg_image struct to fill
  * @return
  *   0 on success
- *   NRG_WARN if unrecognized chunks were encountered
- *   NON_ALLOC if nrg_image or image_file not allocated
+ *   NRG_WARN if unrecognized chunks or unexpected values were encountered
+ *   NON_ALLOC if nrg_image or source not allocated
+ *   NOT_NRG if the file does not have a nero image footer
+ *   NRG_TRUNCATED if a chunk runs past the end of the file
+ *   NRG_CORRUPT if the chunks don't make sense
+ *   NRG_READ_ERR if the chunk data could not be read
  * @author Joe Balough
  */
-int nrg_parse(FILE *image_file, nrg_image *image);
+int nrg_parse(nerorip_context *ctx, image_source *source, nrg_image *image);
 
 
 /**
  * Print out all gathered information about the passed nrg image.
  *
+ * @param nerorip_context *ctx
+ *   The context to print to
  * @param int verbosity
  *   On what verbosity level should the data be printed
  * @param nrg_image *image
  *   Pointer to the loaded nrg_image data structure
  * @author Joe Balough
  */
-void nrg_print(int verbosity, nrg_image *image);
+void nrg_print(nerorip_context *ctx, int verbosity, nrg_image *image);
 
 
 #endif
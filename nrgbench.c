@@ -0,0 +1,214 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * nrgbench
+ *
+ * Runs nerorip on an image a few times and reports how fast it went, how much CPU time it took
+ * and how much memory it needed at most. Used by make bench.
+ * With -c it times a plain copy of the image instead, which is as fast as the disk lets anything go.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Runs done for each measurement if -n isn't given
+#define BENCH_RUNS 3
+// Size of the buffer a plain copy goes through
+#define BENCH_COPY_BUFFER (1024 * 1024)
+
+// Set by -c: time copying the image instead of running nerorip
+static int copy_only = 0;
+
+
+// Converts a timeval to seconds
+static double bench_seconds(struct timeval *t) {
+  return t->tv_sec + t->tv_usec / 1e6;
+}
+
+
+// Copies the image to a file with read() and write(), like cp would. Returns 0 on success
+static int bench_copy(const char *image, const char *copy) {
+  int in = open(image, O_RDONLY);
+  int out = open(copy, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  char *buffer = malloc(BENCH_COPY_BUFFER);
+  if (in < 0 || out < 0 || !buffer) {
+    fprintf(stderr, "Failed to set up copying %s to %s: %s\n", image, copy, strerror(errno));
+    return -1;
+  }
+
+  ssize_t r;
+  while ((r = read(in, buffer, BENCH_COPY_BUFFER)) > 0) {
+    ssize_t w = 0;
+    while (w < r) {
+      ssize_t n = write(out, buffer + w, r - w);
+      if (n < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", copy, strerror(errno));
+        return -1;
+      }
+      w += n;
+    }
+  }
+  if (r < 0) {
+    fprintf(stderr, "Failed to read %s: %s\n", image, strerror(errno));
+    return -1;
+  }
+
+  free(buffer);
+  close(in);
+  return close(out);
+}
+
+// Runs the command once, or with -c copies command[0] to command[1].
+// Returns 0 on success and fills in the wall time and the child's resource usage
+static int bench_run(char **command, double *wall, struct rusage *usage) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid == 0) {
+    if (copy_only)
+      _exit(bench_copy(command[0], command[1]) == 0 ? 0 : 1);
+    execv(command[0], command);
+    fprintf(stderr, "Failed to run %s: %s\n", command[0], strerror(errno));
+    _exit(127);
+  }
+
+  int status;
+  if (wait4(pid, &status, 0, usage) < 0) {
+    fprintf(stderr, "Failed to wait for %s: %s\n", command[0], strerror(errno));
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed with status %d\n", command[0], status);
+    return -1;
+  }
+  return 0;
+}
+
+
+void usage(char *argv0) {
+  printf("Usage: %s [-n RUNS] [-l LABEL] NERORIP IMAGE OUTPUT_DIRECTORY [NERORIP OPTIONS]...\n", argv0);
+  printf("  or:  %s -c [-n RUNS] [-l LABEL] IMAGE OUTPUT_DIRECTORY\n", argv0);
+  printf("Runs NERORIP -q [NERORIP OPTIONS] IMAGE OUTPUT_DIRECTORY RUNS times (default %d) and prints\n", BENCH_RUNS);
+  printf("the image size divided by the fastest run in MB/s, the CPU time and peak RSS of that run.\n");
+  printf("With -c, IMAGE is copied into OUTPUT_DIRECTORY with read() and write() instead, to show how fast the disk is.\n");
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+  int runs = BENCH_RUNS;
+  const char *label = NULL;
+
+  int c;
+  while ((c = getopt(argc, argv, "+n:l:ch")) != -1) {
+    switch (c) {
+      case 'c': copy_only = 1; break;
+      case 'n': runs = atoi(optarg); break;
+      case 'l': label = optarg; break;
+      case 'h': usage(argv[0]); break;
+      default: exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind < 3 - copy_only || runs < 1)
+    usage(argv[0]);
+
+  // -c has no NERORIP or options
+  char *nerorip = (copy_only) ? NULL : argv[optind];
+  char *image = argv[optind + 1 - copy_only];
+  char *output_dir = argv[optind + 2 - copy_only];
+  char **options = argv + optind + 3 - copy_only;
+  int number_options = (copy_only) ? 0 : argc - optind - 3;
+
+  struct stat s;
+  if (stat(image, &s) != 0) {
+    fprintf(stderr, "Error opening %s: %s\n", image, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // nerorip -q [options] image output_dir, or the image and where its copy goes for -c
+  char **command = malloc(sizeof(char *) * (number_options + 5));
+  if (!command)
+    exit(EXIT_FAILURE);
+  int i, n = 0;
+  char copy[4096];
+  if (copy_only) {
+    snprintf(copy, sizeof(copy), "%s/copy.nrg", output_dir);
+    command[n++] = image;
+    command[n++] = copy;
+    command[n] = NULL;
+  }
+  else {
+    command[n++] = nerorip;
+    command[n++] = "-q";
+    for (i = 0; i < number_options; i++)
+      command[n++] = options[i];
+    command[n++] = image;
+    command[n++] = output_dir;
+    command[n] = NULL;
+  }
+
+  // Keep the fastest run. The first one usually pays for getting the image into the page cache
+  double best_wall = 0;
+  struct rusage best;
+  for (i = 0; i < runs; i++) {
+    double wall;
+    struct rusage usage;
+    if (bench_run(command, &wall, &usage) != 0)
+      exit(EXIT_FAILURE);
+    if (i == 0 || wall < best_wall) {
+      best_wall = wall;
+      best = usage;
+    }
+  }
+
+  // The label defaults to the options used
+  char options_str[256] = "";
+  for (i = 0; i < number_options; i++) {
+    strncat(options_str, options[i], sizeof(options_str) - strlen(options_str) - 1);
+    strncat(options_str, " ", sizeof(options_str) - strlen(options_str) - 1);
+  }
+  if (!label)
+    label = (copy_only) ? "(plain copy)" : ((number_options) ? options_str : "(defaults)");
+
+  const char *name = strrchr(image, '/');
+  name = (name) ? name + 1 : image;
+  double mb = s.st_size / (1024.0 * 1024.0);
+  printf("%-16s %-24s %9.1f MB/s %8.3fs wall %8.3fs user %8.3fs sys %8.1f MB peak RSS\n", name, label, mb / best_wall, best_wall,
+         bench_seconds(&best.ru_utime), bench_seconds(&best.ru_stime), best.ru_maxrss / 1024.0);
+
+  free(command);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,583 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * nrgcheck
+ *
+ * Checks the hot kernels of libnerorip against plain reference versions: every implementation the CPU
+ * can run is compared with the scalar one (or a bit at a time version) for all the lengths and alignments
+ * that matter, and the hashes against known answers. Given a directory, it also checks the images make check
+ * writes there with nrggen. Used by make check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h> // uintXX_t types
+#include "nerorip.h"
+#include "iso.h"
+
+// Lengths and buffer offsets the swap, CRC32 and EDC kernels are checked with
+#define CHECK_LENGTHS 1100
+#define CHECK_OFFSETS 64
+// Room for the longest check at the largest offset, plus a guard after it
+#define CHECK_BUFFER (CHECK_LENGTHS + CHECK_OFFSETS + 64)
+
+// Number of checks that failed
+static unsigned int failures = 0;
+
+
+// Prints the result of one check
+static void check_report(const char *what, const char *variant, int ok) {
+  printf("%-24s %-8s %s\n", what, variant, ok ? "ok" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+// Fills a buffer with pseudo-random bytes that are the same every run
+static void check_fill(uint8_t *buffer, size_t length, uint64_t seed) {
+  uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buffer[i] = x >> 24;
+  }
+}
+
+
+/*
+ * swap_buffer
+ */
+typedef void (*swap_fn)(uint8_t *, unsigned int);
+
+// Swaps every length and offset with the variant and the scalar version and compares the whole buffer,
+// so a variant that touches bytes outside of what it was given is caught too
+static int check_swap_variant(swap_fn swap) {
+  static uint8_t expected[CHECK_BUFFER], got[CHECK_BUFFER];
+  unsigned int length, offset;
+  for (length = 0; length <= CHECK_LENGTHS; length++) {
+    for (offset = 0; offset < CHECK_OFFSETS; offset++) {
+      check_fill(expected, CHECK_BUFFER, length * CHECK_OFFSETS + offset);
+      memcpy(got, expected, CHECK_BUFFER);
+      swap_buffer_scalar(expected + offset, length);
+      swap(got + offset, length);
+      if (memcmp(expected, got, CHECK_BUFFER) != 0)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static void check_swap() {
+  // The scalar version itself is checked by hand against what swapping means
+  uint8_t buffer[5] = {1, 2, 3, 4, 5};
+  swap_buffer_scalar(buffer, 5);
+  check_report("swap_buffer", "scalar", memcmp(buffer, "\2\1\4\3\5", 5) == 0);
+
+#ifdef HAVE_X86_SWAP
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    check_report("swap_buffer", "sse2", check_swap_variant(swap_buffer_sse2));
+  if (__builtin_cpu_supports("ssse3"))
+    check_report("swap_buffer", "ssse3", check_swap_variant(swap_buffer_ssse3));
+  if (__builtin_cpu_supports("avx2"))
+    check_report("swap_buffer", "avx2", check_swap_variant(swap_buffer_avx2));
+#endif
+  check_report("swap_buffer", "library", check_swap_variant(swap_buffer));
+}
+
+
+/*
+ * CRC32 and EDC, which are the same thing with different polynomials
+ */
+typedef uint32_t (*crc_fn)(uint32_t, const uint8_t *, size_t);
+
+// The textbook reflected CRC, one bit at a time. CRC32 inverts before and after, the EDC doesn't
+static uint32_t check_crc_bitwise(uint32_t crc, const uint8_t *data, size_t length, uint32_t polynomial, int inverted) {
+  if (inverted)
+    crc = ~crc;
+  size_t i;
+  unsigned int b;
+  for (i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+  }
+  return (inverted) ? ~crc : crc;
+}
+
+// Compares an implementation with the bit at a time version for every length and offset, carrying on from a
+// CRC of something before it so the starting value is checked too
+static int check_crc_variant(crc_fn crc, uint32_t polynomial, int inverted) {
+  static uint8_t buffer[CHECK_BUFFER];
+  check_fill(buffer, CHECK_BUFFER, polynomial);
+  unsigned int length, offset;
+  for (length = 0; length <= CHECK_LENGTHS; length++) {
+    for (offset = 0; offset < CHECK_OFFSETS; offset++) {
+      const uint32_t start = length * 0x01000193 + offset;
+      if (crc(start, buffer + offset, length) != check_crc_bitwise(start, buffer + offset, length, polynomial, inverted))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static void check_crc32() {
+  check_report("crc32 known answer", "library", crc32_update(0, (const uint8_t *) "123456789", 9) == 0xCBF43926);
+  check_report("crc32", "scalar", check_crc_variant(crc32_scalar, 0xEDB88320, 1));
+#ifdef HAVE_X86_HASH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    check_report("crc32", "pclmul", check_crc_variant(crc32_pclmul, 0xEDB88320, 1));
+#endif
+}
+
+static void check_edc() {
+  // 0x8001801B reflected
+  check_report("edc", "scalar", check_crc_variant(edc_compute_scalar, 0xD8018001, 0));
+#ifdef HAVE_X86_EDC
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    check_report("edc", "pclmul", check_crc_variant(edc_compute_pclmul, 0xD8018001, 0));
+#endif
+}
+
+
+/*
+ * MD5 and SHA-1
+ */
+static int check_digest(const uint8_t *digest, const char *hex, unsigned int length) {
+  char got[41];
+  unsigned int i;
+  for (i = 0; i < length; i++)
+    sprintf(got + 2 * i, "%02x", digest[i]);
+  return strcmp(got, hex) == 0;
+}
+
+// Hashes a message in pieces of every size up to 130 bytes so all the ways of filling a block get used
+static int check_sha1_pieces(const uint8_t *message, size_t length, const char *hex) {
+  unsigned int piece;
+  for (piece = 1; piece <= 130; piece++) {
+    sha1_context ctx;
+    uint8_t digest[20];
+    size_t i;
+    sha1_init(&ctx);
+    for (i = 0; i < length; i += piece)
+      sha1_update(&ctx, message + i, (length - i > piece) ? piece : length - i);
+    sha1_final(&ctx, digest);
+    if (!check_digest(digest, hex, 20))
+      return 0;
+  }
+  return 1;
+}
+
+typedef void (*sha1_blocks_fn)(uint32_t *, const uint8_t *, size_t);
+
+// Compares the block function with the scalar one for up to 20 blocks at every offset
+static int check_sha1_variant(sha1_blocks_fn blocks) {
+  static uint8_t buffer[20 * 64 + CHECK_OFFSETS];
+  check_fill(buffer, sizeof(buffer), 1);
+  unsigned int count, offset;
+  for (count = 0; count <= 20; count++) {
+    for (offset = 0; offset < CHECK_OFFSETS; offset++) {
+      uint32_t expected[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+      uint32_t got[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+      sha1_blocks_scalar(expected, buffer + offset, count);
+      blocks(got, buffer + offset, count);
+      if (memcmp(expected, got, sizeof(got)) != 0)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static void check_hashes() {
+  static const char *long_message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+  md5_context md5;
+  uint8_t digest[20];
+  md5_init(&md5);
+  md5_update(&md5, (const uint8_t *) "abc", 3);
+  md5_final(&md5, digest);
+  check_report("md5 known answer", "library", check_digest(digest, "900150983cd24fb0d6963f7d28e17f72", 16));
+
+  check_report("sha1 known answer", "library",
+               check_sha1_pieces((const uint8_t *) "abc", 3, "a9993e364706816aba3e25717850c26c9cd0d89d") &&
+               check_sha1_pieces((const uint8_t *) long_message, strlen(long_message), "84983e441c3bd26ebaae4aa1f95129e5e54670f1") &&
+               check_sha1_pieces((const uint8_t *) "", 0, "da39a3ee5e6b4b0d3255bfef95601890afd80709"));
+#ifdef HAVE_X86_HASH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+    check_report("sha1 blocks", "sha", check_sha1_variant(sha1_blocks_shani));
+#endif
+}
+
+
+/*
+ * ECC and whole sector checks
+ */
+// The usual byte at a time ECC: one codeword at a time, looking each byte up in the sector
+static uint8_t ecc_f_lut[256], ecc_b_lut[256];
+static void ecc_generic_block(const uint8_t *src, unsigned int major_count, unsigned int minor_count,
+                              unsigned int major_mult, unsigned int minor_inc, uint8_t *dest) {
+  const unsigned int size = major_count * minor_count;
+  unsigned int major, minor;
+  for (major = 0; major < major_count; major++) {
+    unsigned int index = (major >> 1) * major_mult + (major & 1);
+    uint8_t a = 0, b = 0;
+    for (minor = 0; minor < minor_count; minor++) {
+      const uint8_t t = src[index];
+      index += minor_inc;
+      if (index >= size)
+        index -= size;
+      a = ecc_f_lut[a ^ t];
+      b ^= t;
+    }
+    a = ecc_b_lut[ecc_f_lut[a] ^ b];
+    dest[major] = a;
+    dest[major + major_count] = a ^ b;
+  }
+}
+
+static int check_ecc_variant() {
+  unsigned int n;
+  for (n = 0; n < 256; n++) {
+    ecc_f_lut[n] = (n << 1) ^ ((n & 0x80) ? 0x1d : 0);
+    ecc_b_lut[n ^ ecc_f_lut[n]] = n;
+  }
+
+  uint8_t data[2340], expected[276], got[276];
+  for (n = 0; n < 64; n++) {
+    check_fill(data, sizeof(data), n);
+    ecc_generic_block(data, 86, 24, 2, 86, expected);
+    ecc_generic_block(data, 52, 43, 86, 88, expected + 172);
+    ecc_compute_p(data, got);
+    ecc_compute_q(data, got + 172);
+    if (memcmp(expected, got, sizeof(got)) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Makes a sector of each kind, checks that it passes and that damage anywhere in it is found
+static int check_sector(unsigned int sector_size, uint8_t mode, int form2) {
+  static const uint8_t sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+  uint8_t sector[2352];
+  check_fill(sector, sizeof(sector), sector_size + mode + form2);
+  if (sector_size == 2352) {
+    memcpy(sector, sync, 12);
+    sector[15] = mode;
+  }
+  if (mode == 2) {
+    uint8_t *subheader = sector + ((sector_size == 2352) ? 16 : 0);
+    memset(subheader, 0, 8);
+    subheader[2] = subheader[6] = (form2) ? 0x20 : 0x08;
+  }
+  edc_generate_sector(sector, sector_size);
+  if (edc_check_sector(sector, sector_size) != EDC_OK)
+    return 0;
+
+  // Damage past the subheader, in the user data and in the EDC (or the ECC for Form1 and Mode1)
+  const unsigned int places[3] = {sector_size - 2352 + 100, sector_size - 2352 + 1000, sector_size - 2352 + ((form2) ? 2350 : 2100)};
+  unsigned int i;
+  for (i = 0; i < 3; i++) {
+    sector[places[i]] ^= 0x40;
+    int r = edc_check_sector(sector, sector_size);
+    sector[places[i]] ^= 0x40;
+    if (r == EDC_OK)
+      return 0;
+  }
+  return 1;
+}
+
+static void check_ecc() {
+  check_report("ecc", "library", check_ecc_variant());
+  check_report("sector mode1/2352", "library", check_sector(2352, 1, 0));
+  check_report("sector form1/2352", "library", check_sector(2352, 2, 0));
+  check_report("sector form2/2352", "library", check_sector(2352, 2, 1));
+  check_report("sector form1/2336", "library", check_sector(2336, 2, 0));
+  check_report("sector form2/2336", "library", check_sector(2336, 2, 1));
+}
+
+
+/*
+ * Subchannel deinterleaving
+ */
+typedef void (*sub_fn)(uint8_t *, const uint8_t *, unsigned int, unsigned int);
+
+// The reference moves one bit at a time
+static void check_sub_bitwise(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride) {
+  unsigned int i, b, c;
+  for (i = 0; i < count; i++, out += SUB_LENGTH, sub += stride) {
+    memset(out, 0, SUB_LENGTH);
+    for (b = 0; b < SUB_LENGTH; b++)
+      for (c = 0; c < 8; c++)
+        out[c * SUB_CHANNEL_LENGTH + b / 8] |= ((sub[b] >> (7 - c)) & 1) << (7 - b % 8);
+  }
+}
+
+// Compares a variant with the reference for up to 40 sectors at every offset, with a guard after the output
+static int check_sub_variant(sub_fn deinterleave, unsigned int stride) {
+  static uint8_t sectors[40 * 2448 + CHECK_OFFSETS], expected[40 * SUB_LENGTH + 64], got[40 * SUB_LENGTH + 64];
+  check_fill(sectors, sizeof(sectors), stride);
+  unsigned int count, offset;
+  for (count = 0; count <= 40; count++) {
+    for (offset = 0; offset < CHECK_OFFSETS; offset++) {
+      memset(expected, 0xA5, sizeof(expected));
+      memset(got, 0xA5, sizeof(got));
+      check_sub_bitwise(expected, sectors + offset, count, stride);
+      deinterleave(got, sectors + offset, count, stride);
+      if (memcmp(expected, got, sizeof(got)) != 0)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// The library function on whole sectors, including the Q only ones
+static int check_sub_library() {
+  static uint8_t sectors[16 * 2448], expected[16 * SUB_LENGTH], got[16 * SUB_LENGTH];
+  check_fill(sectors, sizeof(sectors), 3);
+  check_sub_bitwise(expected, sectors + 2352, 16, 2448);
+  sub_deinterleave(got, sectors, 16, 2448, SUB_LENGTH);
+  if (memcmp(expected, got, sizeof(got)) != 0)
+    return 0;
+
+  unsigned int i;
+  memset(expected, 0, sizeof(expected));
+  for (i = 0; i < 16; i++)
+    memcpy(expected + i * SUB_LENGTH + SUB_CHANNEL_LENGTH, sectors + i * 2368 + 2352, SUB_CHANNEL_LENGTH);
+  sub_deinterleave(got, sectors, 16, 2368, SUB_Q_LENGTH);
+  return memcmp(expected, got, sizeof(got)) == 0;
+}
+
+static void check_sub() {
+  check_report("subchannel 2448", "scalar", check_sub_variant(sub_deinterleave_scalar, 2448));
+  check_report("subchannel 96", "scalar", check_sub_variant(sub_deinterleave_scalar, SUB_LENGTH));
+#ifdef HAVE_X86_SUB
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    check_report("subchannel 2448", "sse2", check_sub_variant(sub_deinterleave_sse2, 2448));
+    check_report("subchannel 96", "sse2", check_sub_variant(sub_deinterleave_sse2, SUB_LENGTH));
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    check_report("subchannel 2448", "avx2", check_sub_variant(sub_deinterleave_avx2, 2448));
+    check_report("subchannel 96", "avx2", check_sub_variant(sub_deinterleave_avx2, SUB_LENGTH));
+  }
+#endif
+  check_report("subchannel 2448/2368", "library", check_sub_library());
+}
+
+
+/*
+ * Images written by nrggen
+ */
+// Opens and parses an image. Returns NULL if that fails
+static nrg_image *check_open(nerorip_context *ctx, const char *filename, image_source **source) {
+  *source = src_open(ctx, filename);
+  if (!*source) {
+    fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+    return NULL;
+  }
+  nrg_image *image = alloc_nrg_image();
+  if (!image || nrg_parse(ctx, *source, image) != 0) {
+    free_nrg_image(image);
+    src_close(*source);
+    return NULL;
+  }
+  return image;
+}
+
+// Writes a directory record
+static unsigned int check_iso_record(uint8_t *record, uint32_t lba, uint32_t length, int directory, const uint8_t *name, unsigned int name_length) {
+  unsigned int record_length = 33 + name_length + !(name_length & 1);
+  memset(record, 0, record_length);
+  record[0] = record_length;
+  record[2] = lba; record[3] = lba >> 8; record[4] = lba >> 16; record[5] = lba >> 24;
+  record[10] = length; record[11] = length >> 8; record[12] = length >> 16; record[13] = length >> 24;
+  record[25] = (directory) ? 0x02 : 0;
+  record[32] = name_length;
+  memcpy(record + 33, name, name_length);
+  return record_length;
+}
+
+// The name every directory and file in the ISO check gets: 200 Latin-1 e acute, which are 2 bytes each in UTF-8
+#define CHECK_ISO_NAME 200
+#define CHECK_ISO_DATA "some file data"
+
+// Puts a plain ISO9660 filesystem with long Latin-1 names on the Mode1/2048 track of an image, then lists it
+// and reads the file back. The descriptors are at 16 and 17, the path table at 18, the root at 19, the one
+// directory at 20 and the file data at 21.
+static int check_iso(nerorip_context *ctx, const char *filename) {
+  image_source *source;
+  nrg_image *image = check_open(ctx, filename, &source);
+  if (!image)
+    return 0;
+  nrg_track *track = get_nrg_track(image, 1);
+  uint64_t offset = track->track_offset;
+  free_nrg_image(image);
+  src_close(source);
+
+  static uint8_t sectors[6][2048];
+  uint8_t name[CHECK_ISO_NAME + 2], dot = 0, dotdot = 1;
+  memset(sectors, 0, sizeof(sectors));
+  memset(name, 0xE9, CHECK_ISO_NAME);
+  memcpy(name + CHECK_ISO_NAME, ";1", 2);
+
+  uint8_t *primary = sectors[0];
+  primary[0] = 1;
+  memcpy(primary + 1, "CD001", 5);
+  primary[6] = 1;
+  memset(primary + 40, ' ', 32);
+  memcpy(primary + 40, "NRGCHECK", 8);
+  primary[132] = 10 + 8 + CHECK_ISO_NAME;
+  primary[140] = 18;
+  check_iso_record(primary + 156, 19, 2048, 1, &dot, 1);
+  memcpy(sectors[1], "\xFF" "CD001" "\x01", 7);
+
+  uint8_t *table = sectors[2];
+  table[0] = 1; table[2] = 19; table[6] = 1;
+  table[10] = CHECK_ISO_NAME; table[12] = 20; table[16] = 1;
+  memcpy(table + 18, name, CHECK_ISO_NAME);
+
+  unsigned int position = check_iso_record(sectors[3], 19, 2048, 1, &dot, 1);
+  position += check_iso_record(sectors[3] + position, 19, 2048, 1, &dotdot, 1);
+  check_iso_record(sectors[3] + position, 20, 2048, 1, name, CHECK_ISO_NAME);
+  position = check_iso_record(sectors[4], 20, 2048, 1, &dot, 1);
+  position += check_iso_record(sectors[4] + position, 19, 2048, 1, &dotdot, 1);
+  check_iso_record(sectors[4] + position, 21, strlen(CHECK_ISO_DATA), 0, name, CHECK_ISO_NAME + 2);
+  memcpy(sectors[5], CHECK_ISO_DATA, strlen(CHECK_ISO_DATA));
+
+  FILE *f = fopen(filename, "r+b");
+  if (!f || fseeko(f, offset + 16 * 2048, SEEK_SET) != 0 || fwrite(sectors, sizeof(sectors), 1, f) != 1) {
+    fprintf(stderr, "Could not write the filesystem to %s: %s\n", filename, strerror(errno));
+    if (f)
+      fclose(f);
+    return 0;
+  }
+  fclose(f);
+
+  // The path it should be found at, in UTF-8
+  char path[2 * (2 * CHECK_ISO_NAME + 1) + 1], *p = path;
+  unsigned int i, j;
+  for (i = 0; i < 2; i++) {
+    *p++ = '/';
+    for (j = 0; j < CHECK_ISO_NAME; j++) {
+      *p++ = '\xC3';
+      *p++ = '\xA9';
+    }
+  }
+  *p = '\0';
+
+  int ok = 0;
+  image = check_open(ctx, filename, &source);
+  if (!image)
+    return 0;
+  sector_cache *cache = alloc_sector_cache(source, image, 0);
+  iso_fs *fs = alloc_iso_fs();
+  FILE *output = tmpfile();
+  if (cache && fs && output && iso_parse(ctx, cache, get_nrg_track(image, 1), fs) == 0 && fs->number_files == 2) {
+    iso_file *file = iso_find(fs, path);
+    char data[sizeof(CHECK_ISO_DATA)] = "";
+    if (file && !file->directory && iso_extract(ctx, fs, file, output) == 0) {
+      rewind(output);
+      ok = fread(data, 1, sizeof(data), output) == strlen(CHECK_ISO_DATA) && memcmp(data, CHECK_ISO_DATA, strlen(CHECK_ISO_DATA)) == 0;
+    }
+  }
+  if (output)
+    fclose(output);
+  free_iso_fs(fs);
+  free_sector_cache(cache);
+  free_nrg_image(image);
+  src_close(source);
+  return ok;
+}
+
+// Parses the same disc written as a Nero 5.0 and a Nero 5.5 image and checks that every session and track
+// gets the same LBAs, which it only does if the 5.0 cue sheet's MM:SS:FF addresses are read as such
+static int check_nero5(nerorip_context *ctx, const char *filename5, const char *filename55) {
+  image_source *source5, *source55;
+  nrg_image *image5 = check_open(ctx, filename5, &source5);
+  if (!image5)
+    return 0;
+  nrg_image *image55 = check_open(ctx, filename55, &source55);
+  if (!image55) {
+    free_nrg_image(image5);
+    src_close(source5);
+    return 0;
+  }
+
+  int ok = image5->nrg_version == NRG_VER_5 && image55->nrg_version == NRG_VER_55 &&
+           image5->number_sessions == image55->number_sessions && image5->number_tracks == image55->number_tracks;
+  unsigned int i;
+  for (i = 0; ok && i < image5->number_sessions; i++)
+    ok = image5->sessions[i].start_lba == image55->sessions[i].start_lba && image5->sessions[i].end_lba == image55->sessions[i].end_lba;
+  for (i = 0; ok && i < image5->number_tracks; i++) {
+    nrg_track *t5 = &image5->tracks[i], *t55 = &image55->tracks[i];
+    uint64_t offset;
+    ok = t5->pretrack_lba == t55->pretrack_lba && t5->track_lba == t55->track_lba &&
+         nrg_find_lba(image5, t55->track_lba, &offset) == t5 && offset == t5->track_offset;
+  }
+
+  free_nrg_image(image5);
+  free_nrg_image(image55);
+  src_close(source5);
+  src_close(source55);
+  return ok;
+}
+
+static void check_images(const char *directory) {
+  nerorip_context *ctx = nerorip_new();
+  if (!ctx) {
+    check_report("images", "library", 0);
+    return;
+  }
+  ctx->verbosity = 0;
+
+  char filename[4096];
+  snprintf(filename, sizeof(filename), "%s/iso.nrg", directory);
+  check_report("iso latin-1 names", "library", check_iso(ctx, filename));
+
+  char filename55[4096];
+  snprintf(filename, sizeof(filename), "%s/dao5.nrg", directory);
+  snprintf(filename55, sizeof(filename55), "%s/dao55.nrg", directory);
+  check_report("nero 5.0 cue sheet", "library", check_nero5(ctx, filename, filename55));
+
+  nerorip_free(ctx);
+}
+
+
+int main(int argc, char **argv) {
+  check_swap();
+  check_crc32();
+  check_hashes();
+  check_edc();
+  check_ecc();
+  check_sub();
+  if (argc > 1)
+    check_images(argv[1]);
+
+  if (failures) {
+    printf("%u check(s) FAILED\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
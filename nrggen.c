@@ -0,0 +1,503 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * nrggen
+ *
+ * Writes synthetic nero images for testing and benchmarking nerorip.
+ * The track data is pseudo-random, Mode2 sectors get a proper sync pattern, header, subheader, EDC and ECC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <getopt.h> // getopt_long
+#include "nrg.h"
+#include "edc.h"
+#include "subchannel.h"
+
+// A disc can't have more tracks than this
+#define GEN_MAX_TRACKS 99
+// Sectors of pregap in front of every DAO track
+#define GEN_PREGAP 150
+// Sectors of run-out after every TAO track
+#define GEN_RUNOUT 2
+// Sectors between the end of one session and the start of the next (lead-out, lead-in and pregap)
+#define GEN_SESSION_GAP 11400
+// Sectors written at once
+#define GEN_BATCH_SECTORS 512
+
+
+/**
+ * Generated track struct
+ *
+ * What one track should look like and where it ended up in the file.
+ */
+typedef struct {
+  // MODE2 or AUDIO as it goes in the cue sheet, what the sectors hold (SECTOR_AUDIO, SECTOR_MODE1 or SECTOR_MODE2)
+  // and for Mode2 whether they are Form2 like the MPEG tracks of a VCD
+  int mode;
+  int sector_mode;
+  int form2;
+  unsigned int sector_size;
+  uint64_t sectors;
+
+  // Filled in as the track is written
+  uint32_t pretrack_lba, track_lba;
+  uint64_t pretrack_offset, track_offset, next_offset;
+} gen_track;
+
+/**
+ * Generated session struct
+ */
+typedef struct {
+  unsigned int first_track, number_tracks;
+  uint32_t end_lba;
+} gen_session;
+
+/**
+ * Growable buffer the chunk data is built in
+ */
+typedef struct {
+  uint8_t *data;
+  size_t length, allocated;
+} gen_buffer;
+
+
+// State of the xorshift random number generator
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+// Every this many data sectors one is damaged, 0 for none, and how many have been written so far
+static uint64_t damage_every = 0;
+static uint64_t data_sectors = 0;
+
+// Returns the next pseudo-random number. Plenty good for filling sectors
+static inline uint64_t gen_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+
+// Appends length big endian bytes of value to a buffer
+static void gen_put(gen_buffer *b, uint64_t value, unsigned int length) {
+  if (b->length + length > b->allocated) {
+    b->allocated = (b->allocated) ? b->allocated * 2 : 4096;
+    b->data = realloc(b->data, b->allocated);
+    if (!b->data) {
+      fprintf(stderr, "Failed to allocate memory for chunk data: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  while (length--)
+    b->data[b->length++] = (value >> (length * 8)) & 0xFF;
+}
+
+// Starts a chunk. Returns where its size goes so gen_end_chunk() can fill it in
+static size_t gen_start_chunk(gen_buffer *b, uint32_t id) {
+  gen_put(b, id, 4);
+  gen_put(b, 0, 4);
+  return b->length;
+}
+
+static void gen_end_chunk(gen_buffer *b, size_t start) {
+  uint32_t size = b->length - start;
+  unsigned int i;
+  for (i = 0; i < 4; i++)
+    b->data[start - 4 + i] = (size >> ((3 - i) * 8)) & 0xFF;
+}
+
+
+// Converts a number under 100 to BCD
+static uint8_t gen_bcd(unsigned int n) {
+  return ((n / 10) << 4) | (n % 10);
+}
+
+// Fills one sector with random data and, for raw data sectors and Mode2 sectors, the header a real disc would have.
+// Any subchannel data after the sector is left random
+static void gen_sector(uint8_t *sector, gen_track *t, uint32_t lba) {
+  unsigned int i;
+  for (i = 0; i + 8 <= t->sector_size; i += 8) {
+    uint64_t r = gen_random();
+    memcpy(sector + i, &r, 8);
+  }
+  const unsigned int main_size = t->sector_size - sub_length(t->sector_size);
+  // Audio sectors and cooked 2048 byte sectors are nothing but data
+  if (t->sector_mode == SECTOR_AUDIO || main_size == 2048)
+    return;
+
+  uint8_t *subheader = sector;
+  if (main_size == 2352) {
+    // Sync pattern, MSF address and mode
+    static const uint8_t sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+    uint32_t address = lba + 150;
+    memcpy(sector, sync, 12);
+    sector[12] = gen_bcd(address / (60 * 75));
+    sector[13] = gen_bcd(address / 75 % 60);
+    sector[14] = gen_bcd(address % 75);
+    sector[15] = (t->sector_mode == SECTOR_MODE1) ? 0x01 : 0x02;
+    subheader = sector + 16;
+  }
+
+  // Mode1 sectors have no subheader
+  if (t->sector_mode == SECTOR_MODE2) {
+    // Form 1 data or Form 2 real time video subheader, repeated twice
+    static const uint8_t form1[8] = {0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00};
+    static const uint8_t form2[8] = {0x01, 0x01, 0x62, 0x0f, 0x01, 0x01, 0x62, 0x0f};
+    memcpy(subheader, t->form2 ? form2 : form1, 8);
+  }
+  edc_generate_sector(sector, main_size);
+
+  // Damage the sync pattern, the user data or the P parity in turn, so nerorip --verify has something to find
+  if (damage_every && ++data_sectors % damage_every == 0) {
+    const unsigned int skip = 2352 - main_size;
+    switch (data_sectors / damage_every % 3) {
+      case 0: sector[(skip ? 100 : 5)] ^= 0x01; break;
+      case 1: sector[100] ^= 0x01; break;
+      case 2: sector[2100 - skip] ^= 0x01; break;
+    }
+  }
+}
+
+// Writes sectors of a track starting at lba. Pregap sectors are all zeros
+static void gen_write_sectors(FILE *output, gen_track *t, uint32_t lba, uint64_t count, int zero, uint8_t *buffer) {
+  while (count > 0) {
+    unsigned int batch = (count > GEN_BATCH_SECTORS) ? GEN_BATCH_SECTORS : count;
+    unsigned int i;
+    if (zero)
+      memset(buffer, 0, (size_t) batch * t->sector_size);
+    else
+      for (i = 0; i < batch; i++)
+        gen_sector(buffer + (size_t) i * t->sector_size, t, lba + i);
+
+    if (fwrite(buffer, t->sector_size, batch, output) != batch) {
+      fprintf(stderr, "Failed to write image data: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    lba += batch;
+    count -= batch;
+  }
+}
+
+
+// Works out the Nero track mode of a track. 2368 byte sectors don't have one of their own and go by the raw 2352
+static uint8_t gen_nero_mode(gen_track *t) {
+  const unsigned int main_size = t->sector_size - sub_length(t->sector_size);
+  const int pw = (sub_length(t->sector_size) == SUB_LENGTH);
+  if (t->sector_mode == SECTOR_AUDIO)
+    return (pw) ? ENT_AUDIO_SUB : ENT_AUDIO;
+  if (t->sector_mode == SECTOR_MODE1)
+    return (pw) ? ENT_MODE1_SUB : ((main_size == 2048) ? ENT_MODE1_2048 : ENT_MODE1_2352);
+  if (pw)
+    return ENT_MODE2_SUB;
+  switch (main_size) {
+    case 2048: return ENT_MODE2_2048;
+    case 2336: return ENT_MODE2_2336;
+    default:   return ENT_MODE2_2352;
+  }
+}
+
+
+// Works out what goes in the cue sheet for an LBA: the LBA itself for Nero 5.5, 00 MM SS FF counted from the
+// start of the lead in for Nero 5.0
+static uint32_t gen_cue_address(int version, uint32_t lba) {
+  if (version == NRG_VER_55)
+    return lba;
+  uint32_t frames = lba + 150;
+  return (frames / 4500) << 16 | (frames / 75 % 60) << 8 | frames % 75;
+}
+
+
+// Parses a track description like "mode2/2336:1000" or "audio:650M"
+static int gen_parse_track(const char *spec, gen_track *t) {
+  char type[16];
+  unsigned int sector_size = 2352;
+  const char *colon = strchr(spec, ':');
+  if (!colon || colon - spec >= (int) sizeof(type))
+    return -1;
+  memcpy(type, spec, colon - spec);
+  type[colon - spec] = '\0';
+
+  char *slash = strchr(type, '/');
+  if (slash) {
+    *slash = '\0';
+    sector_size = atoi(slash + 1);
+  }
+
+  // Raw sectors can have subchannel data after them
+  const int raw = (sector_size == 2352 || sub_length(sector_size));
+  if (strcmp(type, "audio") == 0 && raw)
+    t->sector_mode = SECTOR_AUDIO;
+  else if (strcmp(type, "mode1") == 0 && (raw || sector_size == 2048))
+    t->sector_mode = SECTOR_MODE1;
+  else if (strcmp(type, "mode2") == 0 && (raw || sector_size == 2336 || sector_size == 2048))
+    t->sector_mode = SECTOR_MODE2;
+  else if (strcmp(type, "form2") == 0 && (raw || sector_size == 2336))
+    t->sector_mode = SECTOR_MODE2;
+  else
+    return -1;
+  t->mode = (t->sector_mode == SECTOR_AUDIO) ? AUDIO : MODE2;
+  t->form2 = (strcmp(type, "form2") == 0);
+  t->sector_size = sector_size;
+
+  // A plain number is a number of sectors, with a suffix it's a number of bytes
+  char *end;
+  uint64_t length = strtoull(colon + 1, &end, 10);
+  uint64_t multiplier = 0;
+  switch (*end) {
+    case '\0': break;
+    case 'k': case 'K': multiplier = 1024ULL; break;
+    case 'm': case 'M': multiplier = 1024ULL * 1024; break;
+    case 'g': case 'G': multiplier = 1024ULL * 1024 * 1024; break;
+    default: return -1;
+  }
+  if (multiplier)
+    length = (length * multiplier + sector_size - 1) / sector_size;
+  if (length == 0)
+    return -1;
+  t->sectors = length;
+
+  return 0;
+}
+
+
+void usage(char *argv0) {
+  printf("Usage: %s [OPTIONS]... -s SESSION [-s SESSION]... [OUTPUT FILE]\n", argv0);
+  printf("Writes a synthetic nero image with pseudo-random track data for testing and benchmarking nerorip.\n\n");
+  printf("  -s, --session=TRACKS\tAdd a session holding the comma separated list of TRACKS\n");
+  printf("             \t\tEach track is TYPE[/SECTOR SIZE]:LENGTH where TYPE is audio, mode1, mode2 or form2\n");
+  printf("             \t\t(Mode2 Form2 video sectors like a VCD), SECTOR SIZE is 2352 (default), 2336 (Mode2 only),\n");
+  printf("             \t\t2048 (mode1 and mode2 only), 2448 (P-W subchannel) or 2368 (Q subchannel, not with --tao)\n");
+  printf("             \t\tand LENGTH is a number of sectors or a size in bytes with a K, M or G suffix.\n");
+  printf("  -t, --tao\t\tWrite track at once sessions (ETNF/ETN2) instead of disc at once (CUES/DAOI)\n");
+  printf("  -5, --nero5\t\tWrite a Nero 5.0 image (32 bit offsets, at most 4 GB) instead of Nero 5.5\n");
+  printf("  -r, --seed=N\t\tSeed for the track data\n");
+  printf("  -d, --damage=N\tDamage every Nth data sector, in turn its sync pattern (user data for 2336 byte sectors),\n");
+  printf("             \t\tuser data and ECC, for testing nerorip --verify\n");
+  printf("  -h, --help\t\tDisplay this help message and exit\n\n");
+  printf("For example, a two session image with an audio and a data track in the first session:\n");
+  printf("  %s -s audio:600,mode2:10M -s mode2/2336:1000 image.nrg\n", argv0);
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+  gen_track tracks[GEN_MAX_TRACKS];
+  gen_session sessions[GEN_MAX_TRACKS];
+  unsigned int number_tracks = 0, number_sessions = 0;
+  int tao = 0;
+  int version = NRG_VER_55;
+
+  static struct option long_options[] = {
+    {"session", required_argument, 0, 's'},
+    {"tao",     no_argument, 0, 't'},
+    {"nero5",   no_argument, 0, '5'},
+    {"seed",    required_argument, 0, 'r'},
+    {"damage",  required_argument, 0, 'd'},
+    {"help",    no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "s:t5r:d:h", long_options, NULL)) != -1) {
+    switch (c) {
+      case 's': {
+        gen_session *s = &sessions[number_sessions++];
+        s->first_track = number_tracks;
+        s->number_tracks = 0;
+
+        char *spec = strdup(optarg);
+        char *save = NULL;
+        char *track = strtok_r(spec, ",", &save);
+        for (; track; track = strtok_r(NULL, ",", &save)) {
+          if (number_tracks == GEN_MAX_TRACKS) {
+            fprintf(stderr, "Error: An image can't have more than %d tracks\n", GEN_MAX_TRACKS);
+            exit(EXIT_FAILURE);
+          }
+          if (gen_parse_track(track, &tracks[number_tracks]) != 0) {
+            fprintf(stderr, "Error: Bad track description \"%s\"\n\n", track);
+            usage(argv[0]);
+          }
+          number_tracks++;
+          s->number_tracks++;
+        }
+        free(spec);
+        if (s->number_tracks == 0)
+          number_sessions--;
+        break;
+      }
+      case 't': tao = 1; break;
+      case '5': version = NRG_VER_5; break;
+      case 'r': random_state = strtoull(optarg, NULL, 0) * 0x9E3779B97F4A7C15ULL | 1; break;
+      case 'd': damage_every = strtoull(optarg, NULL, 0); break;
+      case 'h': usage(argv[0]); break;
+      default: break;
+    }
+  }
+
+  if (number_sessions == 0 || optind == argc) {
+    fprintf(stderr, "Error: Need at least one session and an output file\n\n");
+    usage(argv[0]);
+  }
+
+  // ETNF / ETN2 only have modes for the subchannel data of all of P-W
+  unsigned int i, j;
+  for (i = 0; i < number_tracks && tao; i++) {
+    if (sub_length(tracks[i].sector_size) == SUB_Q_LENGTH) {
+      fprintf(stderr, "Error: Track at once images can't have %u byte sectors\n", tracks[i].sector_size);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Nero 5.0 images only have 32 bits for offsets
+  uint64_t size = 0;
+  for (i = 0; i < number_tracks; i++)
+    size += (tracks[i].sectors + ((tao) ? 0 : GEN_PREGAP)) * tracks[i].sector_size;
+  if (version == NRG_VER_5 && size > UINT32_MAX) {
+    fprintf(stderr, "Error: Nero 5.0 images can't be bigger than 4 GB\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *output = fopen(argv[optind], "wb");
+  if (!output) {
+    fprintf(stderr, "Error opening %s: %s\n", argv[optind], strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  uint8_t *buffer = malloc(GEN_BATCH_SECTORS * NRG_MAX_SECTOR_SIZE);
+  if (!buffer) {
+    fprintf(stderr, "Failed to allocate memory for sector buffer: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // Write the track data. DAO tracks have a pregap in the file, the LBA of the first track's data is 0
+  uint32_t lba = (tao) ? 0 : (uint32_t) -GEN_PREGAP;
+  uint64_t offset = 0;
+  for (i = 0; i < number_sessions; i++) {
+    gen_session *s = &sessions[i];
+    if (i > 0)
+      lba += GEN_SESSION_GAP;
+
+    for (j = s->first_track; j < s->first_track + s->number_tracks; j++) {
+      gen_track *t = &tracks[j];
+      t->pretrack_lba = lba;
+      t->pretrack_offset = offset;
+      if (!tao) {
+        gen_write_sectors(output, t, lba, GEN_PREGAP, 1, buffer);
+        lba += GEN_PREGAP;
+        offset += (uint64_t) GEN_PREGAP * t->sector_size;
+      }
+
+      t->track_lba = lba;
+      t->track_offset = offset;
+      gen_write_sectors(output, t, lba, t->sectors, 0, buffer);
+      lba += t->sectors;
+      offset += t->sectors * t->sector_size;
+      t->next_offset = offset;
+
+      if (tao)
+        lba += GEN_RUNOUT;
+    }
+    s->end_lba = lba;
+  }
+  free(buffer);
+
+  // Build the chunks, see nrg.c for what's in them
+  const unsigned int offset_size = (version == NRG_VER_55) ? 8 : 4;
+  gen_buffer b = {NULL, 0, 0};
+  for (i = 0; i < number_sessions; i++) {
+    gen_session *s = &sessions[i];
+    gen_track *first = &tracks[s->first_track];
+    size_t start;
+
+    if (tao) {
+      start = gen_start_chunk(&b, (version == NRG_VER_55) ? ETN2 : ETNF);
+      for (j = s->first_track; j < s->first_track + s->number_tracks; j++) {
+        gen_track *t = &tracks[j];
+        gen_put(&b, t->track_offset, offset_size);
+        gen_put(&b, t->next_offset - t->track_offset, offset_size);
+        gen_put(&b, gen_nero_mode(t), 4);
+        gen_put(&b, t->track_lba, 4);
+        gen_put(&b, 0, offset_size);
+      }
+      gen_end_chunk(&b, start);
+      continue;
+    }
+
+    // Cue sheet
+    start = gen_start_chunk(&b, (version == NRG_VER_55) ? CUEX : CUES);
+    gen_put(&b, first->mode, 1);
+    gen_put(&b, 0, 3);
+    gen_put(&b, gen_cue_address(version, first->pretrack_lba), 4);
+    for (j = s->first_track; j < s->first_track + s->number_tracks; j++) {
+      gen_track *t = &tracks[j];
+      gen_put(&b, t->mode, 1);
+      gen_put(&b, j + 1, 1);
+      gen_put(&b, 0x0000, 2);
+      gen_put(&b, gen_cue_address(version, t->pretrack_lba), 4);
+      gen_put(&b, t->mode, 1);
+      gen_put(&b, j + 1, 1);
+      gen_put(&b, 0x0100, 2);
+      gen_put(&b, gen_cue_address(version, t->track_lba), 4);
+    }
+    gen_put(&b, (version == NRG_VER_55) ? first->mode : 0, 1);
+    gen_put(&b, 0xAA0100, 3);
+    gen_put(&b, gen_cue_address(version, s->end_lba), 4);
+    gen_end_chunk(&b, start);
+
+    // DAO information
+    start = gen_start_chunk(&b, (version == NRG_VER_55) ? DAOX : DAOI);
+    gen_put(&b, s->number_tracks * ((version == NRG_VER_55) ? 42 : 30) + 22, 4);
+    gen_put(&b, 0, 14);
+    gen_put(&b, (first->mode == MODE2) ? TOC_MODE2 : TOC_AUDIO, 1);
+    gen_put(&b, 0, 1);
+    gen_put(&b, s->first_track + 1, 1);
+    gen_put(&b, s->first_track + s->number_tracks, 1);
+    for (j = s->first_track; j < s->first_track + s->number_tracks; j++) {
+      gen_track *t = &tracks[j];
+      gen_put(&b, 0, 10);
+      gen_put(&b, t->sector_size, 4);
+      gen_put(&b, DAO_MODE(gen_nero_mode(t)), 4);
+      gen_put(&b, t->pretrack_offset, offset_size);
+      gen_put(&b, t->track_offset, offset_size);
+      gen_put(&b, t->next_offset, offset_size);
+    }
+    gen_end_chunk(&b, start);
+  }
+  for (i = 0; i < number_sessions; i++) {
+    size_t start = gen_start_chunk(&b, SINF);
+    gen_put(&b, sessions[i].number_tracks, 4);
+    gen_end_chunk(&b, start);
+  }
+  size_t start = gen_start_chunk(&b, MTYP);
+  gen_put(&b, 1, 4);
+  gen_end_chunk(&b, start);
+  gen_end_chunk(&b, gen_start_chunk(&b, END));
+
+  // And the footer pointing at the chunks
+  gen_put(&b, (version == NRG_VER_55) ? NER5 : NERO, 4);
+  gen_put(&b, offset, offset_size);
+
+  if (fwrite(b.data, 1, b.length, output) != b.length || fclose(output) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", argv[optind], strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  free(b.data);
+
+  return EXIT_SUCCESS;
+}
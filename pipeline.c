@@ -0,0 +1,752 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <unistd.h> // pwrite()
+#include <sys/mman.h> // mmap()
+#include <sys/syscall.h> // io_uring_setup, io_uring_enter
+#include <linux/io_uring.h>
+#include "nerorip.h"
+#include "pipeline.h"
+
+// Pipeline slot states
+#define SLOT_FREE      0
+#define SLOT_READING   1
+#define SLOT_READ      2
+#define SLOT_CONVERTED 3
+#define SLOT_WRITING   4
+
+
+/**
+ * One batch making its way through the pipeline
+ */
+typedef struct {
+  int state;
+
+  // Where in the track this batch starts, how much of it is read and how many sectors that makes
+  uint64_t b;
+  uint64_t read_length;
+  unsigned int count;
+  // How many bytes of the read or write currently going on are done
+  uint64_t done;
+
+  // The raw sectors, either in the staging buffer or straight out of the mapping
+  uint8_t *staging;
+  const uint8_t *sectors;
+
+  // The converted data, either in the buffer or the raw sectors themselves, and where it goes
+  uint8_t *buffer;
+  const uint8_t *output;
+  size_t out_length;
+  uint64_t out_offset;
+} pipeline_slot;
+
+
+/**
+ * Everything needed to rip one track through the pipeline
+ */
+typedef struct {
+  image_source *source;
+  nrg_track *track;
+  unsigned int track_number;
+  rip_layout *layout;
+  nerorip_context *ctx;
+  rip_options *options;
+
+  int fd;
+  // Where the subchannel data goes, -1 if the sectors have none or it isn't kept. It is small enough that
+  // the converting thread just writes it as it splits it off, into one buffer, and counts it separately
+  int sub_fd;
+  uint8_t *sub_buffer;
+  uint64_t sub_bytes, sub_calls;
+  // Where the output of the next batch to be converted goes. Batches are converted in order, so this
+  // works even when the sectors don't all turn into the same amount of output
+  uint64_t output_offset;
+  uint64_t start;
+  unsigned int batch_sectors;
+
+  pipeline_slot slots[PIPELINE_DEPTH];
+
+  // Where the next batch to be read starts, where the next one to be converted starts
+  // and how many bytes of track data have been written
+  uint64_t next_b;
+  uint64_t next_convert;
+  uint64_t finished;
+
+  int warned, form2_warned;
+  // The first error hit, 0 if everything is fine
+  int error;
+  // Set if the kernel might still be reading into or writing from the slot buffers, which then can't be freed
+  int buffers_busy;
+
+  // Where the track is counted, NULL if the context isn't collecting stats.
+  // In the threaded pipeline the reader only touches the read counters, the writer the write counters
+  // and the converting thread the convert time, so none of them need the lock.
+  track_stats *stats;
+  // Where the raw and converted batches are hashed, NULL if they aren't.
+  // Batches are always converted in track order so they get hashed in order
+  track_hasher *hasher;
+  // Where the kept sectors are checked, NULL if they aren't. Also passed batches in track order
+  edc_verifier *verifier;
+
+  // Only used by the threaded pipeline
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} pipeline;
+
+
+/*
+ * Steps shared by both pipelines
+ */
+
+// Sets up a slot with the next batch of the track
+static void pipeline_next_batch(pipeline *p, pipeline_slot *s) {
+  const uint64_t sector_size = p->layout->sector_size;
+
+  s->b = p->next_b;
+  s->read_length = p->track->length - s->b;
+  if (s->read_length > p->batch_sectors * sector_size)
+    s->read_length = p->batch_sectors * sector_size;
+  s->count = (s->read_length + sector_size - 1) / sector_size;
+  s->done = 0;
+
+  p->next_b += s->count * sector_size;
+}
+
+// Converts a batch that has been read and works out where it goes.
+// Returns 0 or -1 if its subchannel data couldn't be written, with errno set
+static int pipeline_convert(pipeline *p, pipeline_slot *s) {
+  rip_layout *l = p->layout;
+
+  // A partial sector at the end of the track is padded out with zeros
+  if (s->sectors == s->staging)
+    memset(s->staging + s->read_length, 0, s->count * l->sector_size - s->read_length);
+
+  // Write the batch exactly as it was read if nothing in it needs to change
+  const unsigned int kept = rip_kept_sectors(l, s->b, s->count);
+  if (l->passthrough && kept == s->count) {
+    s->output = s->sectors;
+    s->out_length = s->count * l->sector_size;
+  }
+  else {
+    s->out_length = rip_convert_batch(l, s->sectors, kept, s->count, s->buffer);
+    s->output = s->buffer;
+  }
+  s->out_offset = p->output_offset;
+  p->output_offset += s->out_length;
+  s->done = 0;
+  p->next_convert = s->b + s->count * l->sector_size;
+  hasher_raw(p->hasher, s->sectors, s->read_length);
+  hasher_output(p->hasher, s->output, s->out_length);
+  if (p->verifier) {
+    const unsigned int whole = s->read_length / l->sector_size;
+    edc_verifier_add(p->verifier, s->sectors, (kept < whole) ? kept : whole);
+  }
+  if (p->sub_fd >= 0 && kept > 0) {
+    ssize_t written = rip_write_subchannel(l, s->sectors, kept, p->sub_buffer, p->sub_fd, &p->sub_calls);
+    if (written < 0)
+      return -1;
+    p->sub_bytes += written;
+  }
+
+  // If some sectors are to be trimmed, have a look and see if they might contain some useful data
+  if (kept < s->count && !p->warned && rip_trimmed_has_data(l, s->sectors, kept, s->count)) {
+    rip_warn_trimmed(p->ctx, p->track_number);
+    p->warned = 1;
+  }
+  // Form2 sectors lose some of their data unless they are converted according to their form
+  if (!l->xa && !p->form2_warned && rip_count_form2(l, s->sectors, kept)) {
+    rip_warn_form2(p->ctx, p->track_number);
+    p->form2_warned = 1;
+  }
+  return 0;
+}
+
+// Finishes off a batch that has been written
+static void pipeline_written(pipeline *p, pipeline_slot *s) {
+  const uint64_t offset = p->track->track_offset + s->b;
+  src_release(p->source, offset, offset + s->read_length);
+
+  // The last batch might be padded out past the end of the track
+  const uint64_t length = p->track->length;
+  const uint64_t before = (p->start + p->finished < length) ? p->start + p->finished : length;
+  p->finished += s->count * p->layout->sector_size;
+  const uint64_t after = (p->start + p->finished < length) ? p->start + p->finished : length;
+  progress_add(p->ctx, p->track_number, after - before);
+}
+
+// Records an error if there wasn't one already
+static void pipeline_error(pipeline *p, int error, const char *message) {
+  if (p->error)
+    return;
+
+  if (error == RIP_READ_ERR)
+    fprintf(stderr, "Error reading track: %s\n", message);
+  else
+    fprintf(stderr, "Error writing track: %s\n  Skipping this track.\n", message);
+  p->error = error;
+}
+
+
+
+/*
+ * io_uring pipeline
+ */
+
+/**
+ * A minimal io_uring, set up straight through the system calls
+ */
+typedef struct {
+  int fd;
+
+  // Submission queue ring
+  void *sq_ring;
+  size_t sq_ring_size;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  // Completion queue ring
+  void *cq_ring;
+  size_t cq_ring_size;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  // Number of queued submissions the kernel hasn't picked up yet and of ones it has but hasn't completed
+  unsigned int to_submit;
+  unsigned int in_kernel;
+} uring;
+
+// Unmaps and closes an io_uring
+static void uring_free(uring *u) {
+  if (u->sq_ring && u->sq_ring != MAP_FAILED)
+    munmap(u->sq_ring, u->sq_ring_size);
+  if (u->cq_ring && u->cq_ring != MAP_FAILED)
+    munmap(u->cq_ring, u->cq_ring_size);
+  if (u->sqes && u->sqes != MAP_FAILED)
+    munmap(u->sqes, u->sqes_size);
+  close(u->fd);
+}
+
+// Asks the kernel whether it can do reads and writes. They only came in with Linux 5.6, as did probing, so a kernel
+// that doesn't understand the probe can't do them either. Returns 1 if it can, otherwise 0 with errno set
+static int uring_can_read_write(int fd) {
+  const unsigned int ops = 256;
+  struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op));
+  if (!probe)
+    return 0;
+
+  int r = 0;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, ops) == 0) {
+    r = probe->last_op >= IORING_OP_READ && probe->last_op >= IORING_OP_WRITE &&
+        (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    if (!r)
+      errno = EOPNOTSUPP;
+  }
+  free(probe);
+  return r;
+}
+
+// Sets up an io_uring with room for the passed number of entries. Returns 0 on success
+static int uring_init(uring *u, unsigned int entries) {
+  memset(u, 0, sizeof(uring));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  u->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (u->fd < 0)
+    return -1;
+  if (!uring_can_read_write(u->fd)) {
+    const int error = errno;
+    close(u->fd);
+    errno = error;
+    return -1;
+  }
+
+  // Map in the two rings and the submission entries
+  u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+    uring_free(u);
+    return -1;
+  }
+
+  uint8_t *sq = u->sq_ring, *cq = u->cq_ring;
+  u->sq_head  = (unsigned int *) (sq + params.sq_off.head);
+  u->sq_tail  = (unsigned int *) (sq + params.sq_off.tail);
+  u->sq_mask  = (unsigned int *) (sq + params.sq_off.ring_mask);
+  u->sq_array = (unsigned int *) (sq + params.sq_off.array);
+  u->cq_head  = (unsigned int *) (cq + params.cq_off.head);
+  u->cq_tail  = (unsigned int *) (cq + params.cq_off.tail);
+  u->cq_mask  = (unsigned int *) (cq + params.cq_off.ring_mask);
+  u->cqes     = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+// Queues up a read or write. The ring always has room since there are never more than PIPELINE_DEPTH in flight
+static void uring_queue(uring *u, uint8_t opcode, int fd, const void *buffer, uint32_t length, uint64_t offset, uint64_t user_data) {
+  const unsigned int tail = *u->sq_tail;
+  const unsigned int index = tail & *u->sq_mask;
+
+  struct io_uring_sqe *sqe = &u->sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = length;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  u->sq_array[index] = index;
+
+  // The entry has to be filled in before the kernel can see the new tail
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->to_submit++;
+}
+
+// Submits everything queued and waits for at least one completion. Returns 0 on success
+static int uring_submit_and_wait(uring *u) {
+  while (1) {
+    int r = syscall(__NR_io_uring_enter, u->fd, u->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (r >= 0) {
+      u->to_submit -= r;
+      u->in_kernel += r;
+      return 0;
+    }
+    if (errno != EINTR)
+      return -1;
+  }
+}
+
+// Throws away completions until everything the kernel has picked up is done with, so none of the buffers
+// are still being used. What was queued but never picked up won't ever be. Returns 0 once nothing is left
+static int uring_drain(uring *u) {
+  while (1) {
+    unsigned int head = *u->cq_head;
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) && u->in_kernel > 0) {
+      head++;
+      u->in_kernel--;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    if (u->in_kernel == 0)
+      return 0;
+
+    if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+      return -1;
+  }
+}
+
+// Queues up the (rest of the) read for a slot
+static void uring_queue_read(uring *u, pipeline *p, unsigned int i) {
+  pipeline_slot *s = &p->slots[i];
+  s->sectors = s->staging;
+  uring_queue(u, IORING_OP_READ, fileno(p->source->file), s->staging + s->done, s->read_length - s->done,
+              p->track->track_offset + s->b + s->done, i);
+  s->state = SLOT_READING;
+  if (p->stats)
+    p->stats->read_calls++;
+}
+
+// Queues up the (rest of the) write for a slot
+static void uring_queue_write(uring *u, pipeline *p, unsigned int i) {
+  pipeline_slot *s = &p->slots[i];
+  uring_queue(u, IORING_OP_WRITE, p->fd, s->output + s->done, s->out_length - s->done, s->out_offset + s->done, i);
+  s->state = SLOT_WRITING;
+  if (p->stats)
+    p->stats->write_calls++;
+}
+
+// Runs the pipeline with io_uring. Returns -1 if io_uring isn't available, otherwise 0 with any error in p->error
+static int pipeline_uring(pipeline *p) {
+  uring u;
+  if (uring_init(&u, 2 * PIPELINE_DEPTH) != 0) {
+    ver_printf(p->ctx, 3, "io_uring is not available, using threads: %s\n", strerror(errno));
+    return -1;
+  }
+  ver_printf(p->ctx, 3, "Using io_uring pipeline\n");
+
+  unsigned int in_flight = 0, i;
+  stats_clock clock;
+  if (p->stats)
+    clock = stats_now();
+  while (1) {
+    // Start reading new batches into any free slots
+    for (i = 0; i < PIPELINE_DEPTH && !p->error && p->next_b < p->track->length; i++) {
+      if (p->slots[i].state != SLOT_FREE)
+        continue;
+      pipeline_next_batch(p, &p->slots[i]);
+      uring_queue_read(&u, p, i);
+      in_flight++;
+    }
+
+    if (in_flight == 0)
+      break;
+
+    if (p->stats)
+      stats_add(&p->stats->convert, &clock);
+    if (uring_submit_and_wait(&u) != 0) {
+      // Nothing more can be done with the ring. It's a write error if any output was on its way, since then the
+      // output file is missing some of it, otherwise the track just can't be read any further
+      const int error = errno;
+      int writing = 0;
+      for (i = 0; i < PIPELINE_DEPTH; i++)
+        writing |= (p->slots[i].state == SLOT_WRITING);
+      pipeline_error(p, (writing) ? RIP_WRITE_ERR : RIP_READ_ERR, strerror(error));
+
+      // Whatever the kernel already has might still use the buffers, so wait for it. If even that doesn't work,
+      // there's no knowing when it's done and the buffers are left alone
+      if (uring_drain(&u) != 0) {
+        fprintf(stderr, "Error waiting for io_uring to finish: %s\n", strerror(errno));
+        p->buffers_busy = 1;
+      }
+      break;
+    }
+    if (p->stats)
+      stats_add(&p->stats->wait, &clock);
+
+    // Deal with all the completions
+    unsigned int head = *u.cq_head;
+    while (head != __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+      pipeline_slot *s = &p->slots[cqe->user_data];
+      const int res = cqe->res;
+      head++;
+      __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+      u.in_kernel--;
+
+      if (s->state == SLOT_READING) {
+        if (res <= 0) {
+          pipeline_error(p, RIP_READ_ERR, (res < 0) ? strerror(-res) : "Unexpected end of file");
+          s->state = SLOT_FREE;
+          in_flight--;
+          continue;
+        }
+
+        // Get the rest if the read came up short
+        s->done += res;
+        if (p->stats)
+          p->stats->bytes_read += res;
+        if (s->done < s->read_length) {
+          uring_queue_read(&u, p, cqe->user_data);
+          continue;
+        }
+
+        s->state = SLOT_READ;
+      }
+      else if (s->state == SLOT_WRITING) {
+        if (res <= 0) {
+          pipeline_error(p, RIP_WRITE_ERR, (res < 0) ? strerror(-res) : "Nothing written");
+          s->state = SLOT_FREE;
+          in_flight--;
+          continue;
+        }
+
+        // Write the rest if the write came up short
+        s->done += res;
+        if (p->stats)
+          p->stats->bytes_written += res;
+        if (s->done < s->out_length) {
+          uring_queue_write(&u, p, cqe->user_data);
+          continue;
+        }
+
+        pipeline_written(p, s);
+        s->state = SLOT_FREE;
+        in_flight--;
+      }
+    }
+
+    // Convert the batches that have been read in track order, reads can finish in any order.
+    // Keep going around until the next batch isn't read yet, it might be in a slot already passed over
+    int converted;
+    do {
+      converted = 0;
+      for (i = 0; i < PIPELINE_DEPTH; i++) {
+        pipeline_slot *s = &p->slots[i];
+        if (s->state != SLOT_READ)
+          continue;
+
+        // Don't write anything else once something has gone wrong
+        if (p->error) {
+          s->state = SLOT_FREE;
+          in_flight--;
+          continue;
+        }
+        if (s->b != p->next_convert)
+          continue;
+
+        if (pipeline_convert(p, s) != 0) {
+          pipeline_error(p, RIP_WRITE_ERR, strerror(errno));
+          s->state = SLOT_FREE;
+          in_flight--;
+          continue;
+        }
+        if (s->out_length == 0) {
+          pipeline_written(p, s);
+          s->state = SLOT_FREE;
+          in_flight--;
+        }
+        else
+          uring_queue_write(&u, p, i);
+        converted = 1;
+      }
+    } while (converted);
+  }
+
+  uring_free(&u);
+  return 0;
+}
+
+
+
+/*
+ * Threaded pipeline
+ */
+
+// Waits until slot i is in the wanted state. Returns 0 if it got there or -1 if there was an error. Must hold the lock
+static int pipeline_wait(pipeline *p, unsigned int i, int state) {
+  while (p->slots[i].state != state && !p->error)
+    pthread_cond_wait(&p->changed, &p->lock);
+  return p->error ? -1 : 0;
+}
+
+// Moves slot i into a new state and lets the other threads know. Must hold the lock
+static void pipeline_set_state(pipeline *p, unsigned int i, int state) {
+  p->slots[i].state = state;
+  pthread_cond_broadcast(&p->changed);
+}
+
+// Reader thread, reads the batches in order into free slots
+static void *pipeline_reader(void *arg) {
+  pipeline *p = arg;
+  unsigned int k;
+
+  pthread_mutex_lock(&p->lock);
+  for (k = 0; p->next_b < p->track->length; k++) {
+    const unsigned int i = k % PIPELINE_DEPTH;
+    if (pipeline_wait(p, i, SLOT_FREE) != 0)
+      break;
+    pipeline_slot *s = &p->slots[i];
+    pipeline_next_batch(p, s);
+    pthread_mutex_unlock(&p->lock);
+
+    // Use the sectors straight out of the mapping if possible, otherwise read them in
+    const uint64_t offset = p->track->track_offset + s->b;
+    int error = 0;
+    stats_clock clock;
+    if (p->stats)
+      clock = stats_now();
+    s->sectors = (s->read_length % p->layout->sector_size == 0) ? src_map(p->source, offset, s->read_length) : NULL;
+    if (!s->sectors) {
+      s->sectors = s->staging;
+      if (src_pread(p->source, s->staging, s->read_length, offset) != s->read_length)
+        error = 1;
+      if (p->stats)
+        p->stats->read_calls++;
+    }
+    if (p->stats) {
+      stats_add(&p->stats->read, &clock);
+      p->stats->bytes_read += s->read_length;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    if (error) {
+      pipeline_error(p, RIP_READ_ERR, (p->source->map ? "Unexpected end of file" : strerror(errno)));
+      pthread_cond_broadcast(&p->changed);
+      break;
+    }
+    pipeline_set_state(p, i, SLOT_READ);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+// Writer thread, writes the converted batches in order
+static void *pipeline_writer(void *arg) {
+  pipeline *p = arg;
+  unsigned int k;
+
+  pthread_mutex_lock(&p->lock);
+  for (k = 0; p->start + p->finished < p->track->length; k++) {
+    const unsigned int i = k % PIPELINE_DEPTH;
+    if (pipeline_wait(p, i, SLOT_CONVERTED) != 0)
+      break;
+    pipeline_slot *s = &p->slots[i];
+    pthread_mutex_unlock(&p->lock);
+
+    int error = 0;
+    stats_clock clock;
+    if (p->stats)
+      clock = stats_now();
+    while (s->done < s->out_length) {
+      ssize_t w = pwrite(p->fd, s->output + s->done, s->out_length - s->done, s->out_offset + s->done);
+      if (p->stats)
+        p->stats->write_calls++;
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0) {
+        error = 1;
+        break;
+      }
+      s->done += w;
+      if (p->stats)
+        p->stats->bytes_written += w;
+    }
+    if (p->stats)
+      stats_add(&p->stats->write, &clock);
+
+    pthread_mutex_lock(&p->lock);
+    if (error) {
+      pipeline_error(p, RIP_WRITE_ERR, strerror(errno));
+      pthread_cond_broadcast(&p->changed);
+      break;
+    }
+    pipeline_written(p, s);
+    pipeline_set_state(p, i, SLOT_FREE);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+// Runs the pipeline with a reader thread and a writer thread, converting on the calling thread
+static void pipeline_threads(pipeline *p) {
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->changed, NULL);
+
+  // pthread_create() returns the error instead of setting errno
+  pthread_t reader, writer;
+  int r = pthread_create(&reader, NULL, pipeline_reader, p);
+  if (r != 0) {
+    pipeline_error(p, RIP_READ_ERR, strerror(r));
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    return;
+  }
+  if ((r = pthread_create(&writer, NULL, pipeline_writer, p)) != 0) {
+    pthread_mutex_lock(&p->lock);
+    pipeline_error(p, RIP_WRITE_ERR, strerror(r));
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(reader, NULL);
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    return;
+  }
+
+  // Convert the batches in order as they are read
+  uint64_t converted = p->start;
+  unsigned int k;
+  pthread_mutex_lock(&p->lock);
+  for (k = 0; converted < p->track->length; k++) {
+    const unsigned int i = k % PIPELINE_DEPTH;
+    if (pipeline_wait(p, i, SLOT_READ) != 0)
+      break;
+    pthread_mutex_unlock(&p->lock);
+
+    stats_clock clock;
+    if (p->stats)
+      clock = stats_now();
+    const int error = (pipeline_convert(p, &p->slots[i]) != 0) ? errno : 0;
+    converted += p->slots[i].count * p->layout->sector_size;
+    if (p->stats)
+      stats_add(&p->stats->convert, &clock);
+
+    pthread_mutex_lock(&p->lock);
+    if (error) {
+      pipeline_error(p, RIP_WRITE_ERR, strerror(error));
+      pthread_cond_broadcast(&p->changed);
+      break;
+    }
+    pipeline_set_state(p, i, SLOT_CONVERTED);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  pthread_cond_destroy(&p->changed);
+  pthread_mutex_destroy(&p->lock);
+}
+
+
+
+// Rips a track through the pipeline
+int pipeline_rip(nerorip_context *ctx, image_source *source, nrg_track *t, unsigned int track_number, int fd,
+                 uint64_t output_offset, uint64_t start, rip_layout *l, int sub_fd, track_hasher *hasher,
+                 edc_verifier *verifier) {
+  rip_options *o = &ctx->options;
+  pipeline p;
+  memset(&p, 0, sizeof(pipeline));
+  p.source = source;
+  p.track = t;
+  p.track_number = track_number;
+  p.layout = l;
+  p.ctx = ctx;
+  p.options = o;
+  p.fd = fd;
+  p.sub_fd = sub_fd;
+  p.output_offset = output_offset;
+  p.start = start;
+  p.next_b = start;
+  p.next_convert = start;
+  p.stats = stats_track(ctx, track_number);
+  p.hasher = hasher;
+  p.verifier = verifier;
+
+  // Split the batch buffer budget between the batches in flight
+  const unsigned int batch_sectors = o->batch_sectors ? o->batch_sectors : RIP_BATCH_SECTORS;
+  p.batch_sectors = (batch_sectors / PIPELINE_DEPTH) ? batch_sectors / PIPELINE_DEPTH : 1;
+
+  unsigned int i;
+  int r = 0;
+  for (i = 0; i < PIPELINE_DEPTH; i++) {
+    p.slots[i].state = SLOT_FREE;
+    p.slots[i].staging = malloc(p.batch_sectors * l->sector_size);
+    p.slots[i].buffer = malloc(p.batch_sectors * (l->sector_size + 8));
+    if (!p.slots[i].staging || !p.slots[i].buffer)
+      r = RIP_ALLOC_ERR;
+  }
+  if (sub_fd >= 0 && (p.sub_buffer = malloc(p.batch_sectors * SUB_LENGTH)) == NULL)
+    r = RIP_ALLOC_ERR;
+
+  if (r == 0) {
+    src_sequential(source, t->track_offset + start, t->length - start);
+    if (pipeline_uring(&p) != 0)
+      pipeline_threads(&p);
+    r = p.error;
+    if (p.stats) {
+      p.stats->bytes_written += p.sub_bytes;
+      p.stats->write_calls += p.sub_calls;
+    }
+  }
+  else
+    fprintf(stderr, "Failed to allocate memory for track buffer: %s\n", strerror(errno));
+
+  // Clean up buffers. Ones the kernel might still be using are leaked, which is better than it writing into freed memory
+  for (i = 0; i < PIPELINE_DEPTH && !p.buffers_busy; i++) {
+    free(p.slots[i].staging);
+    free(p.slots[i].buffer);
+  }
+  free(p.sub_buffer);
+  return r;
+}
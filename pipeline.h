@@ -0,0 +1,79 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include "util.h"
+#include "nrg.h"
+#include "source.h"
+#include "rip.h"
+#include "hash.h"
+#include "edc.h"
+
+// Number of batches that can be somewhere between being read and being written at once
+#define PIPELINE_DEPTH 4
+
+
+/**
+ * Rip the rest of a track through an asynchronous read -> convert -> write pipeline.
+ *
+ * Up to PIPELINE_DEPTH batches are in flight at once, so the image is being read and the output
+ * written while other batches are being converted. If the kernel supports it, the reads and writes
+ * are queued with io_uring. Otherwise a reader thread and a writer thread do them while the calling
+ * thread converts. Each batch is written to its own offset in the output so they can finish in any order.
+ * The batch buffer budget in ctx->options.batch_sectors is split between the batches in flight.
+ * Batches are converted in track order, which is the order they are passed to the hasher and the verifier in.
+ *
+ * @param nerorip_context *ctx
+ *   How the track should be converted and where progress goes
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param nrg_track *track
+ *   The track being ripped
+ * @param unsigned int track_number
+ *   The number of this track in the whole image (starting at 1)
+ * @param int output_fd
+ *   File descriptor of the output file. It must be able to seek
+ * @param uint64_t output_offset
+ *   Where in the output file the data from start onwards goes
+ * @param uint64_t start
+ *   How far into the track ripping should start. Must be at the start of a sector
+ * @param rip_layout *layout
+ *   How the sectors of the track are converted
+ * @param int sub_fd
+ *   File descriptor the subchannel data from start onwards is written to, in order, -1 for none
+ * @param track_hasher *hasher
+ *   Where the raw and converted data from start onwards is hashed, NULL to not hash it
+ * @param edc_verifier *verifier
+ *   Where the kept sectors from start onwards are checked, NULL to not check them
+ * @return int
+ *   0 on success
+ *   RIP_READ_ERR if the track data could not be read from the image file
+ *   RIP_WRITE_ERR if the converted data could not be written
+ *   RIP_ALLOC_ERR if the batch buffers could not be allocated
+ */
+int pipeline_rip(nerorip_context *ctx, image_source *source, nrg_track *track, unsigned int track_number, int output_fd,
+                 uint64_t output_offset, uint64_t start, rip_layout *layout, int sub_fd, track_hasher *hasher,
+                 edc_verifier *verifier);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <unistd.h> // write()
+#include "nerorip.h"
+
+// Gets the time now in seconds
+static double progress_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Writes a line to the progress file descriptor. Progress is only informational, so errors are ignored
+static void progress_write(nerorip_progress *p, const char *line, size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t w = write(p->ctx->progress_fd, line + done, length - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return;
+    done += w;
+  }
+}
+
+// Copies string into out as the inside of a JSON string, cutting it short if out isn't big enough
+static void progress_json_string(char *out, size_t size, const char *string) {
+  size_t n = 0;
+  for (; *string && n + 7 < size; string++) {
+    const unsigned char c = *string;
+    if (c == '"' || c == '\\') {
+      out[n++] = '\\';
+      out[n++] = c;
+    }
+    else if (c < 0x20)
+      n += snprintf(out + n, size - n, "\\u%04x", c);
+    else
+      out[n++] = c;
+  }
+  out[n] = '\0';
+}
+
+// Wipes the progress line off the terminal so something else can be printed. Must hold the lock
+static void progress_wipe(nerorip_progress *p) {
+  if (p->line_length) {
+    ver_printf(p->ctx, 1, "\r%*s\r", p->line_length, "");
+    p->line_length = 0;
+  }
+}
+
+// Reports the progress of the whole image. Must hold the lock
+static void progress_report(nerorip_progress *p, unsigned int track_number, double now) {
+  const uint64_t done = __atomic_load_n(&p->done, __ATOMIC_RELAXED);
+  const uint64_t total = __atomic_load_n(&p->total, __ATOMIC_RELAXED);
+  const double elapsed = now - p->start;
+  const double rate = (elapsed > 0) ? done / elapsed : 0;
+  const double percent = (total && done < total) ? done * 100.0 / total : 100;
+  const double eta = (rate > 0 && done < total) ? (total - done) / rate : 0;
+
+  if (p->ctx->options.show_progress && p->ctx->verbosity >= 1) {
+    char line[128];
+    const unsigned int eta_seconds = eta + 0.5;
+    int length = snprintf(line, sizeof(line), "  %3d%% of %.1f MB, %.1f MB/s, ETA %u:%02u:%02u", (int) percent, total / (1024.0 * 1024.0),
+                          rate / (1024.0 * 1024.0), eta_seconds / 3600, eta_seconds / 60 % 60, eta_seconds % 60);
+    ver_printf(p->ctx, 1, "\r%-*s", p->line_length, line);
+    fflush(p->ctx->log ? p->ctx->log : stdout);
+    if (length > p->line_length)
+      p->line_length = length;
+  }
+
+  if (p->ctx->progress_fd >= 0) {
+    char line[256];
+    int length = snprintf(line, sizeof(line), "{\"event\":\"progress\",\"track\":%u,\"done\":%llu,\"total\":%llu,\"percent\":%.1f,\"mb_per_s\":%.3f,\"eta\":%.1f}\n",
+                          track_number, (unsigned long long) done, (unsigned long long) total, percent, rate / (1024.0 * 1024.0), eta);
+    progress_write(p, line, length);
+  }
+}
+
+
+// Starts tracking the progress of an image
+void progress_start(nerorip_progress *progress, nerorip_context *ctx, uint64_t total) {
+  progress->ctx = ctx;
+  progress->total = total;
+  progress->done = 0;
+  progress->start = progress_now();
+  progress->last_report = progress->start;
+  progress->interval = (ctx->progress_rate) ? 1.0 / ctx->progress_rate : -1;
+  progress->line_length = 0;
+  pthread_mutex_init(&progress->lock, NULL);
+}
+
+// Counts some more of the image as ripped
+void progress_add(nerorip_context *ctx, unsigned int track_number, uint64_t bytes) {
+  nerorip_progress *p = ctx->progress;
+  if (!p)
+    return;
+  __atomic_add_fetch(&p->done, bytes, __ATOMIC_RELAXED);
+
+  // Whoever is reporting already has it covered
+  if (p->interval < 0 || pthread_mutex_trylock(&p->lock) != 0)
+    return;
+  const double now = progress_now();
+  if (now - p->last_report >= p->interval) {
+    progress_report(p, track_number, now);
+    p->last_report = now;
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+// Changes the total
+void progress_add_total(nerorip_context *ctx, int64_t change) {
+  if (ctx->progress)
+    __atomic_add_fetch(&ctx->progress->total, (uint64_t) change, __ATOMIC_RELAXED);
+}
+
+// Reports a finished track
+void progress_track_done(nerorip_context *ctx, unsigned int track_number, const char *filename, int result) {
+  nerorip_progress *p = ctx->progress;
+  if (!p)
+    return;
+
+  pthread_mutex_lock(&p->lock);
+  progress_wipe(p);
+  if (result == 0)
+    ver_printf(ctx, 1, "  %s: done\n", strcmp(filename, "-") ? filename : "stdout");
+
+  if (ctx->progress_fd >= 0) {
+    char name[768], line[1024];
+    progress_json_string(name, sizeof(name), filename);
+    int length = snprintf(line, sizeof(line), "{\"event\":\"track\",\"track\":%u,\"file\":\"%s\",\"result\":%d}\n", track_number, name, result);
+    progress_write(p, line, length);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+// Reports a finished image
+void progress_image_done(nerorip_context *ctx, const char *input, int result, const char *error,
+                         unsigned int number_tracks, uint64_t bytes, double seconds) {
+  nerorip_progress *p = ctx->progress;
+  if (!p)
+    return;
+  const double rate = (seconds > 0) ? bytes / seconds : 0;
+
+  pthread_mutex_lock(&p->lock);
+  progress_wipe(p);
+  if (result == 0)
+    ver_printf(ctx, 1, "%s: %u track(s), %.1f MB in %.1fs, %.1f MB/s\n", input, number_tracks, bytes / (1024.0 * 1024.0),
+               seconds, rate / (1024.0 * 1024.0));
+  else
+    ver_printf(ctx, 1, "%s: FAILED, %s\n", input, error);
+
+  if (ctx->progress_fd >= 0) {
+    char name[768], line[1024];
+    progress_json_string(name, sizeof(name), input);
+    int length = snprintf(line, sizeof(line), "{\"event\":\"image\",\"image\":\"%s\",\"result\":%d,\"error\":\"%s\",\"tracks\":%u,"
+                          "\"bytes\":%llu,\"seconds\":%.3f,\"mb_per_s\":%.3f}\n", name, result, (result ? error : ""), number_tracks,
+                          (unsigned long long) bytes, seconds, rate / (1024.0 * 1024.0));
+    progress_write(p, line, length);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+// Prints a message without mixing it up with the progress line
+void progress_printf(nerorip_context *ctx, const char *format, ...) {
+  nerorip_progress *p = ctx->progress;
+  if (ctx->verbosity < 1)
+    return;
+
+  if (p) {
+    pthread_mutex_lock(&p->lock);
+    progress_wipe(p);
+  }
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(ctx->log ? ctx->log : stdout, format, ap);
+  va_end(ap);
+  if (p)
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Makes the final report
+void progress_finish(nerorip_progress *p, int result) {
+  const double elapsed = progress_now() - p->start;
+  const double rate = (elapsed > 0) ? p->done / elapsed : 0;
+
+  progress_wipe(p);
+  if (p->ctx->options.show_progress && result == 0)
+    ver_printf(p->ctx, 1, "  Ripped %.1f MB in %.1fs, %.1f MB/s\n", p->done / (1024.0 * 1024.0), elapsed, rate / (1024.0 * 1024.0));
+
+  if (p->ctx->progress_fd >= 0) {
+    char line[256];
+    int length = snprintf(line, sizeof(line), "{\"event\":\"done\",\"done\":%llu,\"total\":%llu,\"seconds\":%.3f,\"mb_per_s\":%.3f,\"result\":%d}\n",
+                          (unsigned long long) p->done, (unsigned long long) p->total, elapsed, rate / (1024.0 * 1024.0), result);
+    progress_write(p, line, length);
+  }
+  pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,156 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <pthread.h>
+#include "util.h"
+
+// Most progress updates printed per second unless the context says otherwise
+#define PROGRESS_RATE 4
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Nerorip progress struct
+ *
+ * The progress of ripping a whole image, shared by all the tracks being ripped at once.
+ * Each batch adds what it did with progress_add(), which is one atomic add and, at most
+ * ctx->progress_rate times per second, a report of the whole image's percentage, throughput
+ * and estimated time left. Reports go to the terminal through ver_printf() at verbosity 1 if
+ * ctx->options.show_progress is set, and as JSON lines to ctx->progress_fd if it isn't -1.
+ */
+typedef struct nerorip_progress {
+  nerorip_context *ctx;
+
+  // Bytes of track data in all the tracks and how many have been ripped so far (both updated atomically)
+  uint64_t total;
+  uint64_t done;
+
+  // When ripping started and when the last report was made, in seconds
+  double start;
+  double last_report;
+  // Seconds between reports
+  double interval;
+
+  // Length of the progress line on the terminal, so it can be wiped before printing something else
+  int line_length;
+
+  // Protects the reports. Only one thread reports at a time, the others don't wait for it
+  pthread_mutex_t lock;
+} nerorip_progress;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Start tracking the progress of ripping total bytes of track data.
+ *
+ * @param nerorip_progress *progress
+ *   The progress to start
+ * @param nerorip_context *ctx
+ *   Says where and how often the progress is reported
+ * @param uint64_t total
+ *   Bytes of track data that will be ripped
+ */
+void progress_start(nerorip_progress *progress, nerorip_context *ctx, uint64_t total);
+
+/**
+ * Count bytes of track data as ripped and report the progress if it's been long enough since the last report.
+ * Does nothing if ctx->progress is NULL. Safe to call from several threads at once.
+ *
+ * @param nerorip_context *ctx
+ *   The context whose progress is updated
+ * @param unsigned int track_number
+ *   The track the bytes are from, included in the JSON lines
+ * @param uint64_t bytes
+ *   How many more bytes of the track have been ripped
+ */
+void progress_add(nerorip_context *ctx, unsigned int track_number, uint64_t bytes);
+
+/**
+ * Change how many bytes of track data there are in total, for when it isn't known up front.
+ * Does nothing if ctx->progress is NULL. Safe to call from several threads at once.
+ */
+void progress_add_total(nerorip_context *ctx, int64_t change);
+
+/**
+ * Report that a track is done. Prints "FILENAME: done" if it was ripped.
+ *
+ * @param nerorip_context *ctx
+ *   The context whose progress is updated, does nothing if ctx->progress is NULL
+ * @param unsigned int track_number
+ *   The track that finished
+ * @param const char *filename
+ *   Where it was ripped to
+ * @param int result
+ *   What rip_track() returned for it
+ */
+void progress_track_done(nerorip_context *ctx, unsigned int track_number, const char *filename, int result);
+
+/**
+ * Report that a whole image is done, for batch_rip(). Prints a summary line of how it went.
+ *
+ * @param nerorip_context *ctx
+ *   The context whose progress is updated, does nothing if ctx->progress is NULL
+ * @param const char *input
+ *   The image file
+ * @param int result
+ *   0 if every track was ripped, otherwise the error
+ * @param const char *error
+ *   Describes result if it isn't 0
+ * @param unsigned int number_tracks, uint64_t bytes, double seconds
+ *   How many tracks and bytes of track data were in the image and how long it took
+ */
+void progress_image_done(nerorip_context *ctx, const char *input, int result, const char *error,
+                         unsigned int number_tracks, uint64_t bytes, double seconds);
+
+/**
+ * Print a message through ver_printf() at verbosity 1, wiping the progress line off the terminal first
+ * so the two don't get mixed up. The progress line comes back with the next report.
+ *
+ * @param nerorip_context *ctx
+ *   The context whose progress line is in the way. If ctx->progress is NULL, it is just printed
+ * @param const char *format, ...
+ *   What you'd normally pass off to printf
+ */
+void progress_printf(nerorip_context *ctx, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Make the final report and clean up.
+ *
+ * @param nerorip_progress *progress
+ *   The progress to finish
+ * @param int result
+ *   0 if every track was ripped, otherwise the error
+ */
+void progress_finish(nerorip_progress *progress, int result);
+
+#endif
@@ -0,0 +1,982 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE // pipe2()
+#include <pthread.h>
+#include <limits.h> // IOV_MAX
+#include <unistd.h> // write()
+#include <fcntl.h> // O_CLOEXEC
+#include <spawn.h> // posix_spawn()
+#include <sys/uio.h> // writev()
+#include <sys/wait.h> // waitpid()
+#include "nerorip.h"
+#include "pipeline.h"
+
+// Largest number of iovecs one writev call takes. POSIX only guarantees 16 but Linux takes 1024
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// How many bad LBAs of a track are listed in its warning at the normal verbosity
+#define RIP_VERIFY_SHOWN 8
+
+// The 8 byte header that goes before every sector in a "Mac" ISO
+static const uint8_t mac_header[8] = {0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00};
+
+
+// Writes all of buffer to fd, returning the number of bytes written or -1 on error. Every write() is counted in *calls
+static ssize_t write_all(int fd, const uint8_t *buffer, size_t length, uint64_t *calls) {
+  size_t done = 0;
+  while (done < length) {
+    (*calls)++;
+    ssize_t w = write(fd, buffer + done, length - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return -1;
+    done += w;
+  }
+  return done;
+}
+
+// Writes everything in the iovec list to fd, returning the number of bytes written or -1 on error. Every writev() is counted in *calls
+static ssize_t writev_all(int fd, struct iovec *iov, unsigned int count, uint64_t *calls) {
+  size_t done = 0;
+  while (count > 0) {
+    (*calls)++;
+    ssize_t w = writev(fd, iov, count > IOV_MAX ? IOV_MAX : count);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return -1;
+    done += w;
+
+    // Skip past whatever was written, which might end part way through an iovec
+    while (count > 0 && (size_t) w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t *) iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return done;
+}
+
+
+/*
+ * Gather kernels. Each layout that comes up often gets its own loop with constant sizes so the compiler turns every
+ * copy into a few vector moves, the rest get one that reads the sizes from the layout.
+ */
+#define RIP_GATHER(size, header, write) \
+  static uint8_t *gather_##size##_##header##_##write(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) { \
+    unsigned int i; \
+    (void) l; \
+    for (i = 0; i < kept; i++, out += write) \
+      memcpy(out, sectors + (size_t) i * size + header, write); \
+    return out; \
+  }
+
+#define RIP_GATHER_MAC(size, header) \
+  static uint8_t *gather_mac_##size##_##header(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) { \
+    unsigned int i; \
+    (void) l; \
+    for (i = 0; i < kept; i++, out += sizeof(mac_header) + 2048) { \
+      memcpy(out, mac_header, sizeof(mac_header)); \
+      memcpy(out + sizeof(mac_header), sectors + (size_t) i * size + header, 2048); \
+    } \
+    return out; \
+  }
+
+// Form1 Mode2 and Mode1 sectors to ISO/2048
+RIP_GATHER(2352, 24, 2048)
+RIP_GATHER(2352, 16, 2048)
+RIP_GATHER(2336, 8, 2048)
+RIP_GATHER(2448, 24, 2048)
+RIP_GATHER(2448, 16, 2048)
+RIP_GATHER(2368, 24, 2048)
+RIP_GATHER(2368, 16, 2048)
+// Form2 Mode2 sectors, keeping all RIP_FORM2_LENGTH bytes
+RIP_GATHER(2352, 24, 2324)
+RIP_GATHER(2336, 8, 2324)
+RIP_GATHER(2448, 24, 2324)
+RIP_GATHER(2368, 24, 2324)
+// Raw sectors with their subchannel data split off
+RIP_GATHER(2448, 0, 2352)
+RIP_GATHER(2368, 0, 2352)
+// "Mac" ISO/2056
+RIP_GATHER_MAC(2352, 24)
+RIP_GATHER_MAC(2352, 16)
+RIP_GATHER_MAC(2336, 8)
+RIP_GATHER_MAC(2448, 24)
+RIP_GATHER_MAC(2448, 16)
+RIP_GATHER_MAC(2048, 0)
+
+// Sectors that are kept whole are already where they need to be, one after the other
+static uint8_t *gather_whole(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) {
+  memcpy(out, sectors, (size_t) kept * l->sector_size);
+  return out + (size_t) kept * l->sector_size;
+}
+
+static uint8_t *gather_any(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) {
+  unsigned int i;
+  for (i = 0; i < kept; i++, out += l->write_length)
+    memcpy(out, sectors + (size_t) i * l->sector_size + l->header_length, l->write_length);
+  return out;
+}
+
+static uint8_t *gather_any_form2(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) {
+  unsigned int i;
+  for (i = 0; i < kept; i++, out += RIP_FORM2_LENGTH)
+    memcpy(out, sectors + (size_t) i * l->sector_size + l->header_length, RIP_FORM2_LENGTH);
+  return out;
+}
+
+static uint8_t *gather_any_mac(uint8_t *out, const uint8_t *sectors, unsigned int kept, const rip_layout *l) {
+  unsigned int i;
+  for (i = 0; i < kept; i++, out += sizeof(mac_header) + l->write_length) {
+    memcpy(out, mac_header, sizeof(mac_header));
+    memcpy(out + sizeof(mac_header), sectors + (size_t) i * l->sector_size + l->header_length, l->write_length);
+  }
+  return out;
+}
+
+#define RIP_KERNEL(size, header, write) {size, header, write, 0, gather_##size##_##header##_##write, #size "/" #header "/" #write}
+#define RIP_KERNEL_MAC(size, header) {size, header, 2048, 1, gather_mac_##size##_##header, "mac " #size "/" #header "/2048"}
+
+// The specialized kernels and the layouts they are for
+static const struct {
+  unsigned int sector_size, header_length, write_length;
+  int mac;
+  rip_gather_fn gather;
+  const char *name;
+} rip_kernels[] = {
+  RIP_KERNEL(2352, 24, 2048), RIP_KERNEL(2352, 16, 2048), RIP_KERNEL(2336, 8, 2048),
+  RIP_KERNEL(2448, 24, 2048), RIP_KERNEL(2448, 16, 2048), RIP_KERNEL(2368, 24, 2048), RIP_KERNEL(2368, 16, 2048),
+  RIP_KERNEL(2352, 24, 2324), RIP_KERNEL(2336, 8, 2324), RIP_KERNEL(2448, 24, 2324), RIP_KERNEL(2368, 24, 2324),
+  RIP_KERNEL(2448, 0, 2352), RIP_KERNEL(2368, 0, 2352),
+  RIP_KERNEL_MAC(2352, 24), RIP_KERNEL_MAC(2352, 16), RIP_KERNEL_MAC(2336, 8),
+  RIP_KERNEL_MAC(2448, 24), RIP_KERNEL_MAC(2448, 16), RIP_KERNEL_MAC(2048, 0),
+};
+
+// Finds the kernel for a layout, falling back to one that reads the sizes from the layout
+static rip_gather_fn rip_find_kernel(rip_layout *l, unsigned int write_length, int mac, const char **name) {
+  unsigned int i;
+  for (i = 0; i < sizeof(rip_kernels) / sizeof(rip_kernels[0]); i++) {
+    if (rip_kernels[i].sector_size == l->sector_size && rip_kernels[i].header_length == l->header_length &&
+        rip_kernels[i].write_length == write_length && rip_kernels[i].mac == mac) {
+      *name = rip_kernels[i].name;
+      return rip_kernels[i].gather;
+    }
+  }
+
+  if (mac) {
+    *name = "mac generic";
+    return gather_any_mac;
+  }
+  if (l->header_length == 0 && write_length == l->sector_size) {
+    *name = "whole";
+    return gather_whole;
+  }
+  *name = "generic";
+  return (write_length == RIP_FORM2_LENGTH && l->write_length != RIP_FORM2_LENGTH) ? gather_any_form2 : gather_any;
+}
+
+void rip_select_kernels(rip_layout *l) {
+  const char *form2_name;
+  l->gather = rip_find_kernel(l, l->write_length, l->mac, &l->kernel);
+  l->gather_form2 = (l->xa) ? rip_find_kernel(l, RIP_FORM2_LENGTH, 0, &form2_name) : NULL;
+}
+
+
+// Finds the submode byte of the XA subheader, which is the third byte of the last 8 of a Mode2 header.
+// Returns 0 if the layout has no subheader
+static inline unsigned int rip_submode_offset(rip_layout *l) {
+  return (l->header_length == 24 || l->header_length == 8) ? l->header_length - 6 : 0;
+}
+
+// Counts the Form2 sectors of a batch. It only looks at one byte of each sector and doesn't branch on it
+unsigned int rip_count_form2(rip_layout *l, const uint8_t *sectors, unsigned int count) {
+  const unsigned int offset = rip_submode_offset(l);
+  if (!offset)
+    return 0;
+
+  const uint8_t *submode = sectors + offset;
+  unsigned int i, form2 = 0;
+  for (i = 0; i < count; i++, submode += l->sector_size)
+    form2 += (*submode >> 5) & 1;
+  return form2;
+}
+
+// Works out how much user data a sector has under an xa layout
+static inline unsigned int rip_sector_length(rip_layout *l, const uint8_t *sector) {
+  return (l->xa && (sector[rip_submode_offset(l)] & 0x20)) ? RIP_FORM2_LENGTH : l->write_length;
+}
+
+/**
+ * Gathers the user data of the first kept sectors of a Mode2 track into out, as much as each one's form has.
+ * Batches that are all one form, which is nearly all of them, are gathered by the layout's kernels in one go.
+ * Returns a pointer just past the last byte written.
+ */
+static uint8_t *gather_xa_sectors(uint8_t *out, const uint8_t *sectors, unsigned int kept, rip_layout *l) {
+  const unsigned int form2 = rip_count_form2(l, sectors, kept);
+  if (form2 == 0)
+    return l->gather(out, sectors, kept, l);
+  if (form2 == kept)
+    return l->gather_form2(out, sectors, kept, l);
+
+  unsigned int i;
+  for (i = 0; i < kept; i++) {
+    const uint8_t *sector = sectors + (size_t) i * l->sector_size;
+    const unsigned int length = rip_sector_length(l, sector);
+    memcpy(out, sector + l->header_length, length);
+    out += length;
+  }
+  return out;
+}
+
+
+// Works out how a track is to be converted
+void rip_get_layout(nrg_track *t, unsigned int track_number, rip_options *o, rip_layout *l) {
+  l->sector_size = t->sector_size;
+  // Any subchannel data is split off first, everything else only looks at the raw sector in front of it
+  l->subchannel_length = sub_length(l->sector_size);
+  const unsigned int main_size = l->sector_size - l->subchannel_length;
+
+  // Determine the number of sectors to write depending on the trimming options
+  uint64_t trim_length = 0;
+  // First track trimming
+  if (track_number == 1 && (o->trim_tracks & TRIM_FIRST))
+    trim_length += 2 * l->sector_size;
+  if (o->trim_tracks & TRIM_ALL)
+    trim_length += 2 * l->sector_size;
+  l->trimmed_track_length = (t->length > trim_length) ? t->length - trim_length : 0;
+
+  // If the track isn't audio and a conversion is to be done, figure out how long the header is.
+  // None of this changes from one sector to the next so it is only worked out once.
+  l->header_length = 0;
+  l->write_length = main_size;
+  if (t->sector_mode != SECTOR_AUDIO && o->data_output != DAT_BIN) {
+
+    // The header length depends on the track mode: 12 bytes of sync and 4 of address and mode in front of a raw
+    // sector, and 8 bytes of XA subheader after that for Mode2. Cooked 2048 byte sectors have neither
+    if (t->sector_mode == SECTOR_MODE2) {
+      switch (main_size) {
+        case 2352: l->header_length = 24; break;
+        case 2336: l->header_length = 8;  break;
+        default:   l->header_length = 0;  break;
+      }
+    }
+    else {
+      switch (main_size) {
+        case 2352: l->header_length = 16; break;
+        default:   l->header_length = 0;  break;
+      }
+    }
+
+    // Since we're converting to ISO/2048, the sector length is now 2048
+    l->write_length = 2048;
+  }
+  l->mac = (o->data_output == DAT_MAC);
+  l->swap = (o->swap_audio_output && t->sector_mode == SECTOR_AUDIO);
+  // Only Mode2 sectors have a subheader to say what form they are
+  l->xa = (o->data_output == DAT_MPG && t->sector_mode == SECTOR_MODE2 && l->header_length != 0);
+
+  // Sectors that need no conversion at all can be written out exactly as they were read
+  l->passthrough = (!l->mac && !l->swap && l->header_length == 0 && l->write_length == l->sector_size);
+  rip_select_kernels(l);
+}
+
+
+// Counts the sectors of a batch that aren't trimmed
+unsigned int rip_kept_sectors(rip_layout *l, uint64_t b, unsigned int count) {
+  if (b >= l->trimmed_track_length)
+    return 0;
+
+  uint64_t kept = (l->trimmed_track_length - b + l->sector_size - 1) / l->sector_size;
+  return (kept > count) ? count : kept;
+}
+
+
+// Converts a batch of sectors
+size_t rip_convert_batch(rip_layout *l, const uint8_t *sectors, unsigned int kept, unsigned int count, uint8_t *out) {
+  if (l->xa)
+    return gather_xa_sectors(out, sectors, kept, l) - out;
+  uint8_t *end = l->gather(out, sectors, kept, l);
+
+  // Trimmed sectors still get their Mac header, which is what "Mac" ISOs have always had
+  unsigned int i;
+  if (l->mac)
+    for (i = kept; i < count; i++, end += sizeof(mac_header))
+      memcpy(end, mac_header, sizeof(mac_header));
+
+  // Swap the audio if necessary
+  if (l->swap) {
+    if (!l->mac)
+      swap_buffer(out, kept * l->write_length);
+    else {
+      for (i = 0; i < kept; i++)
+        swap_buffer(out + i * (sizeof(mac_header) + l->write_length) + sizeof(mac_header), l->write_length);
+    }
+  }
+
+  return end - out;
+}
+
+
+// Splits off and writes the subchannel data of a batch
+ssize_t rip_write_subchannel(rip_layout *l, const uint8_t *sectors, unsigned int kept, uint8_t *buffer, int fd, uint64_t *calls) {
+  sub_deinterleave(buffer, sectors, kept, l->sector_size, l->subchannel_length);
+  return write_all(fd, buffer, (size_t) kept * SUB_LENGTH, calls);
+}
+
+
+// Returns 1 if any of the payloads of the trimmed sectors in a batch aren't zero
+int rip_trimmed_has_data(rip_layout *l, const uint8_t *sectors, unsigned int kept, unsigned int count) {
+  unsigned int i, d;
+  for (i = kept; i < count; i++) {
+    const uint8_t *payload = sectors + i * l->sector_size + l->header_length;
+    for (d = 0; d < l->write_length; d++)
+      if (payload[d])
+        return 1;
+  }
+  return 0;
+}
+
+// Warns about data in the trimmed sectors
+void rip_warn_trimmed(nerorip_context *ctx, unsigned int track_number) {
+  progress_printf(ctx, "  WARNING: Might be trimming relevant data from the end of track %02d. Consider using the --full option.\n", track_number);
+}
+
+// Warns about Form2 sectors losing their last 276 bytes
+void rip_warn_form2(nerorip_context *ctx, unsigned int track_number) {
+  progress_printf(ctx, "  WARNING: Track %02d has Form2 sectors, which only keep 2048 of their %d bytes. Consider using the --mpg option.\n",
+                  track_number, RIP_FORM2_LENGTH);
+}
+
+
+// Does the work for rip_track(), counting it in ts if it isn't NULL
+static int rip_track_data(nerorip_context *ctx, image_source *source, nrg_track *t, unsigned int track_number, FILE *tf,
+                          FILE *sf, track_hasher *hasher, edc_verifier *verifier, track_stats *ts) {
+  rip_options *o = &ctx->options;
+  rip_layout l;
+  rip_get_layout(t, track_number, o, &l);
+  const uint64_t sector_size = l.sector_size;
+  ver_printf(ctx, 3, "Track %02u: Converting with the %s gather kernel\n", track_number, l.kernel);
+  stats_clock clock;
+  if (ts)
+    clock = stats_now();
+
+  // Add the proper header if the track is AUDIO. Its length doesn't count any subchannel data.
+  // If the output is being hashed, the header is put together in memory first so it can be hashed too.
+  if (t->track_mode == AUDIO && (o->audio_output == AUD_WAV || o->audio_output == AUD_AIFF)) {
+    const uint64_t audio_length = l.trimmed_track_length / sector_size * l.write_length + l.trimmed_track_length % sector_size;
+    char *header = NULL;
+    size_t header_length = 0;
+    FILE *hf = (hasher) ? open_memstream(&header, &header_length) : tf;
+    if (!hf) {
+      fprintf(stderr, "Failed to allocate memory for track header: %s\n", strerror(errno));
+      return RIP_ALLOC_ERR;
+    }
+    if (o->audio_output == AUD_WAV)
+      fwrite_wav_header(hf, audio_length);
+    else
+      fwrite_aiff_header(hf, l.trimmed_track_length / sector_size);
+    if (hasher) {
+      fclose(hf);
+      hasher_output(hasher, (uint8_t *) header, header_length);
+      fwrite(header, 1, header_length, tf);
+      free(header);
+    }
+  }
+
+  // A track that needs no conversion is just a range of bytes in the image file, so let the kernel copy it.
+  // Only whole sectors can be handed off. Anything trimmed off the end still goes through the loop below
+  // so it gets checked for data, as does whatever is left if the kernel gave up part way through.
+  // Output that can't seek, like a pipe, always goes through the loop, as does a track being hashed or verified.
+  // This is what DVD images, with one huge track of 2048 byte sectors, spend nearly all their time in.
+  uint64_t b = 0;
+  if (!hasher && !verifier && l.passthrough && t->length % sector_size == 0 && l.trimmed_track_length > 0 && fflush(tf) == 0 && ftello(tf) >= 0) {
+    const uint64_t output_offset = ftello(tf);
+    const uint64_t chunk = RIP_COPY_LENGTH - RIP_COPY_LENGTH % sector_size;
+    uint64_t copied = 0;
+    while (copied < l.trimmed_track_length) {
+      const uint64_t length = (l.trimmed_track_length - copied > chunk) ? chunk : l.trimmed_track_length - copied;
+      const uint64_t done = copy_file_data(ctx, fileno(source->file), t->track_offset + copied, fileno(tf), output_offset + copied, length);
+      copied += done;
+      if (ts) {
+        ts->bytes_read += done;
+        ts->read_calls++;
+        ts->bytes_written += done;
+        ts->write_calls++;
+      }
+      progress_add(ctx, track_number, (copied - copied % sector_size) - b);
+      b = copied - copied % sector_size;
+      if (done < length)
+        break;
+    }
+    fseeko(tf, output_offset + b, SEEK_SET);
+  }
+
+  // Everything else is written straight to the output file descriptor in one call per batch.
+  // Make sure the audio header isn't still sitting in the stdio buffer first.
+  const int fd = fileno(tf);
+  if (fflush(tf) != 0) {
+    fprintf(stderr, "Error writing track: %s\n  Skipping this track.\n", strerror(errno));
+    return RIP_WRITE_ERR;
+  }
+  if (ts) {
+    // Whatever is in the file now besides the copied sectors is the audio header, written with one call
+    const off_t header_length = ftello(tf) - b;
+    if (header_length > 0) {
+      ts->bytes_written += header_length;
+      ts->write_calls++;
+    }
+    stats_add(&ts->write, &clock);
+  }
+
+  // Hand the rest off to the asynchronous pipeline if it was asked for.
+  // It writes to explicit offsets so it can only be used if the output can seek.
+  const int sub_fd = (sf && l.subchannel_length) ? fileno(sf) : -1;
+  if (o->async) {
+    off_t output_offset = lseek(fd, 0, SEEK_CUR);
+    if (output_offset >= 0)
+      return pipeline_rip(ctx, source, t, track_number, fd, output_offset, b, &l, sub_fd, hasher, verifier);
+  }
+
+  // Raw sectors that can't be used straight out of the mapping are read into the staging buffer.
+  // Converted sectors are gathered into the output buffer, which needs room for the Mac headers too.
+  // If the image is mapped and nothing needs to be swapped, the converted sectors aren't copied at all:
+  // they are gathered into an iovec list pointing into the mapping and written with writev.
+  // Subchannel data is deinterleaved into its own small buffer and written to its file batch by batch.
+  const unsigned int batch_sectors = o->batch_sectors ? o->batch_sectors : RIP_BATCH_SECTORS;
+  uint8_t *staging = malloc(batch_sectors * sector_size);
+  uint8_t *buffer = malloc(batch_sectors * (sector_size + sizeof(mac_header)));
+  struct iovec *iov = malloc(2 * batch_sectors * sizeof(struct iovec));
+  uint8_t *sub_buffer = (sub_fd >= 0) ? malloc(batch_sectors * SUB_LENGTH) : NULL;
+  if (!staging || !buffer || !iov || (sub_fd >= 0 && !sub_buffer)) {
+    fprintf(stderr, "Failed to allocate memory for track buffer: %s\n", strerror(errno));
+    free(staging);
+    free(buffer);
+    free(iov);
+    free(sub_buffer);
+    return RIP_ALLOC_ERR;
+  }
+
+  // Everything is read with positional reads so several tracks can be ripped from the same source at once
+  src_sequential(source, t->track_offset + b, t->length - b);
+
+  int r = 0;
+  int warned = 0, form2_warned = 0;
+  uint64_t read_calls = 0, write_calls = 0;
+  uint64_t bytes_read = 0, bytes_written = 0;
+  while (b < t->length) {
+    // Figure out how many sectors go in this batch
+    uint64_t read_length = t->length - b;
+    if (read_length > batch_sectors * sector_size)
+      read_length = batch_sectors * sector_size;
+    const unsigned int count = (read_length + sector_size - 1) / sector_size;
+
+    // Use the sectors directly from the mapping if possible.
+    // A partial sector at the end of the track can't be, it needs to be padded out with zeros.
+    const uint8_t *sectors = (read_length % sector_size == 0) ? src_map(source, t->track_offset + b, read_length) : NULL;
+    const int mapped = (sectors != NULL);
+    if (!mapped) {
+      // Read the whole batch at once
+      read_calls++;
+      if (src_pread(source, staging, read_length, t->track_offset + b) != read_length) {
+        fprintf(stderr, "Error reading track: %s\n", (source->map ? "Unexpected end of file" : strerror(errno)));
+        r = RIP_READ_ERR;
+        break;
+      }
+      memset(staging + read_length, 0, count * sector_size - read_length);
+      sectors = staging;
+    }
+    bytes_read += read_length;
+    hasher_raw(hasher, sectors, read_length);
+    if (ts)
+      stats_add(&ts->read, &clock);
+
+    // Count how many of the sectors in this batch are kept, the rest get trimmed
+    const unsigned int kept = rip_kept_sectors(&l, b, count);
+    if (verifier) {
+      const unsigned int whole = read_length / sector_size;
+      edc_verifier_add(verifier, sectors, (kept < whole) ? kept : whole);
+    }
+
+    // Write the batch exactly as it was read if nothing in it needs to change
+    const uint8_t *output = NULL;
+    unsigned int n = 0;
+    size_t out_length;
+    if (l.passthrough && kept == count) {
+      out_length = count * sector_size;
+      output = sectors;
+    }
+    // Point the iovecs at the Mac headers and the sector payloads in the mapping
+    else if (mapped && !l.swap) {
+      unsigned int i;
+      out_length = 0;
+      for (i = 0; i < count; i++) {
+        if (l.mac) {
+          iov[n].iov_base = (void *) mac_header;
+          iov[n++].iov_len = sizeof(mac_header);
+          out_length += sizeof(mac_header);
+        }
+        if (i < kept) {
+          iov[n].iov_base = (void *) (sectors + i * sector_size + l.header_length);
+          iov[n].iov_len = rip_sector_length(&l, sectors + i * sector_size);
+          out_length += iov[n++].iov_len;
+        }
+      }
+    }
+    // Copy the converted sectors into the output buffer
+    else {
+      out_length = rip_convert_batch(&l, sectors, kept, count, buffer);
+      output = buffer;
+    }
+
+    // Hash the output before writev_all() moves the iovecs along
+    if (hasher) {
+      if (output)
+        hasher_output(hasher, output, out_length);
+      else {
+        unsigned int i;
+        for (i = 0; i < n; i++)
+          hasher_output(hasher, iov[i].iov_base, iov[i].iov_len);
+      }
+    }
+    if (ts)
+      stats_add(&ts->convert, &clock);
+
+    ssize_t written = (output) ? write_all(fd, output, out_length, &write_calls) : writev_all(fd, iov, n, &write_calls);
+    if (ts)
+      stats_add(&ts->write, &clock);
+
+    if (written < 0 || (size_t) written != out_length) {
+      fprintf(stderr, "Error writing track: %s\n  Skipping this track.\n", strerror(errno));
+      r = RIP_WRITE_ERR;
+      break;
+    }
+    bytes_written += written;
+
+    // The subchannel data of the kept sectors goes to its own file
+    if (sub_fd >= 0 && kept > 0) {
+      written = rip_write_subchannel(&l, sectors, kept, sub_buffer, sub_fd, &write_calls);
+      if (written < 0) {
+        fprintf(stderr, "Error writing subchannel data: %s\n  Skipping this track.\n", strerror(errno));
+        r = RIP_WRITE_ERR;
+        break;
+      }
+      bytes_written += written;
+      if (ts)
+        stats_add(&ts->write, &clock);
+    }
+
+    // If some sectors are to be trimmed, have a look and see if they might contain some useful data
+    if (kept < count && !warned && rip_trimmed_has_data(&l, sectors, kept, count)) {
+      rip_warn_trimmed(ctx, track_number);
+      warned = 1;
+    }
+    // Form2 sectors lose some of their data unless they are converted according to their form
+    if (!l.xa && !form2_warned && rip_count_form2(&l, sectors, kept)) {
+      rip_warn_form2(ctx, track_number);
+      form2_warned = 1;
+    }
+    if (ts)
+      stats_add(&ts->convert, &clock);
+
+    // The mapped pages of this batch won't be needed again
+    src_release(source, t->track_offset + b, t->track_offset + b + read_length);
+    b += count * sector_size;
+    progress_add(ctx, track_number, read_length);
+  }
+
+  if (ts) {
+    ts->bytes_read += bytes_read;
+    ts->read_calls += read_calls;
+    ts->bytes_written += bytes_written;
+    ts->write_calls += write_calls;
+  }
+
+  // Clean up buffers
+  free(staging);
+  free(buffer);
+  free(iov);
+  free(sub_buffer);
+  return r;
+}
+
+// Extracts one track from the image file
+int rip_track(nerorip_context *ctx, image_source *source, nrg_track *t, unsigned int track_number, FILE *tf,
+              FILE *sf, track_hasher *hasher, edc_verifier *verifier) {
+  track_stats *ts = stats_track(ctx, track_number);
+  if (!ts)
+    return rip_track_data(ctx, source, t, track_number, tf, sf, hasher, verifier, NULL);
+
+  stats_clock clock = stats_now();
+  int r = rip_track_data(ctx, source, t, track_number, tf, sf, hasher, verifier, ts);
+  ts->wall += stats_now().wall - clock.wall;
+  return r;
+}
+
+
+/**
+ * Shared state for the worker threads started by rip_jobs()
+ */
+typedef struct {
+  image_source *source;
+  rip_job *jobs;
+  unsigned int number_jobs;
+  nerorip_context ctx;
+
+  // Index of the next job that hasn't been started yet, protected by lock
+  unsigned int next_job;
+  pthread_mutex_t lock;
+} rip_pool;
+
+// Appends string to the command being built in out, in single quotes so the shell takes it as it is
+static size_t rip_exec_quote(char *out, size_t n, size_t size, const char *string) {
+  if (n < size)
+    out[n] = '\'';
+  n++;
+  for (; *string; string++) {
+    // A quote can't be escaped inside quotes, so end the quoted part, add an escaped quote and start a new one
+    const char *piece = (*string == '\'') ? "'\\''" : NULL;
+    size_t length = piece ? 4 : 1;
+    if (n + length < size)
+      memcpy(out + n, piece ? piece : string, length);
+    n += length;
+  }
+  if (n < size)
+    out[n] = '\'';
+  return n + 1;
+}
+
+// Fills in the {track}, {fmt}, {file} and {name} placeholders in ctx->exec for a job.
+// Returns the length the command needs, which is more than size if it didn't fit
+static size_t rip_exec_command(nerorip_context *ctx, rip_job *job, char *out, size_t size) {
+  const char *file = job->filename;
+  const char *name = strrchr(file, '/');
+  name = name ? name + 1 : file;
+  const char *dot = strrchr(name, '.');
+  char number[16], base[256];
+  snprintf(number, sizeof(number), "%02u", job->track_number);
+  snprintf(base, sizeof(base), "%.*s", (int) (dot ? dot - name : (int) strlen(name)), name);
+
+  size_t n = 0;
+  const char *c;
+  for (c = ctx->exec; *c; c++) {
+    if (strncmp(c, "{track}", 7) == 0) {
+      n = rip_exec_quote(out, n, size, number);
+      c += 6;
+    }
+    else if (strncmp(c, "{fmt}", 5) == 0) {
+      n = rip_exec_quote(out, n, size, nerorip_track_extension(ctx, job->track));
+      c += 4;
+    }
+    else if (strncmp(c, "{file}", 6) == 0) {
+      n = rip_exec_quote(out, n, size, file);
+      c += 5;
+    }
+    else if (strncmp(c, "{name}", 6) == 0) {
+      n = rip_exec_quote(out, n, size, base);
+      c += 5;
+    }
+    else {
+      if (n < size)
+        out[n] = *c;
+      n++;
+    }
+  }
+  if (n < size)
+    out[n] = '\0';
+  return n + 1;
+}
+
+// Starts the ctx->exec command for a job with a pipe to its stdin. Returns the pipe or NULL if it couldn't be started
+static FILE *rip_exec_start(nerorip_context *ctx, rip_job *job, pid_t *pid) {
+  size_t size = rip_exec_command(ctx, job, NULL, 0);
+  char *command = malloc(size);
+  if (!command)
+    return NULL;
+  rip_exec_command(ctx, job, command, size);
+  ver_printf(ctx, 2, "Track %02u: %s\n", job->track_number, command);
+
+  // Both ends are closed on exec so no other command started at the same time holds this pipe open.
+  // dup2() onto stdin clears that for the one end this command needs.
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    free(command);
+    return NULL;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+
+  char *argv[] = {"sh", "-c", command, NULL};
+  extern char **environ;
+  int r = posix_spawn(pid, "/bin/sh", &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[0]);
+  free(command);
+  if (r != 0) {
+    close(fds[1]);
+    errno = r;
+    return NULL;
+  }
+
+  FILE *f = fdopen(fds[1], "wb");
+  if (!f) {
+    close(fds[1]);
+    waitpid(*pid, NULL, 0);
+  }
+  return f;
+}
+
+// Waits for the ctx->exec command of a job to finish. Returns 0 if it was successful
+static int rip_exec_finish(rip_job *job, pid_t pid) {
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      fprintf(stderr, "\nError waiting for the command for track %02u: %s\n", job->track_number, strerror(errno));
+      return RIP_EXEC_ERR;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "\nThe command for track %02u failed with status %d\n", job->track_number,
+            WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    return RIP_EXEC_ERR;
+  }
+  return 0;
+}
+
+// Works out how many threads each track being ripped at the same time can have checking its sectors
+static unsigned int rip_verify_threads(nerorip_context *ctx) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long threads = (cpus > 0 ? cpus : 1) / (ctx->jobs > 0 ? ctx->jobs : 1);
+  if (threads < 1)
+    threads = 1;
+  return (threads > EDC_MAX_THREADS) ? EDC_MAX_THREADS : threads;
+}
+
+// Warns about the bad sectors a job's verifier found
+static void rip_report_verify(nerorip_context *ctx, rip_job *job) {
+  const edc_report *v = &job->verify;
+  const uint64_t bad = v->bad_sync + v->bad_edc + v->bad_ecc;
+  if (!bad) {
+    ver_printf(ctx, 2, "Track %02u: %llu sectors verified\n", job->track_number, (unsigned long long) v->sectors);
+    return;
+  }
+
+  // Only the first few LBAs are listed unless the verbosity is turned up
+  const unsigned int shown = (ctx->verbosity >= 2 || v->number_bad_lbas < RIP_VERIFY_SHOWN) ? v->number_bad_lbas : RIP_VERIFY_SHOWN;
+  char lbas[EDC_MAX_BAD_LBAS * 11 + 8] = "";
+  size_t length = 0;
+  unsigned int i;
+  for (i = 0; i < shown; i++)
+    length += snprintf(lbas + length, sizeof(lbas) - length, "%s%u", (i ? " " : ""), v->bad_lbas[i]);
+  if (bad > shown)
+    snprintf(lbas + length, sizeof(lbas) - length, " ...");
+  progress_printf(ctx, "  WARNING: Track %02u has %llu bad sector(s) out of %llu (%llu sync, %llu EDC, %llu ECC) at LBA %s\n",
+                  job->track_number, (unsigned long long) bad, (unsigned long long) v->sectors, (unsigned long long) v->bad_sync,
+                  (unsigned long long) v->bad_edc, (unsigned long long) v->bad_ecc, lbas);
+}
+
+// Opens the file the subchannel data of a job goes to, named like its output file but ending in .sub
+static FILE *rip_sub_open(rip_job *job, char *filename, size_t size) {
+  const char *name = strrchr(job->filename, '/');
+  name = name ? name + 1 : job->filename;
+  const char *dot = strrchr(name, '.');
+  const int length = dot ? dot - job->filename : (int) strlen(job->filename);
+  snprintf(filename, size, "%.*s.sub", length, job->filename);
+  return fopen(filename, "wbe");
+}
+
+// Rips one job, opening and closing its output file
+void rip_job_run(nerorip_context *ctx, image_source *source, rip_job *job) {
+  // Open up a file to dump stuff into. "-" is stdout, which is left open.
+  // Audio tracks are piped into ctx->exec instead if there is one.
+  const int to_stdout = (strcmp(job->filename, "-") == 0);
+  const int to_exec = (!to_stdout && ctx->exec && job->track->track_mode == AUDIO);
+
+  // Subchannel data gets a file of its own, there's nowhere to put it if the track goes to stdout.
+  // It is opened first so there's no command to clean up if it can't be
+  FILE *sf = NULL;
+  char sub_filename[256 + 4];
+  if (sub_length(job->track->sector_size)) {
+    if (to_stdout)
+      ver_printf(ctx, 1, "Track %02u: Leaving out the subchannel data, it can't go to stdout too\n", job->track_number);
+    else if ((sf = rip_sub_open(job, sub_filename, sizeof(sub_filename))) == NULL) {
+      fprintf(stderr, "\nError opening %s: %s\n  Skipping this track.\n", sub_filename, strerror(errno));
+      job->result = RIP_WRITE_ERR;
+      progress_track_done(ctx, job->track_number, job->filename, job->result);
+      return;
+    }
+  }
+
+  pid_t pid = 0;
+  FILE *tf;
+  if (to_stdout)
+    tf = stdout;
+  else if (to_exec)
+    tf = rip_exec_start(ctx, job, &pid);
+  else
+    tf = fopen(job->filename, "wbe");
+  if (tf == NULL) {
+    fprintf(stderr, "\nError %s %s: %s\n  Skipping this track.\n", (to_exec ? "starting the command for" : "opening"), job->filename, strerror(errno));
+    job->result = to_exec ? RIP_EXEC_ERR : RIP_WRITE_ERR;
+    if (sf)
+      fclose(sf);
+    progress_track_done(ctx, job->track_number, job->filename, job->result);
+    return;
+  }
+
+  // Extract the track, hashing and checking it on the way if asked to.
+  // Sectors with subchannel data after them are checked the same as the ones without
+  track_hasher *hasher = (ctx->hash) ? hasher_start() : NULL;
+  edc_verifier *verifier = NULL;
+  const unsigned int main_size = job->track->sector_size - sub_length(job->track->sector_size);
+  if (ctx->verify && job->track->track_mode != AUDIO && (main_size == 2352 || main_size == 2336))
+    verifier = edc_verifier_start(job->track->sector_size, job->track->track_lba, rip_verify_threads(ctx));
+  job->result = rip_track(ctx, source, job->track, job->track_number, tf, sf, hasher, verifier);
+  if (sf && fclose(sf) != 0 && job->result == 0) {
+    fprintf(stderr, "\nError writing %s: %s\n", sub_filename, strerror(errno));
+    job->result = RIP_WRITE_ERR;
+  }
+
+  // Close that file. Closing the pipe lets the command know the track is over
+  if ((to_stdout ? fflush(tf) : fclose(tf)) != 0 && job->result == 0) {
+    fprintf(stderr, "\nError writing %s: %s\n", job->filename, strerror(errno));
+    job->result = RIP_WRITE_ERR;
+  }
+  if (to_exec) {
+    int r = rip_exec_finish(job, pid);
+    if (job->result == 0)
+      job->result = r;
+  }
+
+  // The hashes are only worth keeping if the whole track made it out
+  if (hasher) {
+    hasher_finish(hasher, &job->raw_hash, &job->output_hash);
+    job->hashed = (job->result == 0);
+    track_stats *ts = stats_track(ctx, job->track_number);
+    if (ts && job->hashed) {
+      ts->hashed = 1;
+      ts->raw_hash = job->raw_hash;
+      ts->output_hash = job->output_hash;
+    }
+  }
+
+  // Bad sectors are ripped like any others, but they are worth knowing about
+  if (verifier) {
+    edc_verifier_finish(verifier, &job->verify);
+    job->verified = 1;
+    rip_report_verify(ctx, job);
+    track_stats *ts = stats_track(ctx, job->track_number);
+    if (ts) {
+      ts->verified = 1;
+      ts->verify = job->verify;
+    }
+  }
+
+  char label[32];
+  snprintf(label, sizeof(label), "Track %02u command", job->track_number);
+  progress_track_done(ctx, job->track_number, to_exec ? label : job->filename, job->result);
+}
+
+// Works out how many sectors each of the workers can have in a batch
+unsigned int rip_worker_batch_sectors(nerorip_context *ctx, unsigned int threads) {
+  const size_t budget = ctx->buffer_budget ? ctx->buffer_budget : RIP_BUFFER_BUDGET;
+  size_t r = budget / threads / (RIP_MAX_SECTOR_SIZE + 8);
+  if (r > RIP_BATCH_SECTORS)
+    r = RIP_BATCH_SECTORS;
+  return (r < 1) ? 1 : r;
+}
+
+// Worker thread, takes jobs off the pool until there are none left
+static void *rip_worker(void *arg) {
+  rip_pool *pool = arg;
+
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    unsigned int j = pool->next_job++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (j >= pool->number_jobs)
+      break;
+    rip_job_run(&pool->ctx, pool->source, &pool->jobs[j]);
+  }
+
+  return NULL;
+}
+
+
+// Rips a list of tracks using a pool of worker threads
+int rip_jobs(nerorip_context *ctx, image_source *source, rip_job *jobs, unsigned int number_jobs) {
+  unsigned int threads = ctx->jobs;
+  if (threads > number_jobs)
+    threads = number_jobs;
+  if (threads < 1)
+    threads = 1;
+
+  rip_pool pool;
+  pool.source = source;
+  pool.jobs = jobs;
+  pool.number_jobs = number_jobs;
+  pool.ctx = *ctx;
+  pool.next_job = 0;
+  pthread_mutex_init(&pool.lock, NULL);
+
+  // Split the buffer budget between the workers
+  pool.ctx.options.batch_sectors = rip_worker_batch_sectors(ctx, threads);
+
+  // All the workers count towards the progress of the whole list
+  nerorip_progress progress;
+  uint64_t total = 0;
+  unsigned int i;
+  for (i = 0; i < number_jobs; i++)
+    total += jobs[i].track->length;
+  progress_start(&progress, &pool.ctx, total);
+  pool.ctx.progress = &progress;
+
+  // Start up the workers. If some can't be started, the ones that did will do all the work.
+  pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+  unsigned int started = 0;
+  if (workers) {
+    for (started = 0; started < threads - 1; started++)
+      if (pthread_create(&workers[started], NULL, rip_worker, &pool) != 0)
+        break;
+  }
+
+  // The calling thread does its share too, which is all of it if no workers could be started
+  rip_worker(&pool);
+
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  pthread_mutex_destroy(&pool.lock);
+
+  // Report back the first error found
+  int r = 0;
+  for (i = 0; i < number_jobs && r == 0; i++)
+    r = jobs[i].result;
+  progress_finish(&progress, r);
+  return r;
+}
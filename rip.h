@@ -0,0 +1,336 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RIP_H
+#define RIP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <sys/types.h> // ssize_t
+#include "util.h"
+#include "nrg.h"
+#include "source.h"
+#include "hash.h"
+#include "edc.h"
+#include "subchannel.h"
+
+// Audio output formats
+#define AUD_WAV  0
+#define AUD_RAW  1
+#define AUD_CDA  2
+#define AUD_AIFF 3
+// How many audio output formats there are
+#define AUD_COUNT 4
+
+// Data output formats
+#define DAT_ISO 0
+#define DAT_BIN 1
+#define DAT_MAC 2
+#define DAT_MPG 3
+// How many data output formats there are
+#define DAT_COUNT 4
+
+// Bytes of user data in a Mode2 Form2 sector, like the MPEG sectors of a VCD or SVCD
+#define RIP_FORM2_LENGTH 2324
+
+// Track trimming options
+#define TRIM_NONE  0
+#define TRIM_FIRST 1
+#define TRIM_ALL   2
+
+// Number of sectors read, converted and written at once
+#define RIP_BATCH_SECTORS 512
+// Most bytes handed to the kernel to copy at once for tracks that need no conversion, so the progress
+// keeps moving on DVD sized tracks. Rounded down to whole sectors
+#define RIP_COPY_LENGTH (64ULL * 1024 * 1024)
+// Total number of bytes all the tracks being ripped at once may use for their batch buffers
+#define RIP_BUFFER_BUDGET (16 * 1024 * 1024)
+// Largest sector size the batch buffers need to be able to hold
+#define RIP_MAX_SECTOR_SIZE NRG_MAX_SECTOR_SIZE
+
+// Indicates that reading the track from the image file failed
+#define RIP_READ_ERR  -1
+// Indicates that writing the output file failed
+#define RIP_WRITE_ERR -2
+// Indicates that the batch buffer could not be allocated
+#define RIP_ALLOC_ERR -3
+// Indicates that the command the track was piped into could not be started or failed
+#define RIP_EXEC_ERR  -4
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Rip options struct
+ *
+ * Describes how the tracks in an image should be converted when ripped.
+ */
+typedef struct {
+  // What format the audio tracks should be output as. Either AUD_WAV, AUD_RAW, AUD_CDA, or AUD_AIFF
+  int audio_output;
+  // Whether or not audio tracks should be swapped. 0 or 1 for false or true respectively
+  int swap_audio_output;
+  // What format the data tracks should be saved as. Either DAT_ISO, DAT_BIN, DAT_MAC or DAT_MPG
+  int data_output;
+  // Whether or not tracks should be trimmed. TRIM_NONE or TRIM_FIRST or TRIM_ALL or TRIM_FIRST & TRIM_ALL
+  int trim_tracks;
+
+  // Number of sectors to read at once (0 uses RIP_BATCH_SECTORS)
+  unsigned int batch_sectors;
+  // Whether or not to print the progress of the whole image on the terminal. 0 or 1 for false or true respectively
+  int show_progress;
+  // Whether or not to use the asynchronous read/convert/write pipeline. 0 or 1 for false or true respectively
+  int async;
+} rip_options;
+
+
+/**
+ * Gather kernel
+ *
+ * Copies the kept bytes of the first kept sectors of a batch into out, with a Mac header in front of each one if
+ * the layout has them, and returns a pointer just past the last byte written. Each one is specialized for one
+ * layout, so the sizes are constants and there is nothing to decide per sector.
+ */
+struct rip_layout;
+typedef uint8_t *(*rip_gather_fn)(uint8_t *out, const uint8_t *sectors, unsigned int kept, const struct rip_layout *layout);
+
+/**
+ * Rip layout struct
+ *
+ * Describes how the sectors of one track are converted. Worked out once per track by rip_get_layout().
+ */
+typedef struct rip_layout {
+  // Size of the raw sectors in the image
+  unsigned int sector_size;
+  // How many bytes at the start of each raw sector are skipped and how many after that are kept
+  unsigned int header_length;
+  unsigned int write_length;
+  // How many bytes at the end of each raw sector are subchannel data, which goes to its own file. 0 if there are none
+  unsigned int subchannel_length;
+  // Whether each sector gets a Mac header and whether the kept bytes are swapped
+  int mac;
+  int swap;
+  // Set if the user data of each Mode2 sector is kept according to the form in its subheader:
+  // write_length bytes for Form1 and RIP_FORM2_LENGTH bytes for Form2
+  int xa;
+  // Set if the kept bytes are the whole raw sector, unchanged
+  int passthrough;
+  // Length of the track data that is kept, the sectors after that are trimmed
+  uint64_t trimmed_track_length;
+  // The gather kernels for this layout, picked by rip_select_kernels(): gather for all the sectors, or only the
+  // Form1 ones if the layout is xa, and gather_form2 for the Form2 ones. kernel names the one in gather
+  rip_gather_fn gather;
+  rip_gather_fn gather_form2;
+  const char *kernel;
+} rip_layout;
+
+
+/**
+ * Rip job struct
+ *
+ * Describes one track to be ripped and where it should go.
+ */
+typedef struct {
+  // The track to rip and its number in the whole image (starting at 1)
+  nrg_track *track;
+  unsigned int track_number;
+
+  // Where to write the converted track, "-" for stdout
+  char filename[256];
+
+  // What rip_track() returned for this track
+  int result;
+
+  // Set by rip_job_run() if ctx->hash is set and the track was ripped: the hashes of the raw
+  // track data exactly as it is in the image and of everything written to the output
+  int hashed;
+  hash_digest raw_hash, output_hash;
+
+  // Set by rip_job_run() if ctx->verify is set and the sectors of the track were checked, and what was found
+  int verified;
+  edc_report verify;
+} rip_job;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Work out how the sectors of a track are converted.
+ *
+ * @param nrg_track *track
+ *   The track to be ripped
+ * @param unsigned int track_number
+ *   The number of this track in the whole image (starting at 1), used for trimming
+ * @param rip_options *options
+ *   How the track should be converted
+ * @param rip_layout *layout
+ *   Filled in with the conversion details
+ */
+void rip_get_layout(nrg_track *track, unsigned int track_number, rip_options *options, rip_layout *layout);
+
+/**
+ * Pick the gather kernels for a layout, which rip_get_layout() does already. Only needed for layouts that
+ * are filled in some other way. Layouts without a kernel of their own get one that reads the sizes from the layout.
+ */
+void rip_select_kernels(rip_layout *layout);
+
+/**
+ * Count how many sectors of the batch starting b bytes into the track are kept.
+ * The rest of the count sectors get trimmed.
+ */
+unsigned int rip_kept_sectors(rip_layout *layout, uint64_t b, unsigned int count);
+
+/**
+ * Count the Form2 sectors among the first count sectors of a batch of a Mode2 track, going by the form bit
+ * of the submode byte in the XA subheader of each one. Returns 0 for layouts without a subheader.
+ */
+unsigned int rip_count_form2(rip_layout *layout, const uint8_t *sectors, unsigned int count);
+
+/**
+ * Convert a batch of raw sectors into out.
+ * The first kept sectors are stripped, swapped and given Mac headers as the layout says.
+ * If the layout is xa, each one keeps as much user data as its form has.
+ * The rest are trimmed but still get a Mac header if the layout has them.
+ *
+ * @param rip_layout *layout
+ *   How the sectors are converted
+ * @param const uint8_t *sectors
+ *   The raw sectors
+ * @param unsigned int kept
+ *   How many of the sectors are kept
+ * @param unsigned int count
+ *   How many sectors are in the batch
+ * @param uint8_t *out
+ *   Where the converted data goes. Must have room for count * (sector_size + 8) bytes
+ * @return size_t
+ *   Number of bytes of converted data
+ */
+size_t rip_convert_batch(rip_layout *layout, const uint8_t *sectors, unsigned int kept, unsigned int count, uint8_t *out);
+
+/**
+ * Split the subchannel data off the first kept sectors of a batch with sub_deinterleave() and write it to fd.
+ * buffer must have room for kept * SUB_LENGTH bytes. Every write() is counted in *calls.
+ * Returns the number of bytes written or -1 on error.
+ */
+ssize_t rip_write_subchannel(rip_layout *layout, const uint8_t *sectors, unsigned int kept, uint8_t *buffer, int fd, uint64_t *calls);
+
+/**
+ * Check if any trimmed sectors of a batch have something other than zeros in them,
+ * and warn the user about it.
+ */
+int rip_trimmed_has_data(rip_layout *layout, const uint8_t *sectors, unsigned int kept, unsigned int count);
+void rip_warn_trimmed(nerorip_context *ctx, unsigned int track_number);
+
+/**
+ * Warn the user that the Form2 sectors of a track are being cut down to 2048 bytes.
+ */
+void rip_warn_form2(nerorip_context *ctx, unsigned int track_number);
+
+
+/**
+ * Extract one track from the image file into the output file.
+ *
+ * The track is read RIP_BATCH_SECTORS sectors at a time into one reusable buffer,
+ * converted in place according to ctx->options and written out with a single fwrite per batch.
+ * If the image is memory mapped, sectors are converted straight out of the mapping and
+ * the mapped pages are released once they have been written.
+ * If ctx->options.async is set and the output file can seek, the track goes through pipeline_rip() instead.
+ * Every batch is counted in ctx->progress with progress_add().
+ * If hasher isn't NULL, the raw track data and the output (audio header included) are passed to it as they go by.
+ * If verifier isn't NULL, every whole sector of the track that isn't trimmed is passed to it to be checked.
+ * If the sectors have subchannel data after them, it is split off and written to sub_file as it goes by,
+ * deinterleaved into a CloneCD style .sub, while the rest of each sector is converted as usual.
+ * The image is only read with positional reads so several tracks may be ripped from the same source at once.
+ *
+ * @param nerorip_context *ctx
+ *   How the track should be converted and where progress goes
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param nrg_track *track
+ *   The parsed track to extract
+ * @param unsigned int track_number
+ *   The number of this track in the whole image (starting at 1), used for trimming
+ * @param FILE *output_file
+ *   The already opened file to which the converted track should be written
+ * @param FILE *sub_file
+ *   The already opened file the subchannel data goes to, NULL to throw it away
+ * @param track_hasher *hasher
+ *   Where the track is hashed, NULL to not hash it
+ * @param edc_verifier *verifier
+ *   Where the sectors are checked, NULL to not check them. It must have been started at the LBA of the track
+ * @return int
+ *   0 on success
+ *   RIP_READ_ERR if the track data could not be read from the image file
+ *   RIP_WRITE_ERR if the converted data could not be written
+ *   RIP_ALLOC_ERR if the batch buffer could not be allocated
+ */
+int rip_track(nerorip_context *ctx, image_source *source, nrg_track *track, unsigned int track_number, FILE *output_file,
+              FILE *sub_file, track_hasher *hasher, edc_verifier *verifier);
+
+
+/**
+ * Rip one job: open its output file, rip the track into it with rip_track(), close it and report it done.
+ * If ctx->exec is set, audio tracks are piped into a command started with /bin/sh -c instead.
+ * Its {track}, {fmt}, {file} and {name} placeholders are replaced by the track number, the extension,
+ * the name of the file the track would have been written to and that name without the directory and
+ * extension, each quoted for the shell. The command's exit status is checked once the track is done.
+ * The result is stored in job->result. If ctx->hash is set the track is hashed on the way through
+ * and the hashes are stored in the job (and in ctx->stats if it is collecting stats).
+ * If ctx->verify is set the EDC and ECC of every sector of a 2352 or 2336 byte data track are checked on the
+ * way through by a few threads, any bad sectors are warned about and the report is stored the same way.
+ * Bad sectors are still ripped, they don't change the result.
+ * If the track has subchannel data, it goes into a file named like the track's but ending in .sub.
+ * It is left out if the track is being written to stdout.
+ */
+void rip_job_run(nerorip_context *ctx, image_source *source, rip_job *job);
+
+/**
+ * Work out how many sectors each of a number of workers ripping at the same time can have in a batch,
+ * so that all of their batch buffers fit in ctx->buffer_budget (RIP_BUFFER_BUDGET if that is 0).
+ */
+unsigned int rip_worker_batch_sectors(nerorip_context *ctx, unsigned int threads);
+
+/**
+ * Rip a list of tracks, each into its own file, using a pool of worker threads.
+ *
+ * Up to ctx->jobs tracks are ripped at the same time.
+ * Each worker takes the next job that hasn't been started, opens its output file and rips it with rip_track().
+ * The buffer budget is split between the workers for their batch buffers.
+ * The progress of the whole list is reported as it goes (see progress.h) and a line is printed as each track finishes.
+ *
+ * @param nerorip_context *ctx
+ *   How the tracks should be converted and how many to rip at once
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param rip_job *jobs
+ *   Array of tracks to rip. The result of each one is stored in it
+ * @param unsigned int number_jobs
+ *   Number of jobs in the array
+ * @return int
+ *   0 if every track was ripped, otherwise the first error returned by rip_track()
+ */
+int rip_jobs(nerorip_context *ctx, image_source *source, rip_job *jobs, unsigned int number_jobs);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sector.h"
+#include "rip.h"
+
+// Allocates a sector cache. The block data is only allocated when a block is first used
+sector_cache *alloc_sector_cache(image_source *source, nrg_image *image, unsigned int blocks) {
+  if (!source || !image)
+    return NULL;
+  if (blocks == 0)
+    blocks = SECTOR_CACHE_BLOCKS;
+
+  sector_cache *r = malloc(sizeof(sector_cache));
+  if (!r) {
+    fprintf(stderr, "Failed to allocate memory for sector_cache structure: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  r->blocks = calloc(blocks, sizeof(sector_block));
+  if (!r->blocks) {
+    fprintf(stderr, "Failed to allocate memory for sector cache blocks: %s\n", strerror(errno));
+    free(r);
+    return NULL;
+  }
+
+  r->source = source;
+  r->image = image;
+  r->number_blocks = blocks;
+  r->clock = 0;
+  r->hits = 0;
+  r->misses = 0;
+  pthread_mutex_init(&r->lock, NULL);
+
+  return r;
+}
+
+// Frees a sector cache
+void free_sector_cache(sector_cache *cache) {
+  if (!cache)
+    return;
+
+  unsigned int i;
+  for (i = 0; i < cache->number_blocks; i++)
+    free(cache->blocks[i].data);
+  free(cache->blocks);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+
+// Finds a block of a track in the cache, reading it into the least recently used block if it isn't there.
+// Must be called with the cache locked.
+static sector_block *sector_get_block(sector_cache *cache, nrg_track *t, uint32_t block, int *error) {
+  sector_block *oldest = &cache->blocks[0];
+  unsigned int i;
+
+  cache->clock++;
+  for (i = 0; i < cache->number_blocks; i++) {
+    sector_block *b = &cache->blocks[i];
+    if (b->track == t->number && b->block == block) {
+      cache->hits++;
+      b->last_used = cache->clock;
+      return b;
+    }
+    // Empty blocks have a last_used of 0 so they are always picked first
+    if (b->last_used < oldest->last_used)
+      oldest = b;
+  }
+  cache->misses++;
+
+  if (!oldest->data) {
+    oldest->data = malloc(SECTOR_CACHE_BLOCK * NRG_MAX_SECTOR_SIZE);
+    if (!oldest->data) {
+      fprintf(stderr, "Failed to allocate memory for sector cache block: %s\n", strerror(errno));
+      *error = SECTOR_ALLOC_ERR;
+      return NULL;
+    }
+  }
+
+  // The last block of a track may be short
+  uint32_t track_sectors = t->length / t->sector_size;
+  uint32_t first = block * SECTOR_CACHE_BLOCK;
+  unsigned int sectors = (track_sectors - first < SECTOR_CACHE_BLOCK) ? track_sectors - first : SECTOR_CACHE_BLOCK;
+  size_t length = (size_t) sectors * t->sector_size;
+
+  if (src_pread(cache->source, oldest->data, length, t->track_offset + (uint64_t) first * t->sector_size) != length) {
+    // Don't leave half a block behind looking like it's valid
+    oldest->track = 0;
+    oldest->last_used = 0;
+    *error = SECTOR_READ_ERR;
+    return NULL;
+  }
+
+  oldest->track = t->number;
+  oldest->block = block;
+  oldest->sectors = sectors;
+  oldest->last_used = cache->clock;
+  return oldest;
+}
+
+
+// Reads sectors by LBA
+int sector_read(sector_cache *cache, uint32_t lba, unsigned int count, int cooked, uint8_t *buffer, unsigned int *sector_length) {
+  uint64_t offset;
+  nrg_track *t = nrg_find_lba(cache->image, lba, &offset);
+  if (!t)
+    return SECTOR_RANGE_ERR;
+
+  // Cooked sectors are converted exactly like an untrimmed ISO/2048 rip
+  rip_options cooked_options = {AUD_RAW, 0, DAT_ISO, TRIM_NONE, 0, 0, 0};
+  rip_layout layout;
+  rip_get_layout(t, t->number, &cooked_options, &layout);
+  unsigned int header_length = (cooked) ? layout.header_length : 0;
+  unsigned int write_length = (cooked) ? layout.write_length : t->sector_size;
+  if (sector_length)
+    *sector_length = write_length;
+
+  // Don't go past the end of the track
+  uint32_t sector = lba - t->track_lba;
+  uint32_t track_sectors = t->length / t->sector_size;
+  if (count > track_sectors - sector)
+    count = track_sectors - sector;
+
+  // Mapped images can be copied from directly, there's nothing a cache would save
+  const uint8_t *mapped = src_map(cache->source, offset, (uint64_t) count * t->sector_size);
+  if (mapped) {
+    unsigned int i;
+    for (i = 0; i < count; i++)
+      memcpy(buffer + (size_t) i * write_length, mapped + (size_t) i * t->sector_size + header_length, write_length);
+    return count;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  unsigned int done = 0;
+  while (done < count) {
+    int error = 0;
+    sector_block *b = sector_get_block(cache, t, (sector + done) / SECTOR_CACHE_BLOCK, &error);
+    if (!b) {
+      pthread_mutex_unlock(&cache->lock);
+      return error;
+    }
+
+    // Copy as many sectors as are wanted out of this block
+    unsigned int i = (sector + done) % SECTOR_CACHE_BLOCK;
+    for (; i < b->sectors && done < count; i++, done++)
+      memcpy(buffer + (size_t) done * write_length, b->data + (size_t) i * t->sector_size + header_length, write_length);
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  return count;
+}
@@ -0,0 +1,146 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SECTOR_H
+#define SECTOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <pthread.h>
+#include "util.h"
+#include "nrg.h"
+#include "source.h"
+
+// Number of sectors read into the cache at once
+#define SECTOR_CACHE_BLOCK 16
+// Number of blocks a sector cache holds if none is given
+#define SECTOR_CACHE_BLOCKS 64
+
+// Indicates that the LBA isn't in any track
+#define SECTOR_RANGE_ERR -1
+// Indicates that the sectors could not be read from the image file
+#define SECTOR_READ_ERR  -2
+// Indicates that a cache block could not be allocated
+#define SECTOR_ALLOC_ERR -3
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Sector cache block struct
+ *
+ * Holds SECTOR_CACHE_BLOCK raw sectors from one track.
+ */
+typedef struct {
+  // Number of the track the sectors are from, 0 if the block is empty
+  unsigned int track;
+  // Which block of the track this is. It starts at sector block * SECTOR_CACHE_BLOCK of the track
+  uint32_t block;
+  // How many sectors are in the block, fewer than SECTOR_CACHE_BLOCK at the end of a track
+  unsigned int sectors;
+  // When the block was last used, the block with the smallest value is replaced first
+  uint64_t last_used;
+  // The raw sectors
+  uint8_t *data;
+} sector_block;
+
+
+/**
+ * Sector cache struct
+ *
+ * Reads sectors of a parsed image by LBA, keeping the most recently used blocks of sectors around.
+ * If the image is memory mapped, sectors are copied straight out of the mapping and the blocks aren't used.
+ * All access is protected by a lock so one cache can be shared between threads.
+ */
+typedef struct {
+  // The image the sectors are read from
+  image_source *source;
+  nrg_image *image;
+
+  // The blocks and how many there are
+  sector_block *blocks;
+  unsigned int number_blocks;
+
+  // Counts up with every block lookup, used for the last_used values
+  uint64_t clock;
+  // How many block lookups found the block already in the cache and how many had to read it
+  uint64_t hits, misses;
+
+  pthread_mutex_t lock;
+} sector_cache;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Allocate a sector cache for a parsed image.
+ * The source and image must stay open until the cache is freed.
+ *
+ * @param image_source *source
+ *   The already opened nero image file
+ * @param nrg_image *image
+ *   The image, already filled in by nrg_parse()
+ * @param unsigned int blocks
+ *   How many blocks of SECTOR_CACHE_BLOCK sectors to keep. 0 uses SECTOR_CACHE_BLOCKS
+ * @return *sector_cache
+ *   A pointer to the new cache or NULL if it could not be allocated
+ */
+sector_cache *alloc_sector_cache(image_source *source, nrg_image *image, unsigned int blocks);
+
+/**
+ * Free a sector cache and all of its blocks.
+ * If cache is NULL, it will simply return without doing anything.
+ */
+void free_sector_cache(sector_cache *cache);
+
+
+/**
+ * Read sectors from the image by LBA.
+ *
+ * Reading stops at the end of the track holding lba, so fewer sectors than asked for may be read.
+ * Raw sectors come out exactly as they are in the image. Cooked sectors have the same
+ * 2048 bytes of user data an ISO/2048 rip of the track would have. Audio sectors are always raw.
+ *
+ * @param sector_cache *cache
+ *   The cache for the image to read from
+ * @param uint32_t lba
+ *   The LBA of the first sector to read
+ * @param unsigned int count
+ *   How many sectors to read
+ * @param int cooked
+ *   0 for raw sectors, 1 for the 2048 bytes of user data of each sector
+ * @param uint8_t *buffer
+ *   Where the sectors go. Must have room for count * NRG_MAX_SECTOR_SIZE bytes
+ * @param unsigned int *sector_length
+ *   If not NULL, set to the number of bytes each sector in buffer takes
+ * @return int
+ *   The number of sectors read
+ *   SECTOR_RANGE_ERR if lba isn't in any track
+ *   SECTOR_READ_ERR if the sectors could not be read from the image file
+ *   SECTOR_ALLOC_ERR if a cache block could not be allocated
+ */
+int sector_read(sector_cache *cache, uint32_t lba, unsigned int count, int cooked, uint8_t *buffer, unsigned int *sector_length);
+
+#endif
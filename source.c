@@ -0,0 +1,233 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <fcntl.h> // posix_fadvise()
+#include <unistd.h> // sysconf()
+#include <sys/mman.h> // mmap(), madvise()
+#include <sys/stat.h> // fstat()
+#include "nerorip.h"
+
+
+// Opens an image file, memory mapping it if possible
+image_source *src_open(nerorip_context *ctx, const char *filename) {
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+    return NULL;
+
+  // Do the malloc
+  image_source *r = malloc(sizeof(image_source));
+
+  // Make sure it didn't fail
+  if (!r) {
+    fprintf(stderr, "Failed to allocate memory for image_source structure: %s\n", strerror(errno));
+    fclose(file);
+    return NULL;
+  }
+
+  //Initialize some variables in there
+  r->file = file;
+  r->map = NULL;
+  r->size = 0;
+  r->position = 0;
+  r->eof = 0;
+
+  // Only regular files can be mapped
+  struct stat st;
+  if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode))
+    r->size = st.st_size;
+
+  if (ctx->use_mmap && r->size > 0) {
+    void *map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (map != MAP_FAILED) {
+      r->map = map;
+      ver_printf(ctx, 3, "Memory mapped %s\n", filename);
+    }
+    else
+      ver_printf(ctx, 2, "Could not memory map %s, falling back to stdio: %s\n", filename, strerror(errno));
+  }
+
+  return r;
+}
+
+
+// Closes an image source
+void src_close(image_source *source) {
+  // Make sure source was allocated in the first place
+  if (!source)
+    return;
+
+  if (source->map)
+    munmap(source->map, source->size);
+  fclose(source->file);
+  free(source);
+}
+
+
+// fseek() for image sources
+int src_seek(image_source *source, int64_t offset, int whence) {
+  if (!source->map)
+    return fseeko(source->file, offset, whence);
+
+  int64_t base = 0;
+  if (whence == SEEK_CUR)
+    base = source->position;
+  else if (whence == SEEK_END)
+    base = source->size;
+
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Just like fseek(), seeking clears the end of file indicator
+  source->position = base + offset;
+  source->eof = 0;
+  return 0;
+}
+
+// ftell() for image sources
+uint64_t src_tell(image_source *source) {
+  if (!source->map)
+    return ftello(source->file);
+  return source->position;
+}
+
+// feof() for image sources
+int src_eof(image_source *source) {
+  if (!source->map)
+    return feof(source->file);
+  return source->eof;
+}
+
+
+// fread() for image sources
+size_t src_read(image_source *source, void *buffer, size_t length) {
+  if (!source->map)
+    return fread(buffer, sizeof(uint8_t), length, source->file);
+
+  // Only copy what's left in the file
+  size_t available = (source->position < source->size) ? source->size - source->position : 0;
+  if (length > available) {
+    length = available;
+    source->eof = 1;
+  }
+
+  memcpy(buffer, source->map + source->position, length);
+  source->position += length;
+  return length;
+}
+
+
+// pread() for image sources
+size_t src_pread(image_source *source, void *buffer, size_t length, uint64_t offset) {
+  if (!source->map) {
+    // pread may return less than asked for, so keep going until it's all there
+    size_t done = 0;
+    while (done < length) {
+      ssize_t r = pread(fileno(source->file), (uint8_t *) buffer + done, length - done, offset + done);
+      if (r <= 0)
+        break;
+      done += r;
+    }
+    return done;
+  }
+
+  // Only copy what's left in the file
+  if (offset >= source->size)
+    return 0;
+  if (length > source->size - offset)
+    length = source->size - offset;
+
+  memcpy(buffer, source->map + offset, length);
+  return length;
+}
+
+
+// Image source reading convenience functions
+uint8_t src_read8u(image_source *source) {
+  uint8_t r = 0;
+  if (src_read(source, &r, sizeof(uint8_t)) != sizeof(uint8_t))
+    fprintf(stderr, "Error reading from file: %s\n", (source->map ? "Unexpected end of file" : strerror(errno)));
+  return r;
+}
+
+uint16_t src_read16u(image_source *source) {
+  uint16_t r = 0;
+  if (src_read(source, &r, sizeof(uint16_t)) != sizeof(uint16_t))
+    fprintf(stderr, "Error reading from file: %s\n", (source->map ? "Unexpected end of file" : strerror(errno)));
+  return bswap_16(r);
+}
+
+uint32_t src_read32u(image_source *source) {
+  uint32_t r = 0;
+  if (src_read(source, &r, sizeof(uint32_t)) != sizeof(uint32_t))
+    fprintf(stderr, "Error reading from file: %s\n", (source->map ? "Unexpected end of file" : strerror(errno)));
+  return bswap_32(r);
+}
+
+uint64_t src_read64u(image_source *source) {
+  uint64_t r = 0;
+  if (src_read(source, &r, sizeof(uint64_t)) != sizeof(uint64_t))
+    fprintf(stderr, "Error reading from file: %s\n", (source->map ? "Unexpected end of file" : strerror(errno)));
+  return bswap_64(r);
+}
+
+
+// Returns a pointer directly into the mapping
+const uint8_t *src_map(image_source *source, uint64_t offset, uint64_t length) {
+  if (!source->map || offset > source->size || length > source->size - offset)
+    return NULL;
+  return source->map + offset;
+}
+
+
+// Rounds an offset down to the start of its page
+static uint64_t page_floor(uint64_t offset) {
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  return offset - (offset % page_size);
+}
+
+// Tells the kernel a range is about to be read sequentially
+void src_sequential(image_source *source, uint64_t offset, uint64_t length) {
+  if (!source->map || offset >= source->size)
+    return;
+
+  if (length > source->size - offset)
+    length = source->size - offset;
+
+  // madvise needs a page aligned address
+  const uint64_t start = page_floor(offset);
+  madvise(source->map + start, length + (offset - start), MADV_SEQUENTIAL);
+}
+
+// Releases a range of the image
+void src_release(image_source *source, uint64_t start, uint64_t end) {
+  if (!source->map)
+    return;
+
+  // Only whole pages can be released
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  start = page_floor(start + page_size - 1);
+  end = page_floor(end < source->size ? end : source->size);
+  if (end <= start)
+    return;
+
+  // Drop the pages from the mapping, then drop them from the page cache
+  madvise(source->map + start, end - start, MADV_DONTNEED);
+  posix_fadvise(fileno(source->file), start, end - start, POSIX_FADV_DONTNEED);
+}
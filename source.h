@@ -0,0 +1,190 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include <byteswap.h> // for bswap_XX functions
+#include "util.h"
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Image source struct
+ *
+ * Wraps the nero image file being read.
+ * If possible, the whole file is memory mapped so that it can be parsed and ripped
+ * without copying anything. Otherwise it falls back to reading through stdio.
+ */
+typedef struct {
+  // The stdio file. Always open, used for reading when the file is not mapped
+  FILE *file;
+
+  // The memory mapped file or NULL if it could not be mapped
+  uint8_t *map;
+  // Total size of the file in bytes
+  uint64_t size;
+
+  // Where the next read from the mapping will happen
+  uint64_t position;
+  // Set when a read from the mapping went past the end of the file, like feof()
+  int eof;
+
+} image_source;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Open an image file for reading.
+ * If ctx->use_mmap is set and the file is a regular file, it will be memory mapped.
+ * If it can't be mapped, all reads go through stdio instead.
+ *
+ * @param nerorip_context *ctx
+ *   The context saying whether to memory map the file and where to report it
+ * @param const char *filename
+ *   Path to the image file
+ * @return *image_source
+ *   A pointer to the opened image_source or NULL if the file could not be opened (errno is set)
+ */
+image_source *src_open(nerorip_context *ctx, const char *filename);
+
+/**
+ * Close an image source opened with src_open() and free its memory.
+ * If source is NULL, it will simply return without doing anything.
+ *
+ * @param image_source *source
+ *   The image_source to close
+ */
+void src_close(image_source *source);
+
+
+/**
+ * fseek(), ftell() and feof() equivalents for image sources
+ * src_seek() takes the same whence values as fseek().
+ */
+int src_seek(image_source *source, int64_t offset, int whence);
+uint64_t src_tell(image_source *source);
+int src_eof(image_source *source);
+
+
+/**
+ * fread() equivalent for image sources, reading length bytes into buffer.
+ *
+ * @param image_source *source
+ *   The image_source to read from
+ * @param void *buffer
+ *   Where to put the data
+ * @param size_t length
+ *   How many bytes should be read
+ * @return size_t
+ *   The number of bytes actually read
+ */
+size_t src_read(image_source *source, void *buffer, size_t length);
+
+
+/**
+ * pread() equivalent for image sources, reading length bytes at offset into buffer.
+ * Doesn't use or change the position used by src_read(), so it is safe to call from several threads at once.
+ *
+ * @param image_source *source
+ *   The image_source to read from
+ * @param void *buffer
+ *   Where to put the data
+ * @param size_t length
+ *   How many bytes should be read
+ * @param uint64_t offset
+ *   Where in the image file to read from
+ * @return size_t
+ *   The number of bytes actually read
+ */
+size_t src_pread(image_source *source, void *buffer, size_t length, uint64_t offset);
+
+
+/**
+ * Image source reading convenience functions
+ *
+ * These work exactly like the fread8u() family in util.h but read from an image_source.
+ * The value is converted from big endian before returning. If the read failed, it will return 0.
+ *
+ * @param image_source*
+ *   The image_source from which the value should be read.
+ * @return mixed
+ *   Returns the byteswapped value read
+ */
+uint8_t src_read8u(image_source*);
+uint16_t src_read16u(image_source*);
+uint32_t src_read32u(image_source*);
+uint64_t src_read64u(image_source*);
+
+
+/**
+ * Get a pointer directly into the mapped image data.
+ *
+ * @param image_source *source
+ *   The image_source to look into
+ * @param uint64_t offset
+ *   Offset in the image file of the wanted data
+ * @param uint64_t length
+ *   Number of bytes that will be accessed
+ * @return const uint8_t*
+ *   A pointer to the data at offset or NULL if the source is not mapped or the range
+ *   goes past the end of the file. Callers should fall back to src_pread() when NULL.
+ */
+const uint8_t *src_map(image_source *source, uint64_t offset, uint64_t length);
+
+
+/**
+ * Tell the kernel that the passed range of the image is about to be read sequentially.
+ * Only does anything when the source is mapped.
+ *
+ * @param image_source *source
+ *   The image_source about to be read
+ * @param uint64_t offset
+ *   Where the sequential reading will start
+ * @param uint64_t length
+ *   How many bytes will be read
+ */
+void src_sequential(image_source *source, uint64_t offset, uint64_t length);
+
+/**
+ * Tell the kernel that the passed range of the image has been used and will not be needed again.
+ * The pages are dropped from the mapping and the page cache so ripping huge images doesn't push everything
+ * else out of memory. Only whole pages inside the range are released.
+ * Only does anything when the source is mapped.
+ *
+ * @param image_source *source
+ *   The image_source being read
+ * @param uint64_t start
+ *   Where the range to release starts
+ * @param uint64_t end
+ *   Where the range to release ends
+ */
+void src_release(image_source *source, uint64_t start, uint64_t end);
+
+#endif
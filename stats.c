@@ -0,0 +1,236 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <sys/resource.h> // getrusage()
+#include "nerorip.h"
+
+// Converts a timeval to seconds
+static double stats_seconds(struct timeval *t) {
+  return t->tv_sec + t->tv_usec / 1e6;
+}
+
+
+// Allocates a stats struct
+nerorip_stats *alloc_nerorip_stats() {
+  nerorip_stats *r = malloc(sizeof(nerorip_stats));
+  if (!r) {
+    fprintf(stderr, "Failed to allocate memory for nerorip_stats structure: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  r->tracks = NULL;
+  r->number_tracks = 0;
+  stats_reset(r);
+  return r;
+}
+
+// Frees a stats struct
+void free_nerorip_stats(nerorip_stats *stats) {
+  if (!stats)
+    return;
+  free(stats->tracks);
+  free(stats);
+}
+
+// Clears all the counters and restarts the clock
+void stats_reset(nerorip_stats *stats) {
+  memset(&stats->parse, 0, sizeof(stats->parse));
+  stats->parse_bytes_read = 0;
+  stats->parse_read_calls = 0;
+  if (stats->tracks)
+    memset(stats->tracks, 0, sizeof(track_stats) * stats->number_tracks);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  stats->start = stats_now();
+  stats->start_user = stats_seconds(&usage.ru_utime);
+  stats->start_system = stats_seconds(&usage.ru_stime);
+  stats->wall = 0;
+  stats->user = 0;
+  stats->system = 0;
+  stats->peak_rss = 0;
+}
+
+
+// Makes room for the tracks of an image
+int stats_prepare(nerorip_stats *stats, nrg_image *image) {
+  if (image->number_tracks > stats->number_tracks) {
+    track_stats *r = realloc(stats->tracks, sizeof(track_stats) * image->number_tracks);
+    if (!r) {
+      fprintf(stderr, "Failed to allocate memory for track stats: %s\n", strerror(errno));
+      return -1;
+    }
+    stats->tracks = r;
+  }
+  stats->number_tracks = image->number_tracks;
+  memset(stats->tracks, 0, sizeof(track_stats) * stats->number_tracks);
+  return 0;
+}
+
+// Gets the counters for a track
+track_stats *stats_track(nerorip_context *ctx, unsigned int track_number) {
+  if (!ctx || !ctx->stats || track_number < 1 || track_number > ctx->stats->number_tracks)
+    return NULL;
+  track_stats *r = &ctx->stats->tracks[track_number - 1];
+  r->number = track_number;
+  return r;
+}
+
+
+// Gets the time now
+stats_clock stats_now() {
+  struct timespec wall, cpu;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+  stats_clock r = {wall.tv_sec + wall.tv_nsec / 1e9, cpu.tv_sec + cpu.tv_nsec / 1e9};
+  return r;
+}
+
+// Adds the time since clock and moves it up to now
+void stats_add(stats_time *time, stats_clock *clock) {
+  stats_clock now = stats_now();
+  time->wall += now.wall - clock->wall;
+  time->cpu += now.cpu - clock->cpu;
+  *clock = now;
+}
+
+
+// Fills in the totals
+void stats_finish(nerorip_stats *stats) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  stats->wall = stats_now().wall - stats->start.wall;
+  stats->user = stats_seconds(&usage.ru_utime) - stats->start_user;
+  stats->system = stats_seconds(&usage.ru_stime) - stats->start_system;
+  stats->peak_rss = usage.ru_maxrss;
+}
+
+
+// Megabytes per second, or 0 if no time went by
+static double stats_rate(uint64_t bytes, double seconds) {
+  return (seconds > 0) ? bytes / (1024.0 * 1024.0) / seconds : 0;
+}
+
+// Prints one phase of a track as text
+static void stats_print_phase(FILE *output, const char *name, stats_time *t) {
+  fprintf(output, "      %-8s %9.3fs wall %9.3fs CPU\n", name, t->wall, t->cpu);
+}
+
+// Prints one phase of a track as JSON
+static void stats_print_phase_json(FILE *output, const char *name, stats_time *t) {
+  fprintf(output, "\"%s\":{\"wall\":%.6f,\"cpu\":%.6f},", name, t->wall, t->cpu);
+}
+
+// Prints a hash of a track as text
+static void stats_print_hash(FILE *output, const char *name, hash_digest *d) {
+  char crc32[9], md5[33], sha1[41];
+  hash_hex(d, crc32, md5, sha1);
+  fprintf(output, "      %-8s %llu bytes, CRC32 %s, MD5 %s, SHA-1 %s\n", name, (unsigned long long) d->size, crc32, md5, sha1);
+}
+
+// Prints a hash of a track as JSON
+static void stats_print_hash_json(FILE *output, const char *name, hash_digest *d) {
+  char crc32[9], md5[33], sha1[41];
+  hash_hex(d, crc32, md5, sha1);
+  fprintf(output, "\"%s\":{\"size\":%llu,\"crc32\":\"%s\",\"md5\":\"%s\",\"sha1\":\"%s\"},",
+          name, (unsigned long long) d->size, crc32, md5, sha1);
+}
+
+// Prints what verifying a track found as JSON
+static void stats_print_verify_json(FILE *output, edc_report *v) {
+  fprintf(output, "\"verify\":{\"sectors\":%llu,\"bad_sync\":%llu,\"bad_edc\":%llu,\"bad_ecc\":%llu,\"bad_lbas\":[",
+          (unsigned long long) v->sectors, (unsigned long long) v->bad_sync, (unsigned long long) v->bad_edc, (unsigned long long) v->bad_ecc);
+  unsigned int i;
+  for (i = 0; i < v->number_bad_lbas; i++)
+    fprintf(output, "%s%u", (i ? "," : ""), v->bad_lbas[i]);
+  fprintf(output, "]},");
+}
+
+// Prints the stats
+void stats_print(nerorip_stats *stats, FILE *output, int json) {
+  uint64_t bytes_read = stats->parse_bytes_read, bytes_written = 0;
+  uint64_t read_calls = stats->parse_read_calls, write_calls = 0;
+  unsigned int i;
+  for (i = 0; i < stats->number_tracks; i++) {
+    bytes_read += stats->tracks[i].bytes_read;
+    bytes_written += stats->tracks[i].bytes_written;
+    read_calls += stats->tracks[i].read_calls;
+    write_calls += stats->tracks[i].write_calls;
+  }
+
+  if (json) {
+    fprintf(output, "{\"parse\":{\"wall\":%.6f,\"cpu\":%.6f,\"bytes_read\":%llu,\"read_calls\":%llu},\"tracks\":[",
+            stats->parse.wall, stats->parse.cpu, (unsigned long long) stats->parse_bytes_read, (unsigned long long) stats->parse_read_calls);
+    int first = 1;
+    for (i = 0; i < stats->number_tracks; i++) {
+      track_stats *t = &stats->tracks[i];
+      if (!t->number)
+        continue;
+      fprintf(output, "%s{\"track\":%u,", (first ? "" : ","), t->number);
+      stats_print_phase_json(output, "read", &t->read);
+      stats_print_phase_json(output, "convert", &t->convert);
+      stats_print_phase_json(output, "write", &t->write);
+      stats_print_phase_json(output, "wait", &t->wait);
+      if (t->hashed) {
+        stats_print_hash_json(output, "raw", &t->raw_hash);
+        stats_print_hash_json(output, "output", &t->output_hash);
+      }
+      if (t->verified)
+        stats_print_verify_json(output, &t->verify);
+      fprintf(output, "\"wall\":%.6f,\"bytes_read\":%llu,\"bytes_written\":%llu,\"read_calls\":%llu,\"write_calls\":%llu,\"mb_per_s\":%.3f}",
+              t->wall, (unsigned long long) t->bytes_read, (unsigned long long) t->bytes_written,
+              (unsigned long long) t->read_calls, (unsigned long long) t->write_calls, stats_rate(t->bytes_read, t->wall));
+      first = 0;
+    }
+    fprintf(output, "],\"total\":{\"wall\":%.6f,\"user\":%.6f,\"system\":%.6f,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+            "\"read_calls\":%llu,\"write_calls\":%llu,\"mb_per_s\":%.3f,\"peak_rss_kb\":%ld}}\n",
+            stats->wall, stats->user, stats->system, (unsigned long long) bytes_read, (unsigned long long) bytes_written,
+            (unsigned long long) read_calls, (unsigned long long) write_calls, stats_rate(bytes_read, stats->wall), stats->peak_rss);
+    return;
+  }
+
+  fprintf(output, "Statistics:\n");
+  fprintf(output, "  Parse: %.3fs wall, %.3fs CPU, %llu bytes read in %llu calls\n", stats->parse.wall, stats->parse.cpu,
+          (unsigned long long) stats->parse_bytes_read, (unsigned long long) stats->parse_read_calls);
+  for (i = 0; i < stats->number_tracks; i++) {
+    track_stats *t = &stats->tracks[i];
+    if (!t->number)
+      continue;
+    fprintf(output, "  Track %02u: %.3fs, %.1f MB/s, %llu bytes read in %llu calls, %llu bytes written in %llu calls\n",
+            t->number, t->wall, stats_rate(t->bytes_read, t->wall), (unsigned long long) t->bytes_read, (unsigned long long) t->read_calls,
+            (unsigned long long) t->bytes_written, (unsigned long long) t->write_calls);
+    stats_print_phase(output, "read", &t->read);
+    stats_print_phase(output, "convert", &t->convert);
+    stats_print_phase(output, "write", &t->write);
+    if (t->wait.wall > 0)
+      stats_print_phase(output, "wait", &t->wait);
+    if (t->hashed) {
+      stats_print_hash(output, "raw", &t->raw_hash);
+      stats_print_hash(output, "output", &t->output_hash);
+    }
+    if (t->verified)
+      fprintf(output, "      verify   %llu sectors, %llu bad sync, %llu bad EDC, %llu bad ECC\n", (unsigned long long) t->verify.sectors,
+              (unsigned long long) t->verify.bad_sync, (unsigned long long) t->verify.bad_edc, (unsigned long long) t->verify.bad_ecc);
+  }
+  fprintf(output, "  Total: %.3fs wall, %.3fs user, %.3fs system, %.1f MB/s, %llu bytes read in %llu calls, %llu bytes written in %llu calls\n",
+          stats->wall, stats->user, stats->system, stats_rate(bytes_read, stats->wall), (unsigned long long) bytes_read,
+          (unsigned long long) read_calls, (unsigned long long) bytes_written, (unsigned long long) write_calls);
+  fprintf(output, "  Peak memory: %.1f MB\n", stats->peak_rss / 1024.0);
+}
@@ -0,0 +1,196 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+#include "util.h"
+#include "nrg.h"
+#include "hash.h"
+#include "edc.h"
+
+
+/*
+ * DATA STRUCTURES
+ */
+
+/**
+ * Stats time struct
+ *
+ * Time spent doing something, both on the clock on the wall and on the CPU of the thread(s) doing it.
+ */
+typedef struct {
+  double wall;
+  double cpu;
+} stats_time;
+
+/**
+ * Stats clock struct
+ *
+ * A point in time to measure from with stats_add().
+ */
+typedef struct {
+  double wall;
+  double cpu;
+} stats_clock;
+
+
+/**
+ * Track stats struct
+ *
+ * Everything counted while ripping one track.
+ * With --async, the reads and writes happen on other threads or in the kernel at the same time as
+ * the conversion, so the phase times can add up to more than the wall time of the track.
+ * Reads straight out of a memory mapped image count as bytes read but not as calls, and the time
+ * spent faulting the pages in shows up in whichever phase touches them first. A range of the image
+ * copied by the kernel with copy_file_data() counts as one read and one write call.
+ */
+typedef struct {
+  // The track number, 0 if this track wasn't ripped
+  unsigned int number;
+
+  // Time spent reading the image, converting sectors and writing the output
+  stats_time read, convert, write;
+  // Time spent waiting for io_uring to finish reads and writes, only used by the io_uring pipeline
+  stats_time wait;
+  // Wall time spent in rip_track()
+  double wall;
+
+  // How much was read and written and in how many system calls
+  uint64_t bytes_read, bytes_written;
+  uint64_t read_calls, write_calls;
+
+  // Set if the whole track was hashed, and the hashes of the raw track data and of the output
+  int hashed;
+  hash_digest raw_hash, output_hash;
+
+  // Set if the sectors of the track were verified, and what was found
+  int verified;
+  edc_report verify;
+} track_stats;
+
+
+/**
+ * Nerorip stats struct
+ *
+ * Counters for everything the library does with an image. Put one in a nerorip_context
+ * to have them collected, or leave the context's stats NULL to not spend any time on it.
+ */
+typedef struct nerorip_stats {
+  // Parsing the chunk data
+  stats_time parse;
+  uint64_t parse_bytes_read, parse_read_calls;
+
+  // One entry for each track in the image, in track number order
+  track_stats *tracks;
+  unsigned int number_tracks;
+
+  // When the stats were started or reset, and what had been used by then
+  stats_clock start;
+  double start_user, start_system;
+
+  // Filled in by stats_finish(): the wall time since the start, the CPU time of the whole process
+  // since the start and the peak resident memory of the process in KB
+  double wall, user, system;
+  long peak_rss;
+} nerorip_stats;
+
+
+
+/*
+ * FUNCTIONS
+ */
+
+
+/**
+ * Allocate a new stats struct with all counters at zero and the clock started
+ *
+ * @return *nerorip_stats
+ *   A pointer to the new struct or NULL if it could not be allocated
+ */
+nerorip_stats *alloc_nerorip_stats();
+
+/**
+ * Free a stats struct.
+ * If stats is NULL, it will simply return without doing anything.
+ */
+void free_nerorip_stats(nerorip_stats *stats);
+
+/**
+ * Set all counters back to zero and restart the clock, for counting the next job.
+ */
+void stats_reset(nerorip_stats *stats);
+
+
+/**
+ * Make room for the tracks of an image. Done by nerorip_rip_image() before any track is ripped.
+ * The counters of tracks ripped before are cleared.
+ *
+ * @return int
+ *   0 on success or -1 if memory could not be allocated
+ */
+int stats_prepare(nerorip_stats *stats, nrg_image *image);
+
+/**
+ * Get the counters for a track.
+ *
+ * @param nerorip_context *ctx
+ *   The context whose stats are wanted
+ * @param unsigned int track_number
+ *   The number of the track (starting at 1)
+ * @return *track_stats
+ *   The counters or NULL if the context isn't collecting stats or has no room for that track
+ */
+track_stats *stats_track(nerorip_context *ctx, unsigned int track_number);
+
+
+/**
+ * Get the current wall and thread CPU time to measure from
+ */
+stats_clock stats_now();
+
+/**
+ * Add the time since clock to time and move clock up to now, so the next phase is measured from here.
+ */
+void stats_add(stats_time *time, stats_clock *clock);
+
+
+/**
+ * Fill in the totals: wall time since the start, process CPU time and peak memory.
+ * Can be called as often as needed, every call updates the totals to now.
+ */
+void stats_finish(nerorip_stats *stats);
+
+
+/**
+ * Print the stats, either as text or as one line of JSON.
+ *
+ * @param nerorip_stats *stats
+ *   The stats to print
+ * @param FILE *output
+ *   Where they are printed
+ * @param int json
+ *   1 to print JSON, 0 for text
+ */
+void stats_print(nerorip_stats *stats, FILE *output, int json);
+
+#endif
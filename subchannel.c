@@ -0,0 +1,173 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "subchannel.h"
+#ifdef HAVE_X86_SUB
+#include <immintrin.h> // SSE2 and AVX2 intrinsics
+#endif
+
+
+// Works out how much subchannel data each sector of a track has
+unsigned int sub_length(unsigned int sector_size) {
+  switch (sector_size) {
+    case 2352 + SUB_LENGTH:   return SUB_LENGTH;
+    case 2352 + SUB_Q_LENGTH: return SUB_Q_LENGTH;
+    default:                  return 0;
+  }
+}
+
+
+/*
+ * P-W deinterleaving
+ *
+ * Byte i of the 96 has bit 7 - c of channel c, so channel c's byte j is made of bit 7 - c of bytes 8j to 8j + 7,
+ * the first of them in its top bit. Taking 8 bytes as the rows of an 8x8 bit matrix, that's its transpose.
+ */
+
+// Loads 8 bytes as a big endian word. Compilers turn this into a load and a byte swap
+static inline uint64_t load_be64(const uint8_t *b) {
+  return ((uint64_t) b[0] << 56) | ((uint64_t) b[1] << 48) | ((uint64_t) b[2] << 40) | ((uint64_t) b[3] << 32) |
+         ((uint64_t) b[4] << 24) | ((uint64_t) b[5] << 16) | ((uint64_t) b[6] << 8) | (uint64_t) b[7];
+}
+
+// Transposes 8 bytes as a bit matrix, with the first one in the top byte of the word and bit 7 of each the left column
+static inline uint64_t sub_transpose(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+void sub_deinterleave_scalar(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride) {
+  unsigned int i, j, c;
+  for (i = 0; i < count; i++, sub += stride, out += SUB_LENGTH) {
+    for (j = 0; j < SUB_CHANNEL_LENGTH; j++) {
+      uint64_t x = sub_transpose(load_be64(sub + 8 * j));
+      // Row c of the transpose is channel c
+      for (c = 0; c < 8; c++)
+        out[c * SUB_CHANNEL_LENGTH + j] = x >> (56 - 8 * c);
+    }
+  }
+}
+
+#ifdef HAVE_X86_SUB
+// The byte mask instructions put the top bit of byte k in bit k, which is backwards for what each channel byte wants,
+// so the bytes in every group of 8 are reversed first. After that, the mask of a vector is the next bytes of channel P,
+// and adding the vector to itself moves the next channel into the top bits.
+// SSE2 has no byte shuffle, so the reversing is done by reversing the 16 bit words and then swapping their bytes
+__attribute__((target("sse2")))
+void sub_deinterleave_sse2(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride) {
+  unsigned int i, k, c;
+  for (i = 0; i < count; i++, sub += stride, out += SUB_LENGTH) {
+    // Each 16 bytes has 2 bytes of every channel
+    for (k = 0; k < 6; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (sub + 16 * k));
+      v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      for (c = 0; c < 8; c++) {
+        const uint16_t mask = _mm_movemask_epi8(v);
+        memcpy(out + c * SUB_CHANNEL_LENGTH + 2 * k, &mask, 2);
+        v = _mm_add_epi8(v, v);
+      }
+    }
+  }
+}
+
+// AVX2 does a whole sector with three registers, each mask is 4 bytes of a channel
+__attribute__((target("avx2")))
+void sub_deinterleave_avx2(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride) {
+  const __m256i reverse = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+                                          8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+  unsigned int i, c;
+  for (i = 0; i < count; i++, sub += stride, out += SUB_LENGTH) {
+    __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) sub), reverse);
+    __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (sub + 32)), reverse);
+    __m256i d = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (sub + 64)), reverse);
+    for (c = 0; c < 8; c++) {
+      // Each mask is stored on its own. Putting them together first makes the compiler read them back as one
+      // 8 byte load that has to wait for both stores to finish
+      const uint32_t ma = _mm256_movemask_epi8(a), mb = _mm256_movemask_epi8(b), md = _mm256_movemask_epi8(d);
+      memcpy(out + c * SUB_CHANNEL_LENGTH, &ma, 4);
+      memcpy(out + c * SUB_CHANNEL_LENGTH + 4, &mb, 4);
+      memcpy(out + c * SUB_CHANNEL_LENGTH + 8, &md, 4);
+      a = _mm256_add_epi8(a, a);
+      b = _mm256_add_epi8(b, b);
+      d = _mm256_add_epi8(d, d);
+    }
+  }
+}
+#endif
+
+
+/**
+ * The sub_deinterleave implementation in use and its name.
+ * Starts out pointing at sub_deinterleave_select(), which replaces it with the best one the CPU can run.
+ */
+static void sub_deinterleave_select(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride);
+static void (*sub_deinterleave_impl)(uint8_t *, const uint8_t *, unsigned int, unsigned int) = sub_deinterleave_select;
+static const char *sub_deinterleave_impl_name = "scalar";
+
+// Picks the best implementation the CPU supports using cpuid
+static void sub_deinterleave_select(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride) {
+  void (*impl)(uint8_t *, const uint8_t *, unsigned int, unsigned int) = sub_deinterleave_scalar;
+  const char *name = "scalar";
+
+#ifdef HAVE_X86_SUB
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl = sub_deinterleave_avx2;
+    name = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    impl = sub_deinterleave_sse2;
+    name = "sse2";
+  }
+#endif
+
+  // Same as swap_buffer_select(), the name goes first so it always matches the implementation
+  __atomic_store_n(&sub_deinterleave_impl_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&sub_deinterleave_impl, impl, __ATOMIC_RELEASE);
+
+  impl(out, sub, count, stride);
+}
+
+// Splits the subchannel data off the end of the sectors
+void sub_deinterleave(uint8_t *out, const uint8_t *sectors, unsigned int count, unsigned int sector_size, unsigned int length) {
+  const uint8_t *sub = sectors + sector_size - length;
+  if (length == SUB_LENGTH) {
+    __atomic_load_n(&sub_deinterleave_impl, __ATOMIC_ACQUIRE)(out, sub, count, sector_size);
+    return;
+  }
+
+  // Only Q is there, everything else is left as zeros
+  memset(out, 0, (size_t) count * SUB_LENGTH);
+  unsigned int i;
+  for (i = 0; i < count; i++, sub += sector_size, out += SUB_LENGTH)
+    memcpy(out + SUB_CHANNEL_LENGTH, sub, SUB_CHANNEL_LENGTH);
+}
+
+// Returns the name of the sub_deinterleave implementation
+const char *sub_deinterleave_name() {
+  if (__atomic_load_n(&sub_deinterleave_impl, __ATOMIC_ACQUIRE) == sub_deinterleave_select)
+    sub_deinterleave_select(NULL, NULL, 0, 0);
+  return __atomic_load_n(&sub_deinterleave_impl_name, __ATOMIC_RELAXED);
+}
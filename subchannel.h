@@ -0,0 +1,84 @@
+/*
+ * This file is part of nerorip. (c)2011 Joe Balough
+ *
+ * Nerorip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nerorip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nerorip.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SUBCHANNEL_H
+#define SUBCHANNEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h> // strerror()
+#include <stdint.h> // uintXX_t types
+
+// Bytes of subchannel data that go with each sector: all of P-W, or just Q as a 16 byte block
+#define SUB_LENGTH   96
+#define SUB_Q_LENGTH 16
+// Each of the 8 subchannels P-W has 12 bytes for every sector
+#define SUB_CHANNEL_LENGTH 12
+
+
+/*
+ * FUNCTIONS
+ */
+
+/**
+ * Work out how many bytes at the end of each raw sector of a sector_size byte track are subchannel data:
+ * SUB_LENGTH for 2448 byte sectors, SUB_Q_LENGTH for 2368 byte ones and 0 for everything else.
+ */
+unsigned int sub_length(unsigned int sector_size);
+
+/**
+ * Split the subchannel data off the end of count raw sectors and put it in the order of a CloneCD .sub file:
+ * the 12 bytes of P, then the 12 bytes of Q and so on up to W, 96 bytes for each sector.
+ *
+ * The 96 bytes in the image have the channels interleaved, one bit of each in every byte with P in the top bit.
+ * They are pulled apart 8 bytes at a time by transposing them as an 8x8 bit matrix.
+ * The 16 byte Q blocks are already in order, so their first 12 bytes just go in the Q channel and the rest is zeros.
+ * The fastest implementation the CPU supports is picked the first time this is called.
+ *
+ * @param uint8_t *out
+ *   Where the subchannel data goes. Must have room for count * SUB_LENGTH bytes
+ * @param const uint8_t *sectors
+ *   The raw sectors, subchannel data and all
+ * @param unsigned int count
+ *   How many sectors there are
+ * @param unsigned int sector_size
+ *   Size of each raw sector
+ * @param unsigned int length
+ *   How many bytes at the end of each sector are subchannel data, SUB_LENGTH or SUB_Q_LENGTH
+ */
+void sub_deinterleave(uint8_t *out, const uint8_t *sectors, unsigned int count, unsigned int sector_size, unsigned int length);
+
+/**
+ * The individual implementations that pull the 96 interleaved bytes of each sector apart for sub_deinterleave().
+ * sub points at the subchannel data of the first sector and the next one is always stride bytes further on.
+ * The scalar one transposes 64 bit words, the others use the byte mask instructions to pull one bit out of every
+ * byte of a vector at once. Only call the vectorized ones if the CPU supports the instruction set they use.
+ */
+void sub_deinterleave_scalar(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride);
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SUB
+void sub_deinterleave_sse2(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride);
+void sub_deinterleave_avx2(uint8_t *out, const uint8_t *sub, unsigned int count, unsigned int stride);
+#endif
+
+/**
+ * Returns the name of the sub_deinterleave() implementation being used ("scalar", "sse2" or "avx2")
+ */
+const char *sub_deinterleave_name();
+
+#endif
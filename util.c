@@ -16,44 +16,26 @@
  *
  */
 
-#include "util.h"
-
-
-/**
- * Global variable verbosity
- *
- * Indicates what level of verbosity the user wants to see.
- * Defaults to 1, can be dropped to 0 (print nothing) with the --quiet, -q option.
- * --verbose, -v increse it one value.
- */
-int verbosity = 1;
-
-// Increments verbosity
-void inc_verbosity() {
-  verbosity++;
-}
-
-// Decrements verbosity
-void dec_verbosity() {
-  verbosity--;
-}
-
-// Returns the verbosity
-int get_verbosity() {
-  return verbosity;
-}
+#define _GNU_SOURCE // copy_file_range()
+#include <unistd.h>
+#include <sys/ioctl.h> // ioctl()
+#include <linux/fs.h> // FICLONERANGE
+#include "nerorip.h"
+#ifdef HAVE_X86_SWAP
+#include <immintrin.h> // SSE2, SSSE3 and AVX2 intrinsics
+#endif
 
 
 // printf wrapper to only print if verbosity requirment is met
-int ver_printf(int v, char* fmt, ...) {
+int ver_printf(nerorip_context *ctx, int v, const char *fmt, ...) {
   // Make sure the verbosity level is ok
-  if (v > verbosity)
+  if (!ctx || v > ctx->verbosity)
     return 0;
 
   // Pass the rest off to printf
   va_list ap;
   va_start(ap, fmt);
-  int r = vprintf(fmt, ap);
+  int r = vfprintf(ctx->log ? ctx->log : stdout, fmt, ap);
   va_end(ap);
   return r;
 }
@@ -96,11 +78,17 @@ size_t fwrite16u(uint16_t value, FILE* output) {
   return fwrite(&value, sizeof(uint16_t), 1, output);
 }
 
-void fwrite_wav_header(FILE *tf, unsigned int length)
+// Clamps a length to what fits in the 32 bit size field of a WAV or AIFF header
+static uint32_t header_length32(uint64_t length) {
+  return (length > UINT32_MAX) ? UINT32_MAX : length;
+}
+
+void fwrite_wav_header(FILE *tf, uint64_t length)
 {
   // Following WAV header format found at https://ccrma.stanford.edu/courses/422/projects/WaveFormat/
+  // A RIFF file can't say it's more than 4 GB long, so bigger tracks get the largest size there is
   unsigned int written = fwrite("RIFF", 1, 4, tf);
-  written += fwrite32u(length + 36, tf); // Length of data + 36
+  written += fwrite32u(header_length32(length + 36), tf); // Length of data + 36
   written += fwrite("WAVE", 1, 4, tf);
   written += fwrite("fmt ", 1, 4, tf);
   written += fwrite32u(16,     tf);  // PCM
@@ -111,7 +99,7 @@ void fwrite_wav_header(FILE *tf, unsigned int length)
   written += fwrite16u(4,      tf);  // Block Align
   written += fwrite16u(16,     tf);  // Bits per sample
   written += fwrite("data", 1, 4, tf);
-  written += fwrite32u(length, tf); // Data length
+  written += fwrite32u(header_length32(length), tf); // Data length
 
   // Make sure all 25 things were written properly
   if (written != 25)
@@ -119,13 +107,13 @@ void fwrite_wav_header(FILE *tf, unsigned int length)
 }
 
 
-void fwrite_aiff_header(FILE *tf, unsigned int length)
+void fwrite_aiff_header(FILE *tf, uint64_t length)
 {
-  // Calculate some useful values
-  unsigned long int source_length = length * 2352;
-  uint32_t total_length  = source_length + 8 + 18 + 8 + 12; // COMM + SSND
-  uint32_t number_frames = source_length / 4;
-  uint32_t audio_size = source_length + 8;
+  // Calculate some useful values. Like WAV, the sizes stop at 4 GB
+  uint64_t source_length = length * 2352;
+  uint32_t total_length  = header_length32(source_length + 8 + 18 + 8 + 12); // COMM + SSND
+  uint32_t number_frames = header_length32(source_length / 4);
+  uint32_t audio_size = header_length32(source_length + 8);
   uint8_t sample_rate[10] = {0x40, 0x0E, 0xAC, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
   unsigned int written = 0;
@@ -146,12 +134,135 @@ void fwrite_aiff_header(FILE *tf, unsigned int length)
 }
 
 
-// "Swaps" the data in the buffer
-void swap_buffer(uint8_t *buffer, unsigned int length) {
+// Copies data between files inside the kernel
+uint64_t copy_file_data(nerorip_context *ctx, int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset, uint64_t length) {
+  // Try to reflink the whole range first. This only works if the filesystem supports it
+  // and the offsets are block aligned, so any error just means falling back to copying.
+  struct file_clone_range clone = {in_fd, in_offset, length, out_offset};
+  if (ioctl(out_fd, FICLONERANGE, &clone) == 0) {
+    ver_printf(ctx, 3, "Reflinked %llu bytes\n", (unsigned long long) length);
+    return length;
+  }
+
+  // Otherwise have the kernel copy the data. Don't ask for too much at once so a failure
+  // part way through a huge track still leaves something sensible to fall back from.
+  uint64_t copied = 0;
+  while (copied < length) {
+    size_t chunk = (length - copied > (1 << 30)) ? (1 << 30) : length - copied;
+    loff_t in = in_offset + copied, out = out_offset + copied;
+    ssize_t r = copy_file_range(in_fd, &in, out_fd, &out, chunk, 0);
+    if (r <= 0)
+      break;
+    copied += r;
+  }
+
+  if (copied)
+    ver_printf(ctx, 3, "Copied %llu bytes with copy_file_range\n", (unsigned long long) copied);
+  return copied;
+}
+
+
+// "Swaps" the data in the buffer one pair of bytes at a time
+void swap_buffer_scalar(uint8_t *buffer, unsigned int length) {
   unsigned int i;
-  for (i = 0; i < length; i += 2) {
+  for (i = 0; i + 1 < length; i += 2) {
     uint8_t t= buffer[i];
     buffer[i] = buffer[i + 1];
     buffer[i + 1] = t;
   }
 }
+
+#ifdef HAVE_X86_SWAP
+// SSE2 has no byte shuffle, so rotate each 16 bit word by 8 bits instead
+__attribute__((target("sse2")))
+void swap_buffer_sse2(uint8_t *buffer, unsigned int length) {
+  unsigned int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *) (buffer + i));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i *) (buffer + i), v);
+  }
+  swap_buffer_scalar(buffer + i, length - i);
+}
+
+// SSSE3 can swap 16 bytes at a time with one shuffle
+__attribute__((target("ssse3")))
+void swap_buffer_ssse3(uint8_t *buffer, unsigned int length) {
+  const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+  unsigned int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *) (buffer + i));
+    _mm_storeu_si128((__m128i *) (buffer + i), _mm_shuffle_epi8(v, mask));
+  }
+  swap_buffer_scalar(buffer + i, length - i);
+}
+
+// AVX2 does the same shuffle 32 bytes at a time, two registers per loop
+__attribute__((target("avx2")))
+void swap_buffer_avx2(uint8_t *buffer, unsigned int length) {
+  const __m256i mask = _mm256_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+                                       14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+  unsigned int i = 0;
+  for (; i + 64 <= length; i += 64) {
+    __m256i a = _mm256_loadu_si256((__m256i *) (buffer + i));
+    __m256i b = _mm256_loadu_si256((__m256i *) (buffer + i + 32));
+    _mm256_storeu_si256((__m256i *) (buffer + i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256((__m256i *) (buffer + i + 32), _mm256_shuffle_epi8(b, mask));
+  }
+  for (; i + 32 <= length; i += 32) {
+    __m256i a = _mm256_loadu_si256((__m256i *) (buffer + i));
+    _mm256_storeu_si256((__m256i *) (buffer + i), _mm256_shuffle_epi8(a, mask));
+  }
+  swap_buffer_scalar(buffer + i, length - i);
+}
+#endif
+
+
+/**
+ * The swap_buffer implementation in use and its name.
+ * Starts out pointing at swap_buffer_select(), which replaces it with the best one the CPU can run.
+ */
+static void swap_buffer_select(uint8_t *buffer, unsigned int length);
+static void (*swap_buffer_impl)(uint8_t *, unsigned int) = swap_buffer_select;
+static const char *swap_buffer_impl_name = "scalar";
+
+// Picks the best implementation the CPU supports using cpuid
+static void swap_buffer_select(uint8_t *buffer, unsigned int length) {
+  void (*impl)(uint8_t *, unsigned int) = swap_buffer_scalar;
+  const char *name = "scalar";
+
+#ifdef HAVE_X86_SWAP
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl = swap_buffer_avx2;
+    name = "avx2";
+  }
+  else if (__builtin_cpu_supports("ssse3")) {
+    impl = swap_buffer_ssse3;
+    name = "ssse3";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    impl = swap_buffer_sse2;
+    name = "sse2";
+  }
+#endif
+
+  // Every thread would pick the same one, so it doesn't matter if several get here at once.
+  // The name is stored first so it is always right for whichever implementation a reader sees.
+  __atomic_store_n(&swap_buffer_impl_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&swap_buffer_impl, impl, __ATOMIC_RELEASE);
+
+  impl(buffer, length);
+}
+
+// "Swaps" the data in the buffer
+void swap_buffer(uint8_t *buffer, unsigned int length) {
+  __atomic_load_n(&swap_buffer_impl, __ATOMIC_ACQUIRE)(buffer, length);
+}
+
+// Returns the name of the swap_buffer implementation
+const char *swap_buffer_name() {
+  if (__atomic_load_n(&swap_buffer_impl, __ATOMIC_ACQUIRE) == swap_buffer_select)
+    swap_buffer_select(NULL, 0);
+  return __atomic_load_n(&swap_buffer_impl_name, __ATOMIC_RELAXED);
+}
@@ -31,37 +31,27 @@
 
 
 /**
- * Increments verbosity one tick
- * @author Joe Balough
- */
-void inc_verbosity();
-
-/**
- * Decrements verbosity one tick
- * @author Joe Balough
- */
-void dec_verbosity();
-
-/**
- * Returns the current verbosity
- * @author Joe Balough
+ * The library context, declared in nerorip.h.
+ * Messages are printed according to the context's verbosity instead of any global setting.
  */
-inline int get_verbosity();
+typedef struct nerorip_context nerorip_context;
 
 
 /**
  * printf() wrapper
  *
  * Only prints when verbose enabled.
+ * @param nerorip_context *ctx
+ *   The context whose verbosity and log stream are used. If NULL, nothing is printed
  * @param int verbosity
- *   Only prints the message if global verbosity is >= passed verbosity
- * @param char *format, ...
+ *   Only prints the message if the context's verbosity is >= passed verbosity
+ * @param const char *format, ...
  *   What you'd normally pass off to printf
  * @return int
  *   Total number of characters written (0 if verbosity not met)
  * @author Joe Balough
  */
-int ver_printf(int verbosity, char *format, ...);
+int ver_printf(nerorip_context *ctx, int verbosity, const char *format, ...) __attribute__((format(printf, 3, 4)));
 
 
 /**
@@ -92,11 +82,11 @@ size_t fwrite32u(uint32_t value, FILE* output);
  *
  * @param FILE* output_file
  *   The file to which the header should be written
- * @param unsigned int length
- *   The length of the audio data that will be in the file
+ * @param uint64_t length
+ *   The length of the audio data that will be in the file. Anything over 4 GB is written as 4 GB
  * @author Joe Balough
  */
-void fwrite_wav_header(FILE *output_file, unsigned int length);
+void fwrite_wav_header(FILE *output_file, uint64_t length);
 
 /**
  * Writes an aiff header to the passed file
@@ -104,16 +94,43 @@ void fwrite_wav_header(FILE *output_file, unsigned int length);
  *
  * @param FILE* output_file
  *   The file to which the header should be written
- * @param unsigned int length
- *   The length of the audio data that will be in the file in sectors
+ * @param uint64_t length
+ *   The length of the audio data that will be in the file in sectors. Anything over 4 GB is written as 4 GB
  * @author Joe Balough, DeXT/Lawrence Williams
  */
-void fwrite_aiff_header(FILE *output_file, unsigned int sectors_length);
+void fwrite_aiff_header(FILE *output_file, uint64_t sectors_length);
+
+/**
+ * Copies a range of one file into another without passing the data through user space.
+ * First tries to reflink the range (FICLONERANGE) so that filesystems like btrfs and xfs only
+ * have to share the extents, then falls back to copy_file_range().
+ * Neither file's offset is changed. If the kernel or filesystem can't do either, nothing is copied
+ * and the caller should fall back to reading and writing the data itself.
+ *
+ * @param nerorip_context *ctx
+ *   The context to report how the data was copied to
+ * @param int input_fd
+ *   File descriptor of the file to copy from
+ * @param uint64_t input_offset
+ *   Where the data to copy starts in the input file
+ * @param int output_fd
+ *   File descriptor of the file to copy to
+ * @param uint64_t output_offset
+ *   Where the data should be put in the output file
+ * @param uint64_t length
+ *   How many bytes should be copied
+ * @return uint64_t
+ *   The number of bytes copied, which may be less than length
+ */
+uint64_t copy_file_data(nerorip_context *ctx, int input_fd, uint64_t input_offset, int output_fd, uint64_t output_offset, uint64_t length);
 
 /**
  * "Swaps" the data passed in the buffer
  * Essentially, it takes the first two bytes, swaps them,
  * then goes to the next two bytes and repeats until done with the buffer.
+ * If length is odd, the last byte is left alone.
+ *
+ * The fastest implementation the CPU supports is picked the first time this is called.
  *
  * @param uint8_t *buffer
  *   The buffer of data to swap
@@ -123,4 +140,22 @@ void fwrite_aiff_header(FILE *output_file, unsigned int sectors_length);
  */
 void swap_buffer(uint8_t *buffer, unsigned int length);
 
+/**
+ * The individual swap_buffer() implementations.
+ * These can be called directly to compare them, but only call the vectorized ones
+ * if the CPU supports the instruction set they use.
+ */
+void swap_buffer_scalar(uint8_t *buffer, unsigned int length);
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SWAP
+void swap_buffer_sse2(uint8_t *buffer, unsigned int length);
+void swap_buffer_ssse3(uint8_t *buffer, unsigned int length);
+void swap_buffer_avx2(uint8_t *buffer, unsigned int length);
+#endif
+
+/**
+ * Returns the name of the swap_buffer() implementation being used ("scalar", "sse2", "ssse3" or "avx2")
+ */
+const char *swap_buffer_name();
+
 #endif